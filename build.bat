@@ -1,8 +1,32 @@
 @echo off
 
 mkdir build
-clang -march=nehalem -g -gcodeview -Werror -Wall -Wno-unused -D_CRT_SECURE_NO_WARNINGS src/main.c src/elf.c src/disx86.c -o build/test.exe
-clang -g -gcodeview -Werror -Wall -Wno-unused -D_CRT_SECURE_NO_WARNINGS src/hexbin.c -o build/hexbin.exe
+
+rem regenerate the decoder tables from the NASM instruction table, ISA picks
+rem which instruction sets get decoded (set ISA=gpr,sse), see tablegen.c.
+rem they're generated into build\gen so a subset never touches the tree.
+mkdir build\gen
+if "%ISA%"=="" set ISA=all
+rem INSTRUMENT=1 compiles the decoder counters in (x86_get_counters)
+if "%INSTRUMENT%"=="" set INSTRUMENT=0
+rem one set of flags for the library and every tool, the benchmarks should
+rem measure the same code everything else runs.
+set OPT=-O2 -march=nehalem -g -gcodeview -Werror -Wall -Wno-unused -D_CRT_SECURE_NO_WARNINGS
+clang %OPT% src/tablegen.c -o build/tablegen.exe
+build\tablegen.exe -isa=%ISA% tables/insns.dat tables/semantics.dat tables/inst_ids.dat build/gen/table.inc build/gen/public.inc
+clang %OPT% -Ibuild/gen -DDISX86_INSTRUMENT=%INSTRUMENT% src/main.c src/elf.c src/disx86.c src/arena.c src/prescan.c src/cfg.c src/callgraph.c src/jumptable.c src/funcs.c src/stats.c src/pattern.c src/superset.c src/xref.c src/stack.c src/trace.c src/cache.c src/stream.c src/addrindex.c src/parallel.c -o build/test.exe
+clang %OPT% -Ibuild/gen -DDISX86_INSTRUMENT=%INSTRUMENT% src/lenbench.c src/elf.c src/disx86.c src/arena.c src/prescan.c src/cfg.c src/callgraph.c src/jumptable.c src/funcs.c src/stats.c src/pattern.c src/superset.c src/xref.c src/stack.c src/trace.c src/cache.c src/stream.c src/addrindex.c src/parallel.c -o build/lenbench.exe
+clang %OPT% -Ibuild/gen -DDISX86_INSTRUMENT=%INSTRUMENT% src/bench.c src/elf.c src/disx86.c src/arena.c src/prescan.c src/cfg.c src/callgraph.c src/jumptable.c src/funcs.c src/stats.c src/pattern.c src/superset.c src/xref.c src/stack.c src/trace.c src/cache.c src/stream.c src/addrindex.c src/parallel.c -o build/bench.exe
+clang %OPT% src/hexbin.c -o build/hexbin.exe
 
 build\hexbin.exe tests/bintest.txt build/bintest.bin
+
+rem stack deltas mustn't leak through a call that never returns and the
+rem padding after it, main's ret in there has to come out at 0
+build\hexbin.exe tests/stacktest.txt build/stacktest.bin
+build\test.exe -b -stack build/stacktest.bin 2>nul | findstr /r /c:"^0000000000000034     0  ret" >nul || echo error: tests/stacktest.txt, stack delta leaked into main
+rem serialized streams have to round trip and turn away truncated or corrupt
+rem files, see bench -check-stream. 256k of each mix is enough instructions
+rem for x86_stream_read_all to split them
+build\bench.exe -check-stream -size 262144 >nul || echo error: bench -check-stream, the stream format is broken
 rem cl src/main.c src/disx86.c /MT /Zi /Fe:build\test.exe
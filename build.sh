@@ -2,17 +2,61 @@ rm -rf build
 
 mkdir build
 
+# one set of flags for the library and every tool, the benchmarks should
+# measure the same code everything else runs. build.bat uses the same ones
+# plus its codeview/CRT switches.
+OPT="-O2 -march=nehalem -g -Werror -Wall -Wno-unused"
+
+# regenerate the decoder tables from the NASM instruction table, ISA picks
+# which instruction sets get decoded (ISA=gpr,sse ./build.sh), see tablegen.c.
+# they're generated into build/gen so a subset never touches the tree.
+GEN=build/gen
+mkdir $GEN
+gcc src/tablegen.c $OPT -o build/tablegen
+./build/tablegen -isa=${ISA:-all} tables/insns.dat tables/semantics.dat tables/inst_ids.dat $GEN/table.inc $GEN/public.inc
+
 DISKIT=build/disx86
 mkdir $DISKIT
 mkdir $DISKIT/lib
 mkdir $DISKIT/include
 
-gcc -c -fPIC src/disx86.c -g -o build/disx86.o
-ar rcs $DISKIT/lib/libdisx86.a build/disx86.o
+# INSTRUMENT=1 compiles the decoder counters in (x86_get_counters)
+gcc -c -fPIC src/disx86.c -DDISX86_INSTRUMENT=${INSTRUMENT:-0} $OPT -I$GEN -o build/disx86.o
+gcc -c -fPIC src/arena.c $OPT -I$GEN -o build/arena.o
+gcc -c -fPIC src/prescan.c $OPT -I$GEN -o build/prescan.o
+gcc -c -fPIC src/cfg.c $OPT -I$GEN -o build/cfg.o
+gcc -c -fPIC src/callgraph.c $OPT -I$GEN -o build/callgraph.o
+gcc -c -fPIC src/jumptable.c $OPT -I$GEN -o build/jumptable.o
+gcc -c -fPIC src/funcs.c $OPT -I$GEN -o build/funcs.o
+gcc -c -fPIC src/stats.c $OPT -I$GEN -o build/stats.o
+gcc -c -fPIC src/pattern.c $OPT -I$GEN -o build/pattern.o
+gcc -c -fPIC src/superset.c $OPT -I$GEN -o build/superset.o
+gcc -c -fPIC src/xref.c $OPT -I$GEN -o build/xref.o
+gcc -c -fPIC src/stack.c $OPT -I$GEN -o build/stack.o
+gcc -c -fPIC src/trace.c $OPT -I$GEN -o build/trace.o
+gcc -c -fPIC src/cache.c $OPT -I$GEN -o build/cache.o
+gcc -c -fPIC src/stream.c $OPT -I$GEN -o build/stream.o
+gcc -c -fPIC src/addrindex.c $OPT -I$GEN -o build/addrindex.o
+gcc -c -fPIC src/parallel.c $OPT -I$GEN -o build/parallel.o
+ar rcs $DISKIT/lib/libdisx86.a build/disx86.o build/arena.o build/prescan.o build/cfg.o build/callgraph.o build/jumptable.o build/funcs.o build/stats.o build/pattern.o build/superset.o build/xref.o build/stack.o build/trace.o build/cache.o build/stream.o build/addrindex.o build/parallel.o
 cp src/disx86.h $DISKIT/include/.
-cp src/public.inc $DISKIT/include/.
+cp $GEN/public.inc $DISKIT/include/.
 echo 'library kit @ '$(echo ./$DISKIT/)
 
-gcc src/main.c src/elf.c $DISKIT/lib/libdisx86.a -g -o build/dis
-gcc src/hexbin.c -g -o build/hexbin
+gcc src/main.c src/elf.c $DISKIT/lib/libdisx86.a $OPT -I$GEN -pthread -o build/dis
+gcc src/lenbench.c src/elf.c $DISKIT/lib/libdisx86.a $OPT -I$GEN -pthread -o build/lenbench
+gcc src/bench.c src/elf.c $DISKIT/lib/libdisx86.a $OPT -I$GEN -pthread -o build/bench
+gcc src/objcmp.c src/elf.c $DISKIT/lib/libdisx86.a $OPT -I$GEN -pthread -o build/objcmp
+gcc src/disd.c src/elf.c $DISKIT/lib/libdisx86.a $OPT -I$GEN -pthread -o build/disd
+gcc src/hexbin.c $OPT -o build/hexbin
 ./build/hexbin tests/bintest.txt build/bintest.bin
+
+# stack deltas mustn't leak through a call that never returns and the padding
+# after it, main's ret in there has to come out at 0
+./build/hexbin tests/stacktest.txt build/stacktest.bin
+./build/dis -b -stack build/stacktest.bin 2>/dev/null | grep -q "^0000000000000034     0  ret$" || echo "error: tests/stacktest.txt, stack delta leaked into main"
+
+# serialized streams have to round trip and turn away truncated or corrupt
+# files, see bench -check-stream. 256k of each mix is enough instructions
+# for x86_stream_read_all to split them
+./build/bench -check-stream -size 262144 >/dev/null || echo "error: bench -check-stream, the stream format is broken"
@@ -0,0 +1,162 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Address index, instruction starts are grouped into blocks of 64 and each
+// block keeps a full 32bit base while the instructions in it only keep a
+// 16bit delta from that base. a lookup is a binary search over the bases and
+// then one over at most 64 deltas. blocks which span more than 64KiB (long
+// runs of bytes that don't decode) keep full offsets on the side instead.
+#define X86__ADDR_BLOCK 64
+
+static void x86__addr_index_pack(X86_Arena* arena, const uint32_t* offsets, const uint8_t* lengths, size_t count, X86_AddrIndex* out) {
+    uint32_t block_count = (count + X86__ADDR_BLOCK - 1) / X86__ADDR_BLOCK;
+
+    *out = (X86_AddrIndex){ .count = count, .block_count = block_count };
+    out->block_base = X86_ARENA_ARRAY(arena, uint32_t, block_count);
+    out->block_wide = X86_ARENA_ARRAY(arena, uint32_t, block_count);
+    out->deltas = X86_ARENA_ARRAY(arena, uint16_t, count);
+    out->lengths = X86_ARENA_ARRAY(arena, uint8_t, count);
+    memcpy(out->lengths, lengths, count);
+
+    uint32_t wide_count = 0;
+    for (uint32_t b = 0; b < block_count; b++) {
+        size_t first = (size_t)b * X86__ADDR_BLOCK;
+        size_t last = first + X86__ADDR_BLOCK < count ? first + X86__ADDR_BLOCK - 1 : count - 1;
+
+        out->block_base[b] = offsets[first];
+        if (offsets[last] - offsets[first] > UINT16_MAX) {
+            out->block_wide[b] = wide_count;
+            wide_count += last - first + 1;
+        } else {
+            out->block_wide[b] = UINT32_MAX;
+        }
+    }
+
+    out->wide = X86_ARENA_ARRAY(arena, uint32_t, wide_count);
+    for (size_t i = 0; i < count; i++) {
+        uint32_t b = i / X86__ADDR_BLOCK;
+        uint32_t delta = offsets[i] - out->block_base[b];
+
+        if (out->block_wide[b] != UINT32_MAX) {
+            out->wide[out->block_wide[b] + (i % X86__ADDR_BLOCK)] = offsets[i];
+            delta = 0;
+        }
+        out->deltas[i] = delta;
+    }
+}
+
+void x86_addr_index_build(X86_Arena* arena, X86_Buffer code, X86_AddrIndex* out) {
+    x86_trace_begin("addr index", NULL);
+
+    // at most an instruction per byte, these only live until the index is packed
+    uint32_t* offsets = malloc(code.length * sizeof(uint32_t) + 1);
+    uint8_t* lengths = malloc(code.length + 1);
+    if (offsets == NULL || lengths == NULL) {
+        fprintf(stderr, "error: address index out of memory\n");
+        abort();
+    }
+
+    size_t count = 0, pos = 0;
+    while (pos < code.length) {
+        X86_Inst inst;
+        if (x86_disasm(x86_advance(code, pos), &inst) != X86_RESULT_SUCCESS || inst.length == 0) {
+            pos += 1;
+            continue;
+        }
+
+        offsets[count] = pos;
+        lengths[count] = inst.length;
+        count += 1;
+        pos += inst.length;
+    }
+
+    x86__addr_index_pack(arena, offsets, lengths, count, out);
+    free(offsets);
+    free(lengths);
+    x86_trace_end();
+}
+
+void x86_addr_index_from_decoded(X86_Arena* arena, const X86_DecodedSection* section, X86_AddrIndex* out) {
+    uint8_t* lengths = malloc(section->count + 1);
+    if (lengths == NULL) {
+        fprintf(stderr, "error: address index out of memory\n");
+        abort();
+    }
+
+    for (size_t i = 0; i < section->count; i++) {
+        lengths[i] = section->insts[i].length;
+    }
+
+    x86__addr_index_pack(arena, section->offsets, lengths, section->count, out);
+    free(lengths);
+}
+
+uint32_t x86_addr_index_offset(const X86_AddrIndex* index, size_t i) {
+    assert(i < index->count);
+
+    uint32_t b = i / X86__ADDR_BLOCK;
+    if (index->block_wide[b] != UINT32_MAX) {
+        return index->wide[index->block_wide[b] + (i % X86__ADDR_BLOCK)];
+    }
+
+    return index->block_base[b] + index->deltas[i];
+}
+
+size_t x86_addr_index_floor(const X86_AddrIndex* index, uint32_t offset) {
+    if (index->count == 0 || offset < index->block_base[0]) return SIZE_MAX;
+
+    // last block starting at or before offset
+    size_t lo = 0, hi = index->block_count;
+    while (hi - lo > 1) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->block_base[mid] <= offset) lo = mid;
+        else hi = mid;
+    }
+
+    size_t first = lo * X86__ADDR_BLOCK;
+    size_t n = index->count - first < X86__ADDR_BLOCK ? index->count - first : X86__ADDR_BLOCK;
+
+    // then the last instruction in it starting at or before offset, the
+    // first one always does.
+    lo = 0, hi = n;
+    if (index->block_wide[first / X86__ADDR_BLOCK] != UINT32_MAX) {
+        const uint32_t* wide = &index->wide[index->block_wide[first / X86__ADDR_BLOCK]];
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (wide[mid] <= offset) lo = mid;
+            else hi = mid;
+        }
+    } else {
+        // every delta fits in 16 bits so clamping doesn't change the answer
+        uint32_t delta = offset - index->block_base[first / X86__ADDR_BLOCK];
+        if (delta > UINT16_MAX) delta = UINT16_MAX;
+
+        const uint16_t* deltas = &index->deltas[first];
+        while (hi - lo > 1) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (deltas[mid] <= delta) lo = mid;
+            else hi = mid;
+        }
+    }
+
+    return first + lo;
+}
+
+size_t x86_addr_index_find(const X86_AddrIndex* index, uint32_t offset) {
+    size_t i = x86_addr_index_floor(index, offset);
+    if (i == SIZE_MAX) return SIZE_MAX;
+
+    return offset - x86_addr_index_offset(index, i) < index->lengths[i] ? i : SIZE_MAX;
+}
+
+size_t x86_addr_index_next(const X86_AddrIndex* index, uint32_t offset) {
+    size_t i = x86_addr_index_floor(index, offset);
+    i = i == SIZE_MAX ? 0 : i + 1;
+
+    return i < index->count ? i : SIZE_MAX;
+}
+
+size_t x86_addr_index_prev(const X86_AddrIndex* index, uint32_t offset) {
+    return offset == 0 ? SIZE_MAX : x86_addr_index_floor(index, offset - 1);
+}
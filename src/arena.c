@@ -0,0 +1,144 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// each chunk is a header followed by the bump space, chunks are only
+// ever returned to the heap by x86_arena_free so a reset arena can be
+// refilled without going back to malloc.
+struct X86_ArenaChunk {
+    X86_ArenaChunk* next;
+    size_t used;
+    size_t capacity;
+
+    _Alignas(16) uint8_t data[];
+};
+
+#define X86__ARENA_DEFAULT_CHUNK (1u << 20u)
+
+inline static uintptr_t x86__align_up(uintptr_t x, size_t align) {
+    return (x + (align - 1)) & ~(uintptr_t)(align - 1);
+}
+
+static X86_ArenaChunk* x86__arena_new_chunk(size_t capacity) {
+    X86_ArenaChunk* c = malloc(sizeof(X86_ArenaChunk) + capacity);
+    if (c == NULL) {
+        fprintf(stderr, "error: arena out of memory (%zu bytes)\n", capacity);
+        abort();
+    }
+
+    c->next = NULL;
+    c->used = 0;
+    c->capacity = capacity;
+    return c;
+}
+
+void x86_arena_init(X86_Arena* arena, size_t chunk_size) {
+    arena->base = NULL;
+    arena->top = NULL;
+    arena->chunk_size = chunk_size ? chunk_size : X86__ARENA_DEFAULT_CHUNK;
+}
+
+void* x86_arena_alloc(X86_Arena* arena, size_t size, size_t align) {
+    assert(align && (align & (align - 1)) == 0 && align <= 4096);
+    if (arena->chunk_size == 0) x86_arena_init(arena, 0);
+
+    // try the current chunk and any chunks left over from a reset
+    X86_ArenaChunk* c = arena->top;
+    while (c != NULL) {
+        uintptr_t start = x86__align_up((uintptr_t)&c->data[c->used], align);
+        uintptr_t end = start + size;
+
+        if (end <= (uintptr_t)&c->data[c->capacity]) {
+            c->used = end - (uintptr_t)c->data;
+            arena->top = c;
+            return (void*)start;
+        }
+
+        // only keep walking if the next chunk is empty, we don't want
+        // to scatter a single arena's allocations around
+        if (c->next == NULL || c->next->used != 0) break;
+        c = c->next;
+    }
+
+    // oversized allocations get a chunk of their own
+    size_t capacity = arena->chunk_size;
+    if (size + align > capacity) capacity = size + align;
+
+    X86_ArenaChunk* new_chunk = x86__arena_new_chunk(capacity);
+    if (arena->top == NULL) {
+        arena->base = new_chunk;
+    } else {
+        // splice it after the current chunk so reused chunks stay in order
+        new_chunk->next = arena->top->next;
+        arena->top->next = new_chunk;
+    }
+    arena->top = new_chunk;
+
+    uintptr_t start = x86__align_up((uintptr_t)new_chunk->data, align);
+    new_chunk->used = (start + size) - (uintptr_t)new_chunk->data;
+    return (void*)start;
+}
+
+void* x86_arena_zalloc(X86_Arena* arena, size_t size, size_t align) {
+    void* ptr = x86_arena_alloc(arena, size, align);
+    memset(ptr, 0, size);
+    return ptr;
+}
+
+X86_ArenaSavepoint x86_arena_save(X86_Arena* arena) {
+    return (X86_ArenaSavepoint){ arena->top, arena->top ? arena->top->used : 0 };
+}
+
+void x86_arena_restore(X86_Arena* arena, X86_ArenaSavepoint sp) {
+    if (sp.chunk == NULL) {
+        x86_arena_reset(arena);
+        return;
+    }
+
+    // everything after the savepoint's chunk is considered empty again
+    for (X86_ArenaChunk* c = sp.chunk->next; c != NULL; c = c->next) {
+        c->used = 0;
+    }
+
+    sp.chunk->used = sp.used;
+    arena->top = sp.chunk;
+}
+
+void* x86_arena_restore_keep(X86_Arena* arena, X86_ArenaSavepoint sp, void* top, size_t size, size_t align) {
+    x86_arena_restore(arena, sp);
+
+    // the new spot is either in another chunk or in top's chunk at or below
+    // it (the bump pointer only went backwards), either way memmove is fine.
+    void* dst = x86_arena_alloc(arena, size, align);
+    memmove(dst, top, size);
+    return dst;
+}
+
+void x86_arena_reset(X86_Arena* arena) {
+    for (X86_ArenaChunk* c = arena->base; c != NULL; c = c->next) {
+        c->used = 0;
+    }
+
+    arena->top = arena->base;
+}
+
+void x86_arena_free(X86_Arena* arena) {
+    X86_ArenaChunk* c = arena->base;
+    while (c != NULL) {
+        X86_ArenaChunk* next = c->next;
+        free(c);
+        c = next;
+    }
+
+    arena->base = NULL;
+    arena->top = NULL;
+}
+
+size_t x86_arena_used(const X86_Arena* arena) {
+    size_t total = 0;
+    for (X86_ArenaChunk* c = arena->base; c != NULL; c = c->next) {
+        total += c->used;
+    }
+
+    return total;
+}
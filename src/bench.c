@@ -0,0 +1,623 @@
+// Decode throughput over real and synthetic code: decode only, length only
+// and decode+format, with hardware counters when perf_event_open lets us.
+//
+//   bench [-csv] [-b] [-counters] [-stream] [-mix name]... [-size bytes] [-seed n] [files...]
+//   bench -check-stream [-b] [-mix name]... [-size bytes] [-seed n] [files...]
+//   bench -gen out.bin [-mix name] [-size bytes] [-seed n]
+//
+// without files it runs over tests/*.obj, every run also gets the synthetic
+// streams from x86_synth_stream (every mix unless -mix picks some). -csv
+// prints one row per input and path instead of the table so results can be
+// diffed between builds, -b means the files are raw code. -counters dumps
+// the decoder counters for one decode pass over every input (needs an
+// INSTRUMENT=1 build). -stream compares the serialized instruction stream
+// against a text listing of the same instructions, in size and in how long it
+// takes to get the X86_Insts back compared to decoding. -gen writes a synthetic stream out instead (dis -b
+// reads it back). -check-stream round trips the same inputs through the
+// stream format instead of timing them and makes sure truncated or corrupt
+// copies are turned away, it exits with 1 if anything's off.
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <time.h>
+#include "disx86.h"
+
+#include "elf.h"
+#include "coff.h"
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+static long get_nanos(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+////////////////////////////////
+// Hardware counters
+////////////////////////////////
+enum {
+    COUNTER_CYCLES,
+    COUNTER_INSTRUCTIONS,
+    COUNTER_BRANCH_MISSES,
+    COUNTER_L1D_MISSES,
+    COUNTER_COUNT
+};
+
+static const char* counter_names[COUNTER_COUNT] = { "cycles", "instructions", "branch_misses", "l1d_misses" };
+
+// -1 for the ones we couldn't open (no PMU in a VM, perf_event_paranoid)
+static int counter_fds[COUNTER_COUNT] = { -1, -1, -1, -1 };
+
+static void counters_open(void) {
+    #ifdef __linux__
+    static const struct { uint32_t type; uint64_t config; } events[COUNTER_COUNT] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES },
+        { PERF_TYPE_HW_CACHE, PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16) },
+    };
+
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        struct perf_event_attr attr = { 0 };
+        attr.size = sizeof(attr);
+        attr.type = events[i].type;
+        attr.config = events[i].config;
+        attr.disabled = 1;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+
+        counter_fds[i] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);
+    }
+    #endif
+}
+
+static void counters_start(void) {
+    #ifdef __linux__
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (counter_fds[i] < 0) continue;
+
+        ioctl(counter_fds[i], PERF_EVENT_IOC_RESET, 0);
+        ioctl(counter_fds[i], PERF_EVENT_IOC_ENABLE, 0);
+    }
+    #endif
+}
+
+// fills in -1 for the missing ones
+static void counters_stop(int64_t out[COUNTER_COUNT]) {
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        out[i] = -1;
+
+        #ifdef __linux__
+        uint64_t value;
+        if (counter_fds[i] < 0) continue;
+
+        ioctl(counter_fds[i], PERF_EVENT_IOC_DISABLE, 0);
+        if (read(counter_fds[i], &value, sizeof(value)) == sizeof(value)) out[i] = value;
+        #endif
+    }
+}
+
+////////////////////////////////
+// Paths
+////////////////////////////////
+typedef enum {
+    PATH_DECODE,
+    PATH_LENGTH,
+    PATH_FORMAT,
+    PATH_COUNT
+} Path;
+
+static const char* path_names[PATH_COUNT] = { "decode", "length", "decode+format" };
+
+// one pass over the whole buffer, bytes that don't decode get skipped one at
+// a time so every path sees the same instructions. returns how many decoded.
+static size_t run_path(Path path, X86_Buffer in, uint64_t* checksum) {
+    const uint8_t* start = in.data;
+    size_t count = 0;
+    while (in.length > 0) {
+        size_t length = 0;
+        if (path == PATH_LENGTH) {
+            length = x86_length(in);
+        } else {
+            X86_Inst inst;
+            if (x86_disasm(in, &inst) == X86_RESULT_SUCCESS) {
+                length = inst.length;
+
+                if (path == PATH_FORMAT) {
+                    char line[128];
+                    *checksum += x86_format_line(line, sizeof(line), &inst, in.data - start);
+                } else {
+                    *checksum += inst.type;
+                }
+            }
+        }
+
+        if (length == 0) {
+            in = x86_advance(in, 1);
+            continue;
+        }
+
+        in = x86_advance(in, length);
+        count += 1;
+    }
+
+    return count;
+}
+
+typedef struct {
+    double ns; // per pass
+    size_t insts;
+    int64_t counters[COUNTER_COUNT]; // per pass, -1 if missing
+} Result;
+
+// runs the path enough times to get past timer noise
+static Result measure(Path path, X86_Buffer in) {
+    uint64_t checksum = 0;
+    Result r = { .insts = run_path(path, in, &checksum) };
+
+    int runs = 0;
+    long elapsed = 0;
+    counters_start();
+    long start = get_nanos();
+    do {
+        run_path(path, in, &checksum);
+        runs++;
+        elapsed = get_nanos() - start;
+    } while (elapsed < 200000000L);
+    counters_stop(r.counters);
+
+    r.ns = (double)elapsed / runs;
+    for (int i = 0; i < COUNTER_COUNT; i++) {
+        if (r.counters[i] >= 0) r.counters[i] /= runs;
+    }
+
+    // keeps the formatting from being thrown out
+    if (checksum == 42) printf("\n");
+    return r;
+}
+
+////////////////////////////////
+// Inputs
+////////////////////////////////
+// the .text of an ELF or COFF file or the whole file with -b
+static bool load_text(X86_Arena* arena, const char* path, bool is_binary, X86_Buffer* out) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "error: could not open %s!\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t length = ftell(file);
+    rewind(file);
+
+    char* buffer = X86_ARENA_ARRAY(arena, char, length);
+    fread(buffer, length, sizeof(char), file);
+    fclose(file);
+
+    *out = (X86_Buffer){ (uint8_t*)buffer, length };
+    if (is_binary) return true;
+
+    // parse_elf complains on stdout, that'd end up in the csv
+    ELF_Context ctx = {};
+    if (length >= 4 && memcmp(buffer, "\x7f" "ELF", 4) == 0 && !parse_elf(arena, (uint8_t*)buffer, length, &ctx)) {
+        out->length = 0;
+        for (size_t i = 0; i < ctx.num_sects; i++) {
+            if (!strcmp(ctx.sections[i].name, ".text")) {
+                *out = (X86_Buffer){ ctx.sections[i].data.data, ctx.sections[i].data.length };
+                break;
+            }
+        }
+    } else {
+        COFF_SectionHeader* text_section = get_text_section(buffer);
+        if (text_section == NULL) return false;
+        *out = (X86_Buffer){ (uint8_t*)&buffer[text_section->raw_data_pos], text_section->raw_data_size };
+    }
+
+    return out->length > 0;
+}
+
+static void report(const char* input, Path path, size_t bytes, const Result* r, bool csv) {
+    double seconds = r->ns / 1e9;
+    if (csv) {
+        printf("%s,%s,%zu,%zu,%.3f,%.0f,%.0f", input, path_names[path], r->insts, bytes, r->ns / r->insts, r->insts / seconds, bytes / seconds);
+        for (int i = 0; i < COUNTER_COUNT; i++) {
+            if (r->counters[i] >= 0) printf(",%"PRId64, r->counters[i]);
+            else printf(",");
+        }
+        printf("\n");
+        return;
+    }
+
+    printf("  %-14s %8.2f ns/inst %8.2f Minst/s %8.1f MB/s", path_names[path], r->ns / r->insts, r->insts / seconds / 1e6, bytes / seconds / 1e6);
+    if (r->counters[COUNTER_CYCLES] >= 0) printf(" %7.1f cyc/inst", (double)r->counters[COUNTER_CYCLES] / r->insts);
+    if (r->counters[COUNTER_CYCLES] > 0 && r->counters[COUNTER_INSTRUCTIONS] >= 0) printf(" %5.2f IPC", (double)r->counters[COUNTER_INSTRUCTIONS] / r->counters[COUNTER_CYCLES]);
+    if (r->counters[COUNTER_BRANCH_MISSES] >= 0) printf(" %6.3f br-miss/inst", (double)r->counters[COUNTER_BRANCH_MISSES] / r->insts);
+    if (r->counters[COUNTER_L1D_MISSES] >= 0) printf(" %6.3f L1D-miss/inst", (double)r->counters[COUNTER_L1D_MISSES] / r->insts);
+    printf("\n");
+}
+
+// same sweep as run_path written out as a stream through a temp file, insts
+// & offsets need text.length entries. the text size is what dis would print
+// for it. returns the file (malloc'd) or NULL.
+static uint8_t* write_stream(X86_Buffer text, uint32_t block_size, X86_Inst* insts, uint32_t* offsets, size_t* out_count, size_t* out_text_size, long* out_size) {
+    FILE* file = tmpfile();
+    X86_StreamWriter* w = file ? x86_stream_writer_begin(file, block_size) : NULL;
+    if (w == NULL) {
+        if (file) fclose(file);
+        return NULL;
+    }
+
+    size_t count = 0, text_size = 0;
+    for (size_t pos = 0; pos < text.length;) {
+        X86_Inst* inst = &insts[count];
+        if (x86_disasm(x86_advance(text, pos), inst) != X86_RESULT_SUCCESS) {
+            pos += 1;
+            continue;
+        }
+
+        char line[128];
+        text_size += snprintf(line, sizeof(line), "  %08zX: ", pos) + x86_format_line(line, sizeof(line), inst, pos) + 1;
+
+        offsets[count] = pos;
+        x86_stream_writer_add(w, pos, inst);
+        pos += inst->length, count += 1;
+    }
+
+    bool ok = x86_stream_writer_end(w);
+    long size = ftell(file);
+    uint8_t* data = ok && size > 0 ? malloc(size) : NULL;
+    if (data != NULL) {
+        rewind(file);
+        if (fread(data, 1, size, file) != (size_t)size) {
+            free(data);
+            data = NULL;
+        }
+    }
+    fclose(file);
+
+    *out_count = count;
+    *out_text_size = text_size;
+    *out_size = size;
+    return data;
+}
+
+// decodes once, writes the stream to a temp file and times reading it back
+static void bench_stream(const char* name, X86_Buffer text, bool csv) {
+    size_t capacity = text.length;
+    X86_Inst* insts = malloc(capacity * sizeof(X86_Inst));
+    uint32_t* offsets = malloc(capacity * sizeof(uint32_t));
+    X86_Inst* loaded = malloc(capacity * sizeof(X86_Inst));
+    uint32_t* loaded_offsets = malloc(capacity * sizeof(uint32_t));
+    if (insts == NULL || offsets == NULL || loaded == NULL || loaded_offsets == NULL) {
+        fprintf(stderr, "error: could not set up the stream for %s\n", name);
+        goto done;
+    }
+
+    size_t count, text_size;
+    long stream_size;
+    uint8_t* data = write_stream(text, 0, insts, offsets, &count, &text_size, &stream_size);
+    bool ok = true;
+
+    X86_Arena arena;
+    x86_arena_init(&arena, 0);
+
+    X86_Stream s;
+    if (data == NULL || !x86_stream_open(&arena, (X86_Buffer){ data, stream_size }, &s)) {
+        fprintf(stderr, "error: could not write the stream for %s\n", name);
+        goto cleanup;
+    }
+
+    double ns[2];
+    for (int threads = 1, j = 0; j < 2; threads = 4, j++) {
+        int runs = 0;
+        long start = get_nanos(), elapsed;
+        do {
+            ok &= x86_stream_read_all(&s, loaded, loaded_offsets, threads);
+            runs++;
+            elapsed = get_nanos() - start;
+        } while (elapsed < 200000000L);
+        ns[j] = (double)elapsed / runs;
+    }
+
+    ok &= s.inst_count == count && memcmp(loaded, insts, count * sizeof(X86_Inst)) == 0 && memcmp(loaded_offsets, offsets, count * sizeof(uint32_t)) == 0;
+    double decode_ns = measure(PATH_DECODE, text).ns;
+
+    FILE* out = csv ? stderr : stdout;
+    fprintf(out, "  stream: %zu insts, %ld bytes (%.2f bytes/inst, text is %.1fx bigger), %u dictionary entries\n", count, stream_size, (double)stream_size / count, (double)text_size / stream_size, s.dict_count);
+    fprintf(out, "  stream: load %.2f ns/inst (%.2f with 4 threads), decode %.2f ns/inst%s\n\n", ns[0] / count, ns[1] / count, decode_ns / count, ok ? "" : " MISMATCH");
+
+    cleanup:
+    x86_arena_free(&arena);
+    free(data);
+
+    done:
+    free(insts);
+    free(offsets);
+    free(loaded);
+    free(loaded_offsets);
+}
+
+// true if x86_stream_open and x86_stream_read_all both take the file
+static bool stream_accepts(X86_Arena* arena, X86_Buffer file) {
+    X86_ArenaSavepoint sp = x86_arena_save(arena);
+
+    X86_Stream s;
+    bool ok = x86_stream_open(arena, file, &s);
+    if (ok) {
+        X86_Inst* insts = malloc((s.inst_count + 1) * sizeof(X86_Inst));
+        uint32_t* offsets = malloc((s.inst_count + 1) * sizeof(uint32_t));
+        ok = insts != NULL && offsets != NULL && x86_stream_read_all(&s, insts, offsets, 2);
+        free(insts);
+        free(offsets);
+    }
+
+    x86_arena_restore(arena, sp);
+    return ok;
+}
+
+// writes the stream with small blocks and reads it back every way there is,
+// then truncated and corrupted copies have to be turned away (or at least
+// survived where a flipped byte still makes a valid stream).
+static bool check_stream(const char* name, X86_Buffer text) {
+    size_t capacity = text.length + 1;
+    X86_Inst* insts = malloc(capacity * sizeof(X86_Inst));
+    uint32_t* offsets = malloc(capacity * sizeof(uint32_t));
+    X86_Inst* loaded = malloc(capacity * sizeof(X86_Inst));
+    uint32_t* loaded_offsets = malloc(capacity * sizeof(uint32_t));
+
+    size_t count = 0, text_size;
+    long size = 0;
+    uint8_t* data = insts && offsets && loaded && loaded_offsets ? write_stream(text, 64, insts, offsets, &count, &text_size, &size) : NULL;
+
+    X86_Arena arena;
+    x86_arena_init(&arena, 0);
+
+    X86_Stream s;
+    X86_Buffer file = { data, size };
+    const char* error = NULL;
+    if (data == NULL || !x86_stream_open(&arena, file, &s) || s.inst_count != count) error = "the stream doesn't open";
+
+    // all at once, on one thread and on several
+    for (int threads = 1; error == NULL && threads <= 4; threads += 3) {
+        memset(loaded, 0xCD, count * sizeof(X86_Inst));
+        if (!x86_stream_read_all(&s, loaded, loaded_offsets, threads) ||
+            memcmp(loaded, insts, count * sizeof(X86_Inst)) != 0 ||
+            memcmp(loaded_offsets, offsets, count * sizeof(uint32_t)) != 0) {
+            error = "x86_stream_read_all doesn't give back what was written";
+        }
+    }
+
+    // a block at a time, last one first
+    for (uint32_t b = s.block_count; error == NULL && b-- > 0;) {
+        size_t at = (size_t)b * s.block_size, n = x86_stream_block_count(&s, b);
+        if (x86_stream_read_block(&s, b, loaded, loaded_offsets) != n ||
+            memcmp(loaded, &insts[at], n * sizeof(X86_Inst)) != 0 ||
+            memcmp(loaded_offsets, &offsets[at], n * sizeof(uint32_t)) != 0) {
+            error = "x86_stream_read_block doesn't give back what was written";
+        }
+    }
+
+    // cut anywhere and the trailer isn't where it's looked for
+    for (long cut = 0; error == NULL && cut < size; cut += cut < 256 ? 1 : size / 256 + 1) {
+        if (stream_accepts(&arena, (X86_Buffer){ data, cut })) error = "a truncated stream was read";
+    }
+
+    // a flipped byte in the header, block index or trailer always shows, the
+    // decoder hash is left to the caller and the first offsets aren't read
+    if (error == NULL) {
+        // 16 byte header, the index after the dictionary and a 48 byte
+        // trailer with the hash 8 bytes in. big indices get an odd stride so
+        // it still lands on all 8 bytes of an entry.
+        long index = s.block_starts[s.block_count] + (long)s.dict_count * 8;
+        long index_end = index + ((long)s.block_count + 1) * 8;
+        long ranges[3][3] = {
+            { 0, 16, 1 },
+            { index, index_end, ((index_end - index) / 512) | 1 },
+            { size - 48, size, 1 },
+        };
+
+        for (int r = 0; r < 3; r++) {
+            for (long i = ranges[r][0]; error == NULL && i < ranges[r][1]; i += ranges[r][2]) {
+                if (i >= size - 40 && i < size - 32) continue;
+
+                data[i] ^= 0xFF;
+                if (stream_accepts(&arena, file)) error = "a corrupt header, index or trailer was read";
+                data[i] ^= 0xFF;
+            }
+        }
+
+        // flips in the blocks and dictionary can decode to other
+        // instructions just fine, they only have to be survived
+        for (long i = 16; i < index; i += index / 256 + 1) {
+            data[i] ^= 0xFF;
+            stream_accepts(&arena, file);
+            data[i] ^= 0xFF;
+        }
+    }
+
+    // a block that ends a byte early
+    if (error == NULL && s.block_count > 1) {
+        s.block_starts[1] -= 1;
+        if (x86_stream_read_all(&s, loaded, loaded_offsets, 1)) error = "a short block was read";
+    }
+
+    if (error == NULL) printf("%s: stream ok, %zu insts in %u blocks, %ld bytes\n", name, count, s.block_count, size);
+    else printf("error: %s, %s\n", name, error);
+
+    x86_arena_free(&arena);
+    free(data);
+    free(insts);
+    free(offsets);
+    free(loaded);
+    free(loaded_offsets);
+    return error == NULL;
+}
+
+static void bench_input(const char* name, X86_Buffer text, bool csv, bool counters, bool stream) {
+    if (!csv) printf("%s (%zu bytes):\n", name, text.length);
+
+    for (int path = 0; path < PATH_COUNT; path++) {
+        Result r = measure(path, text);
+        if (r.insts == 0) continue;
+
+        report(name, path, text.length, &r, csv);
+    }
+
+    if (counters) {
+        // a single pass so the numbers are per input, not per time spent
+        uint64_t checksum = 0;
+        x86_reset_counters();
+        run_path(PATH_DECODE, text, &checksum);
+
+        FILE* out = csv ? stderr : stdout;
+        if (csv) fprintf(out, "%s:\n", name);
+        x86_counters_dump(out, x86_get_counters());
+        fprintf(out, "\n");
+    }
+
+    if (stream) bench_stream(name, text, csv);
+}
+
+static bool parse_mix(const char* name, X86_SynthMix* out) {
+    for (int i = 0; i < X86_SYNTH_MIX_COUNT; i++) {
+        if (strcmp(name, x86_get_synth_mix_string(i)) == 0) {
+            *out = i;
+            return true;
+        }
+    }
+
+    fprintf(stderr, "error: unknown mix %s\n", name);
+    return false;
+}
+
+int main(int argc, char* argv[]) {
+    static const char* default_inputs[] = { "tests/a.obj", "tests/disx86.obj", "tests/stb_image.obj" };
+
+    bool is_binary = false, csv = false, counters = false, stream = false, check = false;
+    const char** inputs = calloc(argc + 1, sizeof(char*));
+    int input_count = 0;
+
+    // synthetic streams, every mix unless some are picked
+    bool mixes[X86_SYNTH_MIX_COUNT] = { 0 };
+    bool any_mix = false;
+    size_t synth_size = 1 << 20;
+    uint64_t seed = 0;
+    const char* gen_path = NULL;
+
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) is_binary = true;
+        else if (strcmp(argv[i], "-csv") == 0) csv = true;
+        else if (strcmp(argv[i], "-counters") == 0) counters = true;
+        else if (strcmp(argv[i], "-stream") == 0) stream = true;
+        else if (strcmp(argv[i], "-check-stream") == 0) check = true;
+        else if (strcmp(argv[i], "-size") == 0 && i + 1 < argc) synth_size = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-seed") == 0 && i + 1 < argc) seed = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-gen") == 0 && i + 1 < argc) gen_path = argv[++i];
+        else if (strcmp(argv[i], "-mix") == 0 && i + 1 < argc) {
+            X86_SynthMix mix;
+            if (!parse_mix(argv[++i], &mix)) return 1;
+            mixes[mix] = any_mix = true;
+        }
+        else inputs[input_count++] = argv[i];
+    }
+
+    if (!any_mix) {
+        for (int i = 0; i < X86_SYNTH_MIX_COUNT; i++) mixes[i] = true;
+    }
+
+    X86_Arena arena;
+    x86_arena_init(&arena, 0);
+    uint8_t* synth = X86_ARENA_ARRAY(&arena, uint8_t, synth_size);
+
+    if (gen_path != NULL) {
+        // just write out the first mix, say for a fuzzer's corpus
+        int mix = 0;
+        while (!mixes[mix]) mix++;
+
+        size_t count;
+        size_t length = x86_synth_stream(mix, seed, synth, synth_size, &count);
+
+        FILE* file = fopen(gen_path, "wb");
+        if (file == NULL || fwrite(synth, 1, length, file) != length) {
+            fprintf(stderr, "error: could not write %s!\n", gen_path);
+            return 1;
+        }
+        fclose(file);
+
+        printf("%s: %zu instructions, %zu bytes of %s\n", gen_path, count, length, x86_get_synth_mix_string(mix));
+        x86_arena_free(&arena);
+        free(inputs);
+        return 0;
+    }
+
+    if (input_count == 0) {
+        is_binary = false;
+        input_count = sizeof(default_inputs) / sizeof(default_inputs[0]);
+        memcpy(inputs, default_inputs, sizeof(default_inputs));
+    }
+
+    if (check) {
+        bool ok = true;
+        for (int i = 0; i < input_count; i++) {
+            X86_ArenaSavepoint sp = x86_arena_save(&arena);
+
+            X86_Buffer text;
+            if (load_text(&arena, inputs[i], is_binary, &text)) ok &= check_stream(inputs[i], text);
+            else fprintf(stderr, "error: no code in %s\n", inputs[i]), ok = false;
+
+            x86_arena_restore(&arena, sp);
+        }
+
+        for (int mix = 0; mix < X86_SYNTH_MIX_COUNT; mix++) {
+            if (!mixes[mix]) continue;
+
+            size_t length = x86_synth_stream(mix, seed, synth, synth_size, NULL);
+            ok &= check_stream(x86_get_synth_mix_string(mix), (X86_Buffer){ synth, length });
+        }
+
+        x86_arena_free(&arena);
+        free(inputs);
+        return ok ? 0 : 1;
+    }
+
+    counters_open();
+    if (csv) {
+        printf("input,path,insts,bytes,ns_per_inst,insts_per_sec,bytes_per_sec");
+        for (int i = 0; i < COUNTER_COUNT; i++) printf(",%s", counter_names[i]);
+        printf("\n");
+    } else if (counter_fds[COUNTER_CYCLES] < 0) {
+        printf("no hardware counters (perf_event_open failed), timing only\n\n");
+    }
+
+    for (int i = 0; i < input_count; i++) {
+        X86_ArenaSavepoint sp = x86_arena_save(&arena);
+
+        X86_Buffer text;
+        if (load_text(&arena, inputs[i], is_binary, &text)) bench_input(inputs[i], text, csv, counters, stream);
+        else fprintf(stderr, "error: no code in %s\n", inputs[i]);
+
+        x86_arena_restore(&arena, sp);
+    }
+
+    for (int mix = 0; mix < X86_SYNTH_MIX_COUNT; mix++) {
+        if (!mixes[mix]) continue;
+
+        char name[64];
+        snprintf(name, sizeof(name), "synthetic-%s", x86_get_synth_mix_string(mix));
+
+        size_t length = x86_synth_stream(mix, seed, synth, synth_size, NULL);
+        bench_input(name, (X86_Buffer){ synth, length }, csv, counters, stream);
+    }
+
+    x86_arena_free(&arena);
+    free(inputs);
+    return 0;
+}
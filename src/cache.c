@@ -0,0 +1,383 @@
+// futimens and friends are POSIX 2008, -std=c11 hides them otherwise
+#define _POSIX_C_SOURCE 200809L
+
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define X86__CACHE_POSIX 1
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <time.h>
+#else
+#define X86__CACHE_POSIX 0
+#endif
+
+// Decode cache, one file per section named after the hash of its bytes. the
+// file is a header followed by the X86_Inst array and the offsets so a hit
+// is just a mmap, the last write time doubles as the LRU timestamp (hits
+// touch it).
+//
+// that's ~40 bytes per instruction (9x the code), the x86_stream format gets
+// it to ~6 but reading it back costs about half a decode (bench -stream) and
+// a hit is meant to cost the hash and nothing else.
+#define X86__CACHE_VERSION 1
+#define X86__CACHE_EXT ".dxc"
+
+typedef struct {
+    char magic[8];
+    uint32_t version;
+    uint32_t inst_size;
+    uint64_t decoder;
+    uint64_t key[2];
+    uint64_t code_length;
+    uint64_t count;
+    uint64_t reserved;
+} X86__CacheHeader;
+
+static_assert(sizeof(X86__CacheHeader) == 64, "keep the instructions aligned");
+
+static const char x86__cache_magic[8] = "DISX86C";
+
+////////////////////////////////
+// Hashing
+////////////////////////////////
+// two independent multiply-xorshift lanes over 8 bytes at a time, they
+// don't wait on each other so the second half is close to free.
+inline static uint64_t x86__hash_mix(uint64_t h) {
+    h ^= h >> 33;
+    h *= 0xFF51AFD7ED558CCDull;
+    h ^= h >> 33;
+    h *= 0xC4CEB9FE1A85EC53ull;
+    h ^= h >> 33;
+    return h;
+}
+
+void x86_hash128(const void* data, size_t length, uint64_t out[2]) {
+    const uint8_t* p = data;
+    uint64_t a = 0x9E3779B97F4A7C15ull ^ length;
+    uint64_t b = 0xD6E8FEB86659FD93ull ^ (length << 1);
+
+    size_t i = 0;
+    for (; i + 8 <= length; i += 8) {
+        uint64_t w;
+        memcpy(&w, &p[i], 8);
+
+        a = (a ^ w) * 0x9FB21C651E98DF25ull;
+        a ^= a >> 29;
+        b = (b ^ w) * 0xC2B2AE3D27D4EB4Full;
+        b ^= b >> 31;
+    }
+
+    uint64_t tail = 0;
+    memcpy(&tail, &p[i], length - i);
+
+    out[0] = x86__hash_mix(a ^ tail);
+    out[1] = x86__hash_mix(b ^ x86__hash_mix(tail + 1));
+}
+
+////////////////////////////////
+// Decoding
+////////////////////////////////
+// builds the whole file image, the section points into it
+static bool x86__decode_image(X86_Buffer code, const uint64_t key[2], X86_DecodedSection* out) {
+    size_t capacity = code.length / 4 + 16;
+    X86_Inst* insts = malloc(capacity * sizeof(X86_Inst));
+    uint32_t* offsets = malloc(capacity * sizeof(uint32_t));
+    if (insts == NULL || offsets == NULL) goto oom;
+
+    size_t count = 0;
+    size_t offset = 0;
+    while (offset < code.length) {
+        if (count == capacity) {
+            capacity *= 2;
+
+            X86_Inst* new_insts = realloc(insts, capacity * sizeof(X86_Inst));
+            if (new_insts == NULL) goto oom;
+            insts = new_insts;
+
+            uint32_t* new_offsets = realloc(offsets, capacity * sizeof(uint32_t));
+            if (new_offsets == NULL) goto oom;
+            offsets = new_offsets;
+        }
+
+        X86_Inst* inst = &insts[count];
+        if (x86_disasm(x86_advance(code, offset), inst) != X86_RESULT_SUCCESS || inst->length == 0) {
+            offset += 1;
+            continue;
+        }
+
+        offsets[count++] = offset;
+        offset += inst->length;
+    }
+
+    size_t size = sizeof(X86__CacheHeader) + count * (sizeof(X86_Inst) + sizeof(uint32_t));
+    uint8_t* image = malloc(size);
+    if (image == NULL) goto oom;
+
+    X86__CacheHeader header = {
+        .version = X86__CACHE_VERSION,
+        .inst_size = sizeof(X86_Inst),
+        .decoder = x86_get_decoder_hash(),
+        .key = { key[0], key[1] },
+        .code_length = code.length,
+        .count = count,
+    };
+    memcpy(header.magic, x86__cache_magic, sizeof(header.magic));
+
+    X86_Inst* image_insts = (X86_Inst*) &image[sizeof(X86__CacheHeader)];
+    uint32_t* image_offsets = (uint32_t*) &image_insts[count];
+    memcpy(image, &header, sizeof(header));
+    memcpy(image_insts, insts, count * sizeof(X86_Inst));
+    memcpy(image_offsets, offsets, count * sizeof(uint32_t));
+    free(insts);
+    free(offsets);
+
+    *out = (X86_DecodedSection){ count, image_insts, image_offsets, image, size, false };
+    return true;
+
+    oom:
+    free(insts);
+    free(offsets);
+    return false;
+}
+
+static bool x86__valid_image(const uint8_t* image, size_t size, X86_Buffer code, const uint64_t key[2]) {
+    if (size < sizeof(X86__CacheHeader)) return false;
+
+    X86__CacheHeader header;
+    memcpy(&header, image, sizeof(header));
+
+    return memcmp(header.magic, x86__cache_magic, sizeof(header.magic)) == 0 &&
+        header.version == X86__CACHE_VERSION &&
+        header.inst_size == sizeof(X86_Inst) &&
+        header.decoder == x86_get_decoder_hash() &&
+        header.key[0] == key[0] && header.key[1] == key[1] &&
+        header.code_length == code.length &&
+        header.count <= code.length &&
+        size == sizeof(X86__CacheHeader) + header.count * (sizeof(X86_Inst) + sizeof(uint32_t));
+}
+
+void x86_decoded_release(X86_DecodedSection* section) {
+    #if X86__CACHE_POSIX
+    if (section->is_mapped) {
+        munmap(section->memory, section->memory_size);
+        *section = (X86_DecodedSection){ 0 };
+        return;
+    }
+    #endif
+
+    free(section->memory);
+    *section = (X86_DecodedSection){ 0 };
+}
+
+size_t x86_decoded_find(const X86_DecodedSection* section, uint32_t offset) {
+    size_t lo = 0, hi = section->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (section->offsets[mid] < offset) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo < section->count && section->offsets[lo] == offset ? lo : SIZE_MAX;
+}
+
+#if X86__CACHE_POSIX
+////////////////////////////////
+// Files
+////////////////////////////////
+// dir + "/" + 32 hex digits + extension, the temporaries add ".<pid>.tmp"
+#define X86__CACHE_PATH_MAX (sizeof(((X86_Cache*)0)->dir) + 64)
+
+static void x86__cache_path(const X86_Cache* cache, const uint64_t key[2], char* out, size_t out_capacity) {
+    snprintf(out, out_capacity, "%s/%016llx%016llx" X86__CACHE_EXT, cache->dir, (unsigned long long) key[0], (unsigned long long) key[1]);
+}
+
+static bool x86__cache_map(const char* path, X86_Buffer code, const uint64_t key[2], X86_DecodedSection* out) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || st.st_size < (off_t) sizeof(X86__CacheHeader)) {
+        close(fd);
+        return false;
+    }
+
+    size_t size = st.st_size;
+    void* image = mmap(NULL, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (image == MAP_FAILED) {
+        close(fd);
+        return false;
+    }
+
+    if (!x86__valid_image(image, size, code, key)) {
+        munmap(image, size);
+        close(fd);
+        return false;
+    }
+
+    // now's the last use as far as eviction cares
+    futimens(fd, NULL);
+    close(fd);
+
+    size_t count = ((const X86__CacheHeader*) image)->count;
+    const X86_Inst* insts = (const X86_Inst*) ((const uint8_t*) image + sizeof(X86__CacheHeader));
+    *out = (X86_DecodedSection){ count, insts, (const uint32_t*) &insts[count], image, size, true };
+    return true;
+}
+
+static bool x86__cache_write(const char* path, const X86_DecodedSection* section) {
+    // written next to it and renamed so readers never see half a file
+    char tmp[X86__CACHE_PATH_MAX + 32];
+    snprintf(tmp, sizeof(tmp), "%s.%ld.tmp", path, (long) getpid());
+
+    FILE* file = fopen(tmp, "wb");
+    if (file == NULL) return false;
+
+    bool ok = fwrite(section->memory, 1, section->memory_size, file) == section->memory_size;
+    ok &= fclose(file) == 0;
+    if (ok) ok = rename(tmp, path) == 0;
+    if (!ok) remove(tmp);
+    return ok;
+}
+
+typedef struct {
+    char name[64];
+    time_t time;
+    uint64_t size;
+} X86__CacheEntry;
+
+static int x86__cmp_cache_entry(const void* a, const void* b) {
+    const X86__CacheEntry* x = a;
+    const X86__CacheEntry* y = b;
+    return (x->time > y->time) - (x->time < y->time);
+}
+
+// oldest first until the directory fits, keep is the file we just wrote (or
+// NULL)
+static void x86__cache_evict(X86_Cache* cache, const char* keep) {
+    if (cache->max_bytes == 0) return;
+
+    DIR* dir = opendir(cache->dir);
+    if (dir == NULL) return;
+
+    size_t count = 0, capacity = 64;
+    X86__CacheEntry* entries = malloc(capacity * sizeof(X86__CacheEntry));
+    uint64_t total = 0;
+
+    struct dirent* ent;
+    while (entries != NULL && (ent = readdir(dir)) != NULL) {
+        size_t len = strlen(ent->d_name);
+        size_t ext = sizeof(X86__CACHE_EXT) - 1;
+        if (len <= ext || len >= sizeof(entries[0].name) || strcmp(&ent->d_name[len - ext], X86__CACHE_EXT) != 0) continue;
+
+        char path[X86__CACHE_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, ent->d_name);
+
+        struct stat st;
+        if (stat(path, &st) != 0) continue;
+
+        if (count == capacity) {
+            capacity *= 2;
+            X86__CacheEntry* new_entries = realloc(entries, capacity * sizeof(X86__CacheEntry));
+            if (new_entries == NULL) break;
+            entries = new_entries;
+        }
+
+        X86__CacheEntry* e = &entries[count++];
+        memcpy(e->name, ent->d_name, len + 1);
+        e->time = st.st_mtime;
+        e->size = st.st_size;
+        total += st.st_size;
+    }
+    closedir(dir);
+
+    if (entries == NULL) return;
+
+    qsort(entries, count, sizeof(X86__CacheEntry), x86__cmp_cache_entry);
+    for (size_t i = 0; i < count && total > cache->max_bytes; i++) {
+        if (keep != NULL && strcmp(entries[i].name, keep) == 0) continue;
+
+        char path[X86__CACHE_PATH_MAX];
+        snprintf(path, sizeof(path), "%s/%s", cache->dir, entries[i].name);
+        if (remove(path) == 0) {
+            total -= entries[i].size;
+            cache->evictions += 1;
+        }
+    }
+
+    free(entries);
+}
+
+bool x86_cache_open(X86_Cache* cache, const char* dir, uint64_t max_bytes) {
+    memset(cache, 0, sizeof(*cache));
+
+    size_t len = strlen(dir);
+    if (len == 0 || len >= sizeof(cache->dir)) return false;
+
+    memcpy(cache->dir, dir, len + 1);
+    cache->max_bytes = max_bytes;
+
+    if (mkdir(dir, 0755) != 0 && errno != EEXIST) return false;
+
+    struct stat st;
+    if (stat(dir, &st) != 0 || !S_ISDIR(st.st_mode)) return false;
+
+    // a smaller limit than last time (or only hits from now on) still gets
+    // the directory down to size
+    x86__cache_evict(cache, NULL);
+    return true;
+}
+
+bool x86_cache_decode(X86_Cache* cache, X86_Buffer code, X86_DecodedSection* out) {
+    assert(code.length < UINT32_MAX);
+
+    uint64_t key[2];
+    x86_hash128(code.data, code.length, key);
+
+    char path[X86__CACHE_PATH_MAX];
+    if (cache != NULL) {
+        x86__cache_path(cache, key, path, sizeof(path));
+        if (x86__cache_map(path, code, key, out)) {
+            cache->hits += 1;
+            return true;
+        }
+    }
+
+    if (!x86__decode_image(code, key, out)) {
+        fprintf(stderr, "error: decode cache out of memory\n");
+        abort();
+    }
+
+    if (cache != NULL) {
+        cache->misses += 1;
+        if (x86__cache_write(path, out)) x86__cache_evict(cache, strrchr(path, '/') + 1);
+    }
+
+    return false;
+}
+#else
+bool x86_cache_open(X86_Cache* cache, const char* dir, uint64_t max_bytes) {
+    memset(cache, 0, sizeof(*cache));
+    return false;
+}
+
+bool x86_cache_decode(X86_Cache* cache, X86_Buffer code, X86_DecodedSection* out) {
+    assert(code.length < UINT32_MAX);
+
+    uint64_t key[2];
+    x86_hash128(code.data, code.length, key);
+    if (!x86__decode_image(code, key, out)) {
+        fprintf(stderr, "error: decode cache out of memory\n");
+        abort();
+    }
+
+    if (cache != NULL) cache->misses += 1;
+    return false;
+}
+#endif
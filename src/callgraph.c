@@ -0,0 +1,235 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Call graphs are built in two steps: every region gets swept for call
+// sites on its own (that's the part that runs in parallel), then the sites
+// get attributed to whatever function node precedes them and the edges are
+// sorted into CSR form.
+typedef struct {
+    uint64_t site, target;
+    bool indirect;
+} X86__CallSite;
+
+typedef struct {
+    const X86_CodeRegion* region;
+
+    X86__CallSite* sites;
+    size_t count, capacity;
+} X86__CallScan;
+
+static void x86__push_site(X86__CallScan* scan, X86__CallSite site) {
+    if (scan->count == scan->capacity) {
+        scan->capacity = scan->capacity ? scan->capacity * 2 : 256;
+        scan->sites = realloc(scan->sites, scan->capacity * sizeof(X86__CallSite));
+        if (scan->sites == NULL) {
+            fprintf(stderr, "error: call graph out of memory\n");
+            abort();
+        }
+    }
+
+    scan->sites[scan->count++] = site;
+}
+
+static int x86__scan_calls(void* arg) {
+    X86__CallScan* scan = arg;
+    X86_Buffer code = scan->region->code;
+    uint64_t address = scan->region->address;
+    x86_trace_begin("call scan", NULL);
+
+    size_t offset = 0;
+    while (offset < code.length) {
+        X86_Inst inst;
+        if (x86_disasm(x86_advance(code, offset), &inst) != X86_RESULT_SUCCESS || inst.length == 0) {
+            offset += 1;
+            continue;
+        }
+
+        if (x86_get_branch_class(inst.type) == X86_BRANCH_CALL) {
+            uint64_t site = address + offset;
+            uint64_t target;
+
+            if (x86_get_branch_target(&inst, site, &target)) {
+                x86__push_site(scan, (X86__CallSite){ site, target, false });
+            } else if (inst.flags & X86_INSTR_USE_RIPMEM) {
+                // call [rip+disp], the node is the pointer slot (GOT, IAT...)
+                x86__push_site(scan, (X86__CallSite){ site, site + inst.length + (int64_t)inst.disp, true });
+            }
+        }
+
+        offset += inst.length;
+    }
+
+    x86_trace_end();
+    return 0;
+}
+
+static int x86__cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return (x > y) - (x < y);
+}
+
+static uint32_t x86__find_node(const X86_CallGraph* cg, uint64_t address) {
+    size_t lo = 0, hi = cg->node_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cg->nodes[mid] < address) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo < cg->node_count && cg->nodes[lo] == address ? lo : X86_NODE_NONE;
+}
+
+uint32_t x86_callgraph_find(const X86_CallGraph* cg, uint64_t address) {
+    return x86__find_node(cg, address);
+}
+
+const uint32_t* x86_callgraph_callees(const X86_CallGraph* cg, uint32_t node, size_t* out_count) {
+    *out_count = cg->row_start[node + 1] - cg->row_start[node];
+    return &cg->callees[cg->row_start[node]];
+}
+
+// the results end up right after the blob's start in this order, largest
+// alignment first so nothing needs padding.
+static size_t x86__callgraph_slice(X86_CallGraph* cg, uint8_t* blob) {
+    size_t n = cg->node_count, e = cg->edge_count;
+
+    cg->nodes = (uint64_t*) blob;
+    cg->row_start = (uint32_t*) &cg->nodes[n];
+    cg->callees = &cg->row_start[n + 1];
+    cg->call_counts = &cg->callees[e];
+    cg->node_flags = (uint8_t*) &cg->call_counts[e];
+    return &cg->node_flags[n] - blob;
+}
+
+// copies the results out of the scratch which then gets popped
+static void x86__callgraph_pack(X86_Arena* arena, X86_ArenaSavepoint sp, X86_CallGraph* cg) {
+    size_t n = cg->node_count, e = cg->edge_count;
+
+    X86_CallGraph staged = *cg;
+    size_t size = x86__callgraph_slice(&staged, x86_arena_alloc(arena, n * sizeof(uint64_t) + (n + 1 + 2 * e) * sizeof(uint32_t) + n, _Alignof(uint64_t)));
+    memcpy(staged.nodes, cg->nodes, n * sizeof(uint64_t));
+    memcpy(staged.row_start, cg->row_start, (n + 1) * sizeof(uint32_t));
+    memcpy(staged.callees, cg->callees, e * sizeof(uint32_t));
+    memcpy(staged.call_counts, cg->call_counts, e * sizeof(uint32_t));
+    memcpy(staged.node_flags, cg->node_flags, n);
+
+    x86__callgraph_slice(cg, x86_arena_restore_keep(arena, sp, staged.nodes, size, _Alignof(uint64_t)));
+}
+
+void x86_callgraph_build(X86_Arena* arena, const X86_CodeRegion* regions, size_t region_count, const uint64_t* functions, size_t function_count, int thread_count, X86_CallGraph* out) {
+    memset(out, 0, sizeof(*out));
+
+    // the site lists grow on the worker threads so they're on the heap,
+    // everything else is arena scratch until the results get packed.
+    X86_ArenaSavepoint sp = x86_arena_save(arena);
+    X86__CallScan* scans = X86_ARENA_ZARRAY(arena, X86__CallScan, region_count);
+    for (size_t i = 0; i < region_count; i++) scans[i].region = &regions[i];
+
+    // sweep every region, thread_count of 0 means one thread per region
+    if (thread_count <= 0) thread_count = region_count;
+    x86_parallel_for(thread_count, scans, region_count, sizeof(X86__CallScan), x86__scan_calls);
+
+    // nodes are symbols, region starts and anything that got called, code
+    // nodes are tracked separately since slots can't be callers.
+    size_t site_count = 0;
+    for (size_t i = 0; i < region_count; i++) site_count += scans[i].count;
+
+    size_t max_nodes = function_count + region_count + site_count;
+    uint64_t* code_nodes = X86_ARENA_ARRAY(arena, uint64_t, max_nodes);
+    uint64_t* all_nodes = X86_ARENA_ARRAY(arena, uint64_t, max_nodes);
+
+    size_t code_count = 0, all_count = 0;
+    for (size_t i = 0; i < function_count; i++) code_nodes[code_count++] = functions[i];
+    for (size_t i = 0; i < region_count; i++) code_nodes[code_count++] = regions[i].address;
+    for (size_t i = 0; i < region_count; i++) {
+        for (size_t j = 0; j < scans[i].count; j++) {
+            if (!scans[i].sites[j].indirect) code_nodes[code_count++] = scans[i].sites[j].target;
+            else all_nodes[all_count++] = scans[i].sites[j].target;
+        }
+    }
+
+    qsort(code_nodes, code_count, sizeof(uint64_t), x86__cmp_u64);
+    size_t unique = 0;
+    for (size_t i = 0; i < code_count; i++) {
+        if (unique == 0 || code_nodes[unique - 1] != code_nodes[i]) code_nodes[unique++] = code_nodes[i];
+    }
+    code_count = unique;
+
+    memcpy(&all_nodes[all_count], code_nodes, code_count * sizeof(uint64_t));
+    all_count += code_count;
+    qsort(all_nodes, all_count, sizeof(uint64_t), x86__cmp_u64);
+
+    unique = 0;
+    for (size_t i = 0; i < all_count; i++) {
+        if (unique == 0 || all_nodes[unique - 1] != all_nodes[i]) all_nodes[unique++] = all_nodes[i];
+    }
+
+    out->node_count = unique;
+    out->nodes = all_nodes;
+    out->node_flags = X86_ARENA_ZARRAY(arena, uint8_t, unique);
+
+    for (size_t i = 0; i < function_count; i++) {
+        out->node_flags[x86__find_node(out, functions[i])] |= X86_NODE_SYMBOL;
+    }
+
+    for (size_t i = 0; i < region_count; i++) {
+        out->node_flags[x86__find_node(out, regions[i].address)] |= X86_NODE_REGION_START;
+    }
+
+    // attribute sites, each edge is packed as caller:callee so sorting
+    // groups them into rows.
+    uint64_t* pairs = X86_ARENA_ARRAY(arena, uint64_t, site_count);
+    size_t pair_count = 0;
+    for (size_t i = 0; i < region_count; i++) {
+        for (size_t j = 0; j < scans[i].count; j++) {
+            X86__CallSite* s = &scans[i].sites[j];
+
+            // closest code node at or before the site
+            size_t lo = 0, hi = code_count;
+            while (lo < hi) {
+                size_t mid = lo + (hi - lo) / 2;
+                if (code_nodes[mid] <= s->site) lo = mid + 1;
+                else hi = mid;
+            }
+
+            // nothing before it in this region means no caller
+            if (lo == 0 || code_nodes[lo - 1] < regions[i].address) continue;
+
+            uint32_t caller = x86__find_node(out, code_nodes[lo - 1]);
+            uint32_t callee = x86__find_node(out, s->target);
+            out->node_flags[callee] |= s->indirect ? X86_NODE_INDIRECT_SLOT : X86_NODE_CALLED;
+
+            pairs[pair_count++] = ((uint64_t)caller << 32ull) | callee;
+        }
+        free(scans[i].sites);
+    }
+
+    qsort(pairs, pair_count, sizeof(uint64_t), x86__cmp_u64);
+
+    // CSR, duplicate pairs collapse into one edge with a site count
+    out->row_start = X86_ARENA_ZARRAY(arena, uint32_t, out->node_count + 1);
+    out->callees = X86_ARENA_ARRAY(arena, uint32_t, pair_count);
+    out->call_counts = X86_ARENA_ARRAY(arena, uint32_t, pair_count);
+    out->site_count = pair_count;
+
+    uint32_t edge_count = 0;
+    for (size_t i = 0; i < pair_count; i++) {
+        if (i > 0 && pairs[i] == pairs[i - 1]) {
+            out->call_counts[edge_count - 1]++;
+            continue;
+        }
+
+        out->row_start[(pairs[i] >> 32ull) + 1]++;
+        out->callees[edge_count] = pairs[i] & 0xFFFFFFFF;
+        out->call_counts[edge_count] = 1;
+        edge_count++;
+    }
+
+    for (uint32_t i = 0; i < out->node_count; i++) {
+        out->row_start[i + 1] += out->row_start[i];
+    }
+    out->edge_count = edge_count;
+
+    x86__callgraph_pack(arena, sp, out);
+}
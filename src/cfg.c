@@ -0,0 +1,410 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// The CFG is built from a linear sweep: one pass to find the instructions
+// and block leaders (branch targets & whatever follows a branch), one to
+// carve the instruction list into blocks and one to wire up the edges.
+// Nothing points at anything, blocks and edges are indices into flat arrays.
+//
+// Indirect jmps get their jump tables recovered during the sweep, the
+// entries become leaders and a table inside the code is skipped over
+// instead of being decoded as garbage. a table the sweep already went over
+// gets its instructions dropped and the leaders redone without them.
+//
+// All the working memory comes from the caller's arena above a savepoint,
+// the finished arrays get packed into one allocation which is kept when
+// the scratch is popped.
+typedef struct {
+    X86_Arena* arena;
+    uint32_t* data;
+    size_t count, capacity;
+} X86__U32Array;
+
+static void x86__u32_push(X86__U32Array* arr, uint32_t x) {
+    if (arr->count == arr->capacity) {
+        // the old array is left behind in the scratch
+        size_t capacity = arr->capacity ? arr->capacity * 2 : 1024;
+        uint32_t* data = X86_ARENA_ARRAY(arr->arena, uint32_t, capacity);
+        if (arr->count) memcpy(data, arr->data, arr->count * sizeof(uint32_t));
+
+        arr->data = data;
+        arr->capacity = capacity;
+    }
+
+    arr->data[arr->count++] = x;
+}
+
+inline static void x86__bit_set(uint64_t* bits, size_t i) { bits[i / 64] |= 1ull << (i % 64); }
+inline static bool x86__bit_get(const uint64_t* bits, size_t i) { return (bits[i / 64] >> (i % 64)) & 1; }
+
+bool x86_get_branch_target(const X86_Inst* inst, uint64_t address, uint64_t* out_target) {
+    X86_BranchClass branch = x86_get_branch_class(inst->type);
+    if (branch != X86_BRANCH_JMP && branch != X86_BRANCH_JCC && branch != X86_BRANCH_CALL) {
+        return false;
+    }
+
+    // rel8/rel32 are the only immediates a branch can have, anything going
+    // through a register or memory is indirect
+    if ((inst->flags & (X86_INSTR_IMMEDIATE | X86_INSTR_USE_MEMOP)) != X86_INSTR_IMMEDIATE) {
+        return false;
+    }
+
+    *out_target = address + inst->length + (int64_t)inst->imm;
+    return true;
+}
+
+// block starting exactly at offset, branches into the middle of a block
+// (or an instruction) don't count.
+static uint32_t x86__find_block_start(const X86_CFG* cfg, uint32_t offset) {
+    size_t lo = 0, hi = cfg->block_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->blocks[mid].start < offset) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo < cfg->block_count && cfg->blocks[lo].start == offset ? lo : X86_BLOCK_NONE;
+}
+
+uint32_t x86_cfg_find_block(const X86_CFG* cfg, uint64_t address) {
+    if (address < cfg->base_address) return X86_BLOCK_NONE;
+    uint64_t offset = address - cfg->base_address;
+
+    // last block starting at or before the address
+    size_t lo = 0, hi = cfg->block_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->blocks[mid].start <= offset) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (lo == 0 || offset >= cfg->blocks[lo - 1].end) return X86_BLOCK_NONE;
+    return lo - 1;
+}
+
+const X86_Edge* x86_cfg_succs(const X86_CFG* cfg, uint32_t block, size_t* out_count) {
+    const X86_Block* b = &cfg->blocks[block];
+    *out_count = b->succ_count;
+    return &cfg->edges[b->first_succ];
+}
+
+const uint32_t* x86_cfg_preds(const X86_CFG* cfg, uint32_t block, size_t* out_count) {
+    const X86_Block* b = &cfg->blocks[block];
+    *out_count = b->pred_count;
+    return &cfg->preds[b->first_pred];
+}
+
+static X86_Inst x86__decode_at(X86_Buffer code, uint32_t offset) {
+    X86_Inst inst;
+    X86_ResultCode result = x86_disasm(x86_advance(code, offset), &inst);
+    assert(result == X86_RESULT_SUCCESS), (void)result;
+    return inst;
+}
+
+// the results end up right after the blob's start in this order, largest
+// alignment first so nothing needs padding.
+static size_t x86__cfg_slice(X86_CFG* cfg, uint8_t* blob) {
+    cfg->tables = (X86_JumpTable*) blob;
+    cfg->blocks = (X86_Block*) &cfg->tables[cfg->table_count];
+    cfg->edges = (X86_Edge*) &cfg->blocks[cfg->block_count];
+    cfg->inst_offsets = (uint32_t*) &cfg->edges[cfg->edge_count];
+    cfg->preds = &cfg->inst_offsets[cfg->inst_count];
+    return (uint8_t*) &cfg->preds[cfg->edge_count] - blob;
+}
+
+// copies the results out of the scratch which then gets popped
+static void x86__cfg_pack(X86_Arena* arena, X86_ArenaSavepoint sp, X86_CFG* cfg) {
+    size_t size = cfg->table_count * sizeof(X86_JumpTable) + cfg->block_count * sizeof(X86_Block) +
+        cfg->edge_count * sizeof(X86_Edge) + (cfg->inst_count + cfg->edge_count) * sizeof(uint32_t);
+
+    X86_CFG staged = *cfg;
+    x86__cfg_slice(&staged, x86_arena_alloc(arena, size, _Alignof(X86_JumpTable)));
+    if (cfg->table_count) memcpy(staged.tables, cfg->tables, cfg->table_count * sizeof(X86_JumpTable));
+    if (cfg->block_count) memcpy(staged.blocks, cfg->blocks, cfg->block_count * sizeof(X86_Block));
+    if (cfg->edge_count) memcpy(staged.edges, cfg->edges, cfg->edge_count * sizeof(X86_Edge));
+    if (cfg->inst_count) memcpy(staged.inst_offsets, cfg->inst_offsets, cfg->inst_count * sizeof(uint32_t));
+    if (cfg->edge_count) memcpy(staged.preds, cfg->preds, cfg->edge_count * sizeof(uint32_t));
+
+    x86__cfg_slice(cfg, x86_arena_restore_keep(arena, sp, staged.tables, size, _Alignof(X86_JumpTable)));
+}
+
+static uint32_t x86__find_table(const X86_CFG* cfg, uint64_t jump) {
+    size_t lo = 0, hi = cfg->table_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (cfg->tables[mid].jump < jump) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo < cfg->table_count && cfg->tables[lo].jump == jump ? lo : UINT32_MAX;
+}
+
+// leaders an instruction makes: its branch target, its jump table's targets
+// (jt can be NULL) and whatever follows a branch.
+static void x86__mark_leaders(uint64_t* leaders, X86_Buffer code, uint64_t base_address, const X86_CodeRegion* memory, size_t memory_count, const X86_Inst* inst, uint32_t offset, const X86_JumpTable* jt) {
+    size_t n = code.length;
+
+    uint64_t target;
+    if (x86_get_branch_target(inst, base_address + offset, &target)) {
+        if (target >= base_address && target - base_address < n) x86__bit_set(leaders, target - base_address);
+    } else if (jt != NULL) {
+        for (uint32_t i = 0; i < jt->count; i++) {
+            if (!x86_jump_table_target(jt, code, base_address, memory, memory_count, i, &target)) continue;
+            if (target >= base_address && target - base_address < n) x86__bit_set(leaders, target - base_address);
+        }
+    }
+
+    size_t end = offset + inst->length;
+    X86_BranchClass branch = x86_get_branch_class(inst->type);
+    if (branch != X86_BRANCH_NONE && branch != X86_BRANCH_INT && end < n) {
+        x86__bit_set(leaders, end);
+    }
+}
+
+bool x86_cfg_build(X86_Arena* arena, X86_Buffer code, uint64_t base_address, const uint64_t* entries, size_t entry_count, const X86_CodeRegion* memory, size_t memory_count, X86_CFG* out) {
+    // offsets are 32bit
+    if (code.length >= UINT32_MAX) return false;
+
+    memset(out, 0, sizeof(*out));
+    out->base_address = base_address;
+
+    X86_ArenaSavepoint sp = x86_arena_save(arena);
+
+    size_t n = code.length;
+    uint64_t* leaders = X86_ARENA_ZARRAY(arena, uint64_t, n / 64 + 1);
+    uint64_t* data = X86_ARENA_ZARRAY(arena, uint64_t, n / 64 + 1);
+    X86__U32Array insts = { .arena = arena };
+
+    X86_JumpTable* tables = NULL;
+    size_t table_count = 0, table_capacity = 0, table_entries = 0;
+    bool has_inline_tables = false;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i] >= base_address && entries[i] - base_address < n) {
+            x86__bit_set(leaders, entries[i] - base_address);
+        }
+    }
+
+    // find instructions & leaders
+    bool prev_ok = false;
+    size_t offset = 0;
+    while (offset < n) {
+        if (x86__bit_get(data, offset)) {
+            prev_ok = false;
+            offset += 1;
+            continue;
+        }
+
+        X86_Inst inst;
+        if (x86_disasm(x86_advance(code, offset), &inst) != X86_RESULT_SUCCESS || inst.length == 0) {
+            // skip junk a byte at a time, whatever decodes after it starts a block
+            prev_ok = false;
+            offset += 1;
+            continue;
+        }
+
+        if (!prev_ok) x86__bit_set(leaders, offset);
+        x86__u32_push(&insts, offset);
+        prev_ok = true;
+
+        uint64_t target;
+        X86_JumpTable jt;
+        const X86_JumpTable* table = NULL;
+        if (inst.type == X86_INST_JMP && !x86_get_branch_target(&inst, base_address + offset, &target) &&
+            x86_recover_jump_table(code, base_address, insts.data, insts.count, memory, memory_count, &jt)) {
+            if (table_count == table_capacity) {
+                table_capacity = table_capacity ? table_capacity * 2 : 16;
+                X86_JumpTable* grown = X86_ARENA_ARRAY(arena, X86_JumpTable, table_capacity);
+                if (table_count) memcpy(grown, tables, table_count * sizeof(X86_JumpTable));
+                tables = grown;
+            }
+            tables[table_count] = jt;
+            table = &tables[table_count++];
+            table_entries += jt.count;
+
+            // tables in the code are data from here on
+            uint64_t table_end = jt.table + (uint64_t)jt.count * jt.entry_size;
+            for (uint64_t a = jt.table; a < table_end; a++) {
+                if (a >= base_address && a - base_address < n) {
+                    x86__bit_set(data, a - base_address);
+                    has_inline_tables = true;
+                }
+            }
+        }
+
+        x86__mark_leaders(leaders, code, base_address, memory, memory_count, &inst, offset, table);
+        offset += inst.length;
+    }
+
+    out->table_count = table_count;
+    out->tables = tables;
+
+    // tables found after we swept over them, drop whatever got decoded there.
+    // the leaders get redone from what's left so nothing that turned out to
+    // be data leaves a block start behind.
+    if (has_inline_tables) {
+        memset(leaders, 0, (n / 64 + 1) * sizeof(uint64_t));
+        for (size_t i = 0; i < entry_count; i++) {
+            if (entries[i] >= base_address && entries[i] - base_address < n) {
+                x86__bit_set(leaders, entries[i] - base_address);
+            }
+        }
+
+        size_t j = 0;
+        uint64_t prev_end = UINT64_MAX;
+        for (size_t i = 0; i < insts.count; i++) {
+            uint32_t start = insts.data[i];
+            X86_Inst inst = x86__decode_at(code, start);
+
+            bool overlaps = false;
+            for (uint32_t k = 0; k < inst.length; k++) overlaps |= x86__bit_get(data, start + k);
+            if (overlaps) continue;
+
+            // whatever comes after junk or a dropped instruction starts a block
+            if (start != prev_end) x86__bit_set(leaders, start);
+
+            uint32_t t = inst.type == X86_INST_JMP ? x86__find_table(out, base_address + start) : UINT32_MAX;
+            x86__mark_leaders(leaders, code, base_address, memory, memory_count, &inst, start, t != UINT32_MAX ? &tables[t] : NULL);
+
+            insts.data[j++] = start;
+            prev_end = start + inst.length;
+        }
+        insts.count = j;
+    }
+
+    // carve blocks
+    uint32_t block_count = 0;
+    for (size_t i = 0; i < insts.count; i++) {
+        block_count += x86__bit_get(leaders, insts.data[i]);
+    }
+
+    X86_Block* blocks = X86_ARENA_ZARRAY(arena, X86_Block, block_count);
+    uint32_t* inst_offsets = insts.data;
+
+    uint32_t b = 0;
+    for (size_t i = 0; i < insts.count;) {
+        size_t first = i++;
+        while (i < insts.count && !x86__bit_get(leaders, insts.data[i])) i++;
+
+        X86_Inst last = x86__decode_at(code, insts.data[i - 1]);
+        blocks[b++] = (X86_Block){
+            .start = insts.data[first],
+            .end = insts.data[i - 1] + last.length,
+            .first_inst = first,
+            .inst_count = i - first,
+            .terminator = x86_get_branch_class(last.type),
+        };
+    }
+    assert(b == block_count);
+
+    out->blocks = blocks;
+    out->block_count = block_count;
+    out->inst_offsets = inst_offsets;
+    out->inst_count = insts.count;
+
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i] >= base_address && entries[i] - base_address < n) {
+            uint32_t target = x86__find_block_start(out, entries[i] - base_address);
+            if (target != X86_BLOCK_NONE) blocks[target].flags |= X86_BLOCK_ENTRY;
+        }
+    }
+
+    // edges, at most 2 per block plus the jump table entries
+    X86_Edge* edges = X86_ARENA_ARRAY(arena, X86_Edge, 2 * (size_t)block_count + table_entries);
+    uint32_t* last_switch = X86_ARENA_ARRAY(arena, uint32_t, block_count);
+    memset(last_switch, 0xFF, block_count * sizeof(uint32_t));
+    uint32_t edge_count = 0;
+    for (uint32_t i = 0; i < block_count; i++) {
+        X86_Block* blk = &blocks[i];
+        blk->first_succ = edge_count;
+
+        X86_BranchClass branch = blk->terminator;
+        bool falls_through = branch != X86_BRANCH_JMP && branch != X86_BRANCH_RET && branch != X86_BRANCH_TRAP;
+
+        uint32_t next = i + 1 < block_count && blocks[i + 1].start == blk->end ? i + 1 : X86_BLOCK_NONE;
+        if (falls_through && next == X86_BLOCK_NONE && blk->end < n) {
+            // runs into bytes that didn't decode
+            blk->flags |= X86_BLOCK_INVALID;
+        }
+
+        if (branch == X86_BRANCH_JMP || branch == X86_BRANCH_JCC || branch == X86_BRANCH_CALL) {
+            uint32_t last_offset = inst_offsets[blk->first_inst + blk->inst_count - 1];
+            X86_Inst last = x86__decode_at(code, last_offset);
+
+            uint64_t target;
+            uint32_t to = X86_BLOCK_NONE;
+            uint32_t table = branch == X86_BRANCH_JMP ? x86__find_table(out, base_address + last_offset) : UINT32_MAX;
+            if (table != UINT32_MAX) {
+                // one edge per distinct target
+                const X86_JumpTable* jt = &out->tables[table];
+                blk->flags |= X86_BLOCK_JUMP_TABLE;
+
+                for (uint32_t j = 0; j < jt->count; j++) {
+                    uint32_t t = X86_BLOCK_NONE;
+                    if (x86_jump_table_target(jt, code, base_address, memory, memory_count, j, &target) &&
+                        target >= base_address && target - base_address < n) {
+                        t = x86__find_block_start(out, target - base_address);
+                    }
+
+                    if (t == X86_BLOCK_NONE) {
+                        blk->flags |= X86_BLOCK_EXTERNAL;
+                    } else if (last_switch[t] != i) {
+                        last_switch[t] = i;
+                        edges[edge_count++] = (X86_Edge){ i, t, X86_EDGE_SWITCH };
+                    }
+                }
+
+                blk->succ_count = edge_count - blk->first_succ;
+                continue;
+            } else if (!x86_get_branch_target(&last, base_address + last_offset, &target)) {
+                if (branch != X86_BRANCH_CALL) blk->flags |= X86_BLOCK_INDIRECT;
+            } else if (target >= base_address && target - base_address < n) {
+                to = x86__find_block_start(out, target - base_address);
+            }
+
+            if (to == X86_BLOCK_NONE && (blk->flags & X86_BLOCK_INDIRECT) == 0) {
+                blk->flags |= X86_BLOCK_EXTERNAL;
+            }
+
+            if (branch == X86_BRANCH_CALL) {
+                // calls aren't intraprocedural edges, they just mark the function
+                if (to != X86_BLOCK_NONE) blocks[to].flags |= X86_BLOCK_CALL_TARGET;
+                if (next != X86_BLOCK_NONE) edges[edge_count++] = (X86_Edge){ i, next, X86_EDGE_FALLTHROUGH };
+            } else if (branch == X86_BRANCH_JCC) {
+                if (to != X86_BLOCK_NONE) edges[edge_count++] = (X86_Edge){ i, to, X86_EDGE_TAKEN };
+                if (next != X86_BLOCK_NONE) edges[edge_count++] = (X86_Edge){ i, next, X86_EDGE_NOT_TAKEN };
+            } else {
+                if (to != X86_BLOCK_NONE) edges[edge_count++] = (X86_Edge){ i, to, X86_EDGE_JUMP };
+            }
+        } else if (branch == X86_BRANCH_NONE || branch == X86_BRANCH_INT) {
+            if (next != X86_BLOCK_NONE) edges[edge_count++] = (X86_Edge){ i, next, X86_EDGE_FALLTHROUGH };
+        }
+
+        blk->succ_count = edge_count - blk->first_succ;
+    }
+
+    out->edges = edges;
+    out->edge_count = edge_count;
+
+    // predecessors are the same edges bucketed by target
+    for (uint32_t i = 0; i < edge_count; i++) {
+        blocks[out->edges[i].to].pred_count++;
+    }
+
+    uint32_t sum = 0;
+    for (uint32_t i = 0; i < block_count; i++) {
+        blocks[i].first_pred = sum;
+        sum += blocks[i].pred_count;
+        blocks[i].pred_count = 0;
+    }
+
+    out->preds = X86_ARENA_ARRAY(arena, uint32_t, edge_count);
+    for (uint32_t i = 0; i < edge_count; i++) {
+        X86_Block* to = &blocks[out->edges[i].to];
+        out->preds[to->first_pred + to->pred_count++] = i;
+    }
+
+    x86__cfg_pack(arena, sp, out);
+    return true;
+}
@@ -0,0 +1,749 @@
+// Disassembly daemon, keeps ELF files mapped along with their code sections,
+// function symbols, address indices and stats so editors and triage tools can
+// ask about them without paying to read & parse the file on every query.
+//
+//   disd -socket path [-j threads] files...
+//   disd -socket path [-repeat n] -query "request"
+//
+// every message either way is a 4 byte little endian length and then that
+// many bytes. requests are one line of text, replies start with "ok\n" or
+// "error: ...\n" followed by the text:
+//
+//   files                        the loaded files, code sections and symbols
+//   range <file> <start> <end>   instructions covering [start, end), hex VAs
+//   func <file> <name|address>   instructions of a function symbol
+//   stats <file>                 instruction stats over the code sections
+//
+// a listing that won't fit in one message ends with "truncated at <address>",
+// ask for the range from there to get the rest.
+//
+// <file> is either the index files prints or the path it was loaded with. a
+// connection can send any number of requests, between them it sits in a poll
+// set and each request on its own goes to a pool of -j threads (4 by
+// default) so idle clients don't hold on to a thread. -query sends one
+// request and prints the reply, -repeat sends it n times and prints the
+// latency. POSIX only.
+#include <string.h>
+#include <stdint.h>
+#include <stdarg.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <time.h>
+#include <errno.h>
+#include <limits.h>
+#include <signal.h>
+#include <threads.h>
+#include "disx86.h"
+
+#include "elf.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+
+#define MAX_MESSAGE (1u << 20)
+#define MAX_RANGE   (16u << 20)
+#define MAX_CLIENTS 1024
+#define IO_TIMEOUT  5 // seconds a client gets to finish sending a request or take the reply
+
+static long get_nanos(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+////////////////////////////////
+// Loaded files
+////////////////////////////////
+typedef struct {
+    const char* name;
+    uint64_t start, end; // end is the next symbol's start if there's no size
+} Function;
+
+typedef struct {
+    const char* name;
+    uint64_t address;
+    X86_Buffer code;
+    X86_AddrIndex index;
+} CodeSection;
+
+typedef struct {
+    const char* path;
+    uint8_t* data;
+    size_t length;
+
+    X86_Arena arena;
+    ELF_Context ctx;
+
+    size_t section_count;
+    CodeSection* sections;
+
+    // sorted by start, by_name indexes into it sorted by name
+    size_t function_count;
+    Function* functions;
+    uint32_t* by_name;
+
+    X86_Stats stats;
+} LoadedFile;
+
+static LoadedFile* files;
+static size_t file_count;
+
+static int cmp_functions(const void* a, const void* b) {
+    const Function* x = a;
+    const Function* y = b;
+    return x->start < y->start ? -1 : x->start > y->start;
+}
+
+static const Function* sort_functions;
+static int cmp_by_name(const void* a, const void* b) {
+    return strcmp(sort_functions[*(const uint32_t*)a].name, sort_functions[*(const uint32_t*)b].name);
+}
+
+static bool load_file(const char* path, int thread_count, LoadedFile* out) {
+    *out = (LoadedFile){ .path = path };
+
+    int fd = open(path, O_RDONLY);
+    struct stat st;
+    if (fd < 0 || fstat(fd, &st) != 0 || st.st_size < 4) {
+        fprintf(stderr, "error: could not open %s!\n", path);
+        if (fd >= 0) close(fd);
+        return false;
+    }
+
+    // private so parse_elf can't write through to the file
+    out->length = st.st_size;
+    out->data = mmap(NULL, out->length, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (out->data == MAP_FAILED) {
+        fprintf(stderr, "error: could not map %s!\n", path);
+        return false;
+    }
+
+    x86_arena_init(&out->arena, 0);
+    X86_Arena* arena = &out->arena;
+
+    // parse_elf complains on stdout
+    ELF_Context* ctx = &out->ctx;
+    if (memcmp(out->data, "\x7f" "ELF", 4) != 0 || parse_elf(arena, out->data, out->length, ctx)) {
+        fprintf(stderr, "error: %s isn't an ELF file!\n", path);
+        x86_arena_free(arena);
+        munmap(out->data, out->length);
+        return false;
+    }
+
+    // executable sections, relocatable files have them all at 0 so they get
+    // laid out back to back like dis does.
+    bool relocatable = ctx->file_type == ft_relocatable;
+    uint64_t* bases = X86_ARENA_ZARRAY(arena, uint64_t, ctx->num_sects);
+    X86_CodeRegion* regions = X86_ARENA_ARRAY(arena, X86_CodeRegion, ctx->num_sects);
+    out->sections = X86_ARENA_ARRAY(arena, CodeSection, ctx->num_sects);
+
+    uint64_t next = 0;
+    for (size_t i = 0; i < ctx->num_sects; i++) {
+        Section* s = &ctx->sections[i];
+        if ((s->flags & sf_executable) == 0 || s->data.length == 0) continue;
+
+        bases[i] = relocatable ? next : s->addr;
+        next += (s->data.length + 15) & ~15ull;
+
+        CodeSection* cs = &out->sections[out->section_count];
+        *cs = (CodeSection){ .name = s->name, .address = bases[i], .code = { s->data.data, s->data.length } };
+        x86_addr_index_build(arena, cs->code, &cs->index);
+
+        regions[out->section_count++] = (X86_CodeRegion){ cs->code, cs->address };
+    }
+
+    out->functions = X86_ARENA_ARRAY(arena, Function, ctx->num_syms);
+    for (size_t i = 0; i < ctx->num_syms; i++) {
+        ELF_Symbol* sym = &ctx->syms[i];
+        if (sym->type != stt_func || sym->section_idx == 0 || sym->section_idx >= ctx->num_sects) continue;
+        if ((ctx->sections[sym->section_idx].flags & sf_executable) == 0) continue;
+
+        uint64_t start = relocatable ? bases[sym->section_idx] + sym->value : sym->value;
+        out->functions[out->function_count++] = (Function){ sym->name, start, start + sym->size };
+    }
+    qsort(out->functions, out->function_count, sizeof(Function), cmp_functions);
+
+    // sizeless symbols run up to the next one or the end of their section
+    for (size_t i = 0; i < out->function_count; i++) {
+        Function* f = &out->functions[i];
+        if (f->end > f->start) continue;
+
+        f->end = i + 1 < out->function_count ? out->functions[i + 1].start : f->start;
+        for (size_t j = 0; j < out->section_count; j++) {
+            const CodeSection* cs = &out->sections[j];
+            uint64_t section_end = cs->address + cs->code.length;
+            if (f->start >= cs->address && f->start < section_end && (f->end <= f->start || f->end > section_end)) {
+                f->end = section_end;
+            }
+        }
+    }
+
+    out->by_name = X86_ARENA_ARRAY(arena, uint32_t, out->function_count);
+    for (size_t i = 0; i < out->function_count; i++) out->by_name[i] = i;
+    sort_functions = out->functions;
+    qsort(out->by_name, out->function_count, sizeof(uint32_t), cmp_by_name);
+
+    x86_stats_collect(regions, out->section_count, thread_count, &out->stats);
+    return true;
+}
+
+////////////////////////////////
+// Requests
+////////////////////////////////
+typedef struct {
+    char* data;
+    size_t length, capacity;
+} Reply;
+
+static void reply_printf(Reply* r, const char* fmt, ...) {
+    for (;;) {
+        va_list ap;
+        va_start(ap, fmt);
+        int l = vsnprintf(r->data + r->length, r->capacity - r->length, fmt, ap);
+        va_end(ap);
+
+        if (l < 0) return;
+        if (r->length + l < r->capacity) {
+            r->length += l;
+            return;
+        }
+
+        size_t capacity = r->capacity * 2 > r->length + l + 1 ? r->capacity * 2 : r->length + l + 1;
+        char* data = realloc(r->data, capacity);
+        if (data == NULL) {
+            fprintf(stderr, "error: reply out of memory\n");
+            abort();
+        }
+
+        r->data = data;
+        r->capacity = capacity;
+    }
+}
+
+static const LoadedFile* find_file(const char* name) {
+    char* end;
+    unsigned long long i = strtoull(name, &end, 10);
+    if (*end == 0 && end != name) return i < file_count ? &files[i] : NULL;
+
+    for (size_t i = 0; i < file_count; i++) {
+        if (strcmp(files[i].path, name) == 0) return &files[i];
+    }
+    return NULL;
+}
+
+static bool parse_address(const char* str, uint64_t* out) {
+    char* end;
+    *out = strtoull(str, &end, 16);
+    return *end == 0 && end != str;
+}
+
+// sweeps [start, end) of every section it touches, starting at the
+// instruction that covers start. stops short of MAX_MESSAGE so the reply is
+// something the reader takes.
+static void disassemble_range(Reply* r, const LoadedFile* f, uint64_t start, uint64_t end) {
+    for (size_t i = 0; i < f->section_count; i++) {
+        const CodeSection* cs = &f->sections[i];
+        if (end <= cs->address || start >= cs->address + cs->code.length) continue;
+
+        uint32_t offset = start > cs->address ? start - cs->address : 0;
+        size_t at = x86_addr_index_find(&cs->index, offset);
+        if (at != SIZE_MAX) offset = x86_addr_index_offset(&cs->index, at);
+
+        size_t limit = end - cs->address < cs->code.length ? end - cs->address : cs->code.length;
+        while (offset < limit) {
+            X86_Inst inst;
+            bool decoded = x86_disasm(x86_advance(cs->code, offset), &inst) == X86_RESULT_SUCCESS && inst.length > 0;
+            size_t length = decoded ? inst.length : 1;
+
+            // the decoder takes more prefixes than fit in the architectural
+            // limit, past that the bytes just trail off
+            char bytes[X86_MAX_INST_LENGTH * 3 + 4], text[256];
+            size_t shown = length < X86_MAX_INST_LENGTH ? length : X86_MAX_INST_LENGTH;
+            bytes[0] = 0;
+            for (size_t j = 0; j < shown; j++) snprintf(&bytes[j * 3], 4, "%02X ", cs->code.data[offset + j]);
+            if (shown < length) memcpy(&bytes[shown * 3], "...", 4);
+            if (decoded) x86_format_line(text, sizeof(text), &inst, cs->address + offset);
+            else snprintf(text, sizeof(text), "(bad)");
+
+            // room for this line and the marker after it
+            if (r->length + sizeof(bytes) + sizeof(text) + 64 > MAX_MESSAGE) {
+                reply_printf(r, "truncated at %016llX\n", (long long)(cs->address + offset));
+                return;
+            }
+
+            reply_printf(r, "%016llX: %-30s %s\n", (long long)(cs->address + offset), bytes, text);
+            offset += length;
+        }
+    }
+}
+
+static const Function* find_function(const LoadedFile* f, const char* name) {
+    // by name first, a symbol could look like hex
+    size_t lo = 0, hi = f->function_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        int c = strcmp(f->functions[f->by_name[mid]].name, name);
+        if (c == 0) return &f->functions[f->by_name[mid]];
+        if (c < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    // then the last function starting at or before the address which covers it
+    uint64_t address;
+    if (!parse_address(name, &address)) return NULL;
+
+    lo = 0, hi = f->function_count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (f->functions[mid].start <= address) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo > 0 && address < f->functions[lo - 1].end ? &f->functions[lo - 1] : NULL;
+}
+
+static int cmp_type_counts(const void* a, const void* b) {
+    uint64_t x = ((const uint64_t*)a)[0], y = ((const uint64_t*)b)[0];
+    return x < y ? 1 : x > y ? -1 : 0;
+}
+
+static void print_stats(Reply* r, const LoadedFile* f) {
+    const X86_Stats* s = &f->stats;
+    reply_printf(r, "%" PRIu64 " instructions, %" PRIu64 " bytes, %" PRIu64 " invalid bytes\n", s->inst_count, s->byte_count, s->invalid_bytes);
+
+    // the most common types, count & type pairs
+    uint64_t types[X86_INST_COUNT][2];
+    for (size_t i = 0; i < X86_INST_COUNT; i++) {
+        types[i][0] = s->types[i];
+        types[i][1] = i;
+    }
+    qsort(types, X86_INST_COUNT, sizeof(types[0]), cmp_type_counts);
+
+    for (size_t i = 0; i < 20 && types[i][0]; i++) {
+        char name[32];
+        x86_format_inst(name, sizeof(name), types[i][1], X86_TYPE_NONE);
+        reply_printf(r, "%-16s %12" PRIu64 " %6.2f%%\n", name, types[i][0], 100.0 * types[i][0] / s->inst_count);
+    }
+
+    for (size_t i = 1; i < 16; i++) {
+        if (s->lengths[i]) reply_printf(r, "length %-2zu %12" PRIu64 "\n", i, s->lengths[i]);
+    }
+}
+
+static void handle_request(Reply* r, char* request) {
+    char* args[4] = { 0 };
+    int arg_count = 0;
+
+    char* save;
+    for (char* tok = strtok_r(request, " \t\r\n", &save); tok && arg_count < 4; tok = strtok_r(NULL, " \t\r\n", &save)) {
+        args[arg_count++] = tok;
+    }
+
+    r->length = 0;
+    if (arg_count == 0) {
+        reply_printf(r, "error: empty request\n");
+        return;
+    }
+
+    if (strcmp(args[0], "files") == 0) {
+        reply_printf(r, "ok\n");
+        for (size_t i = 0; i < file_count; i++) {
+            const LoadedFile* f = &files[i];
+            reply_printf(r, "%zu %s %zu sections %zu functions\n", i, f->path, f->section_count, f->function_count);
+            for (size_t j = 0; j < f->section_count; j++) {
+                const CodeSection* cs = &f->sections[j];
+                reply_printf(r, "  %-16s %016llX %10zu bytes %10zu instructions\n", cs->name, (long long)cs->address, cs->code.length, cs->index.count);
+            }
+        }
+        return;
+    }
+
+    const LoadedFile* f = arg_count > 1 ? find_file(args[1]) : NULL;
+    if (f == NULL) {
+        reply_printf(r, "error: %s\n", arg_count > 1 ? "no such file" : "missing file");
+        return;
+    }
+
+    if (strcmp(args[0], "range") == 0) {
+        uint64_t start, end;
+        if (arg_count != 4 || !parse_address(args[2], &start) || !parse_address(args[3], &end) || end < start) {
+            reply_printf(r, "error: expected range <file> <start> <end>\n");
+        } else if (end - start > MAX_RANGE) {
+            reply_printf(r, "error: ranges are capped at %u bytes\n", MAX_RANGE);
+        } else {
+            reply_printf(r, "ok\n");
+            disassemble_range(r, f, start, end);
+        }
+    } else if (strcmp(args[0], "func") == 0) {
+        const Function* fn = arg_count == 3 ? find_function(f, args[2]) : NULL;
+        if (fn == NULL) {
+            reply_printf(r, "error: no such function\n");
+        } else {
+            reply_printf(r, "ok\n%s %016llX-%016llX\n", fn->name, (long long)fn->start, (long long)fn->end);
+            disassemble_range(r, f, fn->start, fn->end - fn->start > MAX_RANGE ? fn->start + MAX_RANGE : fn->end);
+        }
+    } else if (strcmp(args[0], "stats") == 0) {
+        reply_printf(r, "ok\n");
+        print_stats(r, f);
+    } else {
+        reply_printf(r, "error: unknown request %s\n", args[0]);
+    }
+}
+
+////////////////////////////////
+// Messages
+////////////////////////////////
+static bool read_full(int fd, void* data, size_t length) {
+    uint8_t* p = data;
+    while (length > 0) {
+        ssize_t l = read(fd, p, length);
+        if (l < 0 && errno == EINTR) continue;
+        if (l <= 0) return false;
+
+        p += l, length -= l;
+    }
+    return true;
+}
+
+static bool write_message(int fd, const void* data, uint32_t length) {
+    uint8_t header[4] = { length, length >> 8, length >> 16, length >> 24 };
+    struct iovec iov[2] = { { header, 4 }, { (void*)data, length } };
+
+    // one writev for the whole message most of the time
+    size_t left = 4 + (size_t)length;
+    int first = 0;
+    while (left > 0) {
+        ssize_t l = writev(fd, &iov[first], 2 - first);
+        if (l < 0 && errno == EINTR) continue;
+        if (l <= 0) return false;
+
+        left -= l;
+        while (first < 2 && (size_t)l >= iov[first].iov_len) l -= iov[first++].iov_len;
+        if (first < 2) {
+            iov[first].iov_base = (uint8_t*)iov[first].iov_base + l;
+            iov[first].iov_len -= l;
+        }
+    }
+    return true;
+}
+
+// the payload is NUL terminated, false on EOF or if it's too big
+static bool read_message(int fd, char** buffer, size_t* capacity, uint32_t* out_length) {
+    uint8_t header[4];
+    if (!read_full(fd, header, 4)) return false;
+
+    uint32_t length = header[0] | (header[1] << 8) | (header[2] << 16) | ((uint32_t)header[3] << 24);
+    if (length > MAX_MESSAGE) return false;
+
+    if (length + 1 > *capacity) {
+        char* data = realloc(*buffer, length + 1);
+        if (data == NULL) return false;
+
+        *buffer = data;
+        *capacity = length + 1;
+    }
+
+    if (!read_full(fd, *buffer, length)) return false;
+    (*buffer)[length] = 0;
+    *out_length = length;
+    return true;
+}
+
+////////////////////////////////
+// Server
+////////////////////////////////
+// a connection is either waiting in the poll set, queued for a worker or
+// being answered by one, never more than one of them. so neither ring can
+// hold more than MAX_CLIENTS.
+typedef struct {
+    int fds[MAX_CLIENTS];
+    size_t head, count;
+} FdRing;
+
+static void ring_push(FdRing* r, int fd) {
+    assert(r->count < MAX_CLIENTS);
+    r->fds[(r->head + r->count) % MAX_CLIENTS] = fd;
+    r->count += 1;
+}
+
+static int ring_pop(FdRing* r) {
+    int fd = r->fds[r->head];
+    r->head = (r->head + 1) % MAX_CLIENTS;
+    r->count -= 1;
+    return fd;
+}
+
+static struct {
+    mtx_t lock;
+    cnd_t ready;
+    FdRing requests; // has a request to read, for the workers
+    FdRing answered; // going back into the poll set
+    size_t client_count;
+
+    // a byte gets written whenever answered grows so the poll wakes up
+    int wake[2];
+} queue;
+
+static volatile sig_atomic_t stopping;
+
+static void on_signal(int sig) {
+    (void)sig;
+    stopping = 1;
+}
+
+static int worker(void* arg) {
+    (void)arg;
+
+    char* request = NULL;
+    size_t request_capacity = 0;
+    uint32_t length;
+
+    Reply reply = { .data = malloc(4096), .capacity = 4096 };
+    for (;;) {
+        mtx_lock(&queue.lock);
+        while (queue.requests.count == 0) cnd_wait(&queue.ready, &queue.lock);
+        int fd = ring_pop(&queue.requests);
+        mtx_unlock(&queue.lock);
+
+        // just the one request, then the connection goes back to the poll set
+        bool ok = read_message(fd, &request, &request_capacity, &length);
+        if (ok) {
+            handle_request(&reply, request);
+            if (reply.length > MAX_MESSAGE) {
+                // the client would drop the connection on it
+                reply.length = 0;
+                reply_printf(&reply, "error: reply is over %u bytes\n", MAX_MESSAGE);
+            }
+            ok = write_message(fd, reply.data, reply.length);
+        }
+
+        mtx_lock(&queue.lock);
+        if (ok) {
+            ring_push(&queue.answered, fd);
+        } else {
+            close(fd);
+            queue.client_count -= 1;
+        }
+        mtx_unlock(&queue.lock);
+
+        // the pipe is non-blocking, if it's full the poll is awake anyway
+        if (ok) {
+            ssize_t l = write(queue.wake[1], "", 1);
+            (void)l;
+        }
+    }
+    return 0;
+}
+
+static int serve(const char* socket_path, int thread_count) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: socket path is too long!\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    // whatever's left from a previous run
+    unlink(socket_path);
+
+    int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (listener < 0 || bind(listener, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listener, 64) != 0) {
+        fprintf(stderr, "error: could not listen on %s!\n", socket_path);
+        return 1;
+    }
+
+    if (pipe(queue.wake) != 0) {
+        fprintf(stderr, "error: could not create the wake up pipe!\n");
+        return 1;
+    }
+    fcntl(queue.wake[0], F_SETFL, O_NONBLOCK);
+    fcntl(queue.wake[1], F_SETFL, O_NONBLOCK);
+
+    // no SA_RESTART so poll gives up when we're asked to stop
+    struct sigaction sa = { .sa_handler = on_signal };
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+    signal(SIGPIPE, SIG_IGN);
+
+    mtx_init(&queue.lock, mtx_plain);
+    cnd_init(&queue.ready);
+    for (int i = 0; i < thread_count; i++) {
+        thrd_t t;
+        if (thrd_create(&t, worker, NULL) != thrd_success) {
+            fprintf(stderr, "error: could not start worker threads!\n");
+            return 1;
+        }
+        thrd_detach(t);
+    }
+
+    // the listener, the wake up pipe and then every idle connection
+    struct pollfd* polls = calloc(MAX_CLIENTS + 2, sizeof(struct pollfd));
+    polls[0] = (struct pollfd){ .fd = listener, .events = POLLIN };
+    polls[1] = (struct pollfd){ .fd = queue.wake[0], .events = POLLIN };
+    size_t poll_count = 2;
+
+    fprintf(stderr, "info: serving %zu files on %s (%d threads)\n", file_count, socket_path, thread_count);
+    while (!stopping) {
+        if (poll(polls, poll_count, -1) < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "error: poll failed (%s)\n", strerror(errno));
+            break;
+        }
+
+        // anything readable (EOF & errors too) is handed off, the last entry
+        // takes its place so it gets looked at next
+        for (size_t i = 2; i < poll_count;) {
+            if (polls[i].revents == 0) {
+                i++;
+                continue;
+            }
+
+            mtx_lock(&queue.lock);
+            ring_push(&queue.requests, polls[i].fd);
+            cnd_signal(&queue.ready);
+            mtx_unlock(&queue.lock);
+
+            polls[i] = polls[--poll_count];
+        }
+
+        if (polls[1].revents) {
+            char drain[64];
+            while (read(queue.wake[0], drain, sizeof(drain)) > 0) {}
+
+            mtx_lock(&queue.lock);
+            while (queue.answered.count > 0) {
+                polls[poll_count++] = (struct pollfd){ .fd = ring_pop(&queue.answered), .events = POLLIN };
+            }
+            mtx_unlock(&queue.lock);
+        }
+
+        if (polls[0].revents) {
+            int fd = accept(listener, NULL, NULL);
+            if (fd < 0) {
+                if (errno == EINTR || errno == ECONNABORTED) continue;
+                fprintf(stderr, "error: accept failed (%s)\n", strerror(errno));
+                break;
+            }
+
+            mtx_lock(&queue.lock);
+            bool full = queue.client_count == MAX_CLIENTS;
+            if (!full) queue.client_count += 1;
+            mtx_unlock(&queue.lock);
+
+            if (full) {
+                close(fd);
+                continue;
+            }
+
+            // a client stalling halfway through a message only holds a
+            // worker this long
+            struct timeval timeout = { .tv_sec = IO_TIMEOUT };
+            setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+            setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout, sizeof(timeout));
+
+            polls[poll_count++] = (struct pollfd){ .fd = fd, .events = POLLIN };
+        }
+    }
+
+    free(polls);
+    close(listener);
+    unlink(socket_path);
+    return 0;
+}
+
+////////////////////////////////
+// Client
+////////////////////////////////
+static int query(const char* socket_path, const char* request, int repeat) {
+    struct sockaddr_un addr = { .sun_family = AF_UNIX };
+    if (strlen(socket_path) >= sizeof(addr.sun_path)) {
+        fprintf(stderr, "error: socket path is too long!\n");
+        return 1;
+    }
+    strcpy(addr.sun_path, socket_path);
+
+    int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    if (fd < 0 || connect(fd, (struct sockaddr*)&addr, sizeof(addr)) != 0) {
+        fprintf(stderr, "error: could not connect to %s!\n", socket_path);
+        return 1;
+    }
+
+    char* reply = NULL;
+    size_t reply_capacity = 0;
+    uint32_t length = 0;
+
+    long total = 0, best = LONG_MAX;
+    for (int i = 0; i < repeat; i++) {
+        long start = get_nanos();
+        if (!write_message(fd, request, strlen(request)) || !read_message(fd, &reply, &reply_capacity, &length)) {
+            fprintf(stderr, "error: lost the connection to %s!\n", socket_path);
+            return 1;
+        }
+
+        long elapsed = get_nanos() - start;
+        total += elapsed;
+        if (elapsed < best) best = elapsed;
+    }
+
+    fwrite(reply, 1, length, stdout);
+    if (repeat > 1) {
+        fprintf(stderr, "info: %d requests, %.3f ms average, %.3f ms best, %u byte reply\n", repeat, total / 1e6 / repeat, best / 1e6, length);
+    }
+
+    bool ok = length >= 3 && memcmp(reply, "ok\n", 3) == 0;
+    free(reply);
+    close(fd);
+    return ok ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+    const char* socket_path = NULL;
+    const char* request = NULL;
+    int thread_count = 4, repeat = 1;
+
+    const char** inputs = calloc(argc + 1, sizeof(char*));
+    int input_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-socket") == 0 && i + 1 < argc) socket_path = argv[++i];
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) thread_count = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-query") == 0 && i + 1 < argc) request = argv[++i];
+        else if (strcmp(argv[i], "-repeat") == 0 && i + 1 < argc) repeat = atoi(argv[++i]);
+        else inputs[input_count++] = argv[i];
+    }
+
+    if (socket_path == NULL || (request == NULL && input_count == 0)) {
+        fprintf(stderr, "usage: disd -socket path [-j threads] files...\n");
+        fprintf(stderr, "       disd -socket path [-repeat n] -query \"request\"\n");
+        return 1;
+    }
+
+    if (request != NULL) {
+        free(inputs);
+        return query(socket_path, request, repeat > 0 ? repeat : 1);
+    }
+
+    if (thread_count <= 0) thread_count = 1;
+
+    long start = get_nanos();
+    files = calloc(input_count, sizeof(LoadedFile));
+    for (int i = 0; i < input_count; i++) {
+        if (load_file(inputs[i], thread_count, &files[file_count])) file_count++;
+    }
+
+    if (file_count == 0) {
+        fprintf(stderr, "error: nothing to serve!\n");
+        return 1;
+    }
+    fprintf(stderr, "info: loaded %zu files in %.3f ms\n", file_count, (get_nanos() - start) / 1e6);
+
+    int result = serve(socket_path, thread_count);
+    free(inputs);
+    return result;
+}
@@ -1,15 +1,53 @@
 #include "disx86.h"
 #include <string.h>
 #include <assert.h>
+#include <threads.h>
 
 typedef struct {
     const char* name;
 
     // if the instruction has a condition code, it's
     // found in the bottom 4bits of the opcode
-    bool has_cc;
+    bool has_cc : 1;
+
+    // a 66 in front is part of the opcode, not an operand size override
+    bool opcode_66 : 1;
+
+    // semantics, see tables/semantics.dat
+    X86_BranchClass branch : 3;
+    uint8_t flags_read;      // X86_Flags
+    uint8_t flags_written;   // X86_Flags
+    uint16_t implicit_read;  // 1 << X86_GPR
+    uint16_t implicit_write; // 1 << X86_GPR
+
+    // X86_OperandAccess per operand slot xor'd with X86__DEFAULT_ACCESS so
+    // the common case is the zero the table leaves out
+    uint8_t operand_access;
 } InstructionDesc;
 
+// rw, r, r, r
+#define X86__DEFAULT_ACCESS 0x57
+
+// one way to encode an instruction type with some X86_EncodingMode, the
+// prefixes are the ones the DFA walks (X86__ENC_*) and rx is the ModRM reg
+// field for /0-/7 opcodes (-1 otherwise).
+enum {
+    X86__ENC_66   = 1,
+    X86__ENC_REXW = 2,
+    X86__ENC_F3   = 4,
+    X86__ENC_F2   = 8,
+};
+
+typedef struct {
+    uint16_t type;
+    uint8_t mode;
+    uint8_t prefixes;
+    int8_t rx;
+    bool plus_r;
+    uint8_t opcode_count;
+    uint8_t opcode[4];
+} X86__Encoding;
+
 #include "table.inc"
 
 #ifdef __BYTE_ORDER__
@@ -23,6 +61,23 @@ typedef struct {
 #define DISX86_NEEDS_SWAP 0
 #endif
 
+// decoder counters, see X86_DecodeCounters
+#ifndef DISX86_INSTRUMENT
+#define DISX86_INSTRUMENT 0
+#endif
+
+#if DISX86_INSTRUMENT
+static _Thread_local X86_DecodeCounters x86__counters;
+
+#define X86__COUNT(field) (x86__counters.field++)
+
+inline static void x86__count_steps(uint64_t steps) {
+    x86__counters.steps[steps < X86_COUNTERS_MAX_STEPS ? steps : X86_COUNTERS_MAX_STEPS]++;
+}
+#else
+#define X86__COUNT(field) ((void)0)
+#endif
+
 #define DECODE_MODRXRM(mod, rx, rm, src) \
 (mod = (src >> 6) & 3, rx = (src >> 3) & 7, rm = (src & 7))
 
@@ -93,10 +148,12 @@ static int8_t x86_parse_memory_op(X86_Buffer* restrict in, X86_Inst* restrict ou
     } else {
         out->disp = 0;
         out->flags |= X86_INSTR_USE_MEMOP;
+        X86__COUNT(memory);
 
         // indirect
         if (rm == X86_RSP) {
             uint8_t sib = x86__read_uint8(in);
+            X86__COUNT(sib);
 
             uint8_t scale, index, base;
             DECODE_MODRXRM(scale, index, base, sib);
@@ -124,6 +181,7 @@ static int8_t x86_parse_memory_op(X86_Buffer* restrict in, X86_Inst* restrict ou
 
                 out->flags |= X86_INSTR_USE_RIPMEM;
                 out->disp = disp;
+                X86__COUNT(rip_relative);
             } else {
                 out->base = (rex&1 ? 8 : 0) | rm;
                 out->index = X86_GPR_NONE;
@@ -144,7 +202,7 @@ static int8_t x86_parse_memory_op(X86_Buffer* restrict in, X86_Inst* restrict ou
 }
 
 static void dump(int start, int depth) {
-    printf(" %s\n\n", descs[0].name);
+    printf(" root\n\n");
 
     for (int i = 0; i < 256; i++) if (dfa[start+i] != 0) {
         for (int j = 0; j < depth; j++) printf("  ");
@@ -168,6 +226,127 @@ static void dump(int start, int depth) {
     }
 }
 
+X86_ISA x86_get_isa(void) {
+    return X86_TABLE_ISA;
+}
+
+// bump whenever x86_disasm starts producing something different for the
+// same tables, decode caches get invalidated by it.
+#define X86__DECODER_VERSION 1
+
+uint64_t x86_get_decoder_hash(void) {
+    // tablegen already digested every table (X86_TABLE_HASH), this only mixes
+    // in what the decoder adds on top. all constants so it folds away.
+    uint64_t parts[] = { X86__DECODER_VERSION, X86_INST_COUNT, sizeof(X86_Inst) };
+
+    uint64_t hash = X86_TABLE_HASH;
+    for (size_t i = 0; i < sizeof(parts) / sizeof(parts[0]); i++) {
+        hash = (hash ^ parts[i]) * 0x9E3779B97F4A7C15ull;
+        hash ^= hash >> 32;
+    }
+    return hash | 1;
+}
+
+inline static const InstructionDesc* x86__get_desc(X86_InstType type) {
+    // types past descs[] aren't in this ISA subset, they get the all zeros
+    // X86_INST_NONE entry
+    if ((size_t)type >= sizeof(descs) / sizeof(descs[0])) type = X86_INST_NONE;
+    return &descs[type];
+}
+
+X86_BranchClass x86_get_branch_class(X86_InstType type) {
+    return x86__get_desc(type)->branch;
+}
+
+void x86_count_prefixes(X86_Buffer in, const X86_Inst* inst, uint64_t counts[X86_PREFIX_COUNT]) {
+    if (inst->type == X86_INST_ENDBR64) {
+        counts[X86_PREFIX_MANDATORY]++;
+        return;
+    }
+
+    // same loop as x86_disasm, F2 & F3 only ever decode through the opcode
+    // rows (there's no rep movs & co) so they're always mandatory.
+    bool opcode_66 = x86__get_desc(inst->type)->opcode_66;
+    for (size_t i = 0; i < in.length && i < inst->length; i++) {
+        uint8_t p = in.data[i];
+        if ((p & 0xF0) == 0x40) counts[X86_PREFIX_REX]++;
+        else if (p == 0xF0) counts[X86_PREFIX_LOCK]++;
+        else if (p == 0x66) counts[opcode_66 ? X86_PREFIX_MANDATORY : X86_PREFIX_OPSIZE]++;
+        else if (p == 0x67) counts[X86_PREFIX_ADDRSIZE]++;
+        else if (p == 0xF3 || p == 0xF2) counts[X86_PREFIX_MANDATORY]++;
+        else if (p == 0x2E || p == 0x36 || p == 0x3E || p == 0x26 || p == 0x64 || p == 0x65) counts[X86_PREFIX_SEGMENT]++;
+        else break;
+    }
+}
+
+X86_Flags x86_get_flags_read(X86_InstType type) {
+    return x86__get_desc(type)->flags_read;
+}
+
+X86_Flags x86_get_flags_written(X86_InstType type) {
+    return x86__get_desc(type)->flags_written;
+}
+
+uint32_t x86_get_implicit_reads(X86_InstType type) {
+    return x86__get_desc(type)->implicit_read;
+}
+
+uint32_t x86_get_implicit_writes(X86_InstType type) {
+    return x86__get_desc(type)->implicit_write;
+}
+
+uint32_t x86_get_operand_access(X86_InstType type) {
+    return x86__get_desc(type)->operand_access ^ X86__DEFAULT_ACCESS;
+}
+
+// 1 << reg or 0 for X86_GPR_NONE, high byte registers fold into rax-rbx
+inline static uint32_t x86__reg_bit(int reg) {
+    return (uint32_t)(reg >= 0) << (reg & 15);
+}
+
+X86_RegUsage x86_get_reg_usage(const X86_Inst* inst) {
+    const InstructionDesc* desc = x86__get_desc(inst->type);
+    uint32_t access = desc->operand_access ^ X86__DEFAULT_ACCESS;
+
+    // byte & word writes merge into the old value so they read it too,
+    // dword writes zero the top half.
+    uint32_t partial = -(uint32_t)(inst->data_type == X86_TYPE_BYTE || inst->data_type == X86_TYPE_WORD);
+
+    // which slots are xmm, MOVQ mixes the two (the GPR is on the r/m side)
+    uint32_t xmm_slots = -(uint32_t)((inst->flags & X86_INSTR_XMMREG) != 0) & 0xF;
+    if (inst->type == X86_INST_MOVQ) xmm_slots |= 0xF & ~(1u << ((inst->flags & X86_INSTR_DIRECTION) ? 1 : 0));
+
+    X86_RegUsage usage = { desc->implicit_read, desc->implicit_write, 0, 0 };
+    for (int i = 0; i < 4; i++) {
+        uint32_t bit = x86__reg_bit(inst->regs[i]);
+        uint32_t is_xmm = -((xmm_slots >> i) & 1);
+        uint32_t read = -((access >> (i * 2)) & 1);
+        uint32_t write = -((access >> (i * 2 + 1)) & 1);
+
+        read |= write & partial & ~is_xmm;
+        usage.gpr_read  |= bit & read & ~is_xmm;
+        usage.gpr_write |= bit & write & ~is_xmm;
+        usage.xmm_read  |= bit & read & is_xmm;
+        usage.xmm_write |= bit & write & is_xmm;
+    }
+
+    // address registers are always read, even by lea
+    uint32_t memop = -(uint32_t)((inst->flags & (X86_INSTR_USE_MEMOP | X86_INSTR_USE_RIPMEM)) == X86_INSTR_USE_MEMOP);
+    usage.gpr_read |= (x86__reg_bit(inst->base) | x86__reg_bit(inst->index)) & memop;
+
+    // zeroing idioms don't depend on the old value
+    if (inst->regs[0] == inst->regs[1] && inst->regs[0] >= 0 && !(inst->flags & X86_INSTR_USE_MEMOP)) {
+        uint32_t bit = x86__reg_bit(inst->regs[0]);
+        switch (inst->type) {
+            case X86_INST_XOR: case X86_INST_SUB: usage.gpr_read &= ~bit; break;
+            case X86_INST_PXOR: case X86_INST_XORPS: case X86_INST_XORPD: usage.xmm_read &= ~bit; break;
+            default: break;
+        }
+    }
+
+    return usage;
+}
+
 void x86_print_dfa_DEBUG(void) {
     dump(DFA_ENTRYPOINT, 0);
 }
@@ -175,14 +354,24 @@ void x86_print_dfa_DEBUG(void) {
 X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
     memset(out, 0, sizeof(*out));
     memset(out->regs, 0xFF, sizeof(out->regs));
+    X86__COUNT(calls);
 
     if (in.length >= 4 && memcmp(in.data, (uint8_t[]) { 0xF3, 0x0F, 0x1E, 0xFA }, 4) == 0) {
         // endbr64 hack
         out->type = X86_INST_ENDBR64;
         out->length = 4;
+        X86__COUNT(decoded);
         return X86_RESULT_SUCCESS;
     }
 
+    // the readers below assume the whole instruction is there, near the end
+    // of the buffer check that first.
+    if (in.length < 16 && x86_length(in) == 0) {
+        uint8_t padded[16] = { 0 };
+        memcpy(padded, in.data, in.length);
+        return x86_length((X86_Buffer){ padded, sizeof(padded) }) ? X86_RESULT_OUT_OF_SPACE : X86_RESULT_UNKNOWN_OPCODE;
+    }
+
     const uint8_t* start = in.data;
     uint8_t rex = 0;     // 0x4X
     bool addr32 = false; // 0x67
@@ -210,6 +399,10 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
         else break;
     }
 
+    #if DISX86_INSTRUMENT
+    uint64_t steps_before = x86__counters.dfa_steps;
+    #endif
+
     // DFAs amirite
     X86_ResultCode code = X86_RESULT_SUCCESS;
 
@@ -217,19 +410,21 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
     int val = DFA_ENTRYPOINT;
     if (addr16)  {
         val = dfa[val + 0x66];
+        X86__COUNT(dfa_steps);
 
         // if there's no match then we'll just neglect the 66h prefix
         if (dfa[val + op] == 0) val = DFA_ENTRYPOINT;
     }
-    if (rex & 8) val = dfa[val + 0x48];
-    if (rep)     val = dfa[val + 0xF3];
-    if (repne)   val = dfa[val + 0xF2];
+    if (rex & 8) val = dfa[val + 0x48], X86__COUNT(dfa_steps);
+    if (rep)     val = dfa[val + 0xF3], X86__COUNT(dfa_steps);
+    if (repne)   val = dfa[val + 0xF2], X86__COUNT(dfa_steps);
 
     // +r means that the bottom 8bits of the opcode encode a register
     bool is_plus_r = false;
     uint8_t opcode_byte = op;
     while (true) {
         val = dfa[val + op];
+        X86__COUNT(dfa_steps);
         if (val & 0x40000000) is_plus_r = true;
 
         // error state
@@ -242,6 +437,7 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
             break;
         } else if (val & 0x10000000) {
             // we need to do some RX field digging
+            X86__COUNT(rx_digs);
             uint8_t mod_rx_rm = x86__read_uint8(&in);
             x86__prev(&in, 1);
 
@@ -258,6 +454,7 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
 
     X86_EncodingMode encoding_mode = (val >> 16);
     const InstructionDesc* desc = &descs[val & 0xFFFF];
+    X86__COUNT(modes[encoding_mode]);
 
     out->type = (val & 0xFFFF);
     if (desc->has_cc) {
@@ -347,6 +544,7 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
 
         case X86_ENCODE_rm64_reg_cl: {
             uses_implicit_rcx = true;
+            uses_modrxrm = true;
             mod_rx_rm = x86__read_uint8(&in);
             single_operand = true;
             break;
@@ -401,6 +599,7 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
             break;
         }
 
+        #if X86_TABLE_HAS_XMM
         case X86_ENCODE_mem_xmmreg:
         case X86_ENCODE_xmmreg_mem:
         case X86_ENCODE_xmmrm_xmmreg:
@@ -420,6 +619,15 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
             break;
         }
 
+        case X86_ENCODE_xmmreg_imm: {
+            uses_modrxrm = true;
+            uses_xmm = true;
+            mod_rx_rm = x86__read_uint8(&in);
+            uses_imm = IMM8;
+            break;
+        }
+        #endif
+
         case X86_ENCODE_reg_al_imm: {
             uses_imm = IMM8;
             uses_implicit_rax = true;
@@ -468,15 +676,11 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
             break;
         }
 
-        case X86_ENCODE_xmmreg_imm: {
-            uses_modrxrm = true;
-            uses_xmm = true;
-            mod_rx_rm = x86__read_uint8(&in);
-            uses_imm = IMM8;
-            break;
+        // modes the tables have but we don't decode yet
+        default: {
+            code = X86_RESULT_UNKNOWN_OPCODE;
+            goto done;
         }
-
-        default: assert(0);
     }
 
     switch (encoding_mode) {
@@ -568,6 +772,7 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
         case X86_ENCODE_reg64_mem:
         case X86_ENCODE_rm64_reg64:
         case X86_ENCODE_rm64_xmmreg:
+        case X86_ENCODE_rm64_reg_cl:
         case X86_ENCODE_reg_rax_imm:
         case X86_ENCODE_rm64:
         case X86_ENCODE_reg64:
@@ -580,6 +785,7 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
         out->data_type = X86_TYPE_QWORD;
         break;
 
+        #if X86_TABLE_HAS_XMM
         case X86_ENCODE_mem_xmmreg:
         case X86_ENCODE_xmmreg_mem:
         case X86_ENCODE_xmmrm_xmmreg:
@@ -598,8 +804,13 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
             out->data_type = X86_TYPE_SSE_SS;
             break;
         }
+        #endif
 
-        default: assert(0);
+        // modes the tables have but we don't decode yet
+        default: {
+            code = X86_RESULT_UNKNOWN_OPCODE;
+            goto done;
+        }
     }
 
     if (uses_xmm) {
@@ -633,7 +844,7 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
         }
 
         if (single_operand) out->regs[1] = X86_GPR_NONE;
-        else if (uses_implicit_rax) out->regs[1] = X86_RCX;
+        if (uses_implicit_rcx) out->regs[1] = X86_RCX;
     } else if (is_plus_r) {
         out->regs[0] = (rex & 1 ? 8 : 0) | (opcode_byte & 0x7);
 
@@ -678,9 +889,229 @@ X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out) {
 
     done:
     out->length = in.data - start;
+
+    #if DISX86_INSTRUMENT
+    x86__count_steps(x86__counters.dfa_steps - steps_before);
+    if (code == X86_RESULT_SUCCESS) {
+        X86__COUNT(decoded);
+        x86_count_prefixes((X86_Buffer){ start, out->length }, out, x86__counters.prefixes);
+    }
+    #endif
+
     return code;
 }
 
+////////////////////////////////
+// Length-only decoding
+////////////////////////////////
+enum {
+    X86__LEN_VALID   = 0x80,
+    X86__LEN_MODRM   = 0x40,
+    // +r forms put the register in the opcode instead of a ModRM
+    X86__LEN_NO_PLUS_R = 0x20,
+    X86__LEN_IMM_MASK  = 0x0F,
+};
+
+// mirrors the first encoding switch in x86_disasm, the low bits are the
+// size of the immediate.
+static const uint8_t x86__mode_lengths[] = {
+    [X86_ENCODE_void]               = X86__LEN_VALID,
+    [X86_ENCODE_imm_short]          = X86__LEN_VALID | 1,
+    [X86_ENCODE_imm32_near]         = X86__LEN_VALID | 4,
+    [X86_ENCODE_imm64_near]         = X86__LEN_VALID | 4,
+    [X86_ENCODE_reg8_imm]           = X86__LEN_VALID | X86__LEN_MODRM | X86__LEN_NO_PLUS_R | 1,
+    [X86_ENCODE_rm8_imm]            = X86__LEN_VALID | X86__LEN_MODRM | 1,
+    [X86_ENCODE_rm8_imm8]           = X86__LEN_VALID | X86__LEN_MODRM | 1,
+    [X86_ENCODE_mem_imm8]           = X86__LEN_VALID | X86__LEN_MODRM | 1,
+    [X86_ENCODE_reg8]               = X86__LEN_VALID | X86__LEN_MODRM | X86__LEN_NO_PLUS_R,
+    [X86_ENCODE_reg16]              = X86__LEN_VALID | X86__LEN_MODRM | X86__LEN_NO_PLUS_R,
+    [X86_ENCODE_reg32]              = X86__LEN_VALID | X86__LEN_MODRM | X86__LEN_NO_PLUS_R,
+    [X86_ENCODE_reg64]              = X86__LEN_VALID | X86__LEN_MODRM | X86__LEN_NO_PLUS_R,
+    [X86_ENCODE_rm8]                = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm16]               = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm32]               = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm64]               = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm8_unity]          = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm16_unity]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm32_unity]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm64_unity]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm64_reg_cl]        = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm8_reg8]           = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm16_reg16]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm32_reg32]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm64_reg64]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg32_reg32]        = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg64_reg64]        = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm64_xmmreg]        = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg8_mem]           = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg16_mem]          = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg32_mem]          = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg64_mem]          = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg8_rm8]           = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg16_rm16]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg32_rm32]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg64_rm64]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_rm32_imm8]          = X86__LEN_VALID | X86__LEN_MODRM | 1,
+    [X86_ENCODE_rm32_imm32]         = X86__LEN_VALID | X86__LEN_MODRM | 4,
+    [X86_ENCODE_rm64_imm8]          = X86__LEN_VALID | X86__LEN_MODRM | 1,
+    [X86_ENCODE_rm64_imm32]         = X86__LEN_VALID | X86__LEN_MODRM | 4,
+    [X86_ENCODE_mem_imm32]          = X86__LEN_VALID | X86__LEN_MODRM | 4,
+    [X86_ENCODE_reg_al_imm]         = X86__LEN_VALID | 1,
+    [X86_ENCODE_reg_eax_imm]        = X86__LEN_VALID | 4,
+    [X86_ENCODE_reg_rax_imm]        = X86__LEN_VALID | 4,
+    [X86_ENCODE_reg_eax_sbytedword] = X86__LEN_VALID | 1,
+    [X86_ENCODE_reg_rax_sbytedword] = X86__LEN_VALID | 1,
+    [X86_ENCODE_reg32_imm]          = X86__LEN_VALID | 4,
+    [X86_ENCODE_rm64_imm]           = X86__LEN_VALID | X86__LEN_MODRM | 4,
+    [X86_ENCODE_reg64_imm]          = X86__LEN_VALID | 8,
+    [X86_ENCODE_reg32_rm8]          = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg32_rm16]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg64_rm8]          = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg64_rm16]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_reg64_rm32]         = X86__LEN_VALID | X86__LEN_MODRM,
+
+    #if X86_TABLE_HAS_XMM
+    [X86_ENCODE_mem_xmmreg]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_xmmreg_mem]         = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_xmmrm_xmmreg]       = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_xmmreg_xmmrm]       = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_xmmreg_xmmrm128]    = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_xmmrm128_xmmreg]    = X86__LEN_VALID | X86__LEN_MODRM,
+    [X86_ENCODE_xmmreg_imm]         = X86__LEN_VALID | X86__LEN_MODRM | 1,
+    #endif
+};
+
+uint8_t x86_modrm_extra(uint8_t modrm) {
+    uint8_t mod, rx, rm;
+    DECODE_MODRXRM(mod, rx, rm, modrm);
+    (void)rx;
+
+    if (mod == MOD_DIRECT) return 0;
+
+    uint8_t extra = (rm == X86_RSP ? 1 : 0);
+    if (mod == MOD_INDIRECT_DISP8) extra += 1;
+    else if (mod == MOD_INDIRECT_DISP32) extra += 4;
+    else if (rm == X86_RBP) extra += 4; // RIP-relative
+    return extra;
+}
+
+// the type comes out of the same DFA walk, it's only written on success
+inline static size_t x86__length_walk(X86_Buffer in, size_t prefix_count, const uint8_t* modrm_extra, X86_InstType* out_type) {
+    if (in.length >= 4 && memcmp(in.data, (uint8_t[]) { 0xF3, 0x0F, 0x1E, 0xFA }, 4) == 0) {
+        // endbr64 hack, same as x86_disasm
+        *out_type = X86_INST_ENDBR64;
+        return 4;
+    }
+
+    if (prefix_count >= in.length) return 0;
+
+    // same prefix rules as x86_disasm, just without the loop to find them
+    uint8_t rex = 0;
+    bool addr16 = false, rep = false, repne = false;
+    for (size_t i = 0; i < prefix_count; i++) {
+        uint8_t p = in.data[i];
+
+        if ((p & 0xF0) == 0x40) rex = p;
+        else if (p == 0x66) addr16 = true;
+        else if (p == 0xF3) rep = true;
+        else if (p == 0xF2) repne = true;
+    }
+
+    size_t pos = prefix_count;
+    uint8_t op = in.data[pos++];
+
+    int val = DFA_ENTRYPOINT;
+    if (addr16)  {
+        val = dfa[val + 0x66];
+        if (dfa[val + op] == 0) val = DFA_ENTRYPOINT;
+    }
+    if (rex & 8) val = dfa[val + 0x48];
+    if (rep)     val = dfa[val + 0xF3];
+    if (repne)   val = dfa[val + 0xF2];
+
+    bool is_plus_r = false;
+    uint8_t opcode_byte = op;
+    while (true) {
+        val = dfa[val + op];
+        if (val & 0x40000000) is_plus_r = true;
+
+        if (val == 0) {
+            return 0;
+        } else if (val & 0x20000000) {
+            val &= ~0xF0000000;
+            break;
+        } else if (val & 0x10000000) {
+            // peek the RX field
+            if (pos >= in.length) return 0;
+
+            val &= ~0xF0000000;
+            op = (in.data[pos] >> 3) & 7;
+        } else {
+            if (pos >= in.length) return 0;
+            opcode_byte = op = in.data[pos++];
+        }
+    }
+
+    X86_EncodingMode encoding_mode = (val >> 16);
+    if (encoding_mode >= sizeof(x86__mode_lengths)) return 0;
+
+    uint8_t info = x86__mode_lengths[encoding_mode];
+    if ((info & X86__LEN_VALID) == 0) return 0;
+
+    if ((info & X86__LEN_MODRM) && !((info & X86__LEN_NO_PLUS_R) && is_plus_r)) {
+        if (pos >= in.length) return 0;
+
+        uint8_t modrm = in.data[pos];
+        size_t extra = modrm_extra ? modrm_extra[pos] : x86_modrm_extra(modrm);
+
+        // SIB with no base and mod=00 has a disp32 (see x86_parse_memory_op)
+        if ((modrm & 0xC7) == 0x04) {
+            if (pos + 1 >= in.length) return 0;
+            if ((in.data[pos + 1] & 7) == X86_RBP) extra += 4;
+        }
+
+        pos += 1 + extra;
+    }
+
+    pos += info & X86__LEN_IMM_MASK;
+    if (pos > in.length) return 0;
+
+    // same as x86_disasm, cc families are 16 types in a row
+    *out_type = val & 0xFFFF;
+    if (descs[val & 0xFFFF].has_cc) *out_type += opcode_byte & 0xF;
+    return pos;
+}
+
+size_t x86_length_classified(X86_Buffer in, size_t prefix_count, const uint8_t* modrm_extra) {
+    X86_InstType type;
+    return x86__length_walk(in, prefix_count, modrm_extra, &type);
+}
+
+inline static size_t x86__prefix_count(X86_Buffer in) {
+    size_t prefix_count = 0;
+    while (prefix_count < in.length) {
+        uint8_t p = in.data[prefix_count];
+
+        bool is_prefix = (p & 0xF0) == 0x40 ||
+            p == 0xF0 || p == 0x66 || p == 0x67 || p == 0xF3 || p == 0xF2 ||
+            p == 0x2E || p == 0x36 || p == 0x3E || p == 0x26 || p == 0x64 || p == 0x65;
+
+        if (!is_prefix) break;
+        prefix_count++;
+    }
+
+    return prefix_count;
+}
+
+size_t x86_length(X86_Buffer in) {
+    return x86_length_classified(in, x86__prefix_count(in), NULL);
+}
+
+size_t x86_length_and_type(X86_Buffer in, X86_InstType* out_type) {
+    *out_type = X86_INST_NONE;
+    return x86__length_walk(in, x86__prefix_count(in), NULL, out_type);
+}
+
 X86_Buffer x86_advance(X86_Buffer in, size_t amount) {
     assert(in.length >= amount);
 
@@ -690,6 +1121,754 @@ X86_Buffer x86_advance(X86_Buffer in, size_t amount) {
     return in;
 }
 
+////////////////////////////////
+// Encoding
+////////////////////////////////
+enum {
+    X86__FORM_DIRECTION = 0x01,
+    X86__FORM_SINGLE    = 0x02, // the ModRM reg field isn't an operand
+    X86__FORM_XMM       = 0x04,
+    X86__FORM_RAX       = 0x08, // implicit rax, no ModRM
+    X86__FORM_RCX       = 0x10, // implicit cl as regs[1]
+    X86__FORM_UNITY     = 0x20, // imm is always 1 and not stored
+    X86__FORM_SSE_TYPE  = 0x40, // data type comes from the 66/F3/F2 prefix
+};
+
+typedef struct {
+    uint8_t flags;
+    uint8_t data_type, data_type2;
+} X86__Form;
+
+// mirrors the switches in x86_disasm, what an encoding mode decodes into
+// next to x86__mode_lengths (which has the ModRM and immediate sizes).
+static const X86__Form x86__mode_forms[] = {
+    [X86_ENCODE_void]               = { 0, X86_TYPE_NONE },
+    [X86_ENCODE_imm_short]          = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_imm32_near]         = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_imm64_near]         = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_reg8_imm]           = { 0, X86_TYPE_BYTE },
+    [X86_ENCODE_rm8_imm]            = { 0, X86_TYPE_BYTE },
+    [X86_ENCODE_rm8_imm8]           = { 0, X86_TYPE_BYTE },
+    [X86_ENCODE_mem_imm8]           = { 0, X86_TYPE_BYTE },
+    [X86_ENCODE_reg8]               = { X86__FORM_SINGLE, X86_TYPE_BYTE },
+    [X86_ENCODE_reg16]              = { X86__FORM_SINGLE, X86_TYPE_WORD },
+    [X86_ENCODE_reg32]              = { X86__FORM_SINGLE, X86_TYPE_DWORD },
+    [X86_ENCODE_reg64]              = { X86__FORM_SINGLE, X86_TYPE_QWORD },
+    [X86_ENCODE_rm8]                = { X86__FORM_SINGLE, X86_TYPE_BYTE },
+    [X86_ENCODE_rm16]               = { X86__FORM_SINGLE, X86_TYPE_WORD },
+    [X86_ENCODE_rm32]               = { X86__FORM_SINGLE, X86_TYPE_DWORD },
+    [X86_ENCODE_rm64]               = { X86__FORM_SINGLE, X86_TYPE_QWORD },
+    [X86_ENCODE_rm8_unity]          = { X86__FORM_SINGLE | X86__FORM_UNITY, X86_TYPE_BYTE },
+    [X86_ENCODE_rm16_unity]         = { X86__FORM_SINGLE | X86__FORM_UNITY, X86_TYPE_WORD },
+    [X86_ENCODE_rm32_unity]         = { X86__FORM_SINGLE | X86__FORM_UNITY, X86_TYPE_DWORD },
+    [X86_ENCODE_rm64_unity]         = { X86__FORM_SINGLE | X86__FORM_UNITY, X86_TYPE_QWORD },
+    [X86_ENCODE_rm64_reg_cl]        = { X86__FORM_SINGLE | X86__FORM_RCX, X86_TYPE_QWORD },
+    [X86_ENCODE_rm8_reg8]           = { 0, X86_TYPE_BYTE },
+    [X86_ENCODE_rm16_reg16]         = { 0, X86_TYPE_WORD },
+    [X86_ENCODE_rm32_reg32]         = { 0, X86_TYPE_DWORD },
+    [X86_ENCODE_rm64_reg64]         = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_reg32_reg32]        = { 0, X86_TYPE_DWORD },
+    [X86_ENCODE_reg64_reg64]        = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_rm64_xmmreg]        = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_reg8_mem]           = { X86__FORM_DIRECTION, X86_TYPE_BYTE },
+    [X86_ENCODE_reg16_mem]          = { X86__FORM_DIRECTION, X86_TYPE_WORD },
+    [X86_ENCODE_reg32_mem]          = { X86__FORM_DIRECTION, X86_TYPE_DWORD },
+    [X86_ENCODE_reg64_mem]          = { X86__FORM_DIRECTION, X86_TYPE_QWORD },
+    [X86_ENCODE_reg8_rm8]           = { X86__FORM_DIRECTION, X86_TYPE_BYTE },
+    [X86_ENCODE_reg16_rm16]         = { X86__FORM_DIRECTION, X86_TYPE_WORD },
+    [X86_ENCODE_reg32_rm32]         = { X86__FORM_DIRECTION, X86_TYPE_DWORD },
+    [X86_ENCODE_reg64_rm64]         = { X86__FORM_DIRECTION, X86_TYPE_QWORD },
+    [X86_ENCODE_rm32_imm8]          = { 0, X86_TYPE_DWORD },
+    [X86_ENCODE_rm32_imm32]         = { 0, X86_TYPE_DWORD },
+    [X86_ENCODE_rm64_imm8]          = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_rm64_imm32]         = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_mem_imm32]          = { 0, X86_TYPE_DWORD },
+    [X86_ENCODE_reg_al_imm]         = { X86__FORM_RAX, X86_TYPE_BYTE },
+    [X86_ENCODE_reg_eax_imm]        = { X86__FORM_RAX, X86_TYPE_DWORD },
+    [X86_ENCODE_reg_rax_imm]        = { X86__FORM_RAX, X86_TYPE_QWORD },
+    [X86_ENCODE_reg_eax_sbytedword] = { X86__FORM_RAX, X86_TYPE_QWORD },
+    [X86_ENCODE_reg_rax_sbytedword] = { X86__FORM_RAX, X86_TYPE_QWORD },
+    [X86_ENCODE_reg32_imm]          = { 0, X86_TYPE_DWORD },
+    [X86_ENCODE_rm64_imm]           = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_reg64_imm]          = { 0, X86_TYPE_QWORD },
+    [X86_ENCODE_reg32_rm8]          = { X86__FORM_DIRECTION, X86_TYPE_DWORD, X86_TYPE_BYTE },
+    [X86_ENCODE_reg32_rm16]         = { X86__FORM_DIRECTION, X86_TYPE_DWORD, X86_TYPE_WORD },
+    [X86_ENCODE_reg64_rm8]          = { X86__FORM_DIRECTION, X86_TYPE_QWORD, X86_TYPE_BYTE },
+    [X86_ENCODE_reg64_rm16]         = { X86__FORM_DIRECTION, X86_TYPE_QWORD, X86_TYPE_WORD },
+    [X86_ENCODE_reg64_rm32]         = { X86__FORM_DIRECTION, X86_TYPE_QWORD, X86_TYPE_DWORD },
+
+    #if X86_TABLE_HAS_XMM
+    [X86_ENCODE_mem_xmmreg]         = { X86__FORM_DIRECTION | X86__FORM_XMM | X86__FORM_SSE_TYPE },
+    [X86_ENCODE_xmmreg_mem]         = { X86__FORM_DIRECTION | X86__FORM_XMM | X86__FORM_SSE_TYPE },
+    [X86_ENCODE_xmmrm_xmmreg]       = { X86__FORM_DIRECTION | X86__FORM_XMM | X86__FORM_SSE_TYPE },
+    [X86_ENCODE_xmmreg_xmmrm]       = { X86__FORM_DIRECTION | X86__FORM_XMM | X86__FORM_SSE_TYPE },
+    [X86_ENCODE_xmmreg_xmmrm128]    = { X86__FORM_DIRECTION | X86__FORM_XMM | X86__FORM_SSE_TYPE },
+    [X86_ENCODE_xmmrm128_xmmreg]    = { X86__FORM_XMM | X86__FORM_SSE_TYPE },
+    [X86_ENCODE_xmmreg_imm]         = { X86__FORM_XMM, X86_TYPE_SSE_SS },
+    #endif
+};
+
+inline static void x86__write_uint32(uint8_t* out, uint32_t x) {
+    out[0] = x, out[1] = x >> 8, out[2] = x >> 16, out[3] = x >> 24;
+}
+
+typedef struct {
+    uint8_t rex;  // W R X B, the 0x40 gets added at the end
+    bool needs_rex; // spl, bpl, sil & dil only exist with one
+    bool no_rex;    // ah, ch, dh & bh only exist without one
+} X86__RexState;
+
+// 4bit register number for a ModRM, SIB or +r field, -1 if it can't go there
+static int x86__reg_field(X86__RexState* rs, int reg, bool is_byte) {
+    if (reg < 0) return -1;
+
+    if (is_byte && reg >= 16) {
+        // x86_disasm has ah-bh past 16, which of the 4 is the low bits
+        if (reg >= 24) return -1;
+
+        rs->no_rex = true;
+        return 4 + (reg & 3);
+    }
+
+    if (reg >= 16) return -1;
+    if (is_byte && reg >= 4 && reg < 8) rs->needs_rex = true;
+    return reg;
+}
+
+// ModRM, SIB & displacement for the memory operand with the smallest
+// displacement that works, returns the number of bytes or -1.
+static int x86__encode_memory(uint8_t* out, X86__RexState* rs, int rx, const X86_Inst* inst) {
+    uint8_t* p = out;
+    if (inst->flags & X86_INSTR_USE_RIPMEM) {
+        *p++ = (rx & 7) << 3 | X86_RBP;
+        x86__write_uint32(p, inst->disp);
+        return 5;
+    }
+
+    int base = inst->base, index = inst->index;
+    if (base >= 16 || index >= 16) return -1;
+
+    // an index field of 100 is no index even with REX.X, there's no [r12*2]
+    if (index >= 0 && (index & 7) == X86_RSP) return -1;
+
+    int mod = MOD_INDIRECT_DISP32;
+    if (base >= 0 && inst->disp == 0 && (base & 7) != X86_RBP) mod = MOD_INDIRECT;
+    else if (base >= 0 && inst->disp >= INT8_MIN && inst->disp <= INT8_MAX) mod = MOD_INDIRECT_DISP8;
+
+    if (base >= 0 && index < 0 && (base & 7) != X86_RSP) {
+        *p++ = mod << 6 | (rx & 7) << 3 | (base & 7);
+        rs->rex |= base >> 3;
+    } else {
+        // no base is base=101 with mod=00, that's always a disp32
+        if (base < 0) mod = MOD_INDIRECT;
+
+        int scale = index >= 0 ? inst->scale : X86_SCALE_X1;
+        *p++ = mod << 6 | (rx & 7) << 3 | X86_RSP;
+        *p++ = scale << 6 | (index >= 0 ? index & 7 : X86_RSP) << 3 | (base >= 0 ? base & 7 : X86_RBP);
+        if (index >= 0) rs->rex |= (index >> 3) << 1;
+        if (base >= 0) rs->rex |= base >> 3;
+    }
+
+    if (mod == MOD_INDIRECT_DISP8) {
+        *p++ = inst->disp;
+    } else if (mod == MOD_INDIRECT_DISP32 || base < 0) {
+        x86__write_uint32(p, inst->disp);
+        p += 4;
+    }
+    return p - out;
+}
+
+// what x86_disasm fills in for a reverse index entry before it looks at the
+// operands, false if it can't decode into anything.
+typedef struct {
+    X86__Form form;
+    X86_DataType data_type;
+    uint8_t flags; // X86_InstrFlags without the memory operand & lock
+
+    size_t imm_size;
+    bool uses_modrm, has_imm, direction;
+} X86__Shape;
+
+static bool x86__encoding_shape(const X86__Encoding* e, X86__Shape* out) {
+    if (e->mode >= sizeof(x86__mode_lengths) || (x86__mode_lengths[e->mode] & X86__LEN_VALID) == 0) return false;
+
+    uint8_t info = x86__mode_lengths[e->mode];
+    X86__Form form = x86__mode_forms[e->mode];
+
+    X86_DataType dt = form.data_type;
+    if (form.flags & X86__FORM_SSE_TYPE) {
+        if (e->prefixes & X86__ENC_F3) dt = X86_TYPE_SSE_SS;
+        else if (e->prefixes & X86__ENC_F2) dt = X86_TYPE_SSE_SD;
+        else if (e->prefixes & X86__ENC_66) dt = X86_TYPE_SSE_PD;
+        else dt = X86_TYPE_SSE_PS;
+    }
+
+    *out = (X86__Shape){ .form = form, .data_type = dt };
+    out->uses_modrm = (info & X86__LEN_MODRM) && !((info & X86__LEN_NO_PLUS_R) && e->plus_r);
+    out->imm_size = info & X86__LEN_IMM_MASK;
+    out->has_imm = out->imm_size != 0 || (form.flags & X86__FORM_UNITY);
+    out->direction = form.flags & X86__FORM_DIRECTION;
+
+    // the fixed reg field would decode as a register
+    if (out->uses_modrm && e->rx >= 0 && !out->has_imm && !(form.flags & X86__FORM_SINGLE)) return false;
+
+    if (form.data_type2) out->flags |= X86_INSTR_TWO_DATA_TYPES;
+    if (form.flags & X86__FORM_XMM) out->flags |= X86_INSTR_XMMREG;
+    if (out->direction) out->flags |= X86_INSTR_DIRECTION;
+    if (out->imm_size == 8) out->flags |= X86_INSTR_ABSOLUTE;
+    else if (out->has_imm) out->flags |= X86_INSTR_IMMEDIATE;
+    return true;
+}
+
+// builds the bytes for one reverse index entry if the instruction fits its
+// form (what x86_disasm would give back is exactly inst), returns 0 if not.
+static size_t x86__encode_with(const X86__Encoding* e, const X86_Inst* inst, uint8_t* out) {
+    X86__Shape shape;
+    if (!x86__encoding_shape(e, &shape) || inst->data_type != shape.data_type) return 0;
+
+    X86__Form form = shape.form;
+    X86_DataType dt = shape.data_type;
+    size_t imm_size = shape.imm_size;
+    bool uses_modrm = shape.uses_modrm, has_imm = shape.has_imm, direction = shape.direction;
+
+    // the flags have to come out the same too
+    uint8_t flags = inst->flags & (X86_INSTR_USE_MEMOP | X86_INSTR_USE_RIPMEM);
+    if (flags && !uses_modrm) return 0;
+    if (form.data_type2 && inst->data_type2 != form.data_type2) return 0;
+
+    flags |= shape.flags;
+    if ((inst->flags & ~X86_INSTR_LOCK) != flags) return 0;
+
+    if (form.flags & X86__FORM_UNITY) {
+        if (inst->imm != 1) return 0;
+    } else if (imm_size == 1 && (inst->imm < INT8_MIN || inst->imm > INT8_MAX)) {
+        return 0;
+    }
+
+    // which registers land in which fields, everything else has to be
+    // X86_GPR_NONE like x86_disasm leaves it.
+    bool is_byte = dt == X86_TYPE_BYTE;
+    X86__RexState rs = { .rex = e->prefixes & X86__ENC_REXW ? 8 : 0 };
+    int8_t regs[4] = { X86_GPR_NONE, X86_GPR_NONE, X86_GPR_NONE, X86_GPR_NONE };
+    int rx = 0, rm = -1, plus_r = 0;
+    if (uses_modrm) {
+        if ((flags & X86_INSTR_USE_MEMOP) == 0) {
+            rm = x86__reg_field(&rs, inst->regs[direction], is_byte);
+            if (rm < 0) return 0;
+
+            regs[direction] = inst->regs[direction];
+            rs.rex |= rm >> 3;
+        }
+
+        if (has_imm || (form.flags & X86__FORM_SINGLE)) {
+            rx = e->rx >= 0 ? e->rx : 0;
+        } else {
+            rx = x86__reg_field(&rs, inst->regs[!direction], is_byte);
+            if (rx < 0) return 0;
+
+            regs[!direction] = inst->regs[!direction];
+            rs.rex |= (rx >> 3) << 2;
+        }
+
+        if (form.flags & X86__FORM_RCX) regs[1] = X86_RCX;
+    } else if (e->plus_r) {
+        plus_r = x86__reg_field(&rs, inst->regs[0], is_byte);
+        if (plus_r < 0) return 0;
+
+        regs[0] = inst->regs[0];
+        rs.rex |= plus_r >> 3;
+    } else if (form.flags & X86__FORM_RAX) {
+        regs[0] = X86_RAX;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        if (inst->regs[i] != regs[i]) return 0;
+    }
+
+    uint8_t modrm[16];
+    int modrm_length = 0;
+    if (uses_modrm) {
+        if (rm >= 0) {
+            modrm[0] = MOD_DIRECT << 6 | (rx & 7) << 3 | (rm & 7);
+            modrm_length = 1;
+        } else {
+            modrm_length = x86__encode_memory(modrm, &rs, rx, inst);
+            if (modrm_length < 0) return 0;
+        }
+    }
+
+    if (rs.rex) rs.needs_rex = true;
+    if (rs.needs_rex && rs.no_rex) return 0;
+
+    // legacy prefixes, REX has to be right before the opcode
+    static const uint8_t segments[] = {
+        [X86_SEGMENT_ES] = 0x26, [X86_SEGMENT_CS] = 0x2E, [X86_SEGMENT_SS] = 0x36,
+        [X86_SEGMENT_DS] = 0x3E, [X86_SEGMENT_GS] = 0x65, [X86_SEGMENT_FS] = 0x64,
+    };
+
+    uint8_t* p = out;
+    if (inst->flags & X86_INSTR_LOCK) *p++ = 0xF0;
+    if (inst->segment != X86_SEGMENT_DEFAULT) {
+        if (inst->segment > X86_SEGMENT_FS) return 0;
+        *p++ = segments[inst->segment];
+    }
+    if (e->prefixes & X86__ENC_66) *p++ = 0x66;
+    if (e->prefixes & X86__ENC_F3) *p++ = 0xF3;
+    if (e->prefixes & X86__ENC_F2) *p++ = 0xF2;
+    if (rs.needs_rex) *p++ = 0x40 | rs.rex;
+
+    memcpy(p, e->opcode, e->opcode_count);
+    p += e->opcode_count;
+    if (e->plus_r) p[-1] |= plus_r & 7;
+
+    memcpy(p, modrm, modrm_length);
+    p += modrm_length;
+
+    if (imm_size == 1) {
+        *p++ = inst->imm;
+    } else if (imm_size == 4) {
+        x86__write_uint32(p, inst->imm);
+        p += 4;
+    } else if (imm_size == 8) {
+        x86__write_uint32(p, inst->abs);
+        x86__write_uint32(p + 4, inst->abs >> 32);
+        p += 8;
+    }
+
+    return p - out;
+}
+
+////////////////////////////////
+// Reverse index
+////////////////////////////////
+// the operand values that rule out some encodings of a form, the rest is
+// checked by x86__encode_with.
+enum {
+    X86__OPERANDS_MEM   = 0x1, // memory operand, needs a ModRM
+    X86__OPERANDS_IMM8  = 0x2, // immediate fits an imm8
+    X86__OPERANDS_UNITY = 0x4, // immediate is 1
+    X86__OPERANDS_RAX   = 0x8, // regs[0] is rax
+};
+
+// (type, operand form) -> the shortest encoding for it, built on first use.
+// entries are sorted by key within each type.
+typedef struct {
+    uint32_t key;
+    uint16_t encoding;
+    uint8_t length; // without the ModRM's SIB, displacement & REX
+} X86__EncodeEntry;
+
+#define X86__ENCODING_COUNT (sizeof(encodings) / sizeof(encodings[0]))
+#define X86__ENCODE_TYPES   (sizeof(encoding_start) / sizeof(encoding_start[0]) - 1)
+
+static once_flag x86__encode_once = ONCE_FLAG_INIT;
+static X86__EncodeEntry x86__encode_index[X86__ENCODING_COUNT * 16];
+static uint32_t x86__encode_index_start[X86__ENCODE_TYPES + 1];
+
+inline static uint32_t x86__form_key(X86_DataType dt, X86_DataType dt2, uint8_t flags, unsigned operands) {
+    return dt | dt2 << 8 | (uint32_t)flags << 16 | operands << 24;
+}
+
+static uint32_t x86__inst_key(const X86_Inst* inst) {
+    uint8_t flags = inst->flags & ~(X86_INSTR_LOCK | X86_INSTR_USE_MEMOP | X86_INSTR_USE_RIPMEM);
+
+    unsigned operands = 0;
+    if (inst->flags & X86_INSTR_USE_MEMOP) operands |= X86__OPERANDS_MEM;
+    if (flags & X86_INSTR_IMMEDIATE) {
+        if (inst->imm >= INT8_MIN && inst->imm <= INT8_MAX) operands |= X86__OPERANDS_IMM8;
+        if (inst->imm == 1) operands |= X86__OPERANDS_UNITY;
+    }
+    if (inst->regs[0] == X86_RAX) operands |= X86__OPERANDS_RAX;
+
+    X86_DataType dt2 = flags & X86_INSTR_TWO_DATA_TYPES ? inst->data_type2 : 0;
+    return x86__form_key(inst->data_type, dt2, flags, operands);
+}
+
+static int x86__cmp_encode_entry(const void* a, const void* b) {
+    uint32_t x = ((const X86__EncodeEntry*)a)->key, y = ((const X86__EncodeEntry*)b)->key;
+    return x < y ? -1 : x > y;
+}
+
+static void x86__build_encode_index(void) {
+    size_t count = 0;
+    for (size_t type = 0; type < X86__ENCODE_TYPES; type++) {
+        size_t first = count;
+        x86__encode_index_start[type] = first;
+
+        for (size_t i = encoding_start[type]; i < encoding_start[type + 1]; i++) {
+            const X86__Encoding* e = &encodings[i];
+            X86__Shape shape;
+            if (!x86__encoding_shape(e, &shape)) continue;
+
+            size_t length = !!(e->prefixes & X86__ENC_66) + !!(e->prefixes & X86__ENC_F3) + !!(e->prefixes & X86__ENC_F2) + !!(e->prefixes & X86__ENC_REXW);
+            length += e->opcode_count + shape.uses_modrm + shape.imm_size;
+
+            // every operand form this encoding can take
+            for (unsigned operands = 0; operands < 16; operands++) {
+                bool imm8 = operands & X86__OPERANDS_IMM8, unity = operands & X86__OPERANDS_UNITY;
+                if (unity && !imm8) continue;
+                if ((imm8 || unity) && !(shape.flags & X86_INSTR_IMMEDIATE)) continue;
+
+                if ((operands & X86__OPERANDS_MEM) && !shape.uses_modrm) continue;
+                if ((shape.form.flags & X86__FORM_UNITY) && !unity) continue;
+                if (shape.imm_size == 1 && !imm8) continue;
+                if ((shape.form.flags & X86__FORM_RAX) && !(operands & X86__OPERANDS_RAX)) continue;
+
+                uint32_t key = x86__form_key(shape.data_type, shape.form.data_type2, shape.flags, operands);
+
+                // fewest bytes wins, ties go to the first in the table
+                size_t j = first;
+                while (j < count && x86__encode_index[j].key != key) j++;
+
+                if (j == count) x86__encode_index[count++] = (X86__EncodeEntry){ key, i, length };
+                else if (length < x86__encode_index[j].length) x86__encode_index[j] = (X86__EncodeEntry){ key, i, length };
+            }
+        }
+
+        qsort(&x86__encode_index[first], count - first, sizeof(X86__EncodeEntry), x86__cmp_encode_entry);
+    }
+    x86__encode_index_start[X86__ENCODE_TYPES] = count;
+}
+
+size_t x86_encode(const X86_Inst* inst, uint8_t* out) {
+    if (inst->type == X86_INST_ENDBR64) {
+        // endbr64 hack, same as x86_disasm
+        memcpy(out, (uint8_t[]) { 0xF3, 0x0F, 0x1E, 0xFA }, 4);
+        return 4;
+    }
+
+    if (inst->type <= X86_INST_NONE || (size_t)inst->type >= X86__ENCODE_TYPES) return 0;
+    call_once(&x86__encode_once, x86__build_encode_index);
+
+    uint32_t key = x86__inst_key(inst);
+    size_t lo = x86__encode_index_start[inst->type], hi = x86__encode_index_start[inst->type + 1];
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (x86__encode_index[mid].key < key) lo = mid + 1;
+        else hi = mid;
+    }
+
+    if (lo == x86__encode_index_start[inst->type + 1] || x86__encode_index[lo].key != key) return 0;
+
+    // lenbench checks every encoding decodes back into the same thing
+    uint8_t tmp[32];
+    size_t length = x86__encode_with(&encodings[x86__encode_index[lo].encoding], inst, tmp);
+    if (length == 0 || length > X86_MAX_INST_LENGTH) return 0;
+
+    memcpy(out, tmp, length);
+    return length;
+}
+
+size_t x86_encode_batch(const X86_Inst* insts, size_t count, uint8_t* out, size_t out_capacity, size_t* out_length) {
+    size_t used = 0, i = 0;
+    for (; i < count; i++) {
+        uint8_t tmp[X86_MAX_INST_LENGTH];
+        uint8_t* dst = out_capacity - used >= X86_MAX_INST_LENGTH ? &out[used] : tmp;
+
+        size_t length = x86_encode(&insts[i], dst);
+        if (length == 0 || length > out_capacity - used) break;
+
+        if (dst == tmp) memcpy(&out[used], tmp, length);
+        used += length;
+    }
+
+    *out_length = used;
+    return i;
+}
+
+////////////////////////////////
+// Synthetic streams
+////////////////////////////////
+// xorshift64*, the same seed has to give the same stream everywhere
+inline static uint64_t x86__synth_rand(uint64_t* state) {
+    uint64_t x = *state;
+    x ^= x >> 12, x ^= x << 25, x ^= x >> 27;
+    *state = x;
+    return x * 0x2545F4914F6CDD1DULL;
+}
+
+// rough relative frequencies in compiled x86-64 code, everything else gets 1
+static uint32_t x86__synth_real_weight(X86_InstType type) {
+    switch (type) {
+        case X86_INST_MOV:    return 300;
+        case X86_INST_LEA:    return 80;
+        case X86_INST_ADD:    case X86_INST_CMP:  return 60;
+        case X86_INST_TEST:   case X86_INST_CALL: return 50;
+        case X86_INST_SUB:    case X86_INST_PUSH: case X86_INST_POP: return 40;
+        case X86_INST_XOR:    case X86_INST_JMP:  case X86_INST_MOVZX: return 30;
+        case X86_INST_AND:    case X86_INST_RET:  return 20;
+        case X86_INST_OR:     case X86_INST_MOVSXD: case X86_INST_SHL: case X86_INST_SHR: case X86_INST_SAR: return 15;
+        case X86_INST_IMUL:   case X86_INST_NOP:  case X86_INST_MOVSX: return 10;
+        case X86_INST_MOVSD:  case X86_INST_MOVAPS: case X86_INST_MOVUPS: case X86_INST_PXOR: case X86_INST_XORPS: return 10;
+        case X86_INST_CVTSI2SD: case X86_INST_ADDSD: return 5;
+        default: break;
+    }
+
+    // jcc is spread over its condition codes
+    return x86_get_branch_class(type) == X86_BRANCH_JCC ? 8 : 1;
+}
+
+static bool x86__synth_lockable(X86_InstType type) {
+    switch (type) {
+        case X86_INST_ADD: case X86_INST_OR:  case X86_INST_ADC: case X86_INST_SBB:
+        case X86_INST_AND: case X86_INST_SUB: case X86_INST_XOR: case X86_INST_INC:
+        case X86_INST_DEC: case X86_INST_NOT: case X86_INST_NEG: case X86_INST_XCHG:
+        case X86_INST_XADD: case X86_INST_CMPXCHG: case X86_INST_BTS: case X86_INST_BTR: case X86_INST_BTC:
+        return true;
+
+        default: return false;
+    }
+}
+
+static uint32_t x86__synth_weight(X86_SynthMix mix, const X86__Encoding* e) {
+    X86__Shape shape;
+    if (!x86__encoding_shape(e, &shape)) return 0;
+
+    bool is_xmm = (shape.form.flags & X86__FORM_XMM) || e->mode == X86_ENCODE_rm64_xmmreg;
+    bool is_branch = x86_get_branch_class(e->type) != X86_BRANCH_NONE;
+    switch (mix) {
+        case X86_SYNTH_GPR:    return is_xmm ? 0 : is_branch ? 2 : 8;
+        case X86_SYNTH_SSE:    return is_xmm ? 16 : is_branch ? 1 : 2;
+        case X86_SYNTH_PREFIX: return e->prefixes ? 8 : 1;
+        case X86_SYNTH_REAL:   return x86__synth_real_weight(e->type);
+        default:               return 1;
+    }
+}
+
+// whether a ModRM operand is memory, the forms named mem or reg can be either
+// as far as x86_disasm cares but the CPU only takes the one.
+static bool x86__synth_pick_memory(const X86__Encoding* e, X86_SynthMix mix, uint64_t* rng) {
+    switch (e->mode) {
+        case X86_ENCODE_mem_imm8: case X86_ENCODE_mem_imm32:
+        case X86_ENCODE_reg8_mem: case X86_ENCODE_reg16_mem: case X86_ENCODE_reg32_mem: case X86_ENCODE_reg64_mem:
+        #if X86_TABLE_HAS_XMM
+        case X86_ENCODE_mem_xmmreg: case X86_ENCODE_xmmreg_mem:
+        #endif
+        return true;
+
+        case X86_ENCODE_reg8: case X86_ENCODE_reg16: case X86_ENCODE_reg32: case X86_ENCODE_reg64:
+        case X86_ENCODE_reg8_imm: case X86_ENCODE_reg32_reg32: case X86_ENCODE_reg64_reg64:
+        #if X86_TABLE_HAS_XMM
+        case X86_ENCODE_xmmreg_imm:
+        #endif
+        return false;
+
+        default: break;
+    }
+
+    if (e->type == X86_INST_LEA) return true;
+    return x86__synth_rand(rng) % 100 < (mix == X86_SYNTH_REAL ? 35 : 50);
+}
+
+static int x86__synth_reg(X86_SynthMix mix, uint64_t* rng) {
+    // r8-r15 need a REX
+    if (mix == X86_SYNTH_PREFIX) return 8 + x86__synth_rand(rng) % 8;
+    return x86__synth_rand(rng) % 16;
+}
+
+static void x86__synth_memory(X86_Inst* inst, X86_SynthMix mix, uint64_t* rng) {
+    inst->flags |= X86_INSTR_USE_MEMOP;
+
+    uint64_t r = x86__synth_rand(rng);
+    if (r % 100 < 15) {
+        inst->flags |= X86_INSTR_USE_RIPMEM;
+        inst->disp = (int32_t)(x86__synth_rand(rng) % 0x100000) - 0x80000;
+        return;
+    }
+
+    inst->base = r % 100 < 20 ? X86_GPR_NONE : x86__synth_reg(mix, rng);
+    inst->index = X86_GPR_NONE;
+    inst->scale = X86_SCALE_X1;
+    if (x86__synth_rand(rng) % 100 < 30) {
+        // no [r12*s] or [rsp*s], x86_disasm reads rbp/r13 with an index as no base
+        inst->index = x86__synth_reg(mix, rng);
+        if ((inst->index & 7) == X86_RSP) inst->index ^= 1;
+        if (inst->base != X86_GPR_NONE && (inst->base & 7) == X86_RBP) inst->base ^= 2;
+        inst->scale = x86__synth_rand(rng) % 4;
+    } else if (inst->base == X86_GPR_NONE) {
+        // absolute [disp32]
+        inst->disp = x86__synth_rand(rng) % 0x10000000;
+        return;
+    }
+
+    r = x86__synth_rand(rng) % 100;
+    if (r < 40) inst->disp = 0;
+    else if (r < 85) inst->disp = (int8_t)x86__synth_rand(rng);
+    else inst->disp = (int32_t)x86__synth_rand(rng);
+}
+
+// a random instruction for the entry, 0 if it doesn't encode
+static size_t x86__synth_one(const X86__Encoding* e, X86_SynthMix mix, uint64_t* rng, uint8_t* out) {
+    X86__Shape shape;
+    if (!x86__encoding_shape(e, &shape)) return 0;
+
+    X86_Inst inst = { .type = e->type, .data_type = shape.data_type, .data_type2 = shape.form.data_type2, .flags = shape.flags };
+    memset(inst.regs, 0xFF, sizeof(inst.regs));
+
+    bool memory = false;
+    if (shape.uses_modrm) {
+        memory = x86__synth_pick_memory(e, mix, rng);
+        if (memory) x86__synth_memory(&inst, mix, rng);
+        else inst.regs[shape.direction] = x86__synth_reg(mix, rng);
+
+        if (!shape.has_imm && !(shape.form.flags & X86__FORM_SINGLE)) inst.regs[!shape.direction] = x86__synth_reg(mix, rng);
+        if (shape.form.flags & X86__FORM_RCX) inst.regs[1] = X86_RCX;
+    } else if (e->plus_r) {
+        inst.regs[0] = x86__synth_reg(mix, rng);
+    } else if (shape.form.flags & X86__FORM_RAX) {
+        inst.regs[0] = X86_RAX;
+    }
+
+    uint64_t r = x86__synth_rand(rng);
+    if (shape.form.flags & X86__FORM_UNITY) inst.imm = 1;
+    else if (shape.imm_size == 1) inst.imm = (int8_t)r;
+    else if (shape.imm_size == 4) inst.imm = r % 4 ? (int32_t)(r >> 32) % 4096 : (int32_t)(r >> 32);
+    else if (shape.imm_size == 8) inst.abs = r;
+
+    // legacy prefixes on top
+    r = x86__synth_rand(rng) % 100;
+    if (mix == X86_SYNTH_PREFIX) {
+        if (r < 50) inst.segment = X86_SEGMENT_ES + x86__synth_rand(rng) % 6;
+        if (memory && x86__synth_lockable(e->type) && x86__synth_rand(rng) % 2) inst.flags |= X86_INSTR_LOCK;
+    } else if (mix == X86_SYNTH_REAL && memory && r < 1) {
+        inst.segment = X86_SEGMENT_FS;
+    }
+
+    return x86__encode_with(e, &inst, out);
+}
+
+const char* x86_get_synth_mix_string(X86_SynthMix mix) {
+    switch (mix) {
+        case X86_SYNTH_GPR: return "gpr";
+        case X86_SYNTH_SSE: return "sse";
+        case X86_SYNTH_PREFIX: return "prefix";
+        case X86_SYNTH_REAL: return "real";
+        case X86_SYNTH_UNIFORM: return "uniform";
+        default: return "unknown";
+    }
+}
+
+size_t x86_synth_stream(X86_SynthMix mix, uint64_t seed, uint8_t* out, size_t out_capacity, size_t* out_count) {
+    size_t encoding_count = sizeof(encodings) / sizeof(encodings[0]);
+
+    // running sums of the weights, an entry gets picked with a binary search
+    uint64_t* sums = malloc((encoding_count + 1) * sizeof(uint64_t));
+    uint64_t total = 0;
+    for (size_t i = 0; i < encoding_count; i++) {
+        total += x86__synth_weight(mix, &encodings[i]);
+        sums[i] = total;
+    }
+
+    uint64_t rng = seed * 0x9E3779B97F4A7C15ULL + 1;
+    size_t used = 0, count = 0, misses = 0;
+    while (total > 0 && misses < 1000) {
+        uint64_t pick = x86__synth_rand(&rng) % total;
+        size_t lo = 0, hi = encoding_count;
+        while (lo < hi) {
+            size_t mid = lo + (hi - lo) / 2;
+            if (sums[mid] <= pick) lo = mid + 1;
+            else hi = mid;
+        }
+
+        uint8_t tmp[32];
+        size_t length = x86__synth_one(&encodings[lo], mix, &rng, tmp);
+        if (length == 0 || length > X86_MAX_INST_LENGTH) {
+            misses += 1;
+            continue;
+        }
+        if (length > out_capacity - used) break;
+        misses = 0;
+
+        memcpy(&out[used], tmp, length);
+        used += length;
+        count += 1;
+    }
+    free(sums);
+
+    if (out_count) *out_count = count;
+    return used;
+}
+
+////////////////////////////////
+// Instrumentation
+////////////////////////////////
+bool x86_counters_enabled(void) {
+    return DISX86_INSTRUMENT;
+}
+
+const X86_DecodeCounters* x86_get_counters(void) {
+    #if DISX86_INSTRUMENT
+    return &x86__counters;
+    #else
+    static const X86_DecodeCounters zero;
+    return &zero;
+    #endif
+}
+
+void x86_reset_counters(void) {
+    #if DISX86_INSTRUMENT
+    memset(&x86__counters, 0, sizeof(x86__counters));
+    #endif
+}
+
+void x86_counters_merge(X86_DecodeCounters* dst, const X86_DecodeCounters* src) {
+    // it's all uint64_t
+    uint64_t* d = (uint64_t*) dst;
+    const uint64_t* s = (const uint64_t*) src;
+    for (size_t i = 0; i < sizeof(X86_DecodeCounters) / sizeof(uint64_t); i++) d[i] += s[i];
+}
+
+inline static double x86__percent(uint64_t x, uint64_t total) {
+    return total ? (100.0 * x) / total : 0.0;
+}
+
+void x86_counters_dump(FILE* out, const X86_DecodeCounters* c) {
+    if (!DISX86_INSTRUMENT) {
+        fprintf(out, "decoder counters: compiled out (build disx86.c with -DDISX86_INSTRUMENT=1)\n");
+        return;
+    }
+
+    // everything after the endbr64 hack went through the DFA
+    uint64_t walked = 0;
+    for (int i = 0; i <= X86_COUNTERS_MAX_STEPS; i++) walked += c->steps[i];
+
+    fprintf(out, "decoder counters: %llu calls, %llu decoded\n", (unsigned long long) c->calls, (unsigned long long) c->decoded);
+    fprintf(out, "  dfa steps       %.2f per walk\n", walked ? (double) c->dfa_steps / walked : 0.0);
+    for (int i = 1; i <= X86_COUNTERS_MAX_STEPS; i++) {
+        if (c->steps[i] == 0) continue;
+        fprintf(out, "    %d%s %14llu  %5.1f%%\n", i, i == X86_COUNTERS_MAX_STEPS ? "+" : " ", (unsigned long long) c->steps[i], x86__percent(c->steps[i], walked));
+    }
+
+    fprintf(out, "  rx digs         %llu (%.1f%% of walks)\n", (unsigned long long) c->rx_digs, x86__percent(c->rx_digs, walked));
+    fprintf(out, "  memory operands %llu (%.1f%% of calls)\n", (unsigned long long) c->memory, x86__percent(c->memory, c->calls));
+    fprintf(out, "    sib           %llu (%.1f%%)\n", (unsigned long long) c->sib, x86__percent(c->sib, c->memory));
+    fprintf(out, "    rip-relative  %llu (%.1f%%)\n", (unsigned long long) c->rip_relative, x86__percent(c->rip_relative, c->memory));
+
+    fprintf(out, "  prefixes\n");
+    for (int i = 0; i < X86_PREFIX_COUNT; i++) {
+        fprintf(out, "    %-12s %llu\n", x86_get_prefix_string(i), (unsigned long long) c->prefixes[i]);
+    }
+
+    // most hit modes first
+    int order[X86_ENCODING_MODE_COUNT];
+    for (int i = 0; i < X86_ENCODING_MODE_COUNT; i++) {
+        int j = i;
+        while (j > 0 && c->modes[order[j - 1]] < c->modes[i]) {
+            order[j] = order[j - 1];
+            j--;
+        }
+        order[j] = i;
+    }
+
+    fprintf(out, "  encoding modes\n");
+    for (int i = 0; i < X86_ENCODING_MODE_COUNT; i++) {
+        uint64_t hits = c->modes[order[i]];
+        if (hits == 0) break;
+
+        fprintf(out, "    %-20s %14llu  %5.1f%%\n", encoding_mode_names[order[i]], (unsigned long long) hits, x86__percent(hits, walked));
+    }
+}
+
 size_t x86_format_operand(char* out, size_t out_capacity, const X86_Operand* op, X86_DataType dt) {
     static const char* X86__GPR_NAMES[4][16] = {
         { "al", "cl", "dl", "bl", "spl", "bpl", "sil", "dil",
@@ -787,7 +1966,97 @@ size_t x86_format_operand(char* out, size_t out_capacity, const X86_Operand* op,
 }
 
 size_t x86_format_inst(char* out, size_t out_capacity, X86_InstType inst, X86_DataType dt) {
-    return snprintf(out, out_capacity, "%s", descs[inst].name);
+    const char* name = x86__get_desc(inst)->name;
+    return snprintf(out, out_capacity, "%s", name ? name : "");
+}
+
+inline static bool x86__is_shift(X86_InstType type) {
+    switch (type) {
+        case X86_INST_ROL: case X86_INST_ROR: case X86_INST_RCL: case X86_INST_RCR:
+        case X86_INST_SHL: case X86_INST_SHR: case X86_INST_SAR: case X86_INST_SAL:
+        return true;
+
+        default: return false;
+    }
+}
+
+// snprintf result to how far we actually got, l never passes out_capacity - 1
+inline static size_t x86__format_advance(size_t l, int n, size_t out_capacity) {
+    if (n < 0) return l;
+    return l + n < out_capacity ? l + n : out_capacity - 1;
+}
+
+size_t x86_format_line(char* out, size_t out_capacity, const X86_Inst* inst, uint64_t address) {
+    if (out_capacity == 0) return 0;
+
+    char tmp[64];
+    x86_format_inst(tmp, sizeof(tmp), inst->type, inst->data_type);
+
+    size_t l;
+    if (inst->flags & X86_INSTR_LOCK) {
+        l = x86__format_advance(0, snprintf(out, out_capacity, "lock %-7s", tmp), out_capacity);
+    } else {
+        l = x86__format_advance(0, snprintf(out, out_capacity, "%-12s", tmp), out_capacity);
+    }
+
+    bool has_mem_op = inst->flags & X86_INSTR_USE_MEMOP;
+    bool has_immediate = inst->flags & (X86_INSTR_IMMEDIATE | X86_INSTR_ABSOLUTE);
+    for (int j = 0; j < 4; j++) {
+        X86_DataType dt = inst->data_type;
+        if ((inst->flags & X86_INSTR_TWO_DATA_TYPES) != 0 && j == 1) {
+            dt = inst->data_type2;
+        }
+
+        if (inst->regs[j] == X86_GPR_NONE) {
+            // GPR_NONE is either exit or a placeholder if we've got crap
+            if (has_mem_op) {
+                has_mem_op = false;
+
+                if (inst->flags & X86_INSTR_USE_RIPMEM) {
+                    uint64_t target = address + inst->length + inst->disp;
+                    snprintf(tmp, sizeof(tmp), "%s ptr [%016llXh]", x86_get_data_type_string(dt), (unsigned long long)target);
+                } else {
+                    size_t n = x86__format_advance(0, snprintf(tmp, sizeof(tmp), "%s ptr ", x86_get_data_type_string(dt)), sizeof(tmp));
+
+                    X86_Operand op = { X86_OPERAND_MEM, .mem = { inst->base, inst->index, inst->scale, inst->disp } };
+                    x86_format_operand(tmp + n, sizeof(tmp) - n, &op, dt);
+                }
+            } else if (has_immediate) {
+                has_immediate = false;
+
+                int64_t val = inst->flags & X86_INSTR_ABSOLUTE ? (int64_t)inst->abs : inst->imm;
+                snprintf(tmp, sizeof(tmp), "%s%llXh", val < 0 ? "-" : "", (unsigned long long)(val < 0 ? -(uint64_t)val : (uint64_t)val));
+            } else {
+                break;
+            }
+        } else {
+            bool use_xmm = inst->flags & X86_INSTR_XMMREG;
+
+            // hack for MOVQ which does xmm and gpr in the same instruction
+            if (inst->type == X86_INST_MOVQ) {
+                if (j != ((inst->flags & X86_INSTR_DIRECTION) ? 1 : 0)) use_xmm = true;
+            } else if (inst->type == X86_INST_MOVSXD) {
+                if (j == 0) dt = X86_TYPE_QWORD;
+            } else if (j == 1 && inst->regs[1] == X86_RCX && x86__is_shift(inst->type)) {
+                // shift by cl
+                dt = X86_TYPE_BYTE;
+            }
+
+            X86_Operand op = { use_xmm ? X86_OPERAND_XMM : X86_OPERAND_GPR, .gpr = inst->regs[j] };
+            if (op.type == X86_OPERAND_GPR && X86_IS_HIGH_GPR(inst->regs[j])) {
+                op.type = X86_OPERAND_GPR_HIGH;
+                op.gpr = X86_GET_HIGH_GPR(inst->regs[j]) & 3;
+            } else if (op.type == X86_OPERAND_GPR && (dt < X86_TYPE_BYTE || dt > X86_TYPE_QWORD)) {
+                // gpr next to an sse operand (cvtsi2sd & co)
+                dt = X86_TYPE_QWORD;
+            }
+            x86_format_operand(tmp, sizeof(tmp), &op, dt);
+        }
+
+        l = x86__format_advance(l, snprintf(out + l, out_capacity - l, "%s%s", j ? "," : "", tmp), out_capacity);
+    }
+
+    return l;
 }
 
 const char* x86_get_segment_string(X86_Segment res) {
@@ -181,14 +181,698 @@ typedef enum {
 	X86_RESULT_INVALID_RX
 } X86_ResultCode;
 
+// What kind of control flow an instruction type does, whether it's direct
+// or indirect is up to the operands (X86_INSTR_IMMEDIATE means rel32/rel8)
+typedef enum X86_BranchClass {
+	X86_BRANCH_NONE = 0,
+
+	X86_BRANCH_JMP,  // jmp
+	X86_BRANCH_JCC,  // jcc, xbegin
+	X86_BRANCH_CALL, // call
+	X86_BRANCH_RET,  // ret, iret, sysret
+	X86_BRANCH_INT,  // int3, syscall, sysenter (comes back afterwards)
+	X86_BRANCH_TRAP, // ud2, hlt (never falls through)
+} X86_BranchClass;
+
+typedef enum X86_Flags {
+	X86_FLAG_CF = (1u << 0u),
+	X86_FLAG_PF = (1u << 1u),
+	X86_FLAG_AF = (1u << 2u),
+	X86_FLAG_ZF = (1u << 3u),
+	X86_FLAG_SF = (1u << 4u),
+	X86_FLAG_OF = (1u << 5u),
+	X86_FLAG_DF = (1u << 6u),
+	X86_FLAG_IF = (1u << 7u),
+
+	// the ones ALU ops set
+	X86_FLAG_STATUS = X86_FLAG_CF | X86_FLAG_PF | X86_FLAG_AF | X86_FLAG_ZF | X86_FLAG_SF | X86_FLAG_OF,
+} X86_Flags;
+
+// Instruction set groups the decoder tables can be generated with, the
+// library only decodes the ones it was built with (ISA=gpr,sse ./build.sh)
+typedef enum X86_ISA {
+	X86_ISA_GPR    = (1u << 0u), // general purpose, valid in long mode
+	X86_ISA_LEGACY = (1u << 1u), // 16/32bit only
+	X86_ISA_X87    = (1u << 2u),
+	X86_ISA_MMX    = (1u << 3u), // MMX & 3DNow!
+	X86_ISA_SSE    = (1u << 4u), // SSE & SSE2
+	X86_ISA_SSE4   = (1u << 5u), // SSE3 up to SSE4.2
+	X86_ISA_SYSTEM = (1u << 6u), // privileged, VMX, SMM, SGX
+	X86_ISA_EXT    = (1u << 7u), // BMI, TSX, SHA, vendor specific...
+
+	X86_ISA_ALL    = 0xFF
+} X86_ISA;
+
+// Bump allocator shared by the loaders and the analysis passes, everything
+// about a file lives in one arena so releasing it is a single reset.
+typedef struct X86_ArenaChunk X86_ArenaChunk;
+
+typedef struct X86_Arena {
+	X86_ArenaChunk* base;
+	X86_ArenaChunk* top;
+	size_t chunk_size;
+} X86_Arena;
+
+typedef struct X86_ArenaSavepoint {
+	X86_ArenaChunk* chunk;
+	size_t used;
+} X86_ArenaSavepoint;
+
+#define X86_ARENA_NEW(arena, T)        ((T*) x86_arena_zalloc(arena, sizeof(T), _Alignof(T)))
+#define X86_ARENA_ARRAY(arena, T, n)   ((T*) x86_arena_alloc(arena, sizeof(T) * (n), _Alignof(T)))
+#define X86_ARENA_ZARRAY(arena, T, n)  ((T*) x86_arena_zalloc(arena, sizeof(T) * (n), _Alignof(T)))
+
+// chunk_size of 0 picks the default (1MiB), a zero-initialized X86_Arena
+// is also valid and will lazily pick the default.
+void x86_arena_init(X86_Arena* arena, size_t chunk_size);
+void* x86_arena_alloc(X86_Arena* arena, size_t size, size_t align);
+void* x86_arena_zalloc(X86_Arena* arena, size_t size, size_t align);
+
+// rewinds the arena but keeps the chunks around for the next file
+void x86_arena_reset(X86_Arena* arena);
+void x86_arena_free(X86_Arena* arena);
+size_t x86_arena_used(const X86_Arena* arena);
+
+// scratch allocations can be popped without touching anything older
+X86_ArenaSavepoint x86_arena_save(X86_Arena* arena);
+void x86_arena_restore(X86_Arena* arena, X86_ArenaSavepoint sp);
+
+// pops the scratch after sp except for the newest allocation (size bytes at
+// top, allocated with align) which gets moved down to the savepoint. returns
+// where it ended up, results built on top of the scratch can be kept this way.
+void* x86_arena_restore_keep(X86_Arena* arena, X86_ArenaSavepoint sp, void* top, size_t size, size_t align);
+
 void x86_print_dfa_DEBUG(void);
+X86_ISA x86_get_isa(void);
+
+// changes with the tables and anything else that changes what x86_disasm
+// returns, stored decodes are only good for the same hash.
+uint64_t x86_get_decoder_hash(void);
+
+// Per instruction type semantics, these are just table lookups. Undefined
+// flags count as written, implicit registers are masks of (1 << X86_GPR).
+X86_BranchClass x86_get_branch_class(X86_InstType type);
+X86_Flags x86_get_flags_read(X86_InstType type);
+X86_Flags x86_get_flags_written(X86_InstType type);
+uint32_t x86_get_implicit_reads(X86_InstType type);
+uint32_t x86_get_implicit_writes(X86_InstType type);
+
+// how each explicit operand slot (regs[i]) is used, X86_OPERAND_ACCESS(access, i)
+// picks out one slot.
+typedef enum X86_OperandAccess {
+	X86_ACCESS_READ  = (1u << 0u),
+	X86_ACCESS_WRITE = (1u << 1u),
+} X86_OperandAccess;
+#define X86_OPERAND_ACCESS(access, i) ((X86_OperandAccess) (((access) >> ((i) * 2)) & 3))
+
+uint32_t x86_get_operand_access(X86_InstType type);
+
+// Registers an instruction reads and writes: the explicit operands, the
+// memory operand's base & index (reads, even for lea) and the implicit ones.
+// bit i is X86_GPR i (ah-bh fold into rax-rbx) or xmm i.
+typedef struct X86_RegUsage {
+	uint32_t gpr_read, gpr_write;
+	uint32_t xmm_read, xmm_write;
+} X86_RegUsage;
+
+X86_RegUsage x86_get_reg_usage(const X86_Inst* inst);
+
 X86_ResultCode x86_disasm(X86_Buffer in, X86_Inst* restrict out);
 X86_Buffer x86_advance(X86_Buffer in, size_t amount);
 
+// Length-only decoding, walks the same tables as x86_disasm but doesn't fill
+// in an X86_Inst. 0 means the bytes don't decode.
+size_t x86_length(X86_Buffer in);
+
+// x86_length and the type x86_disasm would give, X86_INST_NONE if it doesn't
+// decode.
+size_t x86_length_and_type(X86_Buffer in, X86_InstType* out_type);
+
+// the bytes following a ModRM (SIB & displacement), not counting the disp32
+// of a base-less SIB.
+uint8_t x86_modrm_extra(uint8_t modrm);
+
+// x86_length with the prefixes already counted, modrm_extra[i] is
+// x86_modrm_extra(in.data[i]) or NULL to compute it on the fly.
+size_t x86_length_classified(X86_Buffer in, size_t prefix_count, const uint8_t* modrm_extra);
+
+// Length pre-scan, prefixes and ModRM sizes get classified 32 bytes at a
+// time with SIMD and only the opcode bytes go through the DFA.
+typedef enum X86_SimdLevel {
+	X86_SIMD_SCALAR,
+	X86_SIMD_SSSE3,
+	X86_SIMD_AVX2,
+} X86_SimdLevel;
+
+// starts at SSSE3 if the CPU has it (AVX2 isn't faster here), x86_set_simd_level
+// picks any other level, clamped to what the CPU has.
+X86_SimdLevel x86_get_simd_level(void);
+void x86_set_simd_level(X86_SimdLevel level);
+
+// linear sweep, writes one length per instruction until something doesn't
+// decode or out_capacity runs out. returns the number of instructions. inputs
+// under 4KB always take the scalar path.
+size_t x86_scan_lengths(X86_Buffer in, uint8_t* out_lengths, size_t out_capacity);
+
+// superset, out_lengths[i] is the length of the instruction at byte i (0 if
+// it doesn't decode). needs in.length entries.
+void x86_scan_lengths_superset(X86_Buffer in, uint8_t* out_lengths);
+
+// Some bytes and the address they're mapped at
+typedef struct X86_CodeRegion {
+	X86_Buffer code;
+	uint64_t address;
+} X86_CodeRegion;
+
+// runs fn on each of the job_count jobs (job_size bytes apart) with up to
+// thread_count threads, the calling thread included. threads take the next
+// job until there's none left so one that fails to start just leaves its
+// share to the others.
+void x86_parallel_for(int thread_count, void* jobs, size_t job_count, size_t job_size, int (*fn)(void* job));
+
+// Jump tables, recovered by slicing backwards from an indirect jmp to the
+// table load and the bounds check in front of it.
+typedef struct X86_JumpTable {
+	uint64_t jump;       // address of the jmp
+	uint64_t table;      // address of entry 0
+	uint64_t entry_base; // added to relative entries
+	uint32_t count;
+	uint8_t entry_size;  // 8 for absolute, 4 for relative
+} X86_JumpTable;
+
+// inst_offsets are the instructions leading up to (and including) the jmp
+// as offsets into code, memory is anything else the table could be in.
+bool x86_recover_jump_table(X86_Buffer code, uint64_t base_address, const uint32_t* inst_offsets, size_t inst_count, const X86_CodeRegion* memory, size_t memory_count, X86_JumpTable* out);
+bool x86_jump_table_target(const X86_JumpTable* jt, X86_Buffer code, uint64_t base_address, const X86_CodeRegion* memory, size_t memory_count, uint32_t i, uint64_t* out_target);
+
+// Control flow graphs, blocks and edges are flat arrays that refer to each
+// other by index so they stay small for huge binaries. Everything is
+// allocated from the arena given to x86_cfg_build.
+#define X86_BLOCK_NONE UINT32_MAX
+
+typedef enum X86_EdgeKind {
+	X86_EDGE_FALLTHROUGH, // into the next block, also after calls
+	X86_EDGE_JUMP,        // direct jmp
+	X86_EDGE_TAKEN,       // jcc taken
+	X86_EDGE_NOT_TAKEN,   // jcc not taken
+	X86_EDGE_SWITCH,      // jump table entry
+} X86_EdgeKind;
+
+typedef enum X86_BlockFlags {
+	X86_BLOCK_ENTRY       = (1u << 0u), // one of the entries given to x86_cfg_build
+	X86_BLOCK_CALL_TARGET = (1u << 1u), // target of a direct call
+	X86_BLOCK_INDIRECT    = (1u << 2u), // ends in an indirect jmp without a jump table, successors unknown
+	X86_BLOCK_EXTERNAL    = (1u << 3u), // direct branch leaving the code (or into the middle of an instruction)
+	X86_BLOCK_INVALID     = (1u << 4u), // falls into bytes that don't decode
+	X86_BLOCK_JUMP_TABLE  = (1u << 5u), // ends in a recovered jump table, successors are X86_EDGE_SWITCH
+} X86_BlockFlags;
+
+typedef struct X86_Block {
+	// byte offsets into the code, [start, end)
+	uint32_t start, end;
+
+	// into X86_CFG.inst_offsets
+	uint32_t first_inst, inst_count;
+
+	// into X86_CFG.edges and X86_CFG.preds
+	uint32_t first_succ, first_pred;
+	uint32_t succ_count, pred_count;
+
+	// how the last instruction branches
+	X86_BranchClass terminator : 8;
+	X86_BlockFlags flags : 16;
+} X86_Block;
+
+typedef struct X86_Edge {
+	uint32_t from, to;
+	X86_EdgeKind kind;
+} X86_Edge;
+
+typedef struct X86_CFG {
+	uint64_t base_address;
+
+	// sorted by address
+	uint32_t block_count;
+	X86_Block* blocks;
+
+	// grouped by source block
+	uint32_t edge_count;
+	X86_Edge* edges;
+
+	// edge indices grouped by target block
+	uint32_t* preds;
+
+	// offset of every decoded instruction, in order
+	uint32_t inst_count;
+	uint32_t* inst_offsets;
+
+	// recovered jump tables sorted by the jmp, the ones inside the code
+	// aren't decoded as instructions.
+	uint32_t table_count;
+	X86_JumpTable* tables;
+} X86_CFG;
+
+// rel8/rel32 target of a jmp, jcc or call at address, false if it's
+// indirect or not a branch.
+bool x86_get_branch_target(const X86_Inst* inst, uint64_t address, uint64_t* out_target);
+
+// linear sweep over code which is mapped at base_address, entries are extra
+// block leaders (symbols, exports) and can be NULL. memory is what jump
+// tables can be read from besides the code (.rodata), can be NULL. returns
+// false if the code is too big for 32bit offsets.
+bool x86_cfg_build(X86_Arena* arena, X86_Buffer code, uint64_t base_address, const uint64_t* entries, size_t entry_count, const X86_CodeRegion* memory, size_t memory_count, X86_CFG* out);
+
+// block containing address or X86_BLOCK_NONE
+uint32_t x86_cfg_find_block(const X86_CFG* cfg, uint64_t address);
+
+// successor edges and predecessor edge indices (into cfg->edges) of a block
+const X86_Edge* x86_cfg_succs(const X86_CFG* cfg, uint32_t block, size_t* out_count);
+const uint32_t* x86_cfg_preds(const X86_CFG* cfg, uint32_t block, size_t* out_count);
+
+// Call graphs in CSR form, the callees of node i are
+// callees[row_start[i] .. row_start[i + 1]] (indices into nodes).
+#define X86_NODE_NONE UINT32_MAX
+
+typedef enum X86_NodeFlags {
+	X86_NODE_SYMBOL        = (1u << 0u), // one of the functions given to x86_callgraph_build
+	X86_NODE_REGION_START  = (1u << 1u),
+	X86_NODE_CALLED        = (1u << 2u), // target of a direct call
+	X86_NODE_INDIRECT_SLOT = (1u << 3u), // pointer slot of a call [rip+disp]
+} X86_NodeFlags;
+
+typedef struct X86_CallGraph {
+	// sorted by address
+	uint32_t node_count;
+	uint64_t* nodes;
+	uint8_t* node_flags;
+
+	// node_count + 1 entries
+	uint32_t* row_start;
+
+	// one per unique caller/callee pair, call_counts is how many sites it has
+	uint32_t edge_count;
+	uint32_t* callees;
+	uint32_t* call_counts;
+
+	size_t site_count;
+} X86_CallGraph;
+
+// sweeps each region for direct calls and call [rip+disp], call sites belong
+// to the closest function (or region start) before them. functions can be
+// NULL, thread_count of 0 means a thread per region.
+void x86_callgraph_build(X86_Arena* arena, const X86_CodeRegion* regions, size_t region_count, const uint64_t* functions, size_t function_count, int thread_count, X86_CallGraph* out);
+
+// node at exactly address or X86_NODE_NONE
+uint32_t x86_callgraph_find(const X86_CallGraph* cg, uint64_t address);
+const uint32_t* x86_callgraph_callees(const X86_CallGraph* cg, uint32_t node, size_t* out_count);
+
+// Function boundaries for stripped code, the ranges don't overlap so they can
+// be handed out as independent units of work (X86_CodeRegion each).
+typedef enum X86_FunctionSource {
+	X86_FUNC_ENTRY    = (1u << 0u), // start of the code or one of the entries given to x86_find_functions
+	X86_FUNC_ENDBR    = (1u << 1u),
+	X86_FUNC_PROLOGUE = (1u << 2u), // push rbp; mov rbp, rsp / sub rsp, imm / push r12-r15 after a ret or jmp
+	X86_FUNC_CALLED   = (1u << 3u), // target of a call rel32
+	X86_FUNC_PADDING  = (1u << 4u), // first instruction after the padding following a ret
+} X86_FunctionSource;
+
+typedef struct X86_FunctionRange {
+	// end is exclusive and doesn't include the padding after the function
+	uint64_t start, end;
+	uint8_t sources;
+} X86_FunctionRange;
+
+// sorted ranges allocated from the arena, entries can be NULL. returns the
+// number of ranges.
+size_t x86_find_functions(X86_Arena* arena, X86_Buffer code, uint64_t base_address, const uint64_t* entries, size_t entry_count, X86_FunctionRange** out);
+
+// Instruction mix statistics, straight counts out of x86_disasm with no
+// formatting involved.
+typedef enum X86_OperandForm {
+	X86_FORM_NONE,     // no explicit operands
+	X86_FORM_REG,      // registers only
+	X86_FORM_REG_IMM,
+	X86_FORM_IMM,      // immediate only (push imm, jmp rel32)
+	X86_FORM_MEM,      // [base + index * scale + disp]
+	X86_FORM_MEM_IMM,
+	X86_FORM_RIP,      // [rip + disp]
+	X86_FORM_RIP_IMM,
+	X86_FORM_ABS,      // 64bit immediate or moffs
+
+	X86_FORM_COUNT
+} X86_OperandForm;
+
+typedef enum X86_Prefix {
+	X86_PREFIX_LOCK,
+	X86_PREFIX_REP,      // f3
+	X86_PREFIX_REPNE,    // f2
+	X86_PREFIX_OPSIZE,   // 66
+	X86_PREFIX_ADDRSIZE, // 67
+	X86_PREFIX_SEGMENT,
+	X86_PREFIX_REX,
+	X86_PREFIX_MANDATORY, // 66/f2/f3 that pick the opcode (SSE, popcnt, endbr64...)
+
+	X86_PREFIX_COUNT
+} X86_Prefix;
+
+// adds the prefix bytes in front of an instruction x86_disasm decoded out of
+// in to counts, mandatory ones go in X86_PREFIX_MANDATORY instead of rep,
+// repne or opsize.
+void x86_count_prefixes(X86_Buffer in, const X86_Inst* inst, uint64_t counts[X86_PREFIX_COUNT]);
+
+#define X86_STATS_DATA_TYPES (X86_TYPE_XMMWORD + 1)
+
+typedef struct X86_Stats {
+	uint64_t inst_count;
+	uint64_t byte_count;
+	uint64_t invalid_bytes; // skipped one at a time
+
+	uint64_t types[X86_INST_COUNT];
+	uint64_t data_types[X86_STATS_DATA_TYPES];
+	uint64_t forms[X86_FORM_COUNT];
+	uint64_t prefixes[X86_PREFIX_COUNT]; // see x86_count_prefixes
+	uint64_t lengths[16];
+} X86_Stats;
+
+// sweeps code and adds to stats, undecodable bytes are skipped
+void x86_stats_add(X86_Stats* stats, X86_Buffer code);
+void x86_stats_merge(X86_Stats* dst, const X86_Stats* src);
+
+// splits the regions into thread_count contiguous runs of about the same
+// size, each with its own counters which are merged at the end.
+void x86_stats_collect(const X86_CodeRegion* regions, size_t region_count, int thread_count, X86_Stats* out);
+
+const char* x86_get_operand_form_string(X86_OperandForm form);
+const char* x86_get_prefix_string(X86_Prefix prefix);
+
+// Instruction pattern search, patterns look like the disassembly with
+// wildcards ("lock cmpxchg rip, *", "xor $a, $a", "cmp reg, 0..15; ja *"),
+// the syntax is described in pattern.c.
+typedef struct X86_PatternSet X86_PatternSet;
+
+typedef struct X86_Match {
+	uint64_t address; // first instruction
+	uint32_t pattern; // index into the patterns given to x86_pattern_compile
+	uint32_t length;  // bytes covered by the whole sequence
+} X86_Match;
+
+// NULL on a syntax error with the message written into error
+X86_PatternSet* x86_pattern_compile(X86_Arena* arena, const char** patterns, size_t pattern_count, char* error, size_t error_capacity);
+
+// every pattern gets matched in one sweep per region, regions are searched in
+// parallel (thread_count of 0 means a thread per region). matches are sorted
+// by address and allocated from the arena.
+size_t x86_pattern_search(X86_Arena* arena, const X86_PatternSet* set, const X86_CodeRegion* regions, size_t region_count, int thread_count, X86_Match** out);
+
+// Superset disassembly, an instruction at every byte offset for code that's
+// mixed with data or overlaps itself on purpose. the arrays have length + 1
+// entries, the last one is an empty sentinel.
+typedef struct X86_Superset {
+	uint64_t address;
+	uint32_t length;
+
+	uint8_t* lengths;  // 0 if the offset doesn't decode
+	uint16_t* types;   // X86_InstType
+	uint32_t* chain;   // instructions decoded by following lengths from here
+} X86_Superset;
+
+// offsets are split into thread_count ranges decoded in parallel
+void x86_superset_build(X86_Arena* arena, X86_Buffer code, uint64_t address, int thread_count, X86_Superset* out);
+
+// offset of the instruction after the one at offset, ss->length if that one
+// doesn't decode or runs off the end.
+uint32_t x86_superset_next(const X86_Superset* ss, uint32_t offset);
+
+// follows the chain from offset, returns the number of offsets written
+size_t x86_superset_walk(const X86_Superset* ss, uint32_t offset, uint32_t* out_offsets, size_t out_capacity);
+
+// Cross references out of direct branches, rip-relative operands and 64bit
+// absolute immediates.
+typedef enum X86_XrefKind {
+	X86_XREF_CALL     = (1u << 0u),
+	X86_XREF_JUMP     = (1u << 1u),
+	X86_XREF_BRANCH   = (1u << 2u), // jcc
+	X86_XREF_READ     = (1u << 3u), // [rip+disp], call/jmp [rip+disp] read the pointer
+	X86_XREF_WRITE    = (1u << 4u),
+	X86_XREF_ADDRESS  = (1u << 5u), // lea
+	X86_XREF_ABSOLUTE = (1u << 6u), // mov r64, imm64 / moffs
+} X86_XrefKind;
+
+typedef struct X86_Xref {
+	uint64_t source; // address of the instruction
+	uint64_t target;
+	uint8_t kind;
+} X86_Xref;
+
+typedef struct X86_XrefIndex {
+	size_t count;
+
+	// sorted by source then target
+	X86_Xref* xrefs;
+	// indices into xrefs sorted by target then source
+	uint32_t* by_target;
+} X86_XrefIndex;
+
+// regions are swept in parallel (thread_count of 0 means a thread per region)
+// and merged, everything is allocated from the arena.
+void x86_xref_build(X86_Arena* arena, const X86_CodeRegion* regions, size_t region_count, int thread_count, X86_XrefIndex* out);
+
+// combines two indices, say ones built separately per section
+void x86_xref_merge(X86_Arena* arena, const X86_XrefIndex* a, const X86_XrefIndex* b, X86_XrefIndex* out);
+
+// what the instruction at source references, both are binary searches
+const X86_Xref* x86_xref_from(const X86_XrefIndex* index, uint64_t source, size_t* out_count);
+// who references target, indices into index->xrefs
+const uint32_t* x86_xref_to(const X86_XrefIndex* index, uint64_t target, size_t* out_count);
+
+// Stack pointer deltas, how far rsp is below where it was at the start of the
+// function, before each instruction of a CFG.
+#define X86_STACK_DELTA_UNKNOWN INT32_MIN
+
+typedef enum X86_StackFlags {
+	X86_STACK_UNKNOWN       = (1u << 0u), // delta is X86_STACK_DELTA_UNKNOWN
+	X86_STACK_UNKNOWN_WRITE = (1u << 1u), // rsp gets something we can't follow (mov rsp, rax)
+	X86_STACK_UNBALANCED    = (1u << 2u), // ret with a non-zero delta or paths merging with different ones
+	X86_STACK_ALIGNED       = (1u << 3u), // and rsp, imm
+} X86_StackFlags;
+
+typedef struct X86_StackDeltas {
+	// one per CFG instruction (X86_CFG.inst_offsets)
+	uint32_t count;
+	int32_t* deltas; // push rbp at the entry is 0, the instruction after it -8
+	uint8_t* flags;
+} X86_StackDeltas;
+
+// code is the same buffer the CFG was built from, entries and call targets
+// (or blocks without predecessors) start at 0.
+void x86_stack_deltas(X86_Arena* arena, const X86_CFG* cfg, X86_Buffer code, X86_StackDeltas* out);
+
+// Encoding, the reverse of x86_disasm driven by the same tables: an index
+// built on first use maps the type & operand form to the shortest encoding
+// that decodes back into the same X86_Inst (length aside). branch and
+// rip-relative displacements are kept as is, they're relative to the end of
+// the new encoding. returns the length or 0 if there's no encoding, out needs
+// X86_MAX_INST_LENGTH bytes.
+#define X86_MAX_INST_LENGTH 15
+
+size_t x86_encode(const X86_Inst* inst, uint8_t* out);
+
+// encodes back to back until something doesn't encode or fit, returns the
+// number of instructions and the bytes used go in out_length.
+size_t x86_encode_batch(const X86_Inst* insts, size_t count, uint8_t* out, size_t out_capacity, size_t* out_length);
+
+// Synthetic instruction streams, random picks out of the same tables
+// x86_encode uses so every instruction decodes. the same mix & seed always
+// gives the same bytes.
+typedef enum X86_SynthMix {
+	X86_SYNTH_GPR,     // integer ALU, moves & branches
+	X86_SYNTH_SSE,     // mostly xmm
+	X86_SYNTH_PREFIX,  // REX, 66/F2/F3, segment overrides & lock on all it can
+	X86_SYNTH_REAL,    // roughly the mix compilers emit
+	X86_SYNTH_UNIFORM, // every form the tables have equally often
+
+	X86_SYNTH_MIX_COUNT
+} X86_SynthMix;
+
+const char* x86_get_synth_mix_string(X86_SynthMix mix);
+
+// fills out with whole instructions until the next one doesn't fit, returns
+// the bytes used. out_count (can be NULL) gets the number of instructions.
+size_t x86_synth_stream(X86_SynthMix mix, uint64_t seed, uint8_t* out, size_t out_capacity, size_t* out_count);
+
+// Decoder instrumentation, counters bumped from inside x86_disasm. they're
+// compiled out unless disx86.c is built with DISX86_INSTRUMENT=1
+// (INSTRUMENT=1 ./build.sh), without it the counters just stay zero.
+#define X86_COUNTERS_MAX_STEPS 8
+
+typedef struct X86_DecodeCounters {
+	uint64_t calls;
+	uint64_t decoded;
+
+	// DFA transitions per instruction (prefix rows included), the last
+	// bucket is that many or more.
+	uint64_t dfa_steps;
+	uint64_t steps[X86_COUNTERS_MAX_STEPS + 1];
+
+	uint64_t rx_digs; // states that look at the ModRM reg field (/0-/7)
+	uint64_t prefixes[X86_PREFIX_COUNT]; // of decoded instructions, see x86_count_prefixes
+	uint64_t modes[X86_ENCODING_MODE_COUNT];
+
+	// from the memory operand parser
+	uint64_t memory;
+	uint64_t sib;
+	uint64_t rip_relative;
+} X86_DecodeCounters;
+
+bool x86_counters_enabled(void);
+
+// every thread has its own, they're never reset behind your back
+const X86_DecodeCounters* x86_get_counters(void);
+void x86_reset_counters(void);
+void x86_counters_merge(X86_DecodeCounters* dst, const X86_DecodeCounters* src);
+void x86_counters_dump(FILE* out, const X86_DecodeCounters* counters);
+
+// Stage tracing, begin/end spans are recorded per thread and written out as
+// Chrome trace-event JSON (chrome://tracing, Perfetto) when the program
+// exits. it's off until x86_trace_start, which has to happen before any
+// thread records and only once per run. names and args aren't copied so
+// they have to live until the trace is written, arg can be NULL.
+bool x86_trace_start(const char* path);
+bool x86_trace_is_enabled(void);
+void x86_trace_begin(const char* name, const char* arg);
+void x86_trace_end(void);
+
+// writes the trace now instead of at exit, later spans are dropped
+bool x86_trace_write(void);
+
+// fast non-cryptographic hash (not stable across endianness), two
+// independent 64bit halves.
+void x86_hash128(const void* data, size_t length, uint64_t out[2]);
+
+// Decode cache, the linear sweep of a section (undecodable bytes skipped one
+// at a time) is stored in a directory keyed by a hash of the bytes and
+// mapped back in on a hit. the least recently used files get evicted once
+// the directory goes over max_bytes (checked on open and after each write). POSIX only, x86_cache_open fails
+// elsewhere and callers just decode as usual.
+typedef struct X86_Cache {
+	char dir[1024];
+	uint64_t max_bytes;
+
+	// since x86_cache_open
+	uint64_t hits, misses, evictions;
+} X86_Cache;
+
+typedef struct X86_DecodedSection {
+	size_t count;
+	const X86_Inst* insts;
+	const uint32_t* offsets; // where each instruction starts, ascending
+
+	// whatever backs the arrays, the file mapping on a hit
+	void* memory;
+	size_t memory_size;
+	bool is_mapped;
+} X86_DecodedSection;
+
+// creates dir if needed, max_bytes of 0 means no limit
+bool x86_cache_open(X86_Cache* cache, const char* dir, uint64_t max_bytes);
+
+// a NULL cache just decodes, returns true on a hit. code has to be under
+// 4GiB. failing to write the cache file isn't an error, the decode is
+// still returned.
+bool x86_cache_decode(X86_Cache* cache, X86_Buffer code, X86_DecodedSection* out);
+void x86_decoded_release(X86_DecodedSection* section);
+
+// index of the instruction at offset or SIZE_MAX if the sweep didn't start one there
+size_t x86_decoded_find(const X86_DecodedSection* section, uint32_t offset);
+
+// Serialized instruction streams, decoded X86_Insts in a compact file for
+// passing between tools or keeping around. instructions are grouped into
+// blocks that decode on their own, the layout is described in stream.c.
+typedef struct X86_StreamWriter X86_StreamWriter;
+
+// block_size of 0 picks the default (4096 instructions per block)
+X86_StreamWriter* x86_stream_writer_begin(FILE* out, uint32_t block_size);
+
+// offsets have to be ascending, they're usually where the instruction starts
+// in the section
+bool x86_stream_writer_add(X86_StreamWriter* w, uint32_t offset, const X86_Inst* inst);
+
+// writes the dictionary & block index and frees the writer
+bool x86_stream_writer_end(X86_StreamWriter* w);
+
+// everything points into the file buffer, which has to stay around
+typedef struct X86_Stream {
+	X86_Buffer file;
+	uint64_t decoder_hash; // x86_get_decoder_hash of the writer
+	uint64_t inst_count;
+
+	uint32_t block_size;
+	uint32_t block_count;
+	uint32_t dict_count;
+
+	X86_Inst* dict;        // the type/flags/operand shape of each entry
+	uint8_t* dict_masks;   // which registers each entry has
+	uint64_t* block_starts; // block_count + 1 file offsets
+	uint32_t* block_first_offsets;
+} X86_Stream;
+
+// false if the file isn't a valid stream
+bool x86_stream_open(X86_Arena* arena, X86_Buffer file, X86_Stream* out);
+
+// how many instructions the block holds, block_size for all but the last
+size_t x86_stream_block_count(const X86_Stream* s, uint32_t block);
+
+// out_insts & out_offsets need x86_stream_block_count entries, returns how
+// many were read (0 if the block is corrupt).
+size_t x86_stream_read_block(const X86_Stream* s, uint32_t block, X86_Inst* out_insts, uint32_t* out_offsets);
+
+// every block, split across up to thread_count threads (fewer if they'd get
+// less than 16k instructions each). the arrays need inst_count entries,
+// returns false if any block is corrupt.
+bool x86_stream_read_all(const X86_Stream* s, X86_Inst* out_insts, uint32_t* out_offsets, int thread_count);
+
+// Address index over the instruction starts of a linear sweep, answers which
+// instruction covers an offset and steps forwards or backwards from any
+// offset without decoding again. starts are kept as 16bit deltas from a
+// 32bit base per block of 64 instructions, so ~3 bytes per instruction.
+// instructions are numbered in address order, queries return SIZE_MAX when
+// there's no such instruction.
+typedef struct X86_AddrIndex {
+	size_t count;
+	uint32_t block_count;
+
+	uint32_t* block_base; // offset of the first instruction in each block
+	uint32_t* block_wide; // UINT32_MAX or where the block's offsets start in wide
+	uint16_t* deltas;     // per instruction, from its block's base
+	uint8_t* lengths;
+	uint32_t* wide;       // full offsets for blocks spanning more than 64KiB
+} X86_AddrIndex;
+
+// bytes that don't decode get skipped one at a time, like the other sweeps
+void x86_addr_index_build(X86_Arena* arena, X86_Buffer code, X86_AddrIndex* out);
+// reuses a decode we already have (say from x86_cache_decode)
+void x86_addr_index_from_decoded(X86_Arena* arena, const X86_DecodedSection* section, X86_AddrIndex* out);
+
+// where instruction i starts
+uint32_t x86_addr_index_offset(const X86_AddrIndex* index, size_t i);
+// last instruction starting at or before offset
+size_t x86_addr_index_floor(const X86_AddrIndex* index, uint32_t offset);
+// the instruction whose bytes cover offset
+size_t x86_addr_index_find(const X86_AddrIndex* index, uint32_t offset);
+// first instruction starting after offset
+size_t x86_addr_index_next(const X86_AddrIndex* index, uint32_t offset);
+// last instruction starting before offset
+size_t x86_addr_index_prev(const X86_AddrIndex* index, uint32_t offset);
+
 // Pretty formats
 size_t x86_format_operand(char* out, size_t out_capacity, const X86_Operand* op, X86_DataType dt);
 size_t x86_format_inst(char* out, size_t out_capacity, X86_InstType inst, X86_DataType dt);
 
+// mnemonic & operands the way dis prints them, address is where the
+// instruction is (rip-relative operands get resolved against it). the
+// text is cut off at out_capacity, returns the length actually written.
+size_t x86_format_line(char* out, size_t out_capacity, const X86_Inst* inst, uint64_t address);
+
 const char* x86_get_segment_string(X86_Segment segment);
 const char* x86_get_result_string(X86_ResultCode res);
 const char* x86_get_data_type_string(X86_DataType dt);
@@ -156,6 +156,41 @@ int parse_section_header(ELF_Context *ctx, Slice binary, ELF_Section_Header *ret
 	return 0;
 }
 
+int parse_symbol(ELF_Context *ctx, Slice binary, ELF_Symbol *ret_sym, u32 *ret_name) {
+	memset(ret_sym, 0, sizeof(ELF_Symbol));
+
+	u8 info;
+	if (ctx->bits_64) {
+		ELF64_Symbol *sym = (ELF64_Symbol *)binary.data;
+		if (binary.length < sizeof(ELF64_Symbol)) {
+			printf("File too small for ELF64 Symbol!\n");
+			return 1;
+		}
+
+		*ret_name            = fe_to_ne32(ctx->little_endian, sym->name);
+		ret_sym->value       = fe_to_ne64(ctx->little_endian, sym->value);
+		ret_sym->size        = fe_to_ne64(ctx->little_endian, sym->size);
+		ret_sym->section_idx = fe_to_ne16(ctx->little_endian, sym->section_idx);
+		info = sym->info;
+	} else {
+		ELF32_Symbol *sym = (ELF32_Symbol *)binary.data;
+		if (binary.length < sizeof(ELF32_Symbol)) {
+			printf("File too small for ELF32 Symbol!\n");
+			return 1;
+		}
+
+		*ret_name            = fe_to_ne32(ctx->little_endian, sym->name);
+		ret_sym->value       = (u64)fe_to_ne32(ctx->little_endian, sym->value);
+		ret_sym->size        = (u64)fe_to_ne32(ctx->little_endian, sym->size);
+		ret_sym->section_idx = fe_to_ne16(ctx->little_endian, sym->section_idx);
+		info = sym->info;
+	}
+
+	ret_sym->type    = info & 0xF;
+	ret_sym->binding = info >> 4;
+	return 0;
+}
+
 int parse_program_header(ELF_Context *ctx, Slice binary, ELF_Program_Header *ret_hdr) {
 	memset(ret_hdr, 0, sizeof(ELF_Program_Header));
 
@@ -194,7 +229,7 @@ int parse_program_header(ELF_Context *ctx, Slice binary, ELF_Program_Header *ret
 	return 0;
 }
 
-int parse_elf(uint8_t *bin, uint64_t length, ELF_Context *ctx) {
+int parse_elf(X86_Arena *arena, uint8_t *bin, uint64_t length, ELF_Context *ctx) {
 	Slice binary = into_slice(bin, length);
 
 	ELF_PreHeader *pre_hdr = (ELF_PreHeader *)binary.data;
@@ -268,18 +303,17 @@ int parse_elf(uint8_t *bin, uint64_t length, ELF_Context *ctx) {
 	u64 section_header_array_size = common_hdr.section_hdr_num * common_hdr.section_entry_size;
 	Slice section_header_blob = chunk_slice(binary, common_hdr.section_hdr_offset, section_header_array_size);
 
-	Section *sections = (Section *)calloc(sizeof(Section), common_hdr.section_hdr_num);
+	Section *sections = X86_ARENA_ZARRAY(arena, Section, common_hdr.section_hdr_num);
+	ELF_Section_Header symtab_hdr = { 0 };
 	u64 sect_idx = 0;
 	for (u64 i = 0; i < section_header_array_size; i += common_hdr.section_entry_size) {
 		ELF_Section_Header section_hdr;
 		if (parse_section_header(ctx, sub_slice(section_header_blob, i), &section_hdr)) {
-			free(sections);
 			return 12;
 		}
 
 		if (section_hdr.offset > binary.length) {
 			printf("Section Header offset invalid!\n");
-			free(sections);
 			return 13;
 		}
 
@@ -287,30 +321,56 @@ int parse_elf(uint8_t *bin, uint64_t length, ELF_Context *ctx) {
 
 		Section *sect = &sections[sect_idx];
 		sect->name = (char *)section_name_blob.data;
-		sect->data = chunk_slice(binary, section_hdr.offset, section_hdr.size);
+		sect->data = section_hdr.type == sht_nobits ? into_slice(NULL, 0) : chunk_slice(binary, section_hdr.offset, section_hdr.size);
+		sect->addr = section_hdr.addr;
+		sect->flags = section_hdr.flags;
 		sect_idx++;
+
+		if (section_hdr.type == sht_symtab || (section_hdr.type == sht_dynsym && symtab_hdr.type != sht_symtab)) {
+			symtab_hdr = section_hdr;
+		}
 	}
 
 	ctx->num_sects = common_hdr.section_hdr_num;
 	ctx->sections = sections;
 
+	if (symtab_hdr.type != sht_null && symtab_hdr.entry_size != 0) {
+		if (symtab_hdr.link >= common_hdr.section_hdr_num) {
+			printf("Invalid symbol string table index!\n");
+			return 16;
+		}
+
+		Slice sym_blob = chunk_slice(binary, symtab_hdr.offset, symtab_hdr.size);
+		Slice sym_names = sections[symtab_hdr.link].data;
+
+		u64 num_syms = symtab_hdr.size / symtab_hdr.entry_size;
+		ELF_Symbol *syms = X86_ARENA_ZARRAY(arena, ELF_Symbol, num_syms);
+		for (u64 i = 0; i < num_syms; i++) {
+			u32 name;
+			if (parse_symbol(ctx, sub_slice(sym_blob, i * symtab_hdr.entry_size), &syms[i], &name)) {
+				return 17;
+			}
+
+			syms[i].name = name < sym_names.length ? (char *)&sym_names.data[name] : "";
+		}
+
+		ctx->num_syms = num_syms;
+		ctx->syms = syms;
+	}
+
 	u64 program_header_array_size = common_hdr.program_hdr_num * common_hdr.program_hdr_entry_size;
 	Slice program_header_blob = chunk_slice(binary, common_hdr.program_hdr_offset, program_header_array_size);
 
-	ELF_Program_Header *phdrs = (ELF_Program_Header *)calloc(sizeof(ELF_Program_Header), common_hdr.program_hdr_num);
+	ELF_Program_Header *phdrs = X86_ARENA_ZARRAY(arena, ELF_Program_Header, common_hdr.program_hdr_num);
 	u64 phdr_idx = 0;
 	for (u64 i = 0; i < program_header_array_size; i += common_hdr.program_hdr_entry_size) {
 		ELF_Program_Header program_hdr;
 		if (parse_program_header(ctx, sub_slice(program_header_blob, i), &program_hdr)) {
-			free(phdrs);
-			free(sections);
 			return 14;
 		}
 
 		if (program_hdr.offset > binary.length) {
 			printf("Program Header offset invalid!\n");
-			free(phdrs);
-			free(sections);
 			return 15;
 		}
 
@@ -328,8 +388,3 @@ int parse_elf(uint8_t *bin, uint64_t length, ELF_Context *ctx) {
 
 	return 0;
 }
-
-void free_elf_ctx(ELF_Context *ctx) {
-	free(ctx->phdrs);
-	free(ctx->sections);
-}
@@ -26,6 +26,8 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+#include "disx86.h"
+
 /*
 Handy References:
 - https://refspecs.linuxbase.org/elf/elf.pdf
@@ -194,6 +196,22 @@ typedef enum {
 	sht_unwind      = 0x70000001,
 } Section_Header_Type;
 
+typedef enum {
+	stt_notype  = 0,
+	stt_object  = 1,
+	stt_func    = 2,
+	stt_section = 3,
+	stt_file    = 4,
+	stt_common  = 5,
+	stt_tls     = 6,
+} Symbol_Type;
+
+typedef enum {
+	stb_local  = 0,
+	stb_global = 1,
+	stb_weak   = 2,
+} Symbol_Binding;
+
 typedef enum {
 	pt_null    = 0,
 	pt_load    = 1,
@@ -282,6 +300,24 @@ typedef struct {
 	u64 entry_size;
 } ELF64_Section_Header;
 
+typedef struct {
+	u32 name;
+	u32 value;
+	u32 size;
+	u8  info;
+	u8  other;
+	u16 section_idx;
+} ELF32_Symbol;
+
+typedef struct {
+	u32 name;
+	u8  info;
+	u8  other;
+	u16 section_idx;
+	u64 value;
+	u64 size;
+} ELF64_Symbol;
+
 typedef struct {
 	u32 type;
 	u32 offset;
@@ -343,8 +379,19 @@ typedef struct {
 typedef struct {
 	char *name;
 	Slice data;
+	u64 addr;
+	u64 flags;
 } Section;
 
+typedef struct {
+	char *name;
+	u64 value;
+	u64 size;
+	Symbol_Type type;
+	Symbol_Binding binding;
+	u16 section_idx;
+} ELF_Symbol;
+
 typedef struct {
 	bool           little_endian;
 	bool           bits_64;
@@ -359,8 +406,14 @@ typedef struct {
 
 	u64                num_phdrs;
 	ELF_Program_Header *phdrs;
+
+	// from .symtab, or .dynsym if it's stripped
+	u64         num_syms;
+	ELF_Symbol *syms;
 } ELF_Context;
 
-int parse_elf(uint8_t *bin, uint64_t length, ELF_Context *ctx);
+// section, program header and symbol arrays are allocated out of the arena,
+// they live until the arena is reset.
+int parse_elf(X86_Arena *arena, uint8_t *bin, uint64_t length, ELF_Context *ctx);
 
 #endif
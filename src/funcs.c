@@ -0,0 +1,276 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Function starts are guessed from a few cheap signals: endbr64, prologue
+// signatures right after a ret/jmp (or padding), whatever comes after
+// padding following a ret and direct call targets. The byte signatures are
+// matched 32 bytes at a time, the rest comes from a length-only sweep so
+// nothing here needs a full decode.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define X86__FUNCS_SIMD 1
+#include <immintrin.h>
+#else
+#define X86__FUNCS_SIMD 0
+#endif
+
+// lengths are scanned in batches this big
+#define X86__FUNCS_BATCH 4096
+
+typedef struct {
+    uint32_t endbr;    // f3 0f 1e fa
+    uint32_t prologue; // 55 48 89 e5, 55 53, 55 41, 48 83/81 ec, 41 54-57
+} X86__Signatures;
+
+// p needs 32 + 3 readable bytes
+static X86__Signatures x86__signatures_scalar(const uint8_t* p) {
+    X86__Signatures s = { 0 };
+    for (int i = 0; i < 32; i++) {
+        const uint8_t* b = &p[i];
+        if (b[0] == 0xF3 && b[1] == 0x0F && b[2] == 0x1E && b[3] == 0xFA) s.endbr |= 1u << i;
+
+        bool frame  = b[0] == 0x55 && ((b[1] == 0x48 && b[2] == 0x89 && b[3] == 0xE5) || b[1] == 0x53 || b[1] == 0x41);
+        bool subrsp = b[0] == 0x48 && (b[1] == 0x83 || b[1] == 0x81) && b[2] == 0xEC;
+        bool pushr  = b[0] == 0x41 && (b[1] & 0xFC) == 0x54;
+        if (frame || subrsp || pushr) s.prologue |= 1u << i;
+    }
+    return s;
+}
+
+#if X86__FUNCS_SIMD
+__attribute__((target("ssse3")))
+static X86__Signatures x86__signatures_ssse3(const uint8_t* p) {
+    #define EQ(v, x) _mm_cmpeq_epi8(v, _mm_set1_epi8((char)(x)))
+
+    X86__Signatures s = { 0 };
+    for (int i = 0; i < 32; i += 16) {
+        __m128i b0 = _mm_loadu_si128((const __m128i*)&p[i + 0]);
+        __m128i b1 = _mm_loadu_si128((const __m128i*)&p[i + 1]);
+        __m128i b2 = _mm_loadu_si128((const __m128i*)&p[i + 2]);
+        __m128i b3 = _mm_loadu_si128((const __m128i*)&p[i + 3]);
+
+        __m128i endbr = _mm_and_si128(_mm_and_si128(EQ(b0, 0xF3), EQ(b1, 0x0F)), _mm_and_si128(EQ(b2, 0x1E), EQ(b3, 0xFA)));
+        __m128i frame = _mm_and_si128(_mm_and_si128(EQ(b1, 0x48), EQ(b2, 0x89)), EQ(b3, 0xE5));
+        frame = _mm_and_si128(EQ(b0, 0x55), _mm_or_si128(frame, _mm_or_si128(EQ(b1, 0x53), EQ(b1, 0x41))));
+        __m128i subrsp = _mm_and_si128(_mm_and_si128(EQ(b0, 0x48), _mm_or_si128(EQ(b1, 0x83), EQ(b1, 0x81))), EQ(b2, 0xEC));
+        __m128i pushr = _mm_and_si128(EQ(b0, 0x41), EQ(_mm_and_si128(b1, _mm_set1_epi8((char)0xFC)), 0x54));
+
+        s.endbr |= (uint32_t)_mm_movemask_epi8(endbr) << i;
+        s.prologue |= (uint32_t)_mm_movemask_epi8(_mm_or_si128(frame, _mm_or_si128(subrsp, pushr))) << i;
+    }
+    return s;
+
+    #undef EQ
+}
+
+__attribute__((target("avx2")))
+static X86__Signatures x86__signatures_avx2(const uint8_t* p) {
+    #define EQ(v, x) _mm256_cmpeq_epi8(v, _mm256_set1_epi8((char)(x)))
+
+    __m256i b0 = _mm256_loadu_si256((const __m256i*)&p[0]);
+    __m256i b1 = _mm256_loadu_si256((const __m256i*)&p[1]);
+    __m256i b2 = _mm256_loadu_si256((const __m256i*)&p[2]);
+    __m256i b3 = _mm256_loadu_si256((const __m256i*)&p[3]);
+
+    __m256i endbr = _mm256_and_si256(_mm256_and_si256(EQ(b0, 0xF3), EQ(b1, 0x0F)), _mm256_and_si256(EQ(b2, 0x1E), EQ(b3, 0xFA)));
+    __m256i frame = _mm256_and_si256(_mm256_and_si256(EQ(b1, 0x48), EQ(b2, 0x89)), EQ(b3, 0xE5));
+    frame = _mm256_and_si256(EQ(b0, 0x55), _mm256_or_si256(frame, _mm256_or_si256(EQ(b1, 0x53), EQ(b1, 0x41))));
+    __m256i subrsp = _mm256_and_si256(_mm256_and_si256(EQ(b0, 0x48), _mm256_or_si256(EQ(b1, 0x83), EQ(b1, 0x81))), EQ(b2, 0xEC));
+    __m256i pushr = _mm256_and_si256(EQ(b0, 0x41), EQ(_mm256_and_si256(b1, _mm256_set1_epi8((char)0xFC)), 0x54));
+
+    return (X86__Signatures){
+        .endbr = (uint32_t)_mm256_movemask_epi8(endbr),
+        .prologue = (uint32_t)_mm256_movemask_epi8(_mm256_or_si256(frame, _mm256_or_si256(subrsp, pushr))),
+    };
+
+    #undef EQ
+}
+#endif
+
+enum {
+    X86__FUNCS_PADDING  = 1, // int3, nop
+    X86__FUNCS_INT3     = 2,
+    X86__FUNCS_RETURN   = 4, // ret, ud2, hlt
+    X86__FUNCS_JUMP     = 8, // jmp, anything after it is only reachable from a branch
+};
+
+// rough class of the instruction at p from its opcode bytes
+static int x86__funcs_classify(const uint8_t* p, size_t length) {
+    size_t i = 0;
+    while (i + 1 < length && (p[i] == 0x66 || p[i] == 0x2E || p[i] == 0x3E || p[i] == 0xF2 || p[i] == 0xF3 || (p[i] & 0xF0) == 0x40)) {
+        i++;
+    }
+
+    uint8_t op = p[i];
+    if (op == 0xCC) return X86__FUNCS_PADDING | X86__FUNCS_INT3;
+    if (op == 0x90) return X86__FUNCS_PADDING;
+    if (op == 0x0F && i + 1 < length && p[i + 1] == 0x1F) return X86__FUNCS_PADDING;
+
+    if (op == 0xC3 || op == 0xC2 || op == 0xF4) return X86__FUNCS_RETURN;
+    if (op == 0x0F && i + 1 < length && p[i + 1] == 0x0B) return X86__FUNCS_RETURN;
+    if (op == 0xE9 || op == 0xEB) return X86__FUNCS_JUMP;
+    if (op == 0xFF && i + 1 < length && ((p[i + 1] >> 3) & 7) == 4) return X86__FUNCS_JUMP;
+    return 0;
+}
+
+size_t x86_find_functions(X86_Arena* arena, X86_Buffer code, uint64_t base_address, const uint64_t* entries, size_t entry_count, X86_FunctionRange** out) {
+    size_t n = code.length;
+    uint8_t* sources = calloc(n + 1, 1);
+    uint64_t* endbr = calloc(n / 64 + 1, sizeof(uint64_t));
+    uint64_t* prologue = calloc(n / 64 + 1, sizeof(uint64_t));
+    uint64_t* padding = calloc(n / 64 + 1, sizeof(uint64_t));
+    uint64_t* jumped = calloc(n / 64 + 1, sizeof(uint64_t));
+    uint64_t* jumped_short = calloc(n / 64 + 1, sizeof(uint64_t));
+
+    // signatures
+    X86_SimdLevel level = x86_get_simd_level();
+    for (size_t i = 0; i < n; i += 32) {
+        // vector loads reach 3 bytes past the block, the tail is copied out
+        uint8_t tmp[64];
+        const uint8_t* src = &code.data[i];
+        if (n - i < 35) {
+            memset(tmp, 0, sizeof(tmp));
+            memcpy(tmp, src, n - i);
+            src = tmp;
+        }
+
+        X86__Signatures s;
+        switch (level) {
+            #if X86__FUNCS_SIMD
+            case X86_SIMD_AVX2:  s = x86__signatures_avx2(src);  break;
+            case X86_SIMD_SSSE3: s = x86__signatures_ssse3(src); break;
+            #endif
+            default: s = x86__signatures_scalar(src); break;
+        }
+
+        // i is a multiple of 32 so a block never straddles two words
+        endbr[i / 64] |= (uint64_t)s.endbr << (i % 64);
+        prologue[i / 64] |= (uint64_t)s.prologue << (i % 64);
+    }
+
+    #define BIT(bits, i) (((bits)[(i) / 64] >> ((i) % 64)) & 1)
+
+    // sweep for boundaries, padding & calls
+    uint8_t* lengths = malloc(X86__FUNCS_BATCH);
+    int last = X86__FUNCS_RETURN; // the start of the code counts as a boundary
+    bool in_padding = false, saw_int3 = false;
+
+    size_t offset = 0;
+    while (offset < n) {
+        X86_Buffer rest = { &code.data[offset], n - offset };
+        size_t count = x86_scan_lengths(rest, lengths, X86__FUNCS_BATCH);
+        if (count == 0) {
+            // junk, whatever's after it isn't trustworthy as a boundary
+            last = 0, in_padding = false;
+            offset += 1;
+            continue;
+        }
+
+        for (size_t j = 0; j < count; j++) {
+            const uint8_t* p = &code.data[offset];
+            int cls = x86__funcs_classify(p, lengths[j]);
+
+            if (cls & X86__FUNCS_PADDING) {
+                // nops in the middle of a function are just alignment
+                if (last & (X86__FUNCS_RETURN | X86__FUNCS_JUMP) || in_padding) {
+                    in_padding = true;
+                    saw_int3 |= (cls & X86__FUNCS_INT3) != 0;
+                    for (size_t k = 0; k < lengths[j]; k++) padding[(offset + k) / 64] |= 1ull << ((offset + k) % 64);
+                }
+            } else {
+                bool boundary = (last & (X86__FUNCS_RETURN | X86__FUNCS_JUMP)) || in_padding;
+
+                if (BIT(endbr, offset)) sources[offset] |= X86_FUNC_ENDBR;
+                if (boundary && BIT(prologue, offset)) sources[offset] |= X86_FUNC_PROLOGUE;
+
+                // after a jmp, padding is usually a loop header getting aligned
+                if (in_padding && offset % 16 == 0 && ((last & X86__FUNCS_RETURN) || saw_int3)) sources[offset] |= X86_FUNC_PADDING;
+
+                // call rel32
+                if (p[0] == 0xE8 && lengths[j] == 5) {
+                    int32_t rel;
+                    memcpy(&rel, &p[1], sizeof(rel));
+
+                    uint64_t target = offset + 5 + (int64_t)rel;
+                    if (target < n) sources[target] |= X86_FUNC_CALLED;
+                }
+
+                // jmp/jcc rel8 & rel32
+                int32_t rel32;
+                int64_t rel = 0;
+                bool is_jump = true;
+                if (p[0] == 0xEB || (p[0] & 0xF0) == 0x70) {
+                    rel = (int8_t)p[1];
+                } else if (p[0] == 0xE9 && lengths[j] == 5) {
+                    memcpy(&rel32, &p[1], sizeof(rel32)), rel = rel32;
+                } else if (p[0] == 0x0F && (p[1] & 0xF0) == 0x80 && lengths[j] == 6) {
+                    memcpy(&rel32, &p[2], sizeof(rel32)), rel = rel32;
+                } else {
+                    is_jump = false;
+                }
+
+                uint64_t target = offset + lengths[j] + rel;
+                if (is_jump && target < n) {
+                    jumped[target / 64] |= 1ull << (target % 64);
+                    if (lengths[j] == 2) jumped_short[target / 64] |= 1ull << (target % 64);
+                }
+
+                last = cls, in_padding = false, saw_int3 = false;
+            }
+
+            offset += lengths[j];
+        }
+    }
+    free(lengths);
+
+    if (n > 0) sources[0] |= X86_FUNC_ENTRY;
+    for (size_t i = 0; i < entry_count; i++) {
+        if (entries[i] >= base_address && entries[i] - base_address < n) {
+            sources[entries[i] - base_address] |= X86_FUNC_ENTRY;
+        }
+    }
+
+    // padding alone is usually just an aligned block if something jumps
+    // there, same for a prologue that's the target of a rel8 (shrink wrapped
+    // slow paths). tail calls land on functions with some other signal.
+    for (size_t i = 0; i < n; i++) {
+        if ((sources[i] & ~(X86_FUNC_PROLOGUE | X86_FUNC_PADDING)) != 0) continue;
+        if (BIT(jumped_short, i) || (sources[i] == X86_FUNC_PADDING && BIT(jumped, i))) sources[i] = 0;
+    }
+
+    // ranges run up to the next start minus the padding in front of it
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) count += sources[i] != 0;
+
+    X86_FunctionRange* ranges = X86_ARENA_ARRAY(arena, X86_FunctionRange, count);
+    size_t k = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (sources[i] == 0) continue;
+
+        if (k > 0) {
+            size_t end = i;
+            while (end > ranges[k - 1].start - base_address + 1 && BIT(padding, end - 1)) end--;
+            ranges[k - 1].end = base_address + end;
+        }
+
+        ranges[k++] = (X86_FunctionRange){ base_address + i, base_address + n, sources[i] };
+    }
+
+    if (k > 0) {
+        size_t end = n;
+        while (end > ranges[k - 1].start - base_address + 1 && BIT(padding, end - 1)) end--;
+        ranges[k - 1].end = base_address + end;
+    }
+
+    #undef BIT
+
+    free(sources);
+    free(endbr);
+    free(prologue);
+    free(padding);
+    free(jumped);
+    free(jumped_short);
+
+    *out = ranges;
+    return count;
+}
@@ -0,0 +1,230 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Jump tables get recovered by slicing backwards from the indirect jmp over
+// the last few instructions of the sweep, the shapes compilers emit are:
+//
+//   cmp idx, N; ja default; jmp [table + idx*8]              (absolute)
+//   cmp idx, N; ja default; mov r, [table + idx*8]; jmp r     (absolute)
+//   cmp idx, N; ja default; lea b, [rip+table];
+//     movsxd r, [b + idx*4]; add r, b; jmp r                  (relative)
+//
+// and the MSVC flavor of the last one where b is the image base and the
+// table is a displacement off of it.
+#define X86__SLICE_WINDOW 24
+#define X86__MAX_TABLE_ENTRIES 4096
+
+static bool x86__read_memory(X86_Buffer code, uint64_t base_address, const X86_CodeRegion* memory, size_t memory_count, uint64_t address, size_t size, uint64_t* out) {
+    const uint8_t* src = NULL;
+    if (address >= base_address && address - base_address + size <= code.length) {
+        src = &code.data[address - base_address];
+    } else {
+        for (size_t i = 0; i < memory_count; i++) {
+            const X86_CodeRegion* r = &memory[i];
+            if (address >= r->address && address - r->address + size <= r->code.length) {
+                src = &r->code.data[address - r->address];
+                break;
+            }
+        }
+    }
+
+    if (src == NULL) return false;
+
+    // little endian
+    uint64_t x = 0;
+    for (size_t i = 0; i < size; i++) x |= (uint64_t)src[i] << (i * 8);
+    *out = x;
+    return true;
+}
+
+inline static bool x86__writes_reg(const X86_Inst* inst, int reg) {
+    if (inst->regs[0] != reg) return false;
+
+    // the first operand is read-only for these
+    return inst->type != X86_INST_CMP && inst->type != X86_INST_TEST && inst->type != X86_INST_PUSH;
+}
+
+// walks back from insts[i] (exclusive) for whatever defined reg, returns
+// the instruction index or -1 if something we can't follow got in the way.
+static int x86__find_def(X86_Buffer code, const uint32_t* insts, int i, int stop, int reg, X86_Inst* out) {
+    while (--i >= stop) {
+        X86_Inst inst;
+        x86_disasm(x86_advance(code, insts[i]), &inst);
+
+        X86_BranchClass branch = x86_get_branch_class(inst.type);
+        if (branch == X86_BRANCH_CALL || branch == X86_BRANCH_JMP || branch == X86_BRANCH_RET) return -1;
+        if (x86__writes_reg(&inst, reg)) {
+            *out = inst;
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+// constant value of reg right before insts[i]
+static bool x86__slice_value(X86_Buffer code, uint64_t base_address, const uint32_t* insts, int i, int stop, int reg, uint64_t* out) {
+    X86_Inst def;
+    int j = x86__find_def(code, insts, i, stop, reg, &def);
+    if (j < 0) return false;
+
+    if (def.type == X86_INST_LEA && (def.flags & X86_INSTR_USE_RIPMEM)) {
+        *out = base_address + insts[j] + def.length + (int64_t)def.disp;
+        return true;
+    } else if (def.type == X86_INST_LEA && def.base == X86_GPR_NONE && def.index == X86_GPR_NONE) {
+        *out = (int64_t)def.disp;
+        return true;
+    } else if (def.type == X86_INST_MOV && (def.flags & X86_INSTR_ABSOLUTE)) {
+        *out = def.abs;
+        return true;
+    } else if (def.type == X86_INST_MOV && (def.flags & X86_INSTR_IMMEDIATE) && !(def.flags & X86_INSTR_USE_MEMOP)) {
+        // mov r32, imm zero extends, mov r/m64, imm sign extends
+        *out = def.data_type == X86_TYPE_QWORD ? (uint64_t)(int64_t)def.imm : (uint32_t)def.imm;
+        return true;
+    }
+
+    return false;
+}
+
+// memory operand [base + index*scale + disp] -> address of entry 0 & index register
+static bool x86__table_operand(X86_Buffer code, uint64_t base_address, const uint32_t* insts, int i, int stop, const X86_Inst* inst, uint64_t* out_table, int* out_index) {
+    if ((inst->flags & X86_INSTR_USE_MEMOP) == 0 || (inst->flags & X86_INSTR_USE_RIPMEM) || inst->index == X86_GPR_NONE) {
+        return false;
+    }
+
+    uint64_t base = 0;
+    if (inst->base != X86_GPR_NONE && !x86__slice_value(code, base_address, insts, i, stop, inst->base, &base)) {
+        return false;
+    }
+
+    *out_table = base + (int64_t)inst->disp;
+    *out_index = inst->index;
+    return true;
+}
+
+// cmp idx, N followed by a ja/jae somewhere before the jmp, follows register
+// copies of the index on the way back.
+static bool x86__find_bound(X86_Buffer code, const uint32_t* insts, int i, int stop, int index, uint32_t* out_count) {
+    uint32_t aliases = 1u << index;
+    int jump_cond = -1;
+
+    while (--i >= stop) {
+        X86_Inst inst;
+        x86_disasm(x86_advance(code, insts[i]), &inst);
+
+        if (inst.type == X86_INST_JO + X86_A || inst.type == X86_INST_JO + X86_AE) {
+            if (jump_cond < 0) jump_cond = inst.type - X86_INST_JO;
+            continue;
+        }
+
+        X86_BranchClass branch = x86_get_branch_class(inst.type);
+        if (branch == X86_BRANCH_CALL || branch == X86_BRANCH_JMP || branch == X86_BRANCH_RET) return false;
+        if (inst.regs[0] < 0 || inst.regs[0] >= 16 || (aliases & (1u << inst.regs[0])) == 0) continue;
+
+        if (inst.type == X86_INST_CMP) {
+            if (jump_cond < 0 || (inst.flags & (X86_INSTR_IMMEDIATE | X86_INSTR_USE_MEMOP)) != X86_INSTR_IMMEDIATE) return false;
+
+            // ja takes N+1 entries, jae N
+            int64_t n = (int64_t)inst.imm + (jump_cond == X86_A ? 1 : 0);
+            if (n <= 0 || n > X86__MAX_TABLE_ENTRIES) return false;
+
+            *out_count = n;
+            return true;
+        }
+
+        // register copies just widen the set, anything else clobbers the index
+        bool is_copy = (inst.type == X86_INST_MOV || inst.type == X86_INST_MOVZX || inst.type == X86_INST_MOVSXD)
+            && (inst.flags & (X86_INSTR_USE_MEMOP | X86_INSTR_IMMEDIATE | X86_INSTR_ABSOLUTE)) == 0
+            && inst.regs[1] >= 0 && inst.regs[1] < 16;
+
+        if (is_copy) aliases |= 1u << inst.regs[1];
+        else if (x86__writes_reg(&inst, inst.regs[0]) && inst.type != X86_INST_LEA && inst.type != X86_INST_SUB && inst.type != X86_INST_AND) {
+            // lea/sub rebase the index & and masks it, both keep the cmp meaningful
+            return false;
+        }
+    }
+
+    return false;
+}
+
+bool x86_jump_table_target(const X86_JumpTable* jt, X86_Buffer code, uint64_t base_address, const X86_CodeRegion* memory, size_t memory_count, uint32_t i, uint64_t* out_target) {
+    uint64_t entry;
+    if (!x86__read_memory(code, base_address, memory, memory_count, jt->table + (uint64_t)i * jt->entry_size, jt->entry_size, &entry)) {
+        return false;
+    }
+
+    if (jt->entry_size == 4) entry = jt->entry_base + (int64_t)(int32_t)entry;
+    *out_target = entry;
+    return true;
+}
+
+bool x86_recover_jump_table(X86_Buffer code, uint64_t base_address, const uint32_t* insts, size_t inst_count, const X86_CodeRegion* memory, size_t memory_count, X86_JumpTable* out) {
+    if (inst_count == 0) return false;
+
+    int jmp_index = inst_count - 1;
+    int stop = jmp_index > X86__SLICE_WINDOW ? jmp_index - X86__SLICE_WINDOW : 0;
+
+    X86_Inst jmp;
+    if (x86_disasm(x86_advance(code, insts[jmp_index]), &jmp) != X86_RESULT_SUCCESS || jmp.type != X86_INST_JMP) {
+        return false;
+    }
+
+    X86_JumpTable jt = { .jump = base_address + insts[jmp_index] };
+    int slice_from = jmp_index;
+    int index;
+
+    if (jmp.flags & X86_INSTR_IMMEDIATE) {
+        return false;
+    } else if (jmp.flags & X86_INSTR_USE_MEMOP) {
+        // jmp [table + idx*8]
+        if (jmp.scale != X86_SCALE_X8 || !x86__table_operand(code, base_address, insts, jmp_index, stop, &jmp, &jt.table, &index)) {
+            return false;
+        }
+
+        jt.entry_size = 8;
+    } else {
+        X86_Inst def;
+        int j = x86__find_def(code, insts, jmp_index, stop, jmp.regs[0], &def);
+        if (j < 0) return false;
+
+        if (def.type == X86_INST_MOV && (def.flags & X86_INSTR_USE_MEMOP) && def.scale == X86_SCALE_X8) {
+            // mov r, [table + idx*8]; jmp r
+            if (!x86__table_operand(code, base_address, insts, j, stop, &def, &jt.table, &index)) return false;
+            jt.entry_size = 8;
+            slice_from = j;
+        } else if (def.type == X86_INST_ADD && !(def.flags & (X86_INSTR_USE_MEMOP | X86_INSTR_IMMEDIATE)) && def.regs[1] >= 0) {
+            // movsxd r, [table + idx*4]; add r, b; jmp r
+            if (!x86__slice_value(code, base_address, insts, j, stop, def.regs[1], &jt.entry_base)) return false;
+
+            X86_Inst load;
+            int k = x86__find_def(code, insts, j, stop, jmp.regs[0], &load);
+            if (k < 0 || (load.type != X86_INST_MOVSXD && load.type != X86_INST_MOV) || load.scale != X86_SCALE_X4) return false;
+            if (!x86__table_operand(code, base_address, insts, k, stop, &load, &jt.table, &index)) return false;
+
+            jt.entry_size = 4;
+            slice_from = k;
+        } else {
+            return false;
+        }
+    }
+
+    if (!x86__find_bound(code, insts, slice_from, stop, index, &jt.count)) {
+        return false;
+    }
+
+    // only keep the entries that land in the code, a bad one usually means
+    // the bound was wrong so stop there.
+    uint32_t valid = 0;
+    for (; valid < jt.count; valid++) {
+        uint64_t target;
+        if (!x86_jump_table_target(&jt, code, base_address, memory, memory_count, valid, &target)) break;
+        if (target < base_address || target - base_address >= code.length) break;
+    }
+
+    if (valid == 0) return false;
+    jt.count = valid;
+
+    *out = jt;
+    return true;
+}
@@ -0,0 +1,302 @@
+// Benchmarks the SIMD length pre-scan against the scalar paths and checks
+// they all agree with x86_disasm, same for the full superset decode and
+// x86_encode round trips.
+//
+//   lenbench [-b] <file>
+//   lenbench -synth <mix>
+//
+// like dis, -b means a raw binary otherwise the .text section of an ELF or
+// COFF file is used. -synth runs over 1MB of x86_synth_stream instead (gpr,
+// sse, prefix, real or uniform).
+#include <string.h>
+#include <stdint.h>
+#include <assert.h>
+#include <time.h>
+#include "disx86.h"
+
+#include "elf.h"
+#include "coff.h"
+
+static long get_nanos(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+// runs the loop enough times to get past timer noise, returns ns per pass
+#define BENCH(result, ...) do {                             \
+    long start_ = get_nanos(), elapsed_ = 0; int runs_ = 0; \
+    do {                                                    \
+        __VA_ARGS__;                                        \
+        runs_++;                                            \
+        elapsed_ = get_nanos() - start_;                    \
+    } while (elapsed_ < 200000000L);                        \
+    (result) = (double)elapsed_ / runs_;                    \
+} while (0)
+
+static const char* simd_names[] = { "scalar", "ssse3", "avx2" };
+
+static void report(const char* name, double ns, size_t insts, size_t bytes) {
+    printf("  %-24s %10.3f ms  %8.2f ns/inst  %8.1f MB/s\n",
+        name, ns / 1e6, ns / insts, (bytes / (ns / 1e9)) / 1e6);
+}
+
+// the fields x86_disasm fills in that say anything for this instruction
+static bool same_inst(const X86_Inst* a, const X86_Inst* b) {
+    if (a->type != b->type || a->data_type != b->data_type || a->segment != b->segment || a->flags != b->flags) return false;
+    if (memcmp(a->regs, b->regs, sizeof(a->regs)) != 0) return false;
+    if ((a->flags & X86_INSTR_TWO_DATA_TYPES) && a->data_type2 != b->data_type2) return false;
+
+    if ((a->flags & X86_INSTR_ABSOLUTE) && a->abs != b->abs) return false;
+    if ((a->flags & X86_INSTR_IMMEDIATE) && a->imm != b->imm) return false;
+
+    if (a->flags & X86_INSTR_USE_MEMOP) {
+        if (a->disp != b->disp) return false;
+        if ((a->flags & X86_INSTR_USE_RIPMEM) == 0) {
+            if (a->base != b->base || a->index != b->index) return false;
+            if (a->index != X86_GPR_NONE && a->scale != b->scale) return false;
+        }
+    }
+    return true;
+}
+
+static void bench(X86_Buffer text) {
+    // everything the CPU has, not just the default
+    x86_set_simd_level(X86_SIMD_AVX2);
+    X86_SimdLevel best = x86_get_simd_level();
+
+    // the decoder still asserts on a few encodings, stick to the part that
+    // decodes so every path sees the same bytes.
+    uint8_t* lengths = malloc(text.length);
+    uint8_t* other = malloc(text.length);
+
+    x86_set_simd_level(X86_SIMD_SCALAR);
+    size_t count = x86_scan_lengths(text, lengths, text.length);
+
+    size_t span = 0;
+    for (size_t i = 0; i < count; i++) span += lengths[i];
+    X86_Buffer in = { text.data, span };
+
+    printf("%zu instructions, %zu of %zu bytes decode (best SIMD: %s)\n\n", count, span, text.length, simd_names[best]);
+    if (count == 0) {
+        free(lengths), free(other);
+        return;
+    }
+
+    // everything has to agree with the full decoder
+    size_t pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        X86_Inst inst;
+        x86_disasm((X86_Buffer){ in.data + pos, in.length - pos }, &inst);
+        if (inst.length != lengths[i]) {
+            fprintf(stderr, "error: length mismatch at %zx (disasm %d, length %d)\n", pos, inst.length, lengths[i]);
+            exit(1);
+        }
+        pos += lengths[i];
+    }
+
+    for (int level = X86_SIMD_SSSE3; level <= (int)best; level++) {
+        x86_set_simd_level(level);
+        if (x86_scan_lengths(in, other, count) != count || memcmp(lengths, other, count) != 0) {
+            fprintf(stderr, "error: %s linear sweep doesn't match scalar\n", simd_names[level]);
+            exit(1);
+        }
+    }
+
+    // encoding has to decode back into the same thing and never be longer,
+    // except where x86_disasm reads a longer form (disp8 off rbp with an
+    // index decodes as no base).
+    X86_Inst* insts = malloc(count * sizeof(X86_Inst));
+    size_t decoded = 0, encoded = 0, longer = 0;
+    pos = 0;
+    for (size_t i = 0; i < count; i++) {
+        // the lengths cover a few forms x86_disasm doesn't fill in yet
+        if (x86_disasm((X86_Buffer){ in.data + pos, in.length - pos }, &insts[i]) != X86_RESULT_SUCCESS) {
+            insts[i].type = X86_INST_NONE;
+            pos += lengths[i];
+            continue;
+        }
+        decoded += 1;
+
+        uint8_t bytes[X86_MAX_INST_LENGTH];
+        size_t length = x86_encode(&insts[i], bytes);
+        if (length != 0) {
+            X86_Inst inst;
+            if (x86_disasm((X86_Buffer){ bytes, length }, &inst) != X86_RESULT_SUCCESS || inst.length != length || !same_inst(&insts[i], &inst)) {
+                fprintf(stderr, "error: encoding of %zx doesn't round trip\n", pos);
+                exit(1);
+            }
+
+            encoded += 1;
+            longer += length > insts[i].length;
+        }
+        pos += lengths[i];
+    }
+
+    // superset only has to match between the scalar and SIMD versions
+    x86_set_simd_level(X86_SIMD_SCALAR);
+    x86_scan_lengths_superset(in, lengths);
+    for (int level = X86_SIMD_SSSE3; level <= (int)best; level++) {
+        x86_set_simd_level(level);
+        x86_scan_lengths_superset(in, other);
+        if (memcmp(lengths, other, in.length) != 0) {
+            fprintf(stderr, "error: %s superset doesn't match scalar\n", simd_names[level]);
+            exit(1);
+        }
+    }
+
+    // full superset has to match x86_disasm at every offset
+    X86_Arena arena;
+    x86_arena_init(&arena, 0);
+
+    X86_Superset ss;
+    x86_superset_build(&arena, in, 0, 1, &ss);
+    for (size_t i = 0; i < in.length; i++) {
+        X86_Inst inst;
+        bool ok = x86_disasm((X86_Buffer){ in.data + i, in.length - i }, &inst) == X86_RESULT_SUCCESS;
+        if (ss.lengths[i] != (ok ? inst.length : 0) || (ok && ss.types[i] != inst.type)) {
+            fprintf(stderr, "error: superset mismatch at %zx\n", i);
+            exit(1);
+        }
+    }
+
+    double ns;
+    printf("linear sweep:\n");
+    BENCH(ns, {
+        X86_Buffer it = in;
+        while (it.length > 0) {
+            X86_Inst inst;
+            x86_disasm(it, &inst);
+            it = x86_advance(it, inst.length);
+        }
+    });
+    report("x86_disasm", ns, count, span);
+
+    BENCH(ns, {
+        X86_Buffer it = in;
+        while (it.length > 0) it = x86_advance(it, x86_length(it));
+    });
+    report("x86_length", ns, count, span);
+
+    for (int level = X86_SIMD_SCALAR; level <= (int)best; level++) {
+        char name[64];
+        snprintf(name, sizeof(name), "x86_scan_lengths %s", simd_names[level]);
+
+        x86_set_simd_level(level);
+        BENCH(ns, x86_scan_lengths(in, other, count));
+        report(name, ns, count, span);
+    }
+
+    printf("\nsuperset (%zu offsets):\n", span);
+    for (int level = X86_SIMD_SCALAR; level <= (int)best; level++) {
+        char name[64];
+        snprintf(name, sizeof(name), "superset %s", simd_names[level]);
+
+        x86_set_simd_level(level);
+        BENCH(ns, x86_scan_lengths_superset(in, other));
+        report(name, ns, span, span);
+    }
+
+    BENCH(ns, {
+        for (size_t i = 0; i < in.length; i++) {
+            X86_Inst inst;
+            x86_disasm((X86_Buffer){ in.data + i, in.length - i }, &inst);
+        }
+    });
+    report("x86_disasm", ns, span, span);
+
+    BENCH(ns, {
+        X86_ArenaSavepoint sp = x86_arena_save(&arena);
+        x86_superset_build(&arena, in, 0, 1, &ss);
+        x86_arena_restore(&arena, sp);
+    });
+    report("x86_superset_build", ns, span, span);
+
+    printf("\nencoding (%zu of %zu decoded instructions, %zu longer than the original):\n", encoded, decoded, longer);
+    uint8_t* bytes = malloc(count * X86_MAX_INST_LENGTH);
+    BENCH(ns, {
+        size_t used;
+        for (size_t i = 0; i < count;) {
+            // skip over whatever doesn't encode
+            i += x86_encode_batch(&insts[i], count - i, bytes, count * X86_MAX_INST_LENGTH, &used);
+            i += i < count;
+        }
+    });
+    report("x86_encode_batch", ns, count, span);
+    free(bytes);
+    free(insts);
+
+    x86_arena_free(&arena);
+
+    free(lengths);
+    free(other);
+}
+
+int main(int argc, char* argv[]) {
+    bool is_binary = false;
+    const char* source_file = NULL;
+    const char* mix_name = NULL;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-b") == 0) is_binary = true;
+        else if (strcmp(argv[i], "-synth") == 0 && i + 1 < argc) mix_name = argv[++i];
+        else source_file = argv[i];
+    }
+
+    if (mix_name != NULL) {
+        for (int mix = 0; mix < X86_SYNTH_MIX_COUNT; mix++) {
+            if (strcmp(mix_name, x86_get_synth_mix_string(mix)) != 0) continue;
+
+            size_t capacity = 1 << 20;
+            uint8_t* synth = malloc(capacity);
+            bench((X86_Buffer){ synth, x86_synth_stream(mix, 0, synth, capacity, NULL) });
+            free(synth);
+            return 0;
+        }
+
+        fprintf(stderr, "error: unknown mix %s\n", mix_name);
+        return 1;
+    }
+
+    if (source_file == NULL) {
+        fprintf(stderr, "usage: %s [-b] <file> or %s -synth <mix>\n", argv[0], argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(source_file, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "error: could not open file!\n");
+        return 1;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t length = ftell(file);
+    rewind(file);
+
+    X86_Arena arena;
+    x86_arena_init(&arena, 0);
+
+    char* buffer = X86_ARENA_ARRAY(&arena, char, length);
+    fread(buffer, length, sizeof(char), file);
+    fclose(file);
+
+    X86_Buffer text = { (uint8_t*)buffer, length };
+    if (!is_binary) {
+        ELF_Context ctx = {};
+        if (!parse_elf(&arena, (uint8_t *)buffer, length, &ctx)) {
+            text.length = 0;
+            for (size_t i = 0; i < ctx.num_sects; i++) {
+                if (!strcmp(ctx.sections[i].name, ".text")) {
+                    text = (X86_Buffer){ ctx.sections[i].data.data, ctx.sections[i].data.length };
+                    break;
+                }
+            }
+        } else {
+            COFF_SectionHeader *text_section = get_text_section(buffer);
+            text = (X86_Buffer){ (uint8_t*) &buffer[text_section->raw_data_pos], text_section->raw_data_size };
+        }
+    }
+
+    bench(text);
+    x86_arena_free(&arena);
+    return 0;
+}
@@ -14,37 +14,80 @@ static long get_nanos(void) {
     return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
 }
 
-static void dissassemble_crap(X86_Buffer input) {
-    #if 0
-    long start_time = get_nanos();
-    int instruction_count = 0;
+// where the text is mapped and whatever else jump tables might live in
+typedef struct {
+    uint64_t base_address;
+    const X86_CodeRegion* memory;
+    size_t memory_count;
+} TextMapping;
+
+// -cache, the plain disassembly reads its decodes out of it
+static X86_Cache* decode_cache;
+
+static void dissassemble_crap(X86_Buffer input, const TextMapping* map) {
+    const uint8_t* start = input.data;
+    X86_Buffer text = input;
+
+    // the cached sweep covers everything but whatever comes after a jump
+    // table that doesn't end on an instruction boundary.
+    X86_DecodedSection decoded = { 0 };
+    size_t cursor = 0;
+    if (decode_cache != NULL) {
+        x86_trace_begin("decode cache", NULL);
+        bool hit = x86_cache_decode(decode_cache, input, &decoded);
+        x86_trace_end();
+
+        fprintf(stderr, "info: decode cache %s (%zu instructions)\n", hit ? "hit" : "miss", decoded.count);
+    }
+
+    // the last few instructions are kept around for jump table recovery,
+    // recovered tables get printed as data instead of decoded.
+    enum { RECENT = 32 };
+    uint32_t recent[RECENT];
+    size_t recent_count = 0;
 
+    X86_JumpTable* tables = NULL;
+    size_t table_count = 0;
+
+    fprintf(stderr, "error: disassembling %zu bytes...\n", input.length);
     while (input.length > 0) {
-        X86_Inst inst;
-        X86_ResultCode result = x86_disasm(input, &inst);
-        if (result != X86_RESULT_SUCCESS) {
-            fprintf(stderr, "disassembler error: %s (", x86_get_result_string(result));
-            for (int i = 0; i < inst.length; i++) {
-                if (i) fprintf(stderr, " ");
-                fprintf(stderr, "%x", input.data[i]);
+        uint64_t offset = input.data - start;
+
+        const X86_JumpTable* jt = NULL;
+        for (size_t i = 0; i < table_count; i++) {
+            if (tables[i].table == map->base_address + offset) jt = &tables[i];
+        }
+
+        if (jt != NULL) {
+            size_t size = (size_t)jt->count * jt->entry_size;
+            if (size > input.length) size = input.length;
+
+            for (size_t i = 0; i * jt->entry_size < size; i++) {
+                uint64_t target;
+                x86_jump_table_target(jt, text, map->base_address, map->memory, map->memory_count, i, &target);
+
+                printf("    %016llX: ", (long long)(offset + i * jt->entry_size));
+                for (int j = 0; j < jt->entry_size && j < 6; j++) printf("%02X ", input.data[i * jt->entry_size + j]);
+                for (int j = jt->entry_size; j < 6; j++) printf("   ");
+                printf("%-12s%llXh\n", jt->entry_size == 8 ? "dq" : "dd", (long long)(target - map->base_address));
             }
-            fprintf(stderr, ")\n");
 
-            abort();
+            input = x86_advance(input, size);
+            recent_count = 0;
+            continue;
         }
 
-        input = x86_advance(input, inst.length);
-        instruction_count++;
-    }
-    long end_time = get_nanos();
-    printf("Elapsed: %.3f seconds (%d instructions)\n", (end_time - start_time) / 1000000000.0, instruction_count);
-    #else
-    const uint8_t* start = input.data;
+        while (cursor < decoded.count && decoded.offsets[cursor] < offset) cursor++;
 
-    fprintf(stderr, "error: disassembling %zu bytes...\n", input.length);
-    while (input.length > 0) {
         X86_Inst inst;
-        X86_ResultCode result = x86_disasm(input, &inst);
+        X86_ResultCode result;
+        if (cursor < decoded.count && decoded.offsets[cursor] == offset) {
+            inst = decoded.insts[cursor];
+            result = X86_RESULT_SUCCESS;
+        } else {
+            result = x86_disasm(input, &inst);
+        }
+
         if (result != X86_RESULT_SUCCESS) {
             printf("disassembler error: %s (", x86_get_result_string(result));
 
@@ -55,6 +98,8 @@ static void dissassemble_crap(X86_Buffer input) {
             }
             printf(")\n");
 
+            // abort skips atexit, keep the trace up to here
+            x86_trace_write();
             abort();
         }
 
@@ -70,81 +115,9 @@ static void dissassemble_crap(X86_Buffer input) {
         while (remaining--) printf("   ");
 
         // Print some instruction
-        char tmp[32];
-        x86_format_inst(tmp, sizeof(tmp), inst.type, inst.data_type);
-        if (inst.flags & X86_INSTR_LOCK) {
-            printf("lock %-7s", tmp);
-        } else {
-            printf("%-12s", tmp);
-        }
-
-        bool has_mem_op = inst.flags & X86_INSTR_USE_MEMOP;
-        bool has_immediate = inst.flags & (X86_INSTR_IMMEDIATE | X86_INSTR_ABSOLUTE);
-
-        for (int j = 0; j < 4; j++) {
-            X86_DataType dt = inst.data_type;
-            if ((inst.flags & X86_INSTR_TWO_DATA_TYPES) != 0 && j == 1) {
-                dt = inst.data_type2;
-            }
-
-            if (inst.regs[j] == X86_GPR_NONE) {
-                // GPR_NONE is either exit or a placeholder if we've got crap
-                if (has_mem_op) {
-                    has_mem_op = false;
-
-                    if (inst.flags & X86_INSTR_USE_RIPMEM) {
-                        size_t next_rip = (input.data - start) + inst.length;
-
-                        snprintf(tmp, sizeof(tmp), "%s ptr [%016"PRIX64"h]", x86_get_data_type_string(dt), next_rip + inst.disp);
-                    } else {
-                        int l = snprintf(tmp, sizeof(tmp), "%s ptr ", x86_get_data_type_string(dt));
-                        if (l < 0 || l >= sizeof(tmp)) abort();
-
-                        X86_Operand dummy = {
-                            X86_OPERAND_MEM,
-                            .mem = {
-                                inst.base, inst.index, inst.scale, inst.disp
-                            }
-                        };
-                        x86_format_operand(tmp + l, sizeof(tmp) - l, &dummy, dt);
-                    }
-                } else if (has_immediate) {
-                    has_immediate = false;
-
-                    int64_t val = (inst.flags & X86_INSTR_ABSOLUTE ? inst.abs : inst.imm);
-                    if (val < 0) {
-                        snprintf(tmp, sizeof(tmp), "-%"PRIX64"h", (long long) -val);
-                    } else {
-                        snprintf(tmp, sizeof(tmp), "%"PRIX64"h", (long long) val);
-                    }
-                } else {
-                    break;
-                }
-            } else {
-                bool use_xmm = (inst.flags & X86_INSTR_XMMREG);
-
-                // hack for MOVQ which does xmm and gpr in the same instruction
-                if (inst.type == X86_INST_MOVQ) {
-                    if (j != ((inst.flags & X86_INSTR_DIRECTION) ? 1 : 0)) use_xmm = true;
-                } else if (inst.type == X86_INST_MOVSXD) {
-                    if (j == 0) dt = X86_TYPE_QWORD;
-                }
-
-                X86_Operand dummy = {
-                    use_xmm ? X86_OPERAND_XMM : X86_OPERAND_GPR, .gpr = inst.regs[j]
-                };
-
-                if (dummy.type == X86_OPERAND_GPR && X86_IS_HIGH_GPR(inst.regs[j])) {
-                    dummy.gpr = X86_GET_HIGH_GPR(inst.regs[j]);
-                }
-                x86_format_operand(tmp, sizeof(tmp), &dummy, dt);
-            }
-
-            if (j) printf(",");
-            printf("%s", tmp);
-        }
-
-        printf("\n");
+        char line[128];
+        x86_format_line(line, sizeof(line), &inst, input.data - start);
+        printf("%s\n", line);
 
         if (inst.length > 6) {
             printf("                      ");
@@ -163,9 +136,416 @@ static void dissassemble_crap(X86_Buffer input) {
             printf("\n");
         }
 
+        if (recent_count == RECENT) {
+            memmove(recent, recent + 1, (RECENT - 1) * sizeof(uint32_t));
+            recent_count--;
+        }
+        recent[recent_count++] = offset;
+
+        X86_JumpTable found;
+        if (inst.type == X86_INST_JMP && (inst.flags & X86_INSTR_IMMEDIATE) == 0 &&
+            x86_recover_jump_table(text, map->base_address, recent, recent_count, map->memory, map->memory_count, &found)) {
+            tables = realloc(tables, (table_count + 1) * sizeof(X86_JumpTable));
+            tables[table_count++] = found;
+        }
+
         input = x86_advance(input, inst.length);
     }
-    #endif
+
+    free(tables);
+    x86_decoded_release(&decoded);
+}
+
+static const char* edge_kind_names[] = { "fallthrough", "jump", "taken", "not-taken", "switch" };
+static const char* branch_names[] = { "", "jmp", "jcc", "call", "ret", "int", "trap" };
+
+static void dump_cfg(X86_Arena* arena, X86_Buffer input, const TextMapping* map) {
+    X86_CFG cfg;
+    if (!x86_cfg_build(arena, input, map->base_address, NULL, 0, map->memory, map->memory_count, &cfg)) {
+        fprintf(stderr, "error: code is too big for a CFG!\n");
+        return;
+    }
+
+    fprintf(stderr, "info: %u blocks, %u edges, %u instructions\n", cfg.block_count, cfg.edge_count, cfg.inst_count);
+    for (uint32_t i = 0; i < cfg.block_count; i++) {
+        const X86_Block* b = &cfg.blocks[i];
+        printf("block %u [%016llX, %016llX) %u insts %s", i, (unsigned long long)(cfg.base_address + b->start), (unsigned long long)(cfg.base_address + b->end), b->inst_count, branch_names[b->terminator]);
+        if (b->flags & X86_BLOCK_ENTRY) printf(" entry");
+        if (b->flags & X86_BLOCK_CALL_TARGET) printf(" call-target");
+        if (b->flags & X86_BLOCK_INDIRECT) printf(" indirect");
+        if (b->flags & X86_BLOCK_EXTERNAL) printf(" external");
+        if (b->flags & X86_BLOCK_INVALID) printf(" invalid");
+        if (b->flags & X86_BLOCK_JUMP_TABLE) printf(" jump-table");
+        printf("\n");
+
+        size_t count;
+        const X86_Edge* succs = x86_cfg_succs(&cfg, i, &count);
+        for (size_t j = 0; j < count; j++) {
+            printf("  -> %u (%s)\n", succs[j].to, edge_kind_names[succs[j].kind]);
+        }
+
+        const uint32_t* preds = x86_cfg_preds(&cfg, i, &count);
+        for (size_t j = 0; j < count; j++) {
+            const X86_Edge* e = &cfg.edges[preds[j]];
+            printf("  <- %u (%s)\n", e->from, edge_kind_names[e->kind]);
+        }
+    }
+}
+
+static void dump_stack(X86_Arena* arena, X86_Buffer input, const TextMapping* map) {
+    X86_CFG cfg;
+    if (!x86_cfg_build(arena, input, map->base_address, NULL, 0, map->memory, map->memory_count, &cfg)) {
+        fprintf(stderr, "error: code is too big for a CFG!\n");
+        return;
+    }
+
+    X86_StackDeltas sd;
+    x86_stack_deltas(arena, &cfg, input, &sd);
+
+    size_t unknown = 0, unbalanced = 0;
+    for (uint32_t i = 0; i < sd.count; i++) {
+        uint32_t offset = cfg.inst_offsets[i];
+
+        X86_Inst inst;
+        x86_disasm(x86_advance(input, offset), &inst);
+
+        char name[32];
+        x86_format_inst(name, sizeof(name), inst.type, inst.data_type);
+
+        if (sd.flags[i] & X86_STACK_UNKNOWN) printf("%016llX     ?  %s", (long long)(map->base_address + offset), name), unknown++;
+        else printf("%016llX %5d  %s", (long long)(map->base_address + offset), sd.deltas[i], name);
+
+        if (sd.flags[i] & X86_STACK_UNKNOWN_WRITE) printf(" [lost]");
+        if (sd.flags[i] & X86_STACK_UNBALANCED) printf(" [unbalanced]"), unbalanced++;
+        if (sd.flags[i] & X86_STACK_ALIGNED) printf(" [aligned]");
+        printf("\n");
+    }
+
+    fprintf(stderr, "info: %u instructions, %zu unknown, %zu unbalanced\n", sd.count, unknown, unbalanced);
+}
+
+static void dump_callgraph(X86_Arena* arena, const X86_CodeRegion* regions, size_t region_count, const uint64_t* functions, const char** names, size_t function_count) {
+    X86_CallGraph cg;
+    x86_callgraph_build(arena, regions, region_count, functions, function_count, 0, &cg);
+
+    fprintf(stderr, "info: %u functions, %u edges, %zu call sites\n", cg.node_count, cg.edge_count, cg.site_count);
+    for (uint32_t i = 0; i < cg.node_count; i++) {
+        size_t count;
+        const uint32_t* callees = x86_callgraph_callees(&cg, i, &count);
+        if (count == 0) continue;
+
+        printf("%016llX", (long long)cg.nodes[i]);
+        for (size_t j = 0; j < function_count; j++) {
+            if (functions[j] == cg.nodes[i]) { printf(" %s", names[j]); break; }
+        }
+        printf("\n");
+
+        for (size_t j = 0; j < count; j++) {
+            uint32_t callee = callees[j];
+            printf("  -> %016llX", (long long)cg.nodes[callee]);
+            if (cg.node_flags[callee] & X86_NODE_INDIRECT_SLOT) printf(" [slot]");
+            for (size_t k = 0; k < function_count; k++) {
+                if (functions[k] == cg.nodes[callee]) { printf(" %s", names[k]); break; }
+            }
+            printf(" x%u\n", cg.call_counts[cg.row_start[i] + j]);
+        }
+    }
+}
+
+// executable sections, relocatable files have every section at 0 so those
+// get laid out back to back. bases is the address of every section.
+static size_t elf_code_regions(X86_Arena* arena, ELF_Context* ctx, X86_CodeRegion** out_regions, uint64_t** out_bases) {
+    bool relocatable = ctx->file_type == ft_relocatable;
+    uint64_t* bases = X86_ARENA_ZARRAY(arena, uint64_t, ctx->num_sects);
+    X86_CodeRegion* regions = X86_ARENA_ARRAY(arena, X86_CodeRegion, ctx->num_sects);
+    size_t region_count = 0;
+
+    uint64_t next = 0;
+    for (size_t i = 0; i < ctx->num_sects; i++) {
+        Section* s = &ctx->sections[i];
+        if ((s->flags & sf_executable) == 0 || s->data.length == 0) continue;
+
+        bases[i] = relocatable ? next : s->addr;
+        next += (s->data.length + 15) & ~15ull;
+
+        regions[region_count++] = (X86_CodeRegion){ { s->data.data, s->data.length }, bases[i] };
+    }
+
+    *out_regions = regions;
+    if (out_bases) *out_bases = bases;
+    return region_count;
+}
+
+// function symbols on top of the code regions
+static void elf_callgraph(X86_Arena* arena, ELF_Context* ctx) {
+    bool relocatable = ctx->file_type == ft_relocatable;
+
+    X86_CodeRegion* regions;
+    uint64_t* bases;
+    size_t region_count = elf_code_regions(arena, ctx, &regions, &bases);
+
+    uint64_t* functions = X86_ARENA_ARRAY(arena, uint64_t, ctx->num_syms);
+    const char** names = X86_ARENA_ARRAY(arena, const char*, ctx->num_syms);
+    size_t function_count = 0;
+    for (size_t i = 0; i < ctx->num_syms; i++) {
+        ELF_Symbol* sym = &ctx->syms[i];
+        if (sym->type != stt_func || sym->section_idx == 0 || sym->section_idx >= ctx->num_sects) continue;
+
+        functions[function_count] = relocatable ? bases[sym->section_idx] + sym->value : sym->value;
+        names[function_count] = sym->name;
+        function_count++;
+    }
+
+    dump_callgraph(arena, regions, region_count, functions, names, function_count);
+}
+
+static void dump_funcs(X86_Arena* arena, X86_Buffer input, const TextMapping* map) {
+    X86_FunctionRange* funcs;
+    size_t count = x86_find_functions(arena, input, map->base_address, NULL, 0, &funcs);
+
+    fprintf(stderr, "info: %zu functions\n", count);
+    for (size_t i = 0; i < count; i++) {
+        const X86_FunctionRange* f = &funcs[i];
+        printf("%016llX-%016llX %6llu", (long long)f->start, (long long)f->end, (long long)(f->end - f->start));
+        if (f->sources & X86_FUNC_ENTRY) printf(" entry");
+        if (f->sources & X86_FUNC_ENDBR) printf(" endbr");
+        if (f->sources & X86_FUNC_PROLOGUE) printf(" prologue");
+        if (f->sources & X86_FUNC_CALLED) printf(" called");
+        if (f->sources & X86_FUNC_PADDING) printf(" padding");
+        printf("\n");
+    }
+}
+
+static const char* data_type_names[] = {
+    "none", "byte", "word", "dword", "qword", "pbyte", "pword", "pdword", "pqword",
+    "ss", "sd", "ps", "pd", "xmmword",
+};
+
+static bool stats_csv = false;
+static int thread_count = 1;
+
+typedef struct {
+    const char* name;
+    uint64_t count;
+} StatRow;
+
+static int cmp_stat_rows(const void* a, const void* b) {
+    const StatRow* x = a;
+    const StatRow* y = b;
+    if (x->count != y->count) return x->count < y->count ? 1 : -1;
+    return strcmp(x->name, y->name);
+}
+
+// rows are sorted by count, zeros are skipped
+static void print_stat_rows(const char* section, StatRow* rows, size_t count, uint64_t total) {
+    qsort(rows, count, sizeof(StatRow), cmp_stat_rows);
+
+    if (!stats_csv) printf("\n%s:\n", section);
+    for (size_t i = 0; i < count && rows[i].count > 0; i++) {
+        if (stats_csv) printf("%s,%s,%" PRIu64 "\n", section, rows[i].name, rows[i].count);
+        else printf("  %-16s %12" PRIu64 "  %6.2f%%\n", rows[i].name, rows[i].count, total ? (100.0 * rows[i].count) / total : 0.0);
+    }
+}
+
+static void dump_stats(X86_Arena* arena, X86_Buffer input, const TextMapping* map) {
+    // functions make for nice work units, padding stays with the function
+    // before it so every byte gets counted.
+    X86_FunctionRange* funcs;
+    size_t func_count = x86_find_functions(arena, input, map->base_address, NULL, 0, &funcs);
+
+    X86_CodeRegion* regions = X86_ARENA_ARRAY(arena, X86_CodeRegion, func_count);
+    for (size_t i = 0; i < func_count; i++) {
+        uint64_t start = funcs[i].start - map->base_address;
+        uint64_t end = i + 1 < func_count ? funcs[i + 1].start - map->base_address : input.length;
+        regions[i] = (X86_CodeRegion){ { &input.data[start], end - start }, funcs[i].start };
+    }
+
+    long start_time = get_nanos();
+    X86_Stats* stats = X86_ARENA_NEW(arena, X86_Stats);
+    x86_stats_collect(regions, func_count, thread_count, stats);
+    long elapsed = get_nanos() - start_time;
+
+    fprintf(stderr, "info: %" PRIu64 " instructions in %.3f ms (%d threads)\n", stats->inst_count, elapsed / 1e6, thread_count);
+
+    StatRow rows[X86_INST_COUNT];
+    if (stats_csv) {
+        printf("section,name,count\n");
+        printf("total,instructions,%" PRIu64 "\n", stats->inst_count);
+        printf("total,bytes,%" PRIu64 "\n", stats->byte_count);
+        printf("total,invalid_bytes,%" PRIu64 "\n", stats->invalid_bytes);
+    } else {
+        printf("%" PRIu64 " instructions, %" PRIu64 " bytes, %" PRIu64 " invalid bytes\n", stats->inst_count, stats->byte_count, stats->invalid_bytes);
+    }
+
+    char* names = X86_ARENA_ARRAY(arena, char, X86_INST_COUNT * 16);
+    for (size_t i = 0; i < X86_INST_COUNT; i++) {
+        x86_format_inst(&names[i * 16], 16, i, X86_TYPE_NONE);
+        rows[i] = (StatRow){ &names[i * 16], stats->types[i] };
+    }
+    print_stat_rows("type", rows, X86_INST_COUNT, stats->inst_count);
+
+    for (size_t i = 0; i < X86_STATS_DATA_TYPES; i++) rows[i] = (StatRow){ data_type_names[i], stats->data_types[i] };
+    print_stat_rows("data_type", rows, X86_STATS_DATA_TYPES, stats->inst_count);
+
+    for (size_t i = 0; i < X86_FORM_COUNT; i++) rows[i] = (StatRow){ x86_get_operand_form_string(i), stats->forms[i] };
+    print_stat_rows("form", rows, X86_FORM_COUNT, stats->inst_count);
+
+    for (size_t i = 0; i < X86_PREFIX_COUNT; i++) rows[i] = (StatRow){ x86_get_prefix_string(i), stats->prefixes[i] };
+    print_stat_rows("prefix", rows, X86_PREFIX_COUNT, stats->inst_count);
+
+    static const char* length_names[16] = { "0", "1", "2", "3", "4", "5", "6", "7", "8", "9", "10", "11", "12", "13", "14", "15" };
+    for (size_t i = 0; i < 16; i++) rows[i] = (StatRow){ length_names[i], stats->lengths[i] };
+    print_stat_rows("length", rows, 16, stats->inst_count);
+}
+
+#define MAX_PATTERNS 64
+
+static const char* patterns[MAX_PATTERNS];
+static size_t pattern_count;
+
+static void dump_matches(X86_Arena* arena, const X86_CodeRegion* regions, size_t region_count) {
+    char error[256];
+    X86_PatternSet* set = x86_pattern_compile(arena, patterns, pattern_count, error, sizeof(error));
+    if (set == NULL) {
+        fprintf(stderr, "error: %s\n", error);
+        return;
+    }
+
+    long start_time = get_nanos();
+    X86_Match* matches;
+    size_t count = x86_pattern_search(arena, set, regions, region_count, thread_count, &matches);
+    long elapsed = get_nanos() - start_time;
+
+    fprintf(stderr, "info: %zu matches in %.3f ms\n", count, elapsed / 1e6);
+    for (size_t i = 0; i < count; i++) {
+        printf("%016llX %4u  %s\n", (long long)matches[i].address, matches[i].length, patterns[matches[i].pattern]);
+    }
+}
+
+#define MAX_QUERIES 64
+
+static uint64_t xref_queries[MAX_QUERIES];
+static size_t xref_query_count;
+
+static void print_xref_kind(uint8_t kind) {
+    static const char* names[] = { "call", "jump", "branch", "read", "write", "address", "absolute" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        if (kind & (1u << i)) printf(" %s", names[i]);
+    }
+    printf("\n");
+}
+
+// without -xref queries everything gets listed by target
+static void dump_xrefs(X86_Arena* arena, const X86_CodeRegion* regions, size_t region_count) {
+    long start_time = get_nanos();
+    X86_XrefIndex index;
+    x86_xref_build(arena, regions, region_count, thread_count, &index);
+    long elapsed = get_nanos() - start_time;
+
+    fprintf(stderr, "info: %zu xrefs in %.3f ms\n", index.count, elapsed / 1e6);
+    if (xref_query_count == 0) {
+        for (size_t i = 0; i < index.count; i++) {
+            const X86_Xref* x = &index.xrefs[index.by_target[i]];
+            printf("%016llX <- %016llX", (long long)x->target, (long long)x->source);
+            print_xref_kind(x->kind);
+        }
+        return;
+    }
+
+    for (size_t i = 0; i < xref_query_count; i++) {
+        uint64_t address = xref_queries[i];
+        printf("%016llX:\n", (long long)address);
+
+        size_t count;
+        const uint32_t* to = x86_xref_to(&index, address, &count);
+        for (size_t j = 0; j < count; j++) {
+            printf("  <- %016llX", (long long)index.xrefs[to[j]].source);
+            print_xref_kind(index.xrefs[to[j]].kind);
+        }
+
+        const X86_Xref* from = x86_xref_from(&index, address, &count);
+        for (size_t j = 0; j < count; j++) {
+            printf("  -> %016llX", (long long)from[j].target);
+            print_xref_kind(from[j].kind);
+        }
+    }
+}
+
+static uint64_t at_queries[MAX_QUERIES];
+static size_t at_query_count;
+
+static void print_indexed(const X86_AddrIndex* index, X86_Buffer input, const TextMapping* map, const char* label, size_t i) {
+    if (i == SIZE_MAX) {
+        printf("  %-8s -\n", label);
+        return;
+    }
+
+    uint32_t offset = x86_addr_index_offset(index, i);
+    printf("  %-8s %016llX: ", label, (long long)(map->base_address + offset));
+    for (int j = 0; j < index->lengths[i]; j++) printf("%02X ", input.data[offset + j]);
+
+    X86_Inst inst;
+    char name[32];
+    x86_disasm(x86_advance(input, offset), &inst);
+    x86_format_inst(name, sizeof(name), inst.type, inst.data_type);
+    printf(" %s\n", name);
+}
+
+// the instruction covering each -at address and its neighbours
+static void dump_at(X86_Arena* arena, X86_Buffer input, const TextMapping* map) {
+    long start_time = get_nanos();
+    X86_AddrIndex index;
+    x86_addr_index_build(arena, input, &index);
+    long elapsed = get_nanos() - start_time;
+
+    size_t bytes = index.count * 3 + index.block_count * 8;
+    fprintf(stderr, "info: indexed %zu instructions in %.3f ms (%zu bytes)\n", index.count, elapsed / 1e6, bytes);
+
+    for (size_t i = 0; i < at_query_count; i++) {
+        uint64_t address = at_queries[i];
+        printf("%016llX:\n", (long long)address);
+        if (address < map->base_address || address - map->base_address >= input.length) {
+            printf("  outside the section\n");
+            continue;
+        }
+
+        uint32_t offset = address - map->base_address;
+        size_t at = x86_addr_index_find(&index, offset);
+        print_indexed(&index, input, map, "prev", x86_addr_index_prev(&index, at != SIZE_MAX ? x86_addr_index_offset(&index, at) : offset));
+        print_indexed(&index, input, map, "at", at);
+        print_indexed(&index, input, map, "next", x86_addr_index_next(&index, offset));
+    }
+}
+
+static enum {
+    MODE_DISASM,
+    MODE_CFG,
+    MODE_CALLGRAPH,
+    MODE_FUNCS,
+    MODE_STATS,
+    MODE_FIND,
+    MODE_XREFS,
+    MODE_STACK,
+    MODE_AT,
+} mode = MODE_DISASM;
+
+// trace span for the whole mode
+static const char* mode_names[] = {
+    "disassemble", "cfg", "callgraph", "funcs", "stats", "find", "xrefs", "stack", "at"
+};
+
+static void process_text(X86_Arena* arena, X86_Buffer input, const TextMapping* map) {
+    x86_trace_begin(mode_names[mode], NULL);
+    if (mode == MODE_CFG) dump_cfg(arena, input, map);
+    else if (mode == MODE_CALLGRAPH) dump_callgraph(arena, &(X86_CodeRegion){ input, map->base_address }, 1, NULL, NULL, 0);
+    else if (mode == MODE_FUNCS) dump_funcs(arena, input, map);
+    else if (mode == MODE_STATS) dump_stats(arena, input, map);
+    else if (mode == MODE_FIND) dump_matches(arena, &(X86_CodeRegion){ input, map->base_address }, 1);
+    else if (mode == MODE_XREFS) dump_xrefs(arena, &(X86_CodeRegion){ input, map->base_address }, 1);
+    else if (mode == MODE_STACK) dump_stack(arena, input, map);
+    else if (mode == MODE_AT) dump_at(arena, input, map);
+    else dissassemble_crap(input, map);
+    x86_trace_end();
 }
 
 int main(int argc, char* argv[]) {
@@ -180,8 +560,49 @@ int main(int argc, char* argv[]) {
 
     bool is_binary = false;
     const char* source_file = NULL;
+    const char* trace_path = NULL;
+    const char* cache_dir = NULL;
+    uint64_t cache_size = 256;
     for (int i = 1; i < argc; i++) {
         if (strcmp(argv[i], "-b") == 0) is_binary = true;
+        else if (strcmp(argv[i], "-cfg") == 0) mode = MODE_CFG;
+        else if (strcmp(argv[i], "-callgraph") == 0) mode = MODE_CALLGRAPH;
+        else if (strcmp(argv[i], "-funcs") == 0) mode = MODE_FUNCS;
+        else if (strcmp(argv[i], "-stats") == 0) mode = MODE_STATS;
+        else if (strcmp(argv[i], "-csv") == 0) mode = MODE_STATS, stats_csv = true;
+        else if (strcmp(argv[i], "-j") == 0 && i + 1 < argc) thread_count = atoi(argv[++i]);
+        else if (strcmp(argv[i], "-find") == 0 && i + 1 < argc) {
+            if (pattern_count == MAX_PATTERNS) {
+                fprintf(stderr, "error: too many patterns!\n");
+                return 1;
+            }
+
+            mode = MODE_FIND;
+            patterns[pattern_count++] = argv[++i];
+        }
+        else if (strcmp(argv[i], "-xrefs") == 0) mode = MODE_XREFS;
+        else if (strcmp(argv[i], "-stack") == 0) mode = MODE_STACK;
+        else if (strcmp(argv[i], "-trace") == 0 && i + 1 < argc) trace_path = argv[++i];
+        else if (strcmp(argv[i], "-cache") == 0 && i + 1 < argc) cache_dir = argv[++i];
+        else if (strcmp(argv[i], "-cache-size") == 0 && i + 1 < argc) cache_size = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-xref") == 0 && i + 1 < argc) {
+            if (xref_query_count == MAX_QUERIES) {
+                fprintf(stderr, "error: too many queries!\n");
+                return 1;
+            }
+
+            mode = MODE_XREFS;
+            xref_queries[xref_query_count++] = strtoull(argv[++i], NULL, 16);
+        }
+        else if (strcmp(argv[i], "-at") == 0 && i + 1 < argc) {
+            if (at_query_count == MAX_QUERIES) {
+                fprintf(stderr, "error: too many queries!\n");
+                return 1;
+            }
+
+            mode = MODE_AT;
+            at_queries[at_query_count++] = strtoull(argv[++i], NULL, 16);
+        }
         else {
             if (source_file != NULL) {
                 fprintf(stderr, "error: can't hecking open multiple files!\n");
@@ -192,9 +613,24 @@ int main(int argc, char* argv[]) {
         }
     }
 
+    // stage timings as chrome trace JSON, written at exit
+    if (trace_path != NULL && !x86_trace_start(trace_path)) {
+        fprintf(stderr, "error: could not start tracing!\n");
+        return 1;
+    }
+
+    // decodes of sections we've seen before, -cache-size is in MiB
+    X86_Cache cache;
+    if (cache_dir != NULL) {
+        if (x86_cache_open(&cache, cache_dir, cache_size << 20)) decode_cache = &cache;
+        else fprintf(stderr, "error: could not use %s as a decode cache, decoding as usual\n", cache_dir);
+    }
+
     fprintf(stderr, "info: opening %s...\n", source_file);
+    x86_trace_begin("file", source_file);
 
     // Read sum bites
+    x86_trace_begin("read", NULL);
     FILE* file = fopen(source_file, "rb");
     if (file == NULL) {
         fprintf(stderr, "error: could not open file!\n");
@@ -205,37 +641,81 @@ int main(int argc, char* argv[]) {
     size_t length = ftell(file);
     rewind(file);
 
-    char* buffer = malloc(length * sizeof(char));
+    // the file and everything parsed out of it share one arena
+    X86_Arena arena;
+    x86_arena_init(&arena, 0);
+
+    char* buffer = X86_ARENA_ARRAY(&arena, char, length);
     fread(buffer, length, sizeof(char), file);
     fclose(file);
+    x86_trace_end();
 
     if (is_binary) {
-        dissassemble_crap((X86_Buffer){ (uint8_t*)buffer, length });
+        process_text(&arena, (X86_Buffer){ (uint8_t*)buffer, length }, &(TextMapping){ 0 });
     } else {
         ELF_Context ctx = {};
-        if (!parse_elf((uint8_t *)buffer, length, &ctx)) {
+        x86_trace_begin("parse elf", NULL);
+        bool is_elf = !parse_elf(&arena, (uint8_t *)buffer, length, &ctx);
+        x86_trace_end();
+
+        if (is_elf && mode == MODE_CALLGRAPH) {
+            x86_trace_begin(mode_names[mode], NULL);
+            elf_callgraph(&arena, &ctx);
+            x86_trace_end();
+        } else if (is_elf && (mode == MODE_FIND || mode == MODE_XREFS)) {
+            x86_trace_begin(mode_names[mode], NULL);
+            X86_CodeRegion* regions;
+            size_t region_count = elf_code_regions(&arena, &ctx, &regions, NULL);
+            if (mode == MODE_FIND) dump_matches(&arena, regions, region_count);
+            else dump_xrefs(&arena, regions, region_count);
+            x86_trace_end();
+        } else if (is_elf) {
             uint8_t *text_start = NULL;
             uint64_t text_size = 0;
+            TextMapping map = { 0 };
 
-            for (int i = 0; i < ctx.num_sects; i++) {
+            for (size_t i = 0; i < ctx.num_sects; i++) {
                 Section s = ctx.sections[i];
                 if (!strcmp(s.name, ".text")) {
                     text_start = s.data.data;
                     text_size = s.data.length;
+                    map.base_address = s.addr;
                     break;
                 }
             }
+
+            // sections in relocatable files all sit at 0, nothing to read there
+            if (ctx.file_type != ft_relocatable) {
+                X86_CodeRegion* memory = X86_ARENA_ARRAY(&arena, X86_CodeRegion, ctx.num_sects);
+                for (size_t i = 0; i < ctx.num_sects; i++) {
+                    Section s = ctx.sections[i];
+                    if ((s.flags & sf_alloc) && s.data.length) {
+                        memory[map.memory_count++] = (X86_CodeRegion){ { s.data.data, s.data.length }, s.addr };
+                    }
+                }
+                map.memory = memory;
+            }
             if (!text_start) {
                 fprintf(stderr, "error: could not find .text section in ELF file!\n");
             }
 
-            dissassemble_crap((X86_Buffer){ text_start, text_size });
+            process_text(&arena, (X86_Buffer){ text_start, text_size }, &map);
         } else {
+            x86_trace_begin("parse coff", NULL);
             COFF_SectionHeader *text_section = get_text_section(buffer);
+            x86_trace_end();
+
             const uint8_t* text_section_start = (uint8_t*) &buffer[text_section->raw_data_pos];
-            dissassemble_crap((X86_Buffer){ text_section_start, text_section->raw_data_size });
+            process_text(&arena, (X86_Buffer){ text_section_start, text_section->raw_data_size }, &(TextMapping){ 0 });
         }
     }
 
+    // whatever stdout still has buffered
+    x86_trace_begin("write", NULL);
+    fflush(stdout);
+    x86_trace_end();
+    x86_trace_end();
+
+    x86_arena_free(&arena);
     return 0;
 }
@@ -0,0 +1,445 @@
+// Compares the decoder against GNU objdump (objdump -d -M intel) over the
+// executable sections of ELF files: instruction boundaries and mnemonics at
+// every address objdump disassembles, then end to end throughput and peak
+// RSS of both doing the whole file.
+//
+//   objcmp [-max n] [-objdump path] files...
+//
+// both sides run as freshly exec'd processes so the timing and RSS are per
+// file, our side is objcmp itself again with -ours which decodes & formats
+// every executable section into /dev/null same as objdump does. they run
+// before we load anything so the peak RSS is theirs and not ours. -max caps
+// how many mismatches get printed per file (20 by default). POSIX only,
+// objdump has to be on the PATH unless -objdump says otherwise.
+#include <string.h>
+#include <stdint.h>
+#include <inttypes.h>
+#include <assert.h>
+#include <time.h>
+#include <ctype.h>
+#include <stdarg.h>
+#include "disx86.h"
+
+#include "elf.h"
+
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/wait.h>
+#include <sys/resource.h>
+
+static long get_nanos(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (long)ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+static bool load_elf(X86_Arena* arena, const char* path, ELF_Context* ctx) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "error: could not open %s!\n", path);
+        return false;
+    }
+
+    fseek(file, 0, SEEK_END);
+    size_t length = ftell(file);
+    rewind(file);
+
+    char* buffer = X86_ARENA_ARRAY(arena, char, length);
+    fread(buffer, length, sizeof(char), file);
+    fclose(file);
+
+    // parse_elf complains on stdout
+    *ctx = (ELF_Context){};
+    if (length < 4 || memcmp(buffer, "\x7f" "ELF", 4) != 0 || parse_elf(arena, (uint8_t*)buffer, length, ctx)) {
+        fprintf(stderr, "error: %s isn't an ELF file!\n", path);
+        return false;
+    }
+
+    return true;
+}
+
+////////////////////////////////
+// Our side
+////////////////////////////////
+// snprintf onto the end of line, l never goes past the end so a long
+// instruction just gets cut off.
+static size_t line_append(char* line, size_t cap, size_t l, const char* fmt, ...) {
+    va_list args;
+    va_start(args, fmt);
+    int n = vsnprintf(line + l, cap - l, fmt, args);
+    va_end(args);
+
+    if (n < 0) return l;
+    return l + n < cap ? l + n : cap - 1;
+}
+
+// what objdump -d does: every executable section, address, bytes & text
+static void disassemble_all(const ELF_Context* ctx, FILE* out) {
+    for (size_t i = 0; i < ctx->num_sects; i++) {
+        const Section* s = &ctx->sections[i];
+        if ((s->flags & sf_executable) == 0 || s->data.length == 0) continue;
+
+        X86_Buffer code = { s->data.data, s->data.length };
+        fprintf(out, "\nDisassembly of section %s:\n", s->name);
+
+        size_t offset = 0;
+        while (offset < code.length) {
+            char line[256];
+            size_t l = line_append(line, sizeof(line), 0, "%8"PRIx64":\t", (uint64_t)(s->addr + offset));
+
+            X86_Inst inst;
+            bool decoded = x86_disasm(x86_advance(code, offset), &inst) == X86_RESULT_SUCCESS && inst.length > 0;
+            size_t length = decoded ? inst.length : 1;
+
+            for (size_t j = 0; j < length; j++) l = line_append(line, sizeof(line), l, "%02x ", code.data[offset + j]);
+            l = line_append(line, sizeof(line), l, "\t");
+            if (decoded) x86_format_line(line + l, sizeof(line) - l, &inst, s->addr + offset);
+            else line_append(line, sizeof(line), l, "(bad)");
+
+            fprintf(out, "%s\n", line);
+            offset += length;
+        }
+    }
+}
+
+////////////////////////////////
+// Child processes
+////////////////////////////////
+typedef struct {
+    bool ok;
+    double seconds;
+    long peak_rss_kb;
+} RunResult;
+
+static RunResult wait_child(pid_t pid, long start) {
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) < 0) return (RunResult){ false };
+
+    return (RunResult){
+        WIFEXITED(status) && WEXITSTATUS(status) == 0,
+        (get_nanos() - start) / 1e9,
+        usage.ru_maxrss
+    };
+}
+
+// fork + exec rather than posix_spawn, a vfork'd child shares our memory
+// until the exec and the kernel counts our peak RSS as its own. a forked one
+// only starts out with what we have mapped right now. stdout goes to fd (-1
+// is /dev/null), path is tried before argv[0] on the PATH.
+static pid_t spawn(const char* path, char* argv[], int fd) {
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid != 0) return pid;
+
+    if (fd < 0) fd = open("/dev/null", O_WRONLY);
+    if (fd < 0 || dup2(fd, STDOUT_FILENO) < 0) _exit(127);
+
+    if (path != NULL) execv(path, argv);
+    execvp(argv[0], argv);
+    _exit(127);
+}
+
+static pid_t spawn_objdump(const char* objdump, const char* path, int fd) {
+    char* argv[] = { (char*)objdump, "-d", "-w", "-M", "intel", (char*)path, NULL };
+    return spawn(NULL, argv, fd);
+}
+
+static RunResult run_objdump(const char* objdump, const char* path) {
+    long start = get_nanos();
+    pid_t pid = spawn_objdump(objdump, path, -1);
+    if (pid < 0) return (RunResult){ false };
+
+    return wait_child(pid, start);
+}
+
+// -ours, what gets timed for our side
+static int disassemble_file(const char* path) {
+    X86_Arena arena;
+    x86_arena_init(&arena, 0);
+
+    ELF_Context ctx;
+    if (!load_elf(&arena, path, &ctx)) return 1;
+
+    FILE* out = fopen("/dev/null", "wb");
+    if (out == NULL) return 1;
+
+    disassemble_all(&ctx, out);
+    fclose(out);
+    x86_arena_free(&arena);
+    return 0;
+}
+
+// a fresh exec of ourselves, in process we'd be timing the comparison's
+// memory along with it.
+static RunResult run_ours(const char* self, const char* path) {
+    char* argv[] = { (char*)self, "-ours", (char*)path, NULL };
+
+    long start = get_nanos();
+    pid_t pid = spawn("/proc/self/exe", argv, -1);
+    if (pid < 0) return (RunResult){ false };
+
+    return wait_child(pid, start);
+}
+
+////////////////////////////////
+// Comparison
+////////////////////////////////
+// prefixes objdump spells out in front of the mnemonic, the decoder folds
+// them into flags (or ignores them)
+static const char* objdump_prefixes[] = {
+    "lock", "rep", "repz", "repe", "repnz", "repne", "bnd", "notrack",
+    "data16", "data32", "addr32", "cs", "ds", "es", "ss", "fs", "gs",
+};
+
+static bool is_objdump_prefix(const char* word) {
+    if (strncmp(word, "rex", 3) == 0) return true;
+
+    for (size_t i = 0; i < sizeof(objdump_prefixes) / sizeof(objdump_prefixes[0]); i++) {
+        if (strcmp(word, objdump_prefixes[i]) == 0) return true;
+    }
+    return false;
+}
+
+// both spellings of the same instruction, objdump's first. nothing else
+// counts as a match, string ops included: objdump leaves the size off the
+// mnemonic (movs BYTE PTR ...) where we put it on (movsb).
+static const char* mnemonic_aliases[][2] = {
+    { "je", "jz" },        { "jne", "jnz" },      { "jae", "jnb" },      { "jb", "jc" },
+    { "jbe", "jna" },      { "ja", "jnbe" },      { "jge", "jnl" },      { "jl", "jnge" },
+    { "jle", "jng" },      { "jg", "jnle" },      { "jp", "jpe" },       { "jnp", "jpo" },
+    { "sete", "setz" },    { "setne", "setnz" },  { "setae", "setnb" },  { "setb", "setc" },
+    { "setbe", "setna" },  { "seta", "setnbe" },  { "setge", "setnl" },  { "setl", "setnge" },
+    { "setle", "setng" },  { "setg", "setnle" },  { "setp", "setpe" },   { "setnp", "setpo" },
+    { "cmove", "cmovz" },  { "cmovne", "cmovnz" }, { "cmovae", "cmovnb" }, { "cmovb", "cmovc" },
+    { "cmovbe", "cmovna" }, { "cmova", "cmovnbe" }, { "cmovge", "cmovnl" }, { "cmovl", "cmovnge" },
+    { "cmovle", "cmovng" }, { "cmovg", "cmovnle" }, { "cmovp", "cmovpe" }, { "cmovnp", "cmovpo" },
+    { "shl", "sal" },      { "movabs", "mov" },   { "cwtl", "cwde" },    { "cltq", "cdqe" },
+    { "cltd", "cdq" },     { "cqto", "cqo" },     { "iretq", "iret" },
+    { "movs", "movsb" },   { "movs", "movsw" },   { "movs", "movsd" },   { "movs", "movsq" },
+    { "stos", "stosb" },   { "stos", "stosw" },   { "stos", "stosd" },   { "stos", "stosq" },
+    { "lods", "lodsb" },   { "lods", "lodsw" },   { "lods", "lodsd" },   { "lods", "lodsq" },
+    { "scas", "scasb" },   { "scas", "scasw" },   { "scas", "scasd" },   { "scas", "scasq" },
+    { "cmps", "cmpsb" },   { "cmps", "cmpsw" },   { "cmps", "cmpsd" },   { "cmps", "cmpsq" },
+    { "ins", "insb" },     { "ins", "insw" },     { "ins", "insd" },
+    { "outs", "outsb" },   { "outs", "outsw" },   { "outs", "outsd" },
+};
+
+// the ones that only line up with these exact operands, 66 90 is the two
+// byte nop but objdump prints what it technically is.
+static const char* operand_aliases[][3] = {
+    { "xchg", "ax,ax", "nop" },
+};
+
+static bool same_mnemonic(const char* objdump, const char* operands, const char* ours) {
+    if (strcmp(objdump, ours) == 0) return true;
+
+    for (size_t i = 0; i < sizeof(mnemonic_aliases) / sizeof(mnemonic_aliases[0]); i++) {
+        if (strcmp(objdump, mnemonic_aliases[i][0]) == 0 && strcmp(ours, mnemonic_aliases[i][1]) == 0) return true;
+    }
+
+    for (size_t i = 0; i < sizeof(operand_aliases) / sizeof(operand_aliases[0]); i++) {
+        if (strcmp(objdump, operand_aliases[i][0]) == 0 && strcmp(operands, operand_aliases[i][1]) == 0 && strcmp(ours, operand_aliases[i][2]) == 0) return true;
+    }
+    return false;
+}
+
+typedef struct {
+    size_t insts;        // objdump's, (bad) ones not included
+    size_t agree;
+    size_t length_mismatch;
+    size_t mnemonic_mismatch;
+    size_t undecoded;    // objdump decodes it, we don't
+    size_t objdump_bad;  // the other way around
+    size_t printed;
+} CompareStats;
+
+// code starts at address and runs to the end of the section
+static void print_mismatch(CompareStats* stats, size_t max, uint64_t address, X86_Buffer code, size_t length, const char* objdump, const char* ours) {
+    if (stats->printed++ >= max) return;
+    if (length > code.length) length = code.length;
+
+    printf("  %08"PRIx64": ", address);
+    for (size_t i = 0; i < length; i++) printf("%02x ", code.data[i]);
+    printf("\n    objdump: %s\n    disx86:  %s\n", objdump, ours);
+}
+
+// reads objdump's listing and decodes at every address it has an
+// instruction for, so it doesn't matter where objdump resynchronizes.
+static bool compare_file(const char* objdump, const char* path, const ELF_Context* ctx, size_t max, CompareStats* stats) {
+    int fds[2];
+    if (pipe(fds) != 0) return false;
+
+    pid_t pid = spawn_objdump(objdump, path, fds[1]);
+    close(fds[1]);
+    if (pid < 0) {
+        close(fds[0]);
+        return false;
+    }
+
+    FILE* in = fdopen(fds[0], "r");
+    const Section* section = NULL;
+
+    char* line = NULL;
+    size_t line_cap = 0;
+    while (getline(&line, &line_cap, in) > 0) {
+        line[strcspn(line, "\n")] = 0;
+
+        char name[256];
+        if (sscanf(line, "Disassembly of section %255[^:]:", name) == 1) {
+            section = NULL;
+            for (size_t i = 0; i < ctx->num_sects; i++) {
+                if (strcmp(ctx->sections[i].name, name) == 0) section = &ctx->sections[i];
+            }
+            continue;
+        }
+
+        //     4004:	48 8b 05 ad ff 01 00 	mov    rax,QWORD PTR [rip+0x1ffad]
+        char* tab = strchr(line, '\t');
+        char* text = tab ? strchr(tab + 1, '\t') : NULL;
+        if (section == NULL || tab == NULL || text == NULL || tab[-1] != ':') continue;
+
+        uint64_t address = strtoull(line, NULL, 16);
+        if (address < section->addr || address >= section->addr + section->data.length) continue;
+
+        // -w puts all the bytes on one line, padded out with spaces
+        size_t offset = address - section->addr;
+        size_t length = 0;
+        for (const char* p = tab + 1; p < text; p++) {
+            if (isxdigit(p[0]) && isxdigit(p[1])) length++, p++;
+        }
+        text += 1;
+
+        if (strncmp(text, "(bad)", 5) == 0) {
+            stats->objdump_bad += 1;
+            continue;
+        }
+
+        // skip the prefixes to get the mnemonic, p ends up on the operands
+        char mnemonic[32] = { 0 };
+        const char* p = text;
+        while (*p) {
+            size_t n = strcspn(p, " ");
+            if (n == 0 || n >= sizeof(mnemonic)) break;
+
+            memcpy(mnemonic, p, n);
+            mnemonic[n] = 0;
+            p += n;
+            while (*p == ' ') p++;
+
+            if (!is_objdump_prefix(mnemonic) || *p == 0) break;
+        }
+
+        stats->insts += 1;
+
+        X86_Buffer code = { &section->data.data[offset], section->data.length - offset };
+
+        X86_Inst inst;
+        X86_ResultCode result = x86_disasm(code, &inst);
+        if (result != X86_RESULT_SUCCESS) {
+            stats->undecoded += 1;
+            print_mismatch(stats, max, address, code, length, text, x86_get_result_string(result));
+            continue;
+        }
+
+        char ours[128];
+        x86_format_line(ours, sizeof(ours), &inst, address);
+
+        char our_mnemonic[32];
+        x86_format_inst(our_mnemonic, sizeof(our_mnemonic), inst.type, inst.data_type);
+
+        if (inst.length != length) {
+            stats->length_mismatch += 1;
+            print_mismatch(stats, max, address, code, length > inst.length ? length : inst.length, text, ours);
+        } else if (!same_mnemonic(mnemonic, p, our_mnemonic)) {
+            stats->mnemonic_mismatch += 1;
+            print_mismatch(stats, max, address, code, length, text, ours);
+        } else {
+            stats->agree += 1;
+        }
+    }
+
+    free(line);
+    fclose(in);
+
+    int status;
+    return waitpid(pid, &status, 0) == pid && WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+static double percent(size_t x, size_t total) {
+    return total ? (100.0 * x) / total : 0.0;
+}
+
+int main(int argc, char* argv[]) {
+    if (argc == 3 && strcmp(argv[1], "-ours") == 0) return disassemble_file(argv[2]);
+
+    const char* objdump = "objdump";
+    size_t max = 20;
+
+    const char** inputs = calloc(argc + 1, sizeof(char*));
+    int input_count = 0;
+    for (int i = 1; i < argc; i++) {
+        if (strcmp(argv[i], "-max") == 0 && i + 1 < argc) max = strtoull(argv[++i], NULL, 0);
+        else if (strcmp(argv[i], "-objdump") == 0 && i + 1 < argc) objdump = argv[++i];
+        else inputs[input_count++] = argv[i];
+    }
+
+    if (input_count == 0) {
+        fprintf(stderr, "usage: objcmp [-max n] [-objdump path] files...\n");
+        return 1;
+    }
+
+    bool all_agree = true;
+    X86_Arena arena;
+    x86_arena_init(&arena, 0);
+
+    for (int i = 0; i < input_count; i++) {
+        // end to end, read + parse + decode + format into /dev/null
+        RunResult theirs = run_objdump(objdump, inputs[i]);
+        RunResult ours = run_ours(argv[0], inputs[i]);
+
+        ELF_Context ctx;
+        if (!load_elf(&arena, inputs[i], &ctx)) {
+            all_agree = false;
+            continue;
+        }
+
+        size_t code_size = 0;
+        for (size_t j = 0; j < ctx.num_sects; j++) {
+            if (ctx.sections[j].flags & sf_executable) code_size += ctx.sections[j].data.length;
+        }
+
+        printf("%s (%zu bytes of code):\n", inputs[i], code_size);
+
+        CompareStats stats = { 0 };
+        if (!compare_file(objdump, inputs[i], &ctx, max, &stats)) {
+            fprintf(stderr, "error: couldn't run %s on %s\n", objdump, inputs[i]);
+            all_agree = false;
+            x86_arena_free(&arena);
+            continue;
+        }
+
+        if (stats.printed > max) printf("  ... %zu more\n", stats.printed - max);
+        printf("  %zu instructions, %zu agree (%.3f%%)\n", stats.insts, stats.agree, percent(stats.agree, stats.insts));
+        printf("  %zu length mismatches, %zu mnemonic mismatches, %zu we don't decode, %zu objdump doesn't\n",
+            stats.length_mismatch, stats.mnemonic_mismatch, stats.undecoded, stats.objdump_bad);
+        if (stats.agree != stats.insts) all_agree = false;
+
+        if (theirs.ok && ours.ok) {
+            printf("  objdump %8.2f ms %8.1f MB/s %8ld KB peak RSS\n", theirs.seconds * 1e3, code_size / theirs.seconds / 1e6, theirs.peak_rss_kb);
+            printf("  disx86  %8.2f ms %8.1f MB/s %8ld KB peak RSS\n", ours.seconds * 1e3, code_size / ours.seconds / 1e6, ours.peak_rss_kb);
+            printf("  %.2fx objdump's speed\n", theirs.seconds / ours.seconds);
+        } else {
+            fprintf(stderr, "error: timing runs failed on %s\n", inputs[i]);
+        }
+        printf("\n");
+
+        // actually unmapped so the next file's runs start from scratch
+        x86_arena_free(&arena);
+    }
+
+    free(inputs);
+    return all_agree ? 0 : 2;
+}
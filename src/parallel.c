@@ -0,0 +1,62 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+#ifndef __STDC_NO_THREADS__
+#include <threads.h>
+#include <stdatomic.h>
+#endif
+
+// Fan out for the analysis passes, the jobs are handed out off a shared
+// counter instead of being bound to a thread up front. That way there's
+// only one way for a thread creation failure to go: fewer threads.
+typedef struct {
+    uint8_t* jobs;
+    size_t job_count, job_size;
+    int (*fn)(void* job);
+
+    #ifndef __STDC_NO_THREADS__
+    atomic_size_t next;
+    #endif
+} X86__ParallelFor;
+
+#ifndef __STDC_NO_THREADS__
+static int x86__parallel_worker(void* arg) {
+    X86__ParallelFor* pf = arg;
+    for (;;) {
+        size_t i = atomic_fetch_add(&pf->next, 1);
+        if (i >= pf->job_count) break;
+
+        pf->fn(&pf->jobs[i * pf->job_size]);
+    }
+    return 0;
+}
+#endif
+
+void x86_parallel_for(int thread_count, void* jobs, size_t job_count, size_t job_size, int (*fn)(void* job)) {
+    X86__ParallelFor pf = { .jobs = jobs, .job_count = job_count, .job_size = job_size, .fn = fn };
+    if (thread_count <= 0) thread_count = 1;
+    if ((size_t)thread_count > job_count) thread_count = job_count;
+
+    #ifndef __STDC_NO_THREADS__
+    if (thread_count > 1) {
+        atomic_init(&pf.next, 0);
+
+        // stop at the first thread that doesn't start, the calling thread
+        // always works so everything gets done regardless.
+        thrd_t* threads = malloc((thread_count - 1) * sizeof(thrd_t));
+        int started = 0;
+        while (threads != NULL && started < thread_count - 1) {
+            if (thrd_create(&threads[started], x86__parallel_worker, &pf) != thrd_success) break;
+            started++;
+        }
+
+        x86__parallel_worker(&pf);
+        for (int t = 0; t < started; t++) thrd_join(threads[t], NULL);
+        free(threads);
+        return;
+    }
+    #endif
+
+    for (size_t i = 0; i < job_count; i++) fn(&pf.jobs[i * job_size]);
+}
@@ -0,0 +1,624 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Instruction patterns, a pattern is a few instructions in a row written
+// like the disassembly:
+//
+//   lock cmpxchg rip, *
+//   xor $a, $a
+//   div qword reg
+//   cmp reg, 0..15; ja *; jmp [*]
+//
+// instructions are separated with ';', each one is an optional lock, the
+// mnemonic (globs with '*' are fine, "j*" or "cmov*"), an optional data type
+// and the operands. leaving the operands out matches anything, "..." after
+// the last one allows more. operands are:
+//
+//   *            anything
+//   reg, xmm     any GPR or xmm register
+//   rax, ecx, r8b, xmm3...
+//                that register, GPRs match at any width
+//   $name        any register, every other $name in the pattern has to be
+//                the same one
+//   mem, rip     any memory operand, rip-relative ones are only matched by rip
+//   [base]       memory with that base (a register, $name or *)
+//   imm, N, N..M immediates, rel8/rel32 of branches included
+//
+// Everything compiles down to a list of instructions per pattern, the last
+// instruction of each one gets indexed by type so the search only looks at
+// the patterns that could end at the current instruction.
+#define X86__PATTERN_MAX_INSTS 16
+#define X86__PATTERN_MAX_VARS  8
+
+enum {
+    X86__PAT_ANY,
+    X86__PAT_REG,      // any gpr
+    X86__PAT_XMM,      // any xmm
+    X86__PAT_GPR,      // exact gpr
+    X86__PAT_XMM_N,    // exact xmm
+    X86__PAT_VAR,      // register bound to a $name
+    X86__PAT_MEM,      // any non rip memory operand
+    X86__PAT_RIP,
+    X86__PAT_BASE,     // memory operand with a specific base
+    X86__PAT_BASE_VAR, // ... or one bound to a $name
+    X86__PAT_MEM_ANY,  // [*] any memory, rip included
+    X86__PAT_IMM,      // in [lo, hi]
+};
+
+typedef struct {
+    uint8_t kind;
+    int8_t reg; // register or variable index
+    int64_t lo, hi;
+} X86__OperandPattern;
+
+typedef struct {
+    // bitmap over X86_InstType
+    uint64_t types[(X86_INST_COUNT + 63) / 64];
+
+    bool lock;
+    bool any_operands, more_operands;
+    uint8_t operand_count;
+    int data_type; // -1 is any
+
+    X86__OperandPattern ops[4];
+} X86__InstPattern;
+
+typedef struct {
+    int inst_count;
+    X86__InstPattern* insts;
+} X86__Pattern;
+
+struct X86_PatternSet {
+    size_t pattern_count;
+    X86__Pattern* patterns;
+
+    // CSR, the patterns whose last instruction could be of a type
+    uint32_t* by_type_start;
+    uint32_t* by_type;
+};
+
+// decoded operands in the printed order
+enum {
+    X86__OPERAND_REG,
+    X86__OPERAND_MEM,
+    X86__OPERAND_RIP,
+    X86__OPERAND_IMM,
+};
+
+typedef struct {
+    uint8_t kind;
+    bool xmm;
+    int8_t reg; // register or memory base
+    int64_t imm;
+} X86__Operand;
+
+typedef struct {
+    X86_Inst inst;
+    uint64_t address;
+    int operand_count;
+    X86__Operand ops[4];
+} X86__Decoded;
+
+////////////////////////////////
+// Parser
+////////////////////////////////
+typedef struct {
+    const char* src;
+    const char* p;
+
+    char* error;
+    size_t error_capacity;
+    bool failed;
+
+    // $names
+    int var_count;
+    char vars[X86__PATTERN_MAX_VARS][16];
+} X86__PatternParser;
+
+static const struct {
+    const char* name;
+    int8_t reg;
+} x86__reg_names[] = {
+    { "rax", 0 }, { "rcx", 1 }, { "rdx", 2 }, { "rbx", 3 }, { "rsp", 4 }, { "rbp", 5 }, { "rsi", 6 }, { "rdi", 7 },
+    { "eax", 0 }, { "ecx", 1 }, { "edx", 2 }, { "ebx", 3 }, { "esp", 4 }, { "ebp", 5 }, { "esi", 6 }, { "edi", 7 },
+    { "ax", 0 },  { "cx", 1 },  { "dx", 2 },  { "bx", 3 },  { "sp", 4 },  { "bp", 5 },  { "si", 6 },  { "di", 7 },
+    { "al", 0 },  { "cl", 1 },  { "dl", 2 },  { "bl", 3 },  { "spl", 4 }, { "bpl", 5 }, { "sil", 6 }, { "dil", 7 },
+    { "ah", 16 }, { "ch", 17 }, { "dh", 18 }, { "bh", 19 },
+};
+
+static const char* x86__data_type_names[X86_STATS_DATA_TYPES] = {
+    "none", "byte", "word", "dword", "qword", "pbyte", "pword", "pdword", "pqword",
+    "ss", "sd", "ps", "pd", "xmmword",
+};
+
+static void x86__pattern_error(X86__PatternParser* ps, const char* msg) {
+    if (ps->failed) return;
+
+    ps->failed = true;
+    if (ps->error_capacity > 0) {
+        snprintf(ps->error, ps->error_capacity, "%d: %s", (int)(ps->p - ps->src) + 1, msg);
+    }
+}
+
+static void x86__pattern_skip(X86__PatternParser* ps) {
+    while (*ps->p == ' ' || *ps->p == '\t') ps->p++;
+}
+
+static bool x86__pattern_accept(X86__PatternParser* ps, const char* str) {
+    x86__pattern_skip(ps);
+
+    size_t len = strlen(str);
+    if (strncmp(ps->p, str, len) != 0) return false;
+
+    ps->p += len;
+    return true;
+}
+
+inline static bool x86__is_word_char(char ch) {
+    return (ch >= 'a' && ch <= 'z') || (ch >= 'A' && ch <= 'Z') || (ch >= '0' && ch <= '9') || ch == '_' || ch == '*';
+}
+
+// reads a lowercase word, false if there isn't one
+static bool x86__pattern_word(X86__PatternParser* ps, char* out, size_t capacity) {
+    x86__pattern_skip(ps);
+
+    size_t len = 0;
+    while (x86__is_word_char(ps->p[len])) len++;
+    if (len == 0 || len >= capacity) return false;
+
+    for (size_t i = 0; i < len; i++) {
+        char ch = ps->p[i];
+        out[i] = ch >= 'A' && ch <= 'Z' ? ch + ('a' - 'A') : ch;
+    }
+    out[len] = 0;
+
+    ps->p += len;
+    return true;
+}
+
+static bool x86__pattern_number(X86__PatternParser* ps, int64_t* out) {
+    x86__pattern_skip(ps);
+
+    const char* start = ps->p;
+    bool negative = *ps->p == '-';
+    if (negative) ps->p++;
+    if (*ps->p < '0' || *ps->p > '9') {
+        ps->p = start;
+        return false;
+    }
+
+    char* end;
+    *out = (int64_t)strtoull(ps->p, &end, 0);
+    if (negative) *out = -*out;
+    ps->p = end;
+    return true;
+}
+
+// star matches any run of characters
+static bool x86__glob(const char* pattern, const char* str) {
+    if (*pattern == 0) return *str == 0;
+    if (*pattern == '*') {
+        for (const char* s = str;; s++) {
+            if (x86__glob(pattern + 1, s)) return true;
+            if (*s == 0) return false;
+        }
+    }
+
+    return *pattern == *str && x86__glob(pattern + 1, str + 1);
+}
+
+static int x86__pattern_var(X86__PatternParser* ps) {
+    char name[16];
+    if (!x86__pattern_word(ps, name, sizeof(name))) {
+        x86__pattern_error(ps, "expected a variable name after '$'");
+        return 0;
+    }
+
+    for (int i = 0; i < ps->var_count; i++) {
+        if (strcmp(ps->vars[i], name) == 0) return i;
+    }
+
+    if (ps->var_count == X86__PATTERN_MAX_VARS) {
+        x86__pattern_error(ps, "too many variables");
+        return 0;
+    }
+
+    memcpy(ps->vars[ps->var_count], name, sizeof(name));
+    return ps->var_count++;
+}
+
+static int x86__parse_reg(const char* word, bool* out_xmm) {
+    *out_xmm = false;
+    for (size_t i = 0; i < sizeof(x86__reg_names) / sizeof(x86__reg_names[0]); i++) {
+        if (strcmp(word, x86__reg_names[i].name) == 0) return x86__reg_names[i].reg;
+    }
+
+    // r8-r15 with an optional d/w/b suffix, xmm0-xmm15
+    const char* digits = NULL;
+    if (word[0] == 'r' && word[1] >= '0' && word[1] <= '9') digits = &word[1];
+    else if (strncmp(word, "xmm", 3) == 0 && word[3] >= '0' && word[3] <= '9') digits = &word[3], *out_xmm = true;
+    if (digits == NULL) return -1;
+
+    char* end;
+    long n = strtol(digits, &end, 10);
+    if (*out_xmm ? (*end != 0 || n > 15) : (n < 8 || n > 15 || (*end != 0 && strcmp(end, "d") && strcmp(end, "w") && strcmp(end, "b")))) {
+        return -1;
+    }
+
+    return n;
+}
+
+static void x86__parse_operand(X86__PatternParser* ps, X86__OperandPattern* op) {
+    *op = (X86__OperandPattern){ X86__PAT_ANY };
+
+    if (x86__pattern_accept(ps, "$")) {
+        op->kind = X86__PAT_VAR;
+        op->reg = x86__pattern_var(ps);
+        return;
+    }
+
+    if (x86__pattern_accept(ps, "[")) {
+        if (x86__pattern_accept(ps, "$")) {
+            op->kind = X86__PAT_BASE_VAR;
+            op->reg = x86__pattern_var(ps);
+        } else if (x86__pattern_accept(ps, "*")) {
+            op->kind = X86__PAT_MEM_ANY;
+        } else {
+            char word[16];
+            bool xmm;
+            if (!x86__pattern_word(ps, word, sizeof(word)) || (op->reg = x86__parse_reg(word, &xmm)) < 0 || xmm) {
+                x86__pattern_error(ps, "expected a base register");
+                return;
+            }
+            op->kind = X86__PAT_BASE;
+        }
+
+        if (!x86__pattern_accept(ps, "]")) x86__pattern_error(ps, "expected ']'");
+        return;
+    }
+
+    int64_t lo;
+    if (x86__pattern_number(ps, &lo)) {
+        op->kind = X86__PAT_IMM;
+        op->lo = op->hi = lo;
+        if (x86__pattern_accept(ps, "..") && !x86__pattern_number(ps, &op->hi)) {
+            x86__pattern_error(ps, "expected the end of the range");
+        }
+        return;
+    }
+
+    char word[16];
+    if (!x86__pattern_word(ps, word, sizeof(word))) {
+        x86__pattern_error(ps, "expected an operand");
+        return;
+    }
+
+    bool xmm;
+    if (strcmp(word, "*") == 0) op->kind = X86__PAT_ANY;
+    else if (strcmp(word, "reg") == 0) op->kind = X86__PAT_REG;
+    else if (strcmp(word, "xmm") == 0) op->kind = X86__PAT_XMM;
+    else if (strcmp(word, "mem") == 0) op->kind = X86__PAT_MEM;
+    else if (strcmp(word, "rip") == 0) op->kind = X86__PAT_RIP;
+    else if (strcmp(word, "imm") == 0) op->kind = X86__PAT_IMM, op->lo = INT64_MIN, op->hi = INT64_MAX;
+    else if ((op->reg = x86__parse_reg(word, &xmm)) >= 0) op->kind = xmm ? X86__PAT_XMM_N : X86__PAT_GPR;
+    else x86__pattern_error(ps, "unknown operand");
+}
+
+static void x86__parse_inst(X86__PatternParser* ps, X86__InstPattern* inst) {
+    memset(inst, 0, sizeof(*inst));
+    inst->data_type = -1;
+    inst->any_operands = true;
+
+    char word[32];
+    if (!x86__pattern_word(ps, word, sizeof(word))) {
+        x86__pattern_error(ps, "expected a mnemonic");
+        return;
+    }
+
+    if (strcmp(word, "lock") == 0) {
+        inst->lock = true;
+        if (!x86__pattern_word(ps, word, sizeof(word))) {
+            x86__pattern_error(ps, "expected a mnemonic");
+            return;
+        }
+    }
+
+    // mnemonic -> every type it could be
+    bool any = false;
+    for (int i = 1; i < X86_INST_COUNT; i++) {
+        char name[32];
+        x86_format_inst(name, sizeof(name), i, X86_TYPE_NONE);
+        if (name[0] && x86__glob(word, name)) {
+            inst->types[i / 64] |= 1ull << (i % 64);
+            any = true;
+        }
+    }
+
+    if (!any) {
+        x86__pattern_error(ps, "unknown mnemonic");
+        return;
+    }
+
+    // optional data type, it can't be confused with an operand
+    const char* before = ps->p;
+    if (x86__pattern_word(ps, word, sizeof(word))) {
+        for (int i = 0; i < X86_STATS_DATA_TYPES; i++) {
+            if (strcmp(word, x86__data_type_names[i]) == 0) inst->data_type = i;
+        }
+        if (inst->data_type < 0) ps->p = before;
+    }
+
+    x86__pattern_skip(ps);
+    if (*ps->p == 0 || *ps->p == ';') return;
+
+    inst->any_operands = false;
+    do {
+        if (x86__pattern_accept(ps, "...")) {
+            inst->more_operands = true;
+            break;
+        }
+
+        if (inst->operand_count == 4) {
+            x86__pattern_error(ps, "too many operands");
+            return;
+        }
+
+        x86__parse_operand(ps, &inst->ops[inst->operand_count++]);
+    } while (!ps->failed && x86__pattern_accept(ps, ","));
+}
+
+static bool x86__parse_pattern(X86_Arena* arena, X86__PatternParser* ps, X86__Pattern* out) {
+    X86__InstPattern insts[X86__PATTERN_MAX_INSTS];
+    int count = 0;
+
+    do {
+        if (count == X86__PATTERN_MAX_INSTS) {
+            x86__pattern_error(ps, "too many instructions");
+            break;
+        }
+
+        x86__parse_inst(ps, &insts[count++]);
+    } while (!ps->failed && x86__pattern_accept(ps, ";"));
+
+    x86__pattern_skip(ps);
+    if (!ps->failed && *ps->p != 0) x86__pattern_error(ps, "unexpected junk");
+    if (ps->failed) return false;
+
+    out->inst_count = count;
+    out->insts = X86_ARENA_ARRAY(arena, X86__InstPattern, count);
+    memcpy(out->insts, insts, count * sizeof(X86__InstPattern));
+    return true;
+}
+
+X86_PatternSet* x86_pattern_compile(X86_Arena* arena, const char** patterns, size_t pattern_count, char* error, size_t error_capacity) {
+    X86_PatternSet* set = X86_ARENA_NEW(arena, X86_PatternSet);
+    set->pattern_count = pattern_count;
+    set->patterns = X86_ARENA_ARRAY(arena, X86__Pattern, pattern_count);
+
+    for (size_t i = 0; i < pattern_count; i++) {
+        X86__PatternParser ps = { .src = patterns[i], .p = patterns[i] };
+
+        char msg[200];
+        ps.error = msg, ps.error_capacity = sizeof(msg);
+        if (!x86__parse_pattern(arena, &ps, &set->patterns[i])) {
+            if (error_capacity > 0) snprintf(error, error_capacity, "pattern %zu:%s", i + 1, msg);
+            return NULL;
+        }
+    }
+
+    // index the patterns by the types their last instruction takes
+    set->by_type_start = X86_ARENA_ZARRAY(arena, uint32_t, X86_INST_COUNT + 1);
+    for (size_t i = 0; i < pattern_count; i++) {
+        const X86__InstPattern* last = &set->patterns[i].insts[set->patterns[i].inst_count - 1];
+        for (int t = 0; t < X86_INST_COUNT; t++) {
+            if ((last->types[t / 64] >> (t % 64)) & 1) set->by_type_start[t + 1]++;
+        }
+    }
+
+    for (int t = 0; t < X86_INST_COUNT; t++) set->by_type_start[t + 1] += set->by_type_start[t];
+    set->by_type = X86_ARENA_ARRAY(arena, uint32_t, set->by_type_start[X86_INST_COUNT]);
+
+    X86_ArenaSavepoint sp = x86_arena_save(arena);
+    uint32_t* fill = X86_ARENA_ZARRAY(arena, uint32_t, X86_INST_COUNT);
+    for (size_t i = 0; i < pattern_count; i++) {
+        const X86__InstPattern* last = &set->patterns[i].insts[set->patterns[i].inst_count - 1];
+        for (int t = 0; t < X86_INST_COUNT; t++) {
+            if ((last->types[t / 64] >> (t % 64)) & 1) set->by_type[set->by_type_start[t] + fill[t]++] = i;
+        }
+    }
+    x86_arena_restore(arena, sp);
+
+    return set;
+}
+
+////////////////////////////////
+// Matcher
+////////////////////////////////
+// same operand order the disassembly prints
+static void x86__decode_operands(X86__Decoded* d) {
+    const X86_Inst* inst = &d->inst;
+    bool has_mem = inst->flags & X86_INSTR_USE_MEMOP;
+    bool has_imm = inst->flags & (X86_INSTR_IMMEDIATE | X86_INSTR_ABSOLUTE);
+
+    d->operand_count = 0;
+    for (int j = 0; j < 4; j++) {
+        X86__Operand* op = &d->ops[d->operand_count];
+
+        if (inst->regs[j] == X86_GPR_NONE) {
+            if (has_mem) {
+                has_mem = false;
+                op->kind = inst->flags & X86_INSTR_USE_RIPMEM ? X86__OPERAND_RIP : X86__OPERAND_MEM;
+                op->reg = inst->base;
+            } else if (has_imm) {
+                has_imm = false;
+                op->kind = X86__OPERAND_IMM;
+                op->imm = inst->flags & X86_INSTR_ABSOLUTE ? (int64_t)inst->abs : inst->imm;
+            } else {
+                break;
+            }
+        } else {
+            op->kind = X86__OPERAND_REG;
+            op->reg = inst->regs[j];
+            op->xmm = inst->flags & X86_INSTR_XMMREG;
+
+            // MOVQ mixes xmm and gpr, the gpr is on the r/m side
+            if (inst->type == X86_INST_MOVQ && j != ((inst->flags & X86_INSTR_DIRECTION) ? 1 : 0)) op->xmm = true;
+        }
+
+        d->operand_count++;
+    }
+}
+
+// vars[i] is -1 until bound, xmm registers are stored as 32 + i
+static bool x86__match_var(int8_t* vars, int var, int reg) {
+    if (vars[var] < 0) vars[var] = reg;
+    return vars[var] == reg;
+}
+
+static bool x86__match_operand(const X86__OperandPattern* p, const X86__Operand* op, int8_t* vars) {
+    // gprs are stored by index at every width, ah-bh are 16-19
+    int gpr = op->reg;
+
+    switch (p->kind) {
+        case X86__PAT_ANY:      return true;
+        case X86__PAT_REG:      return op->kind == X86__OPERAND_REG && !op->xmm;
+        case X86__PAT_XMM:      return op->kind == X86__OPERAND_REG && op->xmm;
+        case X86__PAT_GPR:      return op->kind == X86__OPERAND_REG && !op->xmm && gpr == p->reg;
+        case X86__PAT_XMM_N:    return op->kind == X86__OPERAND_REG && op->xmm && op->reg == p->reg;
+        case X86__PAT_VAR:      return op->kind == X86__OPERAND_REG && x86__match_var(vars, p->reg, op->xmm ? 32 + op->reg : gpr);
+        case X86__PAT_MEM:      return op->kind == X86__OPERAND_MEM;
+        case X86__PAT_RIP:      return op->kind == X86__OPERAND_RIP;
+        case X86__PAT_MEM_ANY:  return op->kind == X86__OPERAND_MEM || op->kind == X86__OPERAND_RIP;
+        case X86__PAT_BASE:     return op->kind == X86__OPERAND_MEM && op->reg == p->reg;
+        case X86__PAT_BASE_VAR: return op->kind == X86__OPERAND_MEM && op->reg >= 0 && x86__match_var(vars, p->reg, op->reg);
+        case X86__PAT_IMM:      return op->kind == X86__OPERAND_IMM && op->imm >= p->lo && op->imm <= p->hi;
+        default:                return false;
+    }
+}
+
+static bool x86__match_inst(const X86__InstPattern* p, const X86__Decoded* d, int8_t* vars) {
+    int type = d->inst.type;
+    if (((p->types[type / 64] >> (type % 64)) & 1) == 0) return false;
+    if (p->lock && (d->inst.flags & X86_INSTR_LOCK) == 0) return false;
+    if (p->data_type >= 0 && d->inst.data_type != p->data_type) return false;
+    if (p->any_operands) return true;
+
+    if (d->operand_count < p->operand_count) return false;
+    if (d->operand_count > p->operand_count && !p->more_operands) return false;
+
+    for (int i = 0; i < p->operand_count; i++) {
+        if (!x86__match_operand(&p->ops[i], &d->ops[i], vars)) return false;
+    }
+    return true;
+}
+
+typedef struct {
+    const X86_PatternSet* set;
+    const X86_CodeRegion* region;
+
+    X86_Match* matches;
+    size_t count, capacity;
+} X86__SearchJob;
+
+static void x86__push_match(X86__SearchJob* job, X86_Match m) {
+    if (job->count == job->capacity) {
+        job->capacity = job->capacity ? job->capacity * 2 : 64;
+        job->matches = realloc(job->matches, job->capacity * sizeof(X86_Match));
+        if (job->matches == NULL) {
+            fprintf(stderr, "error: pattern search out of memory\n");
+            abort();
+        }
+    }
+
+    job->matches[job->count++] = m;
+}
+
+static int x86__search_region(void* arg) {
+    X86__SearchJob* job = arg;
+    const X86_PatternSet* set = job->set;
+    X86_Buffer code = job->region->code;
+    x86_trace_begin("pattern search", NULL);
+
+    // the last few instructions, sequences only match within a run that
+    // decoded without gaps.
+    X86__Decoded ring[X86__PATTERN_MAX_INSTS];
+    size_t run = 0;
+
+    size_t offset = 0;
+    while (offset < code.length) {
+        X86__Decoded* d = &ring[run % X86__PATTERN_MAX_INSTS];
+        if (x86_disasm(x86_advance(code, offset), &d->inst) != X86_RESULT_SUCCESS || d->inst.length == 0) {
+            run = 0;
+            offset += 1;
+            continue;
+        }
+
+        d->address = job->region->address + offset;
+        x86__decode_operands(d);
+        run++;
+
+        int type = d->inst.type;
+        for (uint32_t k = set->by_type_start[type]; k < set->by_type_start[type + 1]; k++) {
+            uint32_t pattern_index = set->by_type[k];
+            const X86__Pattern* p = &set->patterns[pattern_index];
+            if ((size_t)p->inst_count > run) continue;
+
+            int8_t vars[X86__PATTERN_MAX_VARS];
+            memset(vars, -1, sizeof(vars));
+
+            size_t first = run - p->inst_count;
+            bool matched = true;
+            for (int i = 0; i < p->inst_count && matched; i++) {
+                matched = x86__match_inst(&p->insts[i], &ring[(first + i) % X86__PATTERN_MAX_INSTS], vars);
+            }
+
+            if (matched) {
+                uint64_t start = ring[first % X86__PATTERN_MAX_INSTS].address;
+                x86__push_match(job, (X86_Match){ start, pattern_index, (uint32_t)(d->address + d->inst.length - start) });
+            }
+        }
+
+        offset += d->inst.length;
+    }
+
+    x86_trace_end();
+    return 0;
+}
+
+static int x86__cmp_match(const void* a, const void* b) {
+    const X86_Match* x = a;
+    const X86_Match* y = b;
+    if (x->address != y->address) return x->address < y->address ? -1 : 1;
+    return (x->pattern > y->pattern) - (x->pattern < y->pattern);
+}
+
+size_t x86_pattern_search(X86_Arena* arena, const X86_PatternSet* set, const X86_CodeRegion* regions, size_t region_count, int thread_count, X86_Match** out) {
+    // match lists grow on the worker threads so they're on the heap
+    X86_ArenaSavepoint sp = x86_arena_save(arena);
+    X86__SearchJob* jobs = X86_ARENA_ZARRAY(arena, X86__SearchJob, region_count);
+    for (size_t i = 0; i < region_count; i++) {
+        jobs[i].set = set;
+        jobs[i].region = &regions[i];
+    }
+
+    // a job per region, thread_count of 0 means a thread for each
+    if (thread_count <= 0) thread_count = region_count;
+    x86_parallel_for(thread_count, jobs, region_count, sizeof(X86__SearchJob), x86__search_region);
+
+    size_t total = 0;
+    for (size_t i = 0; i < region_count; i++) total += jobs[i].count;
+
+    X86_Match* matches = X86_ARENA_ARRAY(arena, X86_Match, total);
+    size_t count = 0;
+    for (size_t i = 0; i < region_count; i++) {
+        if (jobs[i].count) memcpy(&matches[count], jobs[i].matches, jobs[i].count * sizeof(X86_Match));
+        count += jobs[i].count;
+        free(jobs[i].matches);
+    }
+    matches = x86_arena_restore_keep(arena, sp, matches, count * sizeof(X86_Match), _Alignof(X86_Match));
+
+    qsort(matches, count, sizeof(X86_Match), x86__cmp_match);
+    *out = matches;
+    return count;
+}
@@ -0,0 +1,291 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+#include <stdatomic.h>
+#include <threads.h>
+
+// The length pre-scan works out the byte classes the length decoder cares
+// about (is this a prefix? how many bytes follow it if it's a ModRM?) for a
+// whole window with SIMD, after that finding an instruction's length is just
+// the DFA walk over its opcode bytes.
+#if (defined(__x86_64__) || defined(__i386__)) && (defined(__GNUC__) || defined(__clang__))
+#define X86__PRESCAN_SIMD 1
+#include <immintrin.h>
+#else
+#define X86__PRESCAN_SIMD 0
+#endif
+
+// how much gets classified at once, the lookahead covers the longest run of
+// prefixes we'll take from the masks plus the rest of the instruction.
+#define X86__PRESCAN_CHUNK     4096
+#define X86__PRESCAN_LOOKAHEAD 64
+#define X86__PRESCAN_WINDOW    (X86__PRESCAN_CHUNK + X86__PRESCAN_LOOKAHEAD)
+#define X86__PRESCAN_MAX_PREFIXES 32
+
+typedef struct {
+    // bit i is set if window[i] is a legacy prefix or REX
+    uint64_t prefix_bits[X86__PRESCAN_WINDOW / 64];
+    // SIB/displacement bytes following window[i] if it's a ModRM
+    uint8_t modrm_extra[X86__PRESCAN_WINDOW];
+} X86_PrescanWindow;
+
+// what the CPU has is looked up once, the level in use can change whenever
+// so workers read it atomically.
+static once_flag x86__simd_once = ONCE_FLAG_INIT;
+static X86_SimdLevel x86__simd_support;
+static atomic_int x86__simd_level;
+
+////////////////////////////////
+// Byte classification
+////////////////////////////////
+// prefixes are 26 2E 36 3E 40-4F 64-67 F0 F2 F3, split on the nibbles:
+//   hi 2,3 -> bit 0 (lo 6, E)
+//   hi 4   -> bit 1 (any lo)
+//   hi 6   -> bit 2 (lo 4-7)
+//   hi F   -> bit 3 (lo 0, 2, 3)
+// a byte is a prefix if the two lookups share a bit.
+#define X86__PREFIX_HI \
+    0, 0, 1, 1, 2, 0, 4, 0, 0, 0, 0, 0, 0, 0, 0, 8
+#define X86__PREFIX_LO \
+    10, 2, 10, 10, 6, 6, 7, 6, 2, 2, 2, 2, 2, 2, 3, 2
+
+// ModRM: mod is the top half of the high nibble, rm the bottom 3 bits of the low one
+#define X86__MODRM_DISP_HI   0, 0, 0, 0, 1, 1, 1, 1, 4, 4, 4, 4, 0, 0, 0, 0
+#define X86__MODRM_MOD0_HI   -1, -1, -1, -1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0
+#define X86__MODRM_MEM_HI    -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, 0, 0, 0, 0
+#define X86__MODRM_SIB_LO    0, 0, 0, 0, 1, 0, 0, 0, 0, 0, 0, 0, 1, 0, 0, 0
+#define X86__MODRM_RIP_LO    0, 0, 0, 0, 0, 4, 0, 0, 0, 0, 0, 0, 0, 4, 0, 0
+
+static void x86__classify_scalar(const uint8_t* data, uint32_t* prefix_mask, uint8_t* modrm_extra) {
+    static const uint8_t prefix_hi[16] = { X86__PREFIX_HI };
+    static const uint8_t prefix_lo[16] = { X86__PREFIX_LO };
+
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i++) {
+        uint8_t b = data[i];
+        if (prefix_hi[b >> 4] & prefix_lo[b & 15]) mask |= 1u << i;
+
+        modrm_extra[i] = x86_modrm_extra(b);
+    }
+
+    *prefix_mask = mask;
+}
+
+#if X86__PRESCAN_SIMD
+__attribute__((target("ssse3")))
+static void x86__classify_ssse3(const uint8_t* data, uint32_t* prefix_mask, uint8_t* modrm_extra) {
+    const __m128i low_nibble = _mm_set1_epi8(0x0F);
+    const __m128i prefix_hi  = _mm_setr_epi8(X86__PREFIX_HI);
+    const __m128i prefix_lo  = _mm_setr_epi8(X86__PREFIX_LO);
+    const __m128i disp_hi    = _mm_setr_epi8(X86__MODRM_DISP_HI);
+    const __m128i mod0_hi    = _mm_setr_epi8(X86__MODRM_MOD0_HI);
+    const __m128i mem_hi     = _mm_setr_epi8(X86__MODRM_MEM_HI);
+    const __m128i sib_lo     = _mm_setr_epi8(X86__MODRM_SIB_LO);
+    const __m128i rip_lo     = _mm_setr_epi8(X86__MODRM_RIP_LO);
+
+    uint32_t mask = 0;
+    for (int i = 0; i < 32; i += 16) {
+        __m128i v  = _mm_loadu_si128((const __m128i*)&data[i]);
+        __m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), low_nibble);
+        __m128i lo = _mm_and_si128(v, low_nibble);
+
+        __m128i cls = _mm_and_si128(_mm_shuffle_epi8(prefix_hi, hi), _mm_shuffle_epi8(prefix_lo, lo));
+        __m128i not_prefix = _mm_cmpeq_epi8(cls, _mm_setzero_si128());
+        mask |= (uint32_t)(~_mm_movemask_epi8(not_prefix) & 0xFFFF) << i;
+
+        __m128i extra = _mm_add_epi8(_mm_shuffle_epi8(disp_hi, hi), _mm_shuffle_epi8(sib_lo, lo));
+        extra = _mm_add_epi8(extra, _mm_and_si128(_mm_shuffle_epi8(rip_lo, lo), _mm_shuffle_epi8(mod0_hi, hi)));
+        extra = _mm_and_si128(extra, _mm_shuffle_epi8(mem_hi, hi));
+        _mm_storeu_si128((__m128i*)&modrm_extra[i], extra);
+    }
+
+    *prefix_mask = mask;
+}
+
+__attribute__((target("avx2")))
+static void x86__classify_avx2(const uint8_t* data, uint32_t* prefix_mask, uint8_t* modrm_extra) {
+    // vpshufb looks up within each 128bit lane so the tables are doubled up
+    const __m256i low_nibble = _mm256_set1_epi8(0x0F);
+    const __m256i prefix_hi  = _mm256_setr_epi8(X86__PREFIX_HI, X86__PREFIX_HI);
+    const __m256i prefix_lo  = _mm256_setr_epi8(X86__PREFIX_LO, X86__PREFIX_LO);
+    const __m256i disp_hi    = _mm256_setr_epi8(X86__MODRM_DISP_HI, X86__MODRM_DISP_HI);
+    const __m256i mod0_hi    = _mm256_setr_epi8(X86__MODRM_MOD0_HI, X86__MODRM_MOD0_HI);
+    const __m256i mem_hi     = _mm256_setr_epi8(X86__MODRM_MEM_HI, X86__MODRM_MEM_HI);
+    const __m256i sib_lo     = _mm256_setr_epi8(X86__MODRM_SIB_LO, X86__MODRM_SIB_LO);
+    const __m256i rip_lo     = _mm256_setr_epi8(X86__MODRM_RIP_LO, X86__MODRM_RIP_LO);
+
+    __m256i v  = _mm256_loadu_si256((const __m256i*)data);
+    __m256i hi = _mm256_and_si256(_mm256_srli_epi16(v, 4), low_nibble);
+    __m256i lo = _mm256_and_si256(v, low_nibble);
+
+    __m256i cls = _mm256_and_si256(_mm256_shuffle_epi8(prefix_hi, hi), _mm256_shuffle_epi8(prefix_lo, lo));
+    __m256i not_prefix = _mm256_cmpeq_epi8(cls, _mm256_setzero_si256());
+    *prefix_mask = ~(uint32_t)_mm256_movemask_epi8(not_prefix);
+
+    __m256i extra = _mm256_add_epi8(_mm256_shuffle_epi8(disp_hi, hi), _mm256_shuffle_epi8(sib_lo, lo));
+    extra = _mm256_add_epi8(extra, _mm256_and_si256(_mm256_shuffle_epi8(rip_lo, lo), _mm256_shuffle_epi8(mod0_hi, hi)));
+    extra = _mm256_and_si256(extra, _mm256_shuffle_epi8(mem_hi, hi));
+    _mm256_storeu_si256((__m256i*)modrm_extra, extra);
+}
+#endif
+
+static void x86__detect_simd(void) {
+    X86_SimdLevel level = X86_SIMD_SCALAR;
+
+    #if X86__PRESCAN_SIMD
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) level = X86_SIMD_AVX2;
+    else if (__builtin_cpu_supports("ssse3")) level = X86_SIMD_SSSE3;
+    #endif
+
+    // the DFA walk is most of the time, AVX2 only halves the classification
+    // and lenbench doesn't show it beating SSSE3 so that's the default.
+    x86__simd_support = level;
+    atomic_init(&x86__simd_level, level < X86_SIMD_SSSE3 ? level : X86_SIMD_SSSE3);
+}
+
+X86_SimdLevel x86_get_simd_level(void) {
+    call_once(&x86__simd_once, x86__detect_simd);
+    return atomic_load_explicit(&x86__simd_level, memory_order_relaxed);
+}
+
+void x86_set_simd_level(X86_SimdLevel level) {
+    // can't go past what the CPU has
+    call_once(&x86__simd_once, x86__detect_simd);
+    atomic_store_explicit(&x86__simd_level, level < x86__simd_support ? level : x86__simd_support, memory_order_relaxed);
+}
+
+// classifies [0, length) of data, anything past the end reads as zeroes
+static void x86__classify_window(X86_PrescanWindow* w, X86_SimdLevel level, const uint8_t* data, size_t length) {
+    assert(length <= X86__PRESCAN_WINDOW);
+
+    for (size_t i = 0; i < length; i += 32) {
+        const uint8_t* src = &data[i];
+
+        // the tail gets copied out so the vector loads don't go out of bounds
+        uint8_t tmp[32];
+        if (length - i < 32) {
+            memset(tmp, 0, sizeof(tmp));
+            memcpy(tmp, src, length - i);
+            src = tmp;
+        }
+
+        uint32_t mask;
+        switch (level) {
+            #if X86__PRESCAN_SIMD
+            case X86_SIMD_AVX2:  x86__classify_avx2(src, &mask, &w->modrm_extra[i]);  break;
+            case X86_SIMD_SSSE3: x86__classify_ssse3(src, &mask, &w->modrm_extra[i]); break;
+            #endif
+            default: x86__classify_scalar(src, &mask, &w->modrm_extra[i]); break;
+        }
+
+        if (length - i < 32) mask &= (1u << (length - i)) - 1;
+
+        uint64_t* word = &w->prefix_bits[i / 64];
+        if (i % 64 == 0) *word = mask;
+        else *word |= (uint64_t)mask << 32;
+    }
+}
+
+// number of prefix bytes starting at i, capped at max
+inline static size_t x86__prefix_run(const X86_PrescanWindow* w, size_t i, size_t max) {
+    size_t count = 0;
+    while (count < max) {
+        uint64_t bits = ~(w->prefix_bits[(i + count) / 64] >> ((i + count) % 64));
+        size_t left = 64 - ((i + count) % 64);
+
+        if (bits == 0) {
+            count += left;
+            continue;
+        }
+
+        // bits shifted in from the top are ones so this stops by the end of the word
+        size_t run = __builtin_ctzll(bits);
+        count += run;
+        if (run < left) break;
+    }
+
+    return count < max ? count : max;
+}
+
+// length at window offset i, falls back to the scalar path for anything that
+// runs off the classified bytes.
+inline static size_t x86__length_at(const X86_PrescanWindow* w, X86_Buffer in, size_t window_start, size_t window_length, size_t i) {
+    X86_Buffer at = { in.data + window_start + i, in.length - window_start - i };
+
+    size_t max = window_length - i;
+    if (max > X86__PRESCAN_MAX_PREFIXES) max = X86__PRESCAN_MAX_PREFIXES;
+
+    size_t prefixes = x86__prefix_run(w, i, max);
+    if (prefixes == X86__PRESCAN_MAX_PREFIXES) return x86_length(at);
+
+    // near the end of the window the instruction could use bytes that
+    // weren't classified, unless the window is the end of the input.
+    bool at_end = window_start + window_length == in.length;
+    if (!at_end && i + X86__PRESCAN_LOOKAHEAD > window_length) return x86_length(at);
+
+    return x86_length_classified(at, prefixes, &w->modrm_extra[i]);
+}
+
+size_t x86_scan_lengths(X86_Buffer in, uint8_t* out_lengths, size_t out_capacity) {
+    X86_SimdLevel level = x86_get_simd_level();
+    size_t count = 0, pos = 0;
+
+    // under a chunk classifying the window up front costs more than it saves
+    if (level == X86_SIMD_SCALAR || in.length < X86__PRESCAN_CHUNK) {
+        while (pos < in.length && count < out_capacity) {
+            size_t len = x86_length((X86_Buffer){ in.data + pos, in.length - pos });
+            if (len == 0) break;
+
+            out_lengths[count++] = len;
+            pos += len;
+        }
+        return count;
+    }
+
+    X86_PrescanWindow w;
+    while (pos < in.length && count < out_capacity) {
+        size_t window_length = in.length - pos;
+        if (window_length > X86__PRESCAN_WINDOW) window_length = X86__PRESCAN_WINDOW;
+
+        x86__classify_window(&w, level, in.data + pos, window_length);
+
+        // only the first chunk is walked, the rest is lookahead
+        size_t i = 0, end = window_length < X86__PRESCAN_CHUNK ? window_length : X86__PRESCAN_CHUNK;
+        while (i < end && count < out_capacity) {
+            size_t len = x86__length_at(&w, in, pos, window_length, i);
+            if (len == 0) return count;
+
+            out_lengths[count++] = len;
+            i += len;
+        }
+
+        pos += i;
+    }
+
+    return count;
+}
+
+void x86_scan_lengths_superset(X86_Buffer in, uint8_t* out_lengths) {
+    X86_SimdLevel level = x86_get_simd_level();
+
+    if (level == X86_SIMD_SCALAR) {
+        for (size_t i = 0; i < in.length; i++) {
+            out_lengths[i] = x86_length((X86_Buffer){ in.data + i, in.length - i });
+        }
+        return;
+    }
+
+    X86_PrescanWindow w;
+    for (size_t pos = 0; pos < in.length; pos += X86__PRESCAN_CHUNK) {
+        size_t window_length = in.length - pos;
+        if (window_length > X86__PRESCAN_WINDOW) window_length = X86__PRESCAN_WINDOW;
+
+        x86__classify_window(&w, level, in.data + pos, window_length);
+
+        size_t end = window_length < X86__PRESCAN_CHUNK ? window_length : X86__PRESCAN_CHUNK;
+        for (size_t i = 0; i < end; i++) {
+            out_lengths[pos + i] = x86__length_at(&w, in, pos, window_length, i);
+        }
+    }
+}
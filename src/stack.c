@@ -0,0 +1,327 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Stack pointer tracking over a CFG, every block gets the rsp (and rbp, for
+// leave and mov rsp, rbp) delta it starts with from whichever predecessor
+// reaches it first and the instructions are stepped through from there.
+// Blocks nothing falls or jumps into, entries, call targets and whatever
+// follows the padding after a function start a new frame at 0.
+typedef struct {
+    int32_t rsp, rbp;
+} X86__StackState;
+
+#define X86__UNKNOWN X86_STACK_DELTA_UNKNOWN
+
+inline static bool x86__is_reg(const X86_Inst* inst, int slot, X86_GPR reg) {
+    return inst->regs[slot] == reg && inst->data_type == X86_TYPE_QWORD;
+}
+
+inline static bool x86__is_reg_imm(const X86_Inst* inst, X86_GPR reg) {
+    return (inst->flags & (X86_INSTR_IMMEDIATE | X86_INSTR_USE_MEMOP)) == X86_INSTR_IMMEDIATE && x86__is_reg(inst, 0, reg);
+}
+
+inline static int32_t x86__add_delta(int32_t delta, int64_t amount) {
+    if (delta == X86__UNKNOWN) return X86__UNKNOWN;
+
+    int64_t x = delta + amount;
+    return x > INT32_MIN && x <= INT32_MAX ? (int32_t)x : X86__UNKNOWN;
+}
+
+// steps over one instruction, returns the X86_StackFlags it earned
+static uint8_t x86__stack_step(X86__StackState* s, const X86_Inst* inst) {
+    int32_t size = inst->data_type == X86_TYPE_WORD ? 2 : 8;
+
+    switch (inst->type) {
+        case X86_INST_PUSH: case X86_INST_PUSHF: case X86_INST_PUSHFQ:
+        s->rsp = x86__add_delta(s->rsp, -size);
+        return 0;
+
+        case X86_INST_POP: case X86_INST_POPF: case X86_INST_POPFQ:
+        s->rsp = x86__add_delta(s->rsp, size);
+        if (x86__is_reg(inst, 0, X86_RBP)) s->rbp = X86__UNKNOWN;
+        else if (x86__is_reg(inst, 0, X86_RSP)) s->rsp = X86__UNKNOWN;
+        return 0;
+
+        case X86_INST_LEAVE:
+        s->rsp = x86__add_delta(s->rbp, 8);
+        s->rbp = X86__UNKNOWN;
+        return s->rsp == X86__UNKNOWN ? X86_STACK_UNKNOWN_WRITE : 0;
+
+        case X86_INST_CALL:
+        // the callee pops its own return address
+        return 0;
+
+        case X86_INST_ENDBR64:
+        // a function the CFG didn't split off (after a call that doesn't
+        // return), indirect branches only land on these at entries.
+        s->rsp = 0;
+        s->rbp = X86__UNKNOWN;
+        return 0;
+
+        case X86_INST_RET:
+        return s->rsp != 0 && s->rsp != X86__UNKNOWN ? X86_STACK_UNBALANCED : 0;
+
+        case X86_INST_SUB:
+        case X86_INST_ADD:
+        if (x86__is_reg_imm(inst, X86_RSP)) {
+            s->rsp = x86__add_delta(s->rsp, inst->type == X86_INST_SUB ? -(int64_t)inst->imm : inst->imm);
+            return 0;
+        }
+        break;
+
+        case X86_INST_AND:
+        if (x86__is_reg_imm(inst, X86_RSP)) {
+            // realigned, only the frame pointer knows where we are now
+            s->rsp = X86__UNKNOWN;
+            return X86_STACK_ALIGNED;
+        }
+        break;
+
+        case X86_INST_MOV:
+        if ((inst->flags & (X86_INSTR_USE_MEMOP | X86_INSTR_IMMEDIATE | X86_INSTR_ABSOLUTE)) == 0) {
+            if (x86__is_reg(inst, 0, X86_RBP) && inst->regs[1] == X86_RSP) {
+                s->rbp = s->rsp;
+                return 0;
+            } else if (x86__is_reg(inst, 0, X86_RSP) && inst->regs[1] == X86_RBP) {
+                s->rsp = s->rbp;
+                return s->rsp == X86__UNKNOWN ? X86_STACK_UNKNOWN_WRITE : 0;
+            }
+        }
+        break;
+
+        case X86_INST_LEA:
+        if ((inst->flags & X86_INSTR_USE_RIPMEM) == 0 && inst->index == X86_GPR_NONE &&
+            (x86__is_reg(inst, 0, X86_RSP) || x86__is_reg(inst, 0, X86_RBP))) {
+            int32_t base = inst->base == X86_RSP ? s->rsp : inst->base == X86_RBP ? s->rbp : X86__UNKNOWN;
+            int32_t value = x86__add_delta(base, inst->disp);
+
+            if (inst->regs[0] == X86_RSP) {
+                s->rsp = value;
+                return value == X86__UNKNOWN ? X86_STACK_UNKNOWN_WRITE : 0;
+            }
+
+            s->rbp = value;
+            return 0;
+        }
+        break;
+
+        default: break;
+    }
+
+    // anything else that writes the stack or frame pointer loses track of it
+    uint32_t written = x86_get_reg_usage(inst).gpr_write;
+    if (written & (1u << X86_RBP)) s->rbp = X86__UNKNOWN;
+    if (written & (1u << X86_RSP)) {
+        s->rsp = X86__UNKNOWN;
+        return X86_STACK_UNKNOWN_WRITE;
+    }
+
+    return 0;
+}
+
+inline static bool x86__starts_with_endbr(X86_Buffer code, const X86_Block* b) {
+    return b->end - b->start >= 4 && memcmp(&code.data[b->start], (uint8_t[]) { 0xF3, 0x0F, 0x1E, 0xFA }, 4) == 0;
+}
+
+// nops and int3 nothing jumps to are just alignment, they'd only fall into
+// the next block with a made up delta.
+static bool x86__is_padding(const X86_CFG* cfg, X86_Buffer code, const X86_Block* b) {
+    for (uint32_t j = 0; j < b->inst_count; j++) {
+        X86_Inst inst;
+        if (x86_disasm(x86_advance(code, cfg->inst_offsets[b->first_inst + j]), &inst) != X86_RESULT_SUCCESS) return false;
+        if (inst.type != X86_INST_NOP && inst.type != X86_INST_INT3) return false;
+    }
+    return true;
+}
+
+// what x86_find_functions takes for a start once padding is over, aligned to
+// 16 or one of the same prologues.
+static bool x86__looks_like_start(const X86_CFG* cfg, X86_Buffer code, uint32_t offset) {
+    if ((cfg->base_address + offset) % 16 == 0) return true;
+    if (code.length - offset < 4) return false;
+
+    const uint8_t* p = &code.data[offset];
+    bool frame  = p[0] == 0x55 && ((p[1] == 0x48 && p[2] == 0x89 && p[3] == 0xE5) || p[1] == 0x53 || p[1] == 0x41);
+    bool subrsp = p[0] == 0x48 && (p[1] == 0x83 || p[1] == 0x81) && p[2] == 0xEC;
+    bool pushr  = p[0] == 0x41 && (p[1] & 0xFC) == 0x54;
+    return frame || subrsp || pushr;
+}
+
+// padding only falls into a function (and not a loop header getting aligned)
+// when it looks like one and nothing else gets there. if the padding comes
+// after a call (that never returned) tail calls can jmp there too, loops
+// branch back with a jcc.
+static bool x86__after_padding(const X86_CFG* cfg, X86_Buffer code, uint32_t block) {
+    const X86_Block* b = &cfg->blocks[block];
+    if (block == 0 || cfg->blocks[block - 1].end != b->start) return false;
+
+    const X86_Block* prev = &cfg->blocks[block - 1];
+    if (!x86__looks_like_start(cfg, code, b->start) || !x86__is_padding(cfg, code, prev)) return false;
+
+    const X86_Block* before = block > 1 ? &cfg->blocks[block - 2] : NULL;
+    bool after_call = before != NULL && before->end == prev->start && before->terminator == X86_BRANCH_CALL;
+
+    size_t pred_count;
+    const uint32_t* preds = x86_cfg_preds(cfg, block, &pred_count);
+    for (size_t i = 0; i < pred_count; i++) {
+        const X86_Edge* e = &cfg->edges[preds[i]];
+        if (e->from == block - 1) continue;
+        if (!after_call || e->kind != X86_EDGE_JUMP) return false;
+    }
+    return true;
+}
+
+// falling or jumping into one of these doesn't carry a delta over (a call to
+// something that doesn't return just before a function, tail calls)
+static bool x86__is_frame_start(const X86_CFG* cfg, X86_Buffer code, uint32_t block) {
+    const X86_Block* b = &cfg->blocks[block];
+    return (b->flags & (X86_BLOCK_ENTRY | X86_BLOCK_CALL_TARGET)) || x86__starts_with_endbr(code, b) || x86__after_padding(cfg, code, block);
+}
+
+// falling out of a call into a block something also jumps to is usually a
+// call that doesn't return (abort stubs back to back), whatever it carries
+// over is only a guess the jumps get to overwrite.
+static bool x86__after_noreturn(const X86_CFG* cfg, const X86_Block* from, const X86_Edge* e) {
+    return e->kind == X86_EDGE_FALLTHROUGH && from->terminator == X86_BRANCH_CALL && cfg->blocks[e->to].pred_count > 1;
+}
+
+typedef struct {
+    const X86_CFG* cfg;
+    X86_Buffer code;
+    X86_StackDeltas* out;
+
+    X86__StackState* entry;
+    bool* reached;
+    bool* guessed;    // entry came through x86__after_noreturn
+    bool* conflicted; // paths with different deltas merged here
+    uint32_t* worklist;
+} X86__StackWalk;
+
+// walks everything reachable from block whose entry state is known, every
+// block gets pushed once, twice if a guess gets overwritten.
+static void x86__stack_propagate(X86__StackWalk* w, uint32_t start) {
+    const X86_CFG* cfg = w->cfg;
+    X86_StackDeltas* out = w->out;
+
+    size_t worklist_count = 0;
+    w->worklist[worklist_count++] = start;
+    while (worklist_count > 0) {
+        uint32_t block = w->worklist[--worklist_count];
+        const X86_Block* b = &cfg->blocks[block];
+
+        // a call that doesn't return, padding and the next function all
+        // end up in one block when nothing jumps to the function (the call
+        // itself ends the block before)
+        const X86_Block* prev = block > 0 ? &cfg->blocks[block - 1] : NULL;
+        bool after_call = prev != NULL && prev->end == b->start && prev->terminator == X86_BRANCH_CALL;
+        bool padded = false;
+
+        X86__StackState s = w->entry[block];
+        bool guessed = w->guessed[block];
+        for (uint32_t j = 0; j < b->inst_count; j++) {
+            uint32_t inst_index = b->first_inst + j;
+            uint32_t offset = cfg->inst_offsets[inst_index];
+
+            X86_Inst inst;
+            bool decoded = x86_disasm(x86_advance(w->code, offset), &inst) == X86_RESULT_SUCCESS;
+            if (decoded && (inst.type == X86_INST_NOP || inst.type == X86_INST_INT3)) {
+                padded = after_call;
+            } else {
+                if (decoded && padded && x86__looks_like_start(cfg, w->code, offset)) {
+                    s = (X86__StackState){ 0, X86__UNKNOWN };
+                    guessed = false;
+                }
+                after_call = decoded && inst.type == X86_INST_CALL;
+                padded = false;
+            }
+
+            // from scratch, the block might have been walked with a guess
+            out->deltas[inst_index] = s.rsp;
+            out->flags[inst_index] = s.rsp == X86__UNKNOWN ? X86_STACK_UNKNOWN : 0;
+
+            if (!decoded) {
+                s.rsp = s.rbp = X86__UNKNOWN;
+                continue;
+            }
+
+            out->flags[inst_index] |= x86__stack_step(&s, &inst);
+        }
+
+        size_t succ_count;
+        const X86_Edge* succs = x86_cfg_succs(cfg, block, &succ_count);
+        for (size_t j = 0; j < succ_count; j++) {
+            uint32_t to = succs[j].to;
+            if (x86__is_frame_start(cfg, w->code, to)) continue;
+
+            bool guess = guessed || x86__after_noreturn(cfg, b, &succs[j]);
+            // a real path into a guessed block walks it again so everything
+            // after it stops being a guess too, unless it lost track and the
+            // guess didn't
+            bool known = s.rsp != X86__UNKNOWN || w->entry[to].rsp == X86__UNKNOWN;
+            if (!w->reached[to] || (w->guessed[to] && !guess && known)) {
+                w->entry[to] = s;
+                w->reached[to] = true;
+                w->guessed[to] = guess;
+                w->worklist[worklist_count++] = to;
+            } else if (!guess && !w->guessed[to] && w->entry[to].rsp != s.rsp && w->entry[to].rsp != X86__UNKNOWN && s.rsp != X86__UNKNOWN) {
+                // the first path in wins, the block just gets marked
+                w->conflicted[to] = true;
+            }
+        }
+    }
+}
+
+void x86_stack_deltas(X86_Arena* arena, const X86_CFG* cfg, X86_Buffer code, X86_StackDeltas* out) {
+    out->count = cfg->inst_count;
+    out->deltas = X86_ARENA_ARRAY(arena, int32_t, cfg->inst_count);
+    out->flags = X86_ARENA_ZARRAY(arena, uint8_t, cfg->inst_count);
+    for (size_t i = 0; i < cfg->inst_count; i++) out->deltas[i] = X86__UNKNOWN;
+
+    X86__StackWalk w = { .cfg = cfg, .code = code, .out = out };
+    w.entry = malloc((cfg->block_count + 1) * sizeof(X86__StackState));
+    w.reached = calloc(cfg->block_count + 1, sizeof(bool));
+    w.guessed = calloc(cfg->block_count + 1, sizeof(bool));
+    w.conflicted = calloc(cfg->block_count + 1, sizeof(bool));
+    w.worklist = malloc(2 * (cfg->block_count + 1) * sizeof(uint32_t));
+
+    // frames start at entries, call targets, endbr64 and after padding. once
+    // those have spread as far as they go, any block nothing reaches (called
+    // through a pointer, only jumped to from elsewhere) starts one too unless
+    // it's padding. bytes after something that didn't decode aren't a new
+    // frame, they're the rest of one we lost track of.
+    for (int pass = 0; pass < 2; pass++) {
+        for (uint32_t i = 0; i < cfg->block_count; i++) {
+            const X86_Block* b = &cfg->blocks[i];
+            if (w.reached[i]) continue;
+
+            bool is_frame;
+            if (pass == 0) {
+                is_frame = x86__is_frame_start(cfg, code, i);
+            } else {
+                is_frame = b->pred_count == 0 && !(i > 0 && (cfg->blocks[i - 1].flags & X86_BLOCK_INVALID)) && !x86__is_padding(cfg, code, b);
+            }
+
+            if (is_frame) {
+                w.entry[i] = (X86__StackState){ 0, X86__UNKNOWN };
+                w.reached[i] = true;
+                x86__stack_propagate(&w, i);
+            }
+        }
+    }
+
+    for (uint32_t i = 0; i < cfg->block_count; i++) {
+        const X86_Block* b = &cfg->blocks[i];
+        if (w.conflicted[i] && b->inst_count > 0) out->flags[b->first_inst] |= X86_STACK_UNBALANCED;
+        if (w.reached[i]) continue;
+
+        // blocks only reachable from loops nothing enters stay unknown
+        for (uint32_t j = 0; j < b->inst_count; j++) out->flags[b->first_inst + j] |= X86_STACK_UNKNOWN;
+    }
+
+    free(w.worklist);
+    free(w.conflicted);
+    free(w.guessed);
+    free(w.reached);
+    free(w.entry);
+}
@@ -0,0 +1,122 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Instruction mix counters, every thread fills its own X86_Stats over a
+// contiguous run of regions and they get summed at the end so the decode
+// loop never touches shared memory.
+typedef struct {
+    const X86_CodeRegion* regions;
+    size_t count;
+
+    X86_Stats stats;
+} X86__StatsJob;
+
+static X86_OperandForm x86__operand_form(const X86_Inst* inst) {
+    bool imm = (inst->flags & X86_INSTR_IMMEDIATE) != 0;
+
+    if (inst->flags & X86_INSTR_ABSOLUTE) return X86_FORM_ABS;
+    if (inst->flags & X86_INSTR_USE_RIPMEM) return imm ? X86_FORM_RIP_IMM : X86_FORM_RIP;
+    if (inst->flags & X86_INSTR_USE_MEMOP) return imm ? X86_FORM_MEM_IMM : X86_FORM_MEM;
+    if (inst->regs[0] != X86_GPR_NONE) return imm ? X86_FORM_REG_IMM : X86_FORM_REG;
+    return imm ? X86_FORM_IMM : X86_FORM_NONE;
+}
+
+void x86_stats_add(X86_Stats* stats, X86_Buffer code) {
+    size_t offset = 0;
+    while (offset < code.length) {
+        X86_Inst inst;
+        if (x86_disasm(x86_advance(code, offset), &inst) != X86_RESULT_SUCCESS || inst.length == 0) {
+            stats->invalid_bytes++;
+            offset += 1;
+            continue;
+        }
+
+        stats->inst_count++;
+        stats->byte_count += inst.length;
+        stats->types[inst.type]++;
+        stats->data_types[inst.data_type]++;
+        stats->forms[x86__operand_form(&inst)]++;
+        stats->lengths[inst.length < 16 ? inst.length : 15]++;
+
+        x86_count_prefixes(x86_advance(code, offset), &inst, stats->prefixes);
+        offset += inst.length;
+    }
+}
+
+void x86_stats_merge(X86_Stats* dst, const X86_Stats* src) {
+    dst->inst_count += src->inst_count;
+    dst->byte_count += src->byte_count;
+    dst->invalid_bytes += src->invalid_bytes;
+
+    for (size_t i = 0; i < X86_INST_COUNT; i++) dst->types[i] += src->types[i];
+    for (size_t i = 0; i < X86_STATS_DATA_TYPES; i++) dst->data_types[i] += src->data_types[i];
+    for (size_t i = 0; i < X86_FORM_COUNT; i++) dst->forms[i] += src->forms[i];
+    for (size_t i = 0; i < X86_PREFIX_COUNT; i++) dst->prefixes[i] += src->prefixes[i];
+    for (size_t i = 0; i < 16; i++) dst->lengths[i] += src->lengths[i];
+}
+
+static int x86__stats_job(void* arg) {
+    X86__StatsJob* job = arg;
+    x86_trace_begin("stats", NULL);
+    for (size_t i = 0; i < job->count; i++) x86_stats_add(&job->stats, job->regions[i].code);
+    x86_trace_end();
+    return 0;
+}
+
+void x86_stats_collect(const X86_CodeRegion* regions, size_t region_count, int thread_count, X86_Stats* out) {
+    memset(out, 0, sizeof(*out));
+    if (region_count == 0) return;
+
+    if (thread_count <= 0) thread_count = 1;
+    if ((size_t)thread_count > region_count) thread_count = region_count;
+
+    // contiguous runs of regions with about the same number of bytes each
+    size_t total = 0;
+    for (size_t i = 0; i < region_count; i++) total += regions[i].code.length;
+
+    X86__StatsJob* jobs = calloc(thread_count, sizeof(X86__StatsJob));
+    size_t next = 0, bytes = 0;
+    for (int t = 0; t < thread_count; t++) {
+        size_t goal = (total * (t + 1)) / thread_count;
+
+        jobs[t].regions = &regions[next];
+        while (next < region_count && (bytes < goal || t == thread_count - 1)) {
+            bytes += regions[next++].code.length;
+            jobs[t].count++;
+        }
+    }
+
+    x86_parallel_for(thread_count, jobs, thread_count, sizeof(X86__StatsJob), x86__stats_job);
+    for (int t = 0; t < thread_count; t++) x86_stats_merge(out, &jobs[t].stats);
+    free(jobs);
+}
+
+const char* x86_get_operand_form_string(X86_OperandForm form) {
+    switch (form) {
+        case X86_FORM_NONE: return "none";
+        case X86_FORM_REG: return "reg";
+        case X86_FORM_REG_IMM: return "reg_imm";
+        case X86_FORM_IMM: return "imm";
+        case X86_FORM_MEM: return "mem";
+        case X86_FORM_MEM_IMM: return "mem_imm";
+        case X86_FORM_RIP: return "rip";
+        case X86_FORM_RIP_IMM: return "rip_imm";
+        case X86_FORM_ABS: return "abs64";
+        default: return "unknown";
+    }
+}
+
+const char* x86_get_prefix_string(X86_Prefix prefix) {
+    switch (prefix) {
+        case X86_PREFIX_LOCK: return "lock";
+        case X86_PREFIX_REP: return "rep";
+        case X86_PREFIX_REPNE: return "repne";
+        case X86_PREFIX_OPSIZE: return "opsize";
+        case X86_PREFIX_ADDRSIZE: return "addrsize";
+        case X86_PREFIX_SEGMENT: return "segment";
+        case X86_PREFIX_REX: return "rex";
+        case X86_PREFIX_MANDATORY: return "mandatory";
+        default: return "unknown";
+    }
+}
@@ -0,0 +1,504 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Serialized instruction streams, all integers are little endian:
+//
+//   header   "DISX86S\0" version:u32 0:u32
+//   blocks   per block: first offset (varint), then per instruction
+//              gap from the end of the last one (zigzag varint)
+//              dictionary entry (varint)
+//              the registers the entry says are there (1 byte each)
+//              base & index (1 byte each) for non rip-relative memory
+//              disp (zigzag varint) for memory operands
+//              imm (zigzag varint) or abs (varint) if the flags say so
+//   dict     dict_count entries (u64): type:16 data_type:8 data_type2:8
+//            segment:8 flags:8 length:8 scale:4 reg mask:4
+//   index    block_count + 1 file offsets (u64) and block_count first
+//            offsets (u32)
+//   trailer  footer start:u64 decoder hash:u64 inst count:u64
+//            block size:u32 block count:u32 dict count:u32 version:u32
+//            "DISX86S\0"
+//
+// The dictionary and index sit at the end so the writer can stream, readers
+// start from the trailer. Every block only needs the dictionary so they
+// decode in any order.
+#define X86__STREAM_VERSION 1
+#define X86__STREAM_HEADER_SIZE 16
+#define X86__STREAM_TRAILER_SIZE 48
+#define X86__STREAM_MAX_INST 32 // varints for everything above can't take more
+#define X86__STREAM_THREAD_INSTS 16384 // fewest instructions worth a thread in x86_stream_read_all
+
+static const char x86__stream_magic[8] = "DISX86S";
+
+inline static void x86__put_u32(uint8_t* out, uint32_t x) {
+    for (int i = 0; i < 4; i++) out[i] = x >> (i * 8);
+}
+
+inline static void x86__put_u64(uint8_t* out, uint64_t x) {
+    for (int i = 0; i < 8; i++) out[i] = x >> (i * 8);
+}
+
+inline static uint32_t x86__get_u32(const uint8_t* in) {
+    uint32_t x = 0;
+    for (int i = 0; i < 4; i++) x |= (uint32_t)in[i] << (i * 8);
+    return x;
+}
+
+inline static uint64_t x86__get_u64(const uint8_t* in) {
+    uint64_t x = 0;
+    for (int i = 0; i < 8; i++) x |= (uint64_t)in[i] << (i * 8);
+    return x;
+}
+
+inline static size_t x86__put_varint(uint8_t* out, uint64_t x) {
+    size_t i = 0;
+    while (x >= 0x80) {
+        out[i++] = (x & 0x7F) | 0x80;
+        x >>= 7;
+    }
+    out[i++] = x;
+    return i;
+}
+
+inline static uint64_t x86__zigzag(int64_t x) {
+    return ((uint64_t)x << 1) ^ (uint64_t)(x >> 63);
+}
+
+inline static int64_t x86__unzigzag(uint64_t x) {
+    return (int64_t)(x >> 1) ^ -(int64_t)(x & 1);
+}
+
+// which of the regs aren't X86_GPR_NONE
+inline static uint8_t x86__reg_mask(const X86_Inst* inst) {
+    uint8_t mask = 0;
+    for (int i = 0; i < 4; i++) {
+        if (inst->regs[i] != X86_GPR_NONE) mask |= 1u << i;
+    }
+    return mask;
+}
+
+inline static uint64_t x86__shape_key(const X86_Inst* inst) {
+    return (uint64_t)inst->type |
+        ((uint64_t)(inst->data_type & 0xFF) << 16) |
+        ((uint64_t)(inst->data_type2 & 0xFF) << 24) |
+        ((uint64_t)(inst->segment & 0xFF) << 32) |
+        ((uint64_t)(inst->flags & 0xFF) << 40) |
+        ((uint64_t)inst->length << 48) |
+        ((uint64_t)(inst->scale & 0xF) << 56) |
+        ((uint64_t)x86__reg_mask(inst) << 60);
+}
+
+////////////////////////////////
+// Writer
+////////////////////////////////
+struct X86_StreamWriter {
+    FILE* out;
+    uint64_t file_pos;
+    bool failed;
+
+    uint32_t block_size;
+    uint64_t inst_count;
+
+    // the block being built
+    uint8_t* block;
+    size_t block_used, block_capacity;
+    uint32_t block_insts;
+    uint32_t next_offset; // where the last instruction ended
+    uint32_t last_offset;
+
+    // dictionary, keys in the order they showed up and an open addressed
+    // table of key -> index + 1
+    uint64_t* dict;
+    uint32_t dict_count, dict_capacity;
+    uint32_t* dict_table;
+    uint32_t dict_table_mask;
+
+    uint64_t* block_starts;
+    uint32_t* block_first_offsets;
+    uint32_t block_count, block_list_capacity;
+};
+
+static void x86__stream_emit(X86_StreamWriter* w, const void* data, size_t size) {
+    if (!w->failed && fwrite(data, 1, size, w->out) != size) w->failed = true;
+    w->file_pos += size;
+}
+
+inline static uint32_t x86__dict_slot(uint64_t key, uint32_t mask) {
+    key ^= key >> 29;
+    key *= 0xBF58476D1CE4E5B9ull;
+    return (key >> 32) & mask;
+}
+
+static bool x86__dict_grow(X86_StreamWriter* w) {
+    uint32_t size = w->dict_table_mask ? (w->dict_table_mask + 1) * 2 : 1024;
+    uint32_t* table = calloc(size, sizeof(uint32_t));
+    if (table == NULL) return false;
+
+    for (uint32_t i = 0; i < w->dict_count; i++) {
+        uint32_t slot = x86__dict_slot(w->dict[i], size - 1);
+        while (table[slot]) slot = (slot + 1) & (size - 1);
+        table[slot] = i + 1;
+    }
+
+    free(w->dict_table);
+    w->dict_table = table;
+    w->dict_table_mask = size - 1;
+    return true;
+}
+
+// UINT32_MAX if we ran out of memory
+static uint32_t x86__dict_index(X86_StreamWriter* w, uint64_t key) {
+    uint32_t slot = x86__dict_slot(key, w->dict_table_mask);
+    while (w->dict_table[slot]) {
+        uint32_t index = w->dict_table[slot] - 1;
+        if (w->dict[index] == key) return index;
+        slot = (slot + 1) & w->dict_table_mask;
+    }
+
+    if (w->dict_count == w->dict_capacity) {
+        uint32_t capacity = w->dict_capacity * 2;
+        uint64_t* dict = realloc(w->dict, capacity * sizeof(uint64_t));
+        if (dict == NULL) return UINT32_MAX;
+
+        w->dict = dict;
+        w->dict_capacity = capacity;
+    }
+
+    uint32_t index = w->dict_count++;
+    w->dict[index] = key;
+    w->dict_table[slot] = index + 1;
+
+    // keep it at most half full
+    if (w->dict_count * 2 > w->dict_table_mask && !x86__dict_grow(w)) return UINT32_MAX;
+    return index;
+}
+
+static void x86__stream_flush_block(X86_StreamWriter* w) {
+    if (w->block_insts == 0) return;
+
+    if (w->block_count + 1 >= w->block_list_capacity) {
+        uint32_t capacity = w->block_list_capacity * 2;
+        uint64_t* starts = realloc(w->block_starts, capacity * sizeof(uint64_t));
+        uint32_t* firsts = starts ? realloc(w->block_first_offsets, capacity * sizeof(uint32_t)) : NULL;
+        if (starts) w->block_starts = starts;
+        if (firsts) w->block_first_offsets = firsts;
+        if (firsts == NULL) {
+            w->failed = true;
+            return;
+        }
+        w->block_list_capacity = capacity;
+    }
+
+    w->block_starts[w->block_count++] = w->file_pos;
+    x86__stream_emit(w, w->block, w->block_used);
+    w->block_used = 0;
+    w->block_insts = 0;
+}
+
+X86_StreamWriter* x86_stream_writer_begin(FILE* out, uint32_t block_size) {
+    X86_StreamWriter* w = calloc(1, sizeof(X86_StreamWriter));
+    if (w == NULL) return NULL;
+
+    w->out = out;
+    w->block_size = block_size ? block_size : 4096;
+    w->block_capacity = (size_t)w->block_size * X86__STREAM_MAX_INST + 16;
+    w->block = malloc(w->block_capacity);
+    w->dict_capacity = 256;
+    w->dict = malloc(w->dict_capacity * sizeof(uint64_t));
+    w->block_list_capacity = 64;
+    w->block_starts = malloc(w->block_list_capacity * sizeof(uint64_t));
+    w->block_first_offsets = malloc(w->block_list_capacity * sizeof(uint32_t));
+
+    if (w->block == NULL || w->dict == NULL || w->block_starts == NULL || w->block_first_offsets == NULL || !x86__dict_grow(w)) {
+        w->failed = true;
+        x86_stream_writer_end(w);
+        return NULL;
+    }
+
+    uint8_t header[X86__STREAM_HEADER_SIZE] = { 0 };
+    memcpy(header, x86__stream_magic, 8);
+    x86__put_u32(&header[8], X86__STREAM_VERSION);
+    x86__stream_emit(w, header, sizeof(header));
+    return w;
+}
+
+bool x86_stream_writer_add(X86_StreamWriter* w, uint32_t offset, const X86_Inst* inst) {
+    if (w->failed) return false;
+    // overlapping instructions are fine (superset), going backwards isn't
+    if (w->inst_count > 0 && offset < w->last_offset) return false;
+
+    uint32_t entry = x86__dict_index(w, x86__shape_key(inst));
+    if (entry == UINT32_MAX) {
+        w->failed = true;
+        return false;
+    }
+
+    uint8_t* p = &w->block[w->block_used];
+    if (w->block_insts == 0) {
+        w->block_first_offsets[w->block_count] = offset;
+        p += x86__put_varint(p, offset);
+        w->next_offset = offset;
+    }
+
+    p += x86__put_varint(p, x86__zigzag((int64_t)offset - w->next_offset));
+    p += x86__put_varint(p, entry);
+
+    for (int i = 0; i < 4; i++) {
+        if (inst->regs[i] != X86_GPR_NONE) *p++ = inst->regs[i];
+    }
+
+    if (inst->flags & X86_INSTR_USE_MEMOP) {
+        if (!(inst->flags & X86_INSTR_USE_RIPMEM)) {
+            *p++ = inst->base;
+            *p++ = inst->index;
+        }
+        p += x86__put_varint(p, x86__zigzag(inst->disp));
+    }
+
+    if (inst->flags & X86_INSTR_ABSOLUTE) p += x86__put_varint(p, inst->abs);
+    else if (inst->flags & X86_INSTR_IMMEDIATE) p += x86__put_varint(p, x86__zigzag(inst->imm));
+
+    w->block_used = p - w->block;
+    w->next_offset = offset + inst->length;
+    w->last_offset = offset;
+    w->inst_count += 1;
+
+    if (++w->block_insts == w->block_size) x86__stream_flush_block(w);
+    return !w->failed;
+}
+
+bool x86_stream_writer_end(X86_StreamWriter* w) {
+    if (!w->failed) {
+        x86__stream_flush_block(w);
+
+        uint64_t footer = w->file_pos;
+        w->block_starts[w->block_count] = footer;
+
+        uint8_t tmp[8];
+        for (uint32_t i = 0; i < w->dict_count; i++) {
+            x86__put_u64(tmp, w->dict[i]);
+            x86__stream_emit(w, tmp, 8);
+        }
+        for (uint32_t i = 0; i <= w->block_count; i++) {
+            x86__put_u64(tmp, w->block_starts[i]);
+            x86__stream_emit(w, tmp, 8);
+        }
+        for (uint32_t i = 0; i < w->block_count; i++) {
+            x86__put_u32(tmp, w->block_first_offsets[i]);
+            x86__stream_emit(w, tmp, 4);
+        }
+
+        uint8_t trailer[X86__STREAM_TRAILER_SIZE];
+        x86__put_u64(&trailer[0], footer);
+        x86__put_u64(&trailer[8], x86_get_decoder_hash());
+        x86__put_u64(&trailer[16], w->inst_count);
+        x86__put_u32(&trailer[24], w->block_size);
+        x86__put_u32(&trailer[28], w->block_count);
+        x86__put_u32(&trailer[32], w->dict_count);
+        x86__put_u32(&trailer[36], X86__STREAM_VERSION);
+        memcpy(&trailer[40], x86__stream_magic, 8);
+        x86__stream_emit(w, trailer, sizeof(trailer));
+    }
+
+    bool ok = !w->failed;
+    free(w->block);
+    free(w->dict);
+    free(w->dict_table);
+    free(w->block_starts);
+    free(w->block_first_offsets);
+    free(w);
+    return ok;
+}
+
+////////////////////////////////
+// Reader
+////////////////////////////////
+bool x86_stream_open(X86_Arena* arena, X86_Buffer file, X86_Stream* out) {
+    memset(out, 0, sizeof(*out));
+    if (file.length < X86__STREAM_HEADER_SIZE + X86__STREAM_TRAILER_SIZE) return false;
+    if (memcmp(file.data, x86__stream_magic, 8) != 0 || x86__get_u32(&file.data[8]) != X86__STREAM_VERSION || x86__get_u32(&file.data[12]) != 0) return false;
+
+    const uint8_t* trailer = &file.data[file.length - X86__STREAM_TRAILER_SIZE];
+    if (memcmp(&trailer[40], x86__stream_magic, 8) != 0 || x86__get_u32(&trailer[36]) != X86__STREAM_VERSION) return false;
+
+    uint64_t footer = x86__get_u64(&trailer[0]);
+    out->file = file;
+    out->decoder_hash = x86__get_u64(&trailer[8]);
+    out->inst_count = x86__get_u64(&trailer[16]);
+    out->block_size = x86__get_u32(&trailer[24]);
+    out->block_count = x86__get_u32(&trailer[28]);
+    out->dict_count = x86__get_u32(&trailer[32]);
+
+    // the footer has to fit exactly between the blocks and the trailer
+    uint64_t footer_size = (uint64_t)out->dict_count * 8 + ((uint64_t)out->block_count + 1) * 8 + (uint64_t)out->block_count * 4;
+    if (footer < X86__STREAM_HEADER_SIZE || footer + footer_size + X86__STREAM_TRAILER_SIZE != file.length) return false;
+    // every block but the last is full and the last one isn't empty, readers
+    // size their arrays off inst_count so this has to hold exactly
+    if (out->block_size == 0 || out->inst_count > (uint64_t)out->block_count * out->block_size) return false;
+    if (out->block_count > 0 && out->inst_count <= (uint64_t)(out->block_count - 1) * out->block_size) return false;
+    if (out->block_count == 0 && out->inst_count != 0) return false;
+
+    const uint8_t* p = &file.data[footer];
+    out->dict = X86_ARENA_ARRAY(arena, X86_Inst, out->dict_count);
+    out->dict_masks = X86_ARENA_ARRAY(arena, uint8_t, out->dict_count);
+    for (uint32_t i = 0; i < out->dict_count; i++, p += 8) {
+        uint64_t key = x86__get_u64(p);
+
+        X86_Inst* inst = &out->dict[i];
+        memset(inst, 0, sizeof(*inst));
+        memset(inst->regs, 0xFF, sizeof(inst->regs));
+        inst->type = key & 0xFFFF;
+        inst->data_type = (key >> 16) & 0xFF;
+        inst->data_type2 = (key >> 24) & 0xFF;
+        inst->segment = (key >> 32) & 0xFF;
+        inst->flags = (key >> 40) & 0xFF;
+        inst->length = (key >> 48) & 0xFF;
+        inst->scale = (key >> 56) & 0xF;
+        out->dict_masks[i] = key >> 60;
+    }
+
+    out->block_starts = X86_ARENA_ARRAY(arena, uint64_t, out->block_count + 1);
+    for (uint32_t i = 0; i <= out->block_count; i++, p += 8) {
+        out->block_starts[i] = x86__get_u64(p);
+        if (out->block_starts[i] < X86__STREAM_HEADER_SIZE || out->block_starts[i] > footer) return false;
+        if (i > 0 && out->block_starts[i] < out->block_starts[i - 1]) return false;
+    }
+
+    out->block_first_offsets = X86_ARENA_ARRAY(arena, uint32_t, out->block_count);
+    for (uint32_t i = 0; i < out->block_count; i++, p += 4) {
+        out->block_first_offsets[i] = x86__get_u32(p);
+    }
+
+    return true;
+}
+
+typedef struct {
+    const uint8_t* p;
+    const uint8_t* end;
+    bool failed;
+} X86__StreamCursor;
+
+inline static uint64_t x86__read_varint(X86__StreamCursor* c) {
+    uint64_t x = 0;
+    for (int shift = 0; shift < 64; shift += 7) {
+        if (c->p == c->end) break;
+
+        uint8_t b = *c->p++;
+        x |= (uint64_t)(b & 0x7F) << shift;
+        if ((b & 0x80) == 0) return x;
+    }
+
+    c->failed = true;
+    return 0;
+}
+
+inline static uint8_t x86__read_byte(X86__StreamCursor* c) {
+    if (c->p == c->end) {
+        c->failed = true;
+        return 0;
+    }
+    return *c->p++;
+}
+
+size_t x86_stream_block_count(const X86_Stream* s, uint32_t block) {
+    if (block >= s->block_count) return 0;
+
+    uint64_t at = (uint64_t)block * s->block_size;
+    return s->inst_count - at < s->block_size ? s->inst_count - at : s->block_size;
+}
+
+size_t x86_stream_read_block(const X86_Stream* s, uint32_t block, X86_Inst* out_insts, uint32_t* out_offsets) {
+    if (block >= s->block_count) return 0;
+
+    X86__StreamCursor c = {
+        .p = &s->file.data[s->block_starts[block]],
+        .end = &s->file.data[s->block_starts[block + 1]]
+    };
+    uint64_t next = x86__read_varint(&c);
+
+    // never more than the block's share of inst_count, whatever the bytes say
+    size_t expected = x86_stream_block_count(s, block);
+    size_t count = 0;
+    while (c.p < c.end && count < expected && !c.failed) {
+        next += x86__unzigzag(x86__read_varint(&c));
+
+        uint64_t entry = x86__read_varint(&c);
+        if (entry >= s->dict_count) return 0;
+
+        X86_Inst* inst = &out_insts[count];
+        *inst = s->dict[entry];
+
+        uint8_t mask = s->dict_masks[entry];
+        for (int i = 0; i < 4; i++) {
+            if (mask & (1u << i)) inst->regs[i] = x86__read_byte(&c);
+        }
+
+        if (inst->flags & X86_INSTR_USE_MEMOP) {
+            if (!(inst->flags & X86_INSTR_USE_RIPMEM)) {
+                inst->base = (int8_t) x86__read_byte(&c);
+                inst->index = (int8_t) x86__read_byte(&c);
+            }
+            inst->disp = x86__unzigzag(x86__read_varint(&c));
+        }
+
+        if (inst->flags & X86_INSTR_ABSOLUTE) inst->abs = x86__read_varint(&c);
+        else if (inst->flags & X86_INSTR_IMMEDIATE) inst->imm = x86__unzigzag(x86__read_varint(&c));
+
+        out_offsets[count++] = next;
+        next += inst->length;
+    }
+
+    return c.failed || c.p != c.end || count != expected ? 0 : count;
+}
+
+typedef struct {
+    const X86_Stream* s;
+    uint32_t first, last;
+    X86_Inst* insts;
+    uint32_t* offsets;
+    bool ok;
+} X86__StreamJob;
+
+static int x86__stream_job(void* arg) {
+    X86__StreamJob* job = arg;
+    x86_trace_begin("stream read", NULL);
+
+    job->ok = true;
+    for (uint32_t b = job->first; b < job->last && job->ok; b++) {
+        size_t at = (size_t)b * job->s->block_size;
+        job->ok = x86_stream_read_block(job->s, b, &job->insts[at], &job->offsets[at]) != 0;
+    }
+
+    x86_trace_end();
+    return 0;
+}
+
+bool x86_stream_read_all(const X86_Stream* s, X86_Inst* out_insts, uint32_t* out_offsets, int thread_count) {
+    if (s->block_count == 0) return s->inst_count == 0;
+
+    // an instruction is ~40ns to read and a thread ~20us to start, below a
+    // few hundred us each the extra threads cost more than they save.
+    uint64_t max_threads = s->inst_count / X86__STREAM_THREAD_INSTS;
+    if (max_threads > s->block_count) max_threads = s->block_count;
+    if (max_threads == 0) max_threads = 1;
+    if (thread_count <= 0) thread_count = 1;
+    if ((uint64_t)thread_count > max_threads) thread_count = max_threads;
+
+    X86__StreamJob* jobs = calloc(thread_count, sizeof(X86__StreamJob));
+    for (int t = 0; t < thread_count; t++) {
+        jobs[t] = (X86__StreamJob){
+            .s = s,
+            .first = ((uint64_t)s->block_count * t) / thread_count,
+            .last = ((uint64_t)s->block_count * (t + 1)) / thread_count,
+            .insts = out_insts,
+            .offsets = out_offsets
+        };
+    }
+
+    x86_parallel_for(thread_count, jobs, thread_count, sizeof(X86__StreamJob), x86__stream_job);
+    bool ok = true;
+    for (int t = 0; t < thread_count; t++) ok &= jobs[t].ok;
+    free(jobs);
+    return ok;
+}
@@ -0,0 +1,101 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Superset disassembly, every byte offset gets its length & type. Only the
+// DFA walk is needed for those so nothing fills in operands (x86_length
+// agrees with x86_disasm on what decodes). Offsets are walked backwards so an
+// instruction starting with a segment or lock prefix can reuse the walk of
+// the byte after it: those prefixes don't change the DFA walk so it's the
+// same instruction one byte longer. Data that's mostly ASCII is full of them
+// (& . 6 > d e).
+typedef struct {
+    X86_Buffer code;
+    size_t start, end;
+
+    uint8_t* lengths;
+    uint16_t* types;
+} X86__SupersetJob;
+
+inline static bool x86__is_passive_prefix(uint8_t b) {
+    return b == 0xF0 || b == 0x2E || b == 0x36 || b == 0x3E || b == 0x26 || b == 0x64 || b == 0x65;
+}
+
+inline static bool x86__is_endbr64(const uint8_t* p, size_t length) {
+    return length >= 4 && memcmp(p, (uint8_t[]) { 0xF3, 0x0F, 0x1E, 0xFA }, 4) == 0;
+}
+
+static int x86__superset_job(void* arg) {
+    X86__SupersetJob* job = arg;
+    const uint8_t* data = job->code.data;
+    size_t length = job->code.length;
+    x86_trace_begin("superset", NULL);
+
+    for (size_t i = job->end; i-- > job->start;) {
+        // the suffix is already decoded unless it belongs to the next job or
+        // is the endbr64 special case which only applies at its first byte.
+        size_t next = i + 1;
+        if (x86__is_passive_prefix(data[i]) && next < job->end && job->lengths[next] != 0 &&
+            job->lengths[next] < UINT8_MAX && !x86__is_endbr64(&data[next], length - next)) {
+            job->lengths[i] = job->lengths[next] + 1;
+            job->types[i] = job->types[next];
+            continue;
+        }
+
+        X86_InstType type;
+        job->lengths[i] = x86_length_and_type((X86_Buffer){ &data[i], length - i }, &type);
+        job->types[i] = type;
+    }
+    x86_trace_end();
+    return 0;
+}
+
+void x86_superset_build(X86_Arena* arena, X86_Buffer code, uint64_t address, int thread_count, X86_Superset* out) {
+    assert(code.length < UINT32_MAX);
+
+    *out = (X86_Superset){ .address = address, .length = code.length };
+    out->lengths = X86_ARENA_ARRAY(arena, uint8_t, code.length + 1);
+    out->types = X86_ARENA_ARRAY(arena, uint16_t, code.length + 1);
+    out->chain = X86_ARENA_ARRAY(arena, uint32_t, code.length + 1);
+    if (code.length == 0) return;
+
+    if (thread_count <= 0) thread_count = 1;
+    if ((size_t)thread_count > code.length) thread_count = code.length;
+
+    X86_ArenaSavepoint sp = x86_arena_save(arena);
+    X86__SupersetJob* jobs = X86_ARENA_ARRAY(arena, X86__SupersetJob, thread_count);
+    for (int t = 0; t < thread_count; t++) {
+        jobs[t] = (X86__SupersetJob){
+            code,
+            (code.length * t) / thread_count,
+            (code.length * (t + 1)) / thread_count,
+            out->lengths, out->types
+        };
+    }
+
+    x86_parallel_for(thread_count, jobs, thread_count, sizeof(X86__SupersetJob), x86__superset_job);
+    x86_arena_restore(arena, sp);
+
+    // chains merge quickly so every offset just extends the one its next
+    // instruction starts, an instruction running past the end ends its chain.
+    out->lengths[code.length] = 0;
+    out->types[code.length] = X86_INST_NONE;
+    out->chain[code.length] = 0;
+    for (size_t i = code.length; i-- > 0;) {
+        size_t len = out->lengths[i];
+        out->chain[i] = len != 0 && i + len <= code.length ? 1 + out->chain[i + len] : 0;
+    }
+}
+
+uint32_t x86_superset_next(const X86_Superset* ss, uint32_t offset) {
+    return ss->chain[offset] ? offset + ss->lengths[offset] : ss->length;
+}
+
+size_t x86_superset_walk(const X86_Superset* ss, uint32_t offset, uint32_t* out_offsets, size_t out_capacity) {
+    size_t count = 0;
+    while (count < out_capacity && ss->chain[offset] != 0) {
+        out_offsets[count++] = offset;
+        offset += ss->lengths[offset];
+    }
+    return count;
+}
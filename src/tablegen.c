@@ -0,0 +1,1196 @@
+// Builds the decoder tables (table.inc & public.inc) out of NASM's instruction
+// table (tables/insns.dat).
+//
+//   tablegen [-isa=gpr,sse,...] <insns.dat> <semantics.dat> <inst_ids.dat> <table.inc> <public.inc>
+//
+// Every usable insns.dat line becomes a path through a byte trie:
+//
+//   [66] [48] [F3] [F2] opcode bytes... [/rx]
+//
+// the prefixes are ordered the same way x86_disasm walks them, +r and +cc
+// opcodes fan out into 8 and 16 edges. The trie is then minimized (it's
+// acyclic so merging identical rows bottom-up gives the minimal DFA) and laid
+// out into the flat dfa[] array. Output only depends on insns.dat so running
+// it twice gives the same bytes.
+//
+// semantics.dat adds the branch class, flags, implicit registers and operand
+// access to each descriptor. inst_ids.dat pins the X86_InstType values the
+// hand-made table had, new instructions go after those.
+//
+// -isa= limits the DFA to a few instruction sets (see isa_groups), subsets
+// move the types they decode to the front (see renumber_descs) so only the
+// full set keeps the pinned values.
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+#include <ctype.h>
+
+// these match the DFA encoding in disx86.c
+#define DFA_RX     0x10000000
+#define DFA_END    0x20000000
+#define DFA_PLUS_R 0x40000000
+
+// row 0 is never used since a zero cell means "no transition"
+#define DFA_FIRST_ROW 0x100
+
+// the operand forms the decoder understands, the order is the value of
+// X86_EncodingMode so only append to this list.
+static const char* encoding_modes[] = {
+    "",
+    "void",
+    "reg8,imm", "reg16,imm", "reg32,imm", "reg64,imm",
+    "reg_al,imm", "reg_ax,imm", "reg_eax,imm", "reg_rax,imm",
+    "reg_ax,sbyteword", "reg_eax,sbytedword", "reg_rax,sbytedword",
+    "rm8,imm", "rm8,imm8", "rm16,imm", "rm32,imm", "rm64,imm",
+    "rm8,unity", "rm16,unity", "rm32,unity", "rm64,unity",
+    "rm64,reg_cl",
+    "reg8,reg8", "mem,reg8", "reg8,mem", "rm8,reg8", "reg8,rm8",
+    "reg16,reg16", "mem,reg16", "reg16,mem", "rm16,reg16", "reg16,rm16", "reg16,reg8",
+    "reg32,reg32", "mem,reg32", "reg32,mem", "rm32,reg32", "reg32,rm32", "reg32,rm8", "reg32,rm16",
+    "reg64,reg64", "mem,reg64", "reg64,mem", "rm64,reg64", "reg64,rm64", "reg64,rm8", "reg64,rm16", "reg64,rm32",
+    "mem,imm8", "mem,imm16", "mem,imm32",
+    "reg8", "reg16", "reg32", "reg64",
+    "rm8", "rm16", "rm32", "rm64",
+    "rm16,imm8", "rm32,imm8", "rm64,imm8",
+    "rm32,imm32", "rm64,imm32",
+    "imm|short", "imm16|near", "imm32|near", "imm64|near",
+    "xmmreg,xmmreg", "xmmreg,xmmrm128", "xmmrm128,xmmreg", "xmmrm,xmmreg", "xmmreg,xmmrm",
+    "mem,xmmreg", "xmmreg,mem", "xmmreg,imm", "xmmreg,rm64", "rm64,xmmreg",
+};
+enum { ENCODING_MODE_COUNT = sizeof(encoding_modes) / sizeof(encoding_modes[0]) };
+
+// same order as X86_Cond
+static const char* cond_codes[16] = {
+    "o", "no", "b", "nb", "e", "ne", "be", "a",
+    "s", "ns", "p", "np", "l", "ge", "le", "g"
+};
+
+// matches X86_ISA in disx86.h, every line belongs to the first group with
+// one of its flags and anything unclaimed is plain GPR code.
+enum {
+    ISA_GPR, ISA_LEGACY, ISA_X87, ISA_MMX, ISA_SSE, ISA_SSE4, ISA_SYSTEM, ISA_EXT,
+    ISA_COUNT
+};
+
+static const struct {
+    const char* name;
+    const char* flags[16];
+} isa_groups[ISA_COUNT] = {
+    [ISA_GPR]    = { "gpr" },
+    [ISA_LEGACY] = { "legacy", { "NOLONG" } },
+    [ISA_X87]    = { "x87",    { "FPU" } },
+    [ISA_MMX]    = { "mmx",    { "MMX", "3DNOW" } },
+    [ISA_SSE]    = { "sse",    { "SSE", "SSE2" } },
+    [ISA_SSE4]   = { "sse4",   { "SSE3", "SSSE3", "SSE41", "SSE42", "SSE4A" } },
+    [ISA_SYSTEM] = { "system", { "PRIV", "PROT", "SMM", "VMX", "SGX" } },
+    [ISA_EXT]    = { "ext",    { "CYRIX", "IA64", "BMI1", "BMI2", "TBM", "RTM", "HLE", "GFNI",
+                                 "SHA", "ENQCMD", "SERIALIZE", "TSXLDTRK", "WBNOINVD", "PCONFIG",
+                                 "INVPCID" } },
+};
+
+#define ISA_ALL ((1u << ISA_COUNT) - 1)
+static unsigned isa_mask = ISA_ALL;
+
+// strtok_r isn't on every libc we build with
+static char* next_token(char** cursor, const char* delims) {
+    char* str = *cursor + strspn(*cursor, delims);
+    if (*str == '\0') {
+        *cursor = str;
+        return NULL;
+    }
+
+    char* end = str + strcspn(str, delims);
+    if (*end) *end++ = '\0';
+
+    *cursor = end;
+    return str;
+}
+
+////////////////////////////////
+// Instruction descriptors
+////////////////////////////////
+#define MAX_DESCS 4096
+
+// 2 bits per operand slot (read, write), matches X86_OperandAccess. anything
+// not in semantics.dat reads & writes the first operand and reads the rest.
+#define DEFAULT_OPERAND_ACCESS 0x57
+
+typedef struct {
+    char key[32];  // name as written in insns.dat
+    char name[32]; // name in the output, differs for cc families
+    bool has_cc;
+
+    // false if none of its lines made it into the ISA subset
+    bool used;
+
+    // a line spells out the 66 byte (SSE and friends) or uses it as o16,
+    // never both so x86_count_prefixes can tell the two apart by type
+    bool opcode_66, o16;
+
+    // from semantics.dat
+    int branch;
+    unsigned flags_read, flags_written;
+    unsigned implicit_read, implicit_write;
+    unsigned operand_access;
+} Desc;
+
+static Desc descs[MAX_DESCS];
+static int desc_count = 1; // 0 is X86_INST_NONE
+
+// X86_InstType values out of inst_ids.dat
+typedef struct {
+    char name[32];
+    int value;
+} Pin;
+
+static Pin pins[MAX_DESCS];
+static int pin_count;
+
+static int find_pin(const char* name) {
+    for (int i = 0; i < pin_count; i++) {
+        if (strcmp(pins[i].name, name) == 0) return pins[i].value;
+    }
+    return 0;
+}
+
+// cc families (Jcc, CMOVcc, SETcc) take up 16 descriptors, one per condition
+static int get_desc(const char* name, bool is_cc) {
+    for (int i = 1; i < desc_count; i++) {
+        if (strcmp(descs[i].key, name) == 0) return i;
+    }
+
+    // cc families are pinned by their first condition, jcc -> jo
+    char first[32];
+    snprintf(first, sizeof(first), "%s", name);
+    if (is_cc) snprintf(first + strlen(name) - 2, sizeof(first) - strlen(name) + 2, "%s", cond_codes[0]);
+
+    int count = is_cc ? 16 : 1;
+    int base = find_pin(first);
+    if (base == 0) base = desc_count;
+
+    if (base + count > MAX_DESCS) {
+        fprintf(stderr, "error: too many instructions!\n");
+        exit(1);
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (descs[base + i].name[0]) {
+            fprintf(stderr, "error: %s lands on X86_InstType %d which %s already has!\n", name, base + i, descs[base + i].name);
+            exit(1);
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        Desc* d = &descs[base + i];
+        snprintf(d->key, sizeof(d->key), "%s", i == 0 ? name : "");
+        snprintf(d->name, sizeof(d->name), "%s", name);
+        d->has_cc = is_cc;
+        d->operand_access = DEFAULT_OPERAND_ACCESS;
+
+        if (is_cc) {
+            // jcc -> jo, jno, jb...
+            size_t len = strlen(name) - 2;
+            snprintf(d->name + len, sizeof(d->name) - len, "%s", cond_codes[i]);
+        }
+    }
+
+    if (desc_count < base + count) desc_count = base + count;
+    return base;
+}
+
+static void load_pins(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "error: could not open %s!\n", path);
+        exit(1);
+    }
+
+    char line[256];
+    while (fgets(line, sizeof(line), file)) {
+        char* cursor = line;
+        char* name = next_token(&cursor, " \t\r\n");
+        char* value = next_token(&cursor, " \t\r\n");
+        if (name == NULL || name[0] == ';') continue;
+
+        int v = value ? atoi(value) : 0;
+        if (v <= 0 || v >= MAX_DESCS || pin_count == MAX_DESCS || find_pin(name)) {
+            fprintf(stderr, "error: %s: bad entry for '%s'!\n", path, name);
+            exit(1);
+        }
+
+        Pin* p = &pins[pin_count++];
+        snprintf(p->name, sizeof(p->name), "%s", name);
+        p->value = v;
+
+        // everything that isn't pinned goes after the last one
+        if (desc_count <= v) desc_count = v + 1;
+    }
+    fclose(file);
+}
+
+// pinned names insns.dat had nothing for stay around as reserved values
+static void reserve_pins(void) {
+    for (int i = 0; i < pin_count; i++) {
+        Desc* d = &descs[pins[i].value];
+        if (d->name[0]) continue;
+
+        memcpy(d->key, pins[i].name, sizeof(d->key));
+        memcpy(d->name, pins[i].name, sizeof(d->name));
+        d->operand_access = DEFAULT_OPERAND_ACCESS;
+    }
+}
+
+////////////////////////////////
+// Trie
+////////////////////////////////
+typedef struct {
+    char name[32];     // family name for cc instructions
+    char ops[64];      // operands as written in insns.dat
+    int mode;
+    int desc;
+    int prio;
+    bool plus_r;
+} Term;
+
+typedef struct Node Node;
+typedef struct {
+    Node* child;
+    bool has_term;
+    Term term;
+} Edge;
+
+struct Node {
+    Edge byte[256];
+    Edge rx[8];
+    bool has_rx;
+
+    // filled in during layout
+    int base;
+    bool placed;
+};
+
+static Node* new_node(void) {
+    Node* n = calloc(1, sizeof(Node));
+    if (n == NULL) {
+        fprintf(stderr, "error: out of memory!\n");
+        exit(1);
+    }
+    return n;
+}
+
+static Node* get_child(Edge* e) {
+    if (e->child == NULL) e->child = new_node();
+    return e->child;
+}
+
+static int find_mode(const char* ops) {
+    for (int i = 1; i < ENCODING_MODE_COUNT; i++) {
+        if (strcmp(encoding_modes[i], ops) == 0) return i;
+    }
+    return 0;
+}
+
+// "mem,reg8" + "reg8,reg8" -> "rm8,reg8", only merges if a single operand
+// differs and the result is something the decoder knows about.
+static int merge_ops(char* out, const char* a, const char* b) {
+    char tmp_a[64], tmp_b[64];
+    strcpy(tmp_a, a), strcpy(tmp_b, b);
+
+    char* cursor_a = tmp_a;
+    char* cursor_b = tmp_b;
+    char* x = next_token(&cursor_a, ",");
+    char* y = next_token(&cursor_b, ",");
+
+    int diffs = 0;
+    out[0] = '\0';
+    while (x && y) {
+        char merged[16];
+        if (strcmp(x, y) == 0) {
+            snprintf(merged, sizeof(merged), "%s", x);
+        } else {
+            // the register/memory halves of an r/m operand
+            const char* reg = !strncmp(x, "reg", 3) ? x : !strncmp(y, "reg", 3) ? y : NULL;
+            const char* other = reg == x ? y : x;
+            if (reg == NULL || (strcmp(other, "mem") != 0 && strncmp(other, "rm", 2) != 0)) return 0;
+            if (other[0] == 'r' && strcmp(other + 2, reg + 3) != 0) return 0;
+
+            snprintf(merged, sizeof(merged), "rm%s", reg + 3);
+            diffs++;
+        }
+
+        if (out[0]) strcat(out, ",");
+        strcat(out, merged);
+
+        x = next_token(&cursor_a, ",");
+        y = next_token(&cursor_b, ",");
+    }
+
+    if (x || y || diffs != 1) return 0;
+    return find_mode(out);
+}
+
+// when two lines want the same slot:
+//   same instruction: merge the operand forms if possible, otherwise the later
+//                     line wins (it's usually the more specific one).
+//   different ones:   the more reliable line wins (disassemblable, documented,
+//                     valid in long mode), ties go to whoever came first.
+static void place_term(Edge* e, const Term* t) {
+    if (!e->has_term) {
+        e->has_term = true;
+        e->term = *t;
+        return;
+    }
+
+    Term* old = &e->term;
+    if (strcmp(old->name, t->name) == 0) {
+        char merged[64];
+        int mode = merge_ops(merged, old->ops, t->ops);
+        if (mode) {
+            strcpy(old->ops, merged);
+            old->mode = mode;
+        } else if (t->prio >= old->prio) {
+            *old = *t;
+        }
+    } else if (t->prio > old->prio) {
+        *old = *t;
+    }
+}
+
+static bool is_prefix_byte(int b) {
+    switch (b) {
+        case 0x26: case 0x2E: case 0x36: case 0x3E:
+        case 0x64: case 0x65: case 0x66: case 0x67:
+        case 0xF0: case 0xF2: case 0xF3:
+        return true;
+
+        default:
+        return (b & 0xF0) == 0x40;
+    }
+}
+
+static int hex_byte(const char* str) {
+    if (!isxdigit(str[0]) || !isxdigit(str[1])) return -1;
+    if (isupper(str[0]) || isupper(str[1])) return -1;
+
+    char tmp[3] = { str[0], str[1], 0 };
+    return (int)strtol(tmp, NULL, 16);
+}
+
+static bool has_flag(const char* flags, const char* flag) {
+    size_t len = strlen(flag);
+    for (const char* p = flags; (p = strstr(p, flag)) != NULL; p += len) {
+        bool starts = (p == flags || p[-1] == ',');
+        bool ends = (p[len] == '\0' || p[len] == ',');
+        if (starts && ends) return true;
+    }
+    return false;
+}
+
+static int classify_isa(const char* ops, const char* flags) {
+    // MMX forms of SSE-era instructions are still MMX
+    if (strstr(ops, "mmx")) return ISA_MMX;
+
+    for (int i = 0; i < ISA_COUNT; i++) {
+        for (int j = 0; isa_groups[i].flags[j]; j++) {
+            if (has_flag(flags, isa_groups[i].flags[j])) return i;
+        }
+    }
+    return ISA_GPR;
+}
+
+// priority bit for lines NASM would disassemble (no ND flag)
+#define PRIO_DISASM 4
+
+enum {
+    PREFIX_66 = 1, PREFIX_REXW = 2, PREFIX_F3 = 4, PREFIX_F2 = 8
+};
+
+static int used_lines = 0;
+
+static void insert_line(Node* root, char* name, char* ops, char* code, char* flags) {
+    if (strcmp(code, "ignore") == 0) return;
+
+    if (has_flag(flags, "OBSOLETE")) return;
+
+    // undocumented assembler-only forms (UMOV & co) just shadow real opcodes
+    if (has_flag(flags, "ND") && has_flag(flags, "UNDOC")) return;
+
+    int mode = find_mode(ops);
+    if (mode == 0) return;
+
+    // [mr: hle o32 01 /r] -> "hle o32 01 /r"
+    char* body = code + 1;
+    char* end = strrchr(body, ']');
+    if (end) *end = '\0';
+
+    char* colon = strrchr(body, ':');
+    if (colon) body = colon + 1;
+
+    int prefixes = 0;
+    bool opcode_66 = false, o16 = false;
+    int opcode[8];
+    int opcode_count = 0;
+    int rx = -1;
+    int fan_out = 1;
+    bool plus_r = false;
+
+    char* cursor = body;
+    for (char* tok; (tok = next_token(&cursor, " \t")) != NULL;) {
+        // VEX & friends are out of scope for the DFA
+        if (!strncmp(tok, "vex", 3) || !strncmp(tok, "evex", 4) || !strncmp(tok, "xop", 3)) return;
+
+        int b = hex_byte(tok);
+        if (b >= 0 && (tok[2] == '\0' || tok[2] == '+')) {
+            if (opcode_count == 0 && tok[2] == '\0' && (b == 0x66 || b == 0xF2 || b == 0xF3)) {
+                // mandatory prefix spelled as a byte
+                prefixes |= (b == 0x66 ? PREFIX_66 : b == 0xF3 ? PREFIX_F3 : PREFIX_F2);
+                opcode_66 |= b == 0x66;
+                continue;
+            }
+
+            if (opcode_count >= 8) return;
+            opcode[opcode_count++] = b;
+
+            if (!strcmp(tok + 2, "+r")) plus_r = true, fan_out = 8;
+            else if (!strcmp(tok + 2, "+c")) fan_out = 16;
+            else if (tok[2] == '+') return;
+            continue;
+        }
+
+        if (!strcmp(tok, "wait")) {
+            // it's just the FWAIT opcode glued in front
+            if (opcode_count >= 8) return;
+            opcode[opcode_count++] = 0x9B;
+            continue;
+        }
+
+        if (opcode_count == 0) {
+            if (!strcmp(tok, "o16")) prefixes |= PREFIX_66, o16 = true;
+            else if (!strcmp(tok, "o64")) prefixes |= PREFIX_REXW;
+            else if (!strcmp(tok, "f3i") || !strcmp(tok, "mustrep")) prefixes |= PREFIX_F3;
+            else if (!strcmp(tok, "f2i") || !strcmp(tok, "mustrepne")) prefixes |= PREFIX_F2;
+
+            // everything else (o32, odf, hle, np...) doesn't change the bytes
+            continue;
+        }
+
+        // the ModRM marks the end of the opcode, anything after it is an
+        // immediate of some sort.
+        if (tok[0] == '/' && tok[1] >= '0' && tok[1] <= '7' && tok[2] == '\0') {
+            rx = tok[1] - '0';
+        }
+        break;
+    }
+
+    // fan outs are only on the last opcode byte
+    if (opcode_count == 0) return;
+    if (fan_out > 1 && (opcode[opcode_count - 1] & (fan_out - 1))) return;
+
+    // can't reach an opcode that x86_disasm eats as a prefix
+    if (is_prefix_byte(opcode[0])) return;
+
+    // Jcc, CMOVcc, SETcc
+    for (char* p = name; *p; p++) *p = tolower(*p);
+    size_t name_len = strlen(name);
+    bool is_cc = fan_out == 16 && name_len > 2 && !strcmp(name + name_len - 2, "cc");
+    if (fan_out == 16 && !is_cc) return;
+
+    // the descriptor is allocated even if the ISA is filtered out, that way
+    // code can name X86_InstTypes the subset doesn't decode (they sort after
+    // the used ones, see renumber_descs).
+    int desc = get_desc(name, is_cc);
+    if ((isa_mask & (1u << classify_isa(ops, flags))) == 0) return;
+
+    for (int i = 0; i < (is_cc ? 16 : 1); i++) {
+        descs[desc + i].used = true;
+        descs[desc + i].opcode_66 |= opcode_66;
+        descs[desc + i].o16 |= o16;
+    }
+
+    if (descs[desc].opcode_66 && descs[desc].o16) {
+        fprintf(stderr, "error: %s has 66 both as o16 and as part of the opcode!\n", name);
+        exit(1);
+    }
+
+    Term t = { 0 };
+    snprintf(t.name, sizeof(t.name), "%s", name);
+    snprintf(t.ops, sizeof(t.ops), "%s", ops);
+    t.mode = mode;
+    t.desc = desc;
+    // ND lines are assembler aliases (but they're also where the |near and
+    // |short forms the decoder wants live) so they only fill in the gaps.
+    t.prio = (has_flag(flags, "ND")     ? 0 : PRIO_DISASM)
+        +    (has_flag(flags, "UNDOC")  ? 0 : 2)
+        +    (has_flag(flags, "NOLONG") ? 0 : 1);
+    t.plus_r = plus_r;
+
+    // walk the prefixes in the same order the decoder does
+    Node* n = root;
+    if (prefixes & PREFIX_66)   n = get_child(&n->byte[0x66]);
+    if (prefixes & PREFIX_REXW) n = get_child(&n->byte[0x48]);
+    if (prefixes & PREFIX_F3)   n = get_child(&n->byte[0xF3]);
+    if (prefixes & PREFIX_F2)   n = get_child(&n->byte[0xF2]);
+
+    for (int i = 0; i < opcode_count - 1; i++) {
+        n = get_child(&n->byte[opcode[i]]);
+    }
+
+    int last = opcode[opcode_count - 1];
+    for (int i = 0; i < fan_out; i++) {
+        Edge* e = &n->byte[last + i];
+        if (rx >= 0) {
+            Node* rx_node = get_child(e);
+            rx_node->has_rx = true;
+            place_term(&rx_node->rx[rx], &t);
+        } else {
+            place_term(e, &t);
+        }
+    }
+
+    used_lines++;
+}
+
+// used descriptors move to the front so descs[] only has to cover them, the
+// rest keep their X86_InstType names after those. with every ISA picked
+// nothing moves, that's the build that keeps the pinned values.
+static int desc_remap[MAX_DESCS];
+static int used_desc_count = 1;
+
+static void remap_terms(Node* n) {
+    for (int i = 0; i < 256; i++) {
+        if (n->byte[i].has_term) n->byte[i].term.desc = desc_remap[n->byte[i].term.desc];
+        if (n->byte[i].child) remap_terms(n->byte[i].child);
+    }
+
+    for (int i = 0; i < 8; i++) {
+        if (n->rx[i].has_term) n->rx[i].term.desc = desc_remap[n->rx[i].term.desc];
+        if (n->rx[i].child) remap_terms(n->rx[i].child);
+    }
+}
+
+static void renumber_descs(Node* root) {
+    static Desc sorted[MAX_DESCS];
+    if (isa_mask == ISA_ALL) {
+        used_desc_count = desc_count;
+        return;
+    }
+
+    // cc families are used or not as a whole so they stay contiguous
+    int next = 1;
+    for (int pass = 0; pass < 2; pass++) {
+        for (int i = 1; i < desc_count; i++) {
+            // holes in the pinned values don't need to survive a subset
+            if (descs[i].used != (pass == 0) || descs[i].name[0] == 0) continue;
+
+            desc_remap[i] = next;
+            sorted[next++] = descs[i];
+        }
+
+        if (pass == 0) used_desc_count = next;
+    }
+
+    memcpy(&descs[1], &sorted[1], (next - 1) * sizeof(Desc));
+    desc_count = next;
+    remap_terms(root);
+}
+
+////////////////////////////////
+// Layout & minimization
+////////////////////////////////
+typedef struct {
+    bool is_rx;
+    int base;
+    int cells[256];
+    const Term* terms[256];
+} Row;
+
+#define MAX_ROWS 8192
+static Row* rows[MAX_ROWS];
+static int row_count;
+static int dfa_cursor = DFA_FIRST_ROW;
+
+static int term_value(const Term* t) {
+    return DFA_END | (t->plus_r ? DFA_PLUS_R : 0) | (t->mode << 16) | t->desc;
+}
+
+// returns the value a parent should store to reach this node
+static int layout(Node* n) {
+    if (n->placed) return n->base;
+
+    Row* r = calloc(1, sizeof(Row));
+    r->is_rx = n->has_rx;
+
+    // RX rows only ever get indexed with 0-7, byte rows need all 256.
+    // when a node has both we keep the RX form, the literal ModRM bytes
+    // can't be told apart from a normal ModRM in the current decoder.
+    int width = r->is_rx ? 8 : 256;
+    for (int i = 0; i < width; i++) {
+        Edge* e = r->is_rx ? &n->rx[i] : &n->byte[i];
+
+        if (e->has_term && (e->child == NULL || e->term.prio >= PRIO_DISASM)) {
+            // a complete instruction wins over a longer one sharing its
+            // bytes unless it's just an assembler alias (0f 38 SMINT).
+            r->cells[i] = term_value(&e->term);
+            r->terms[i] = &e->term;
+        } else if (e->child) {
+            r->cells[i] = layout(e->child);
+        }
+    }
+
+    // minimization: identical rows (and thus identical subtrees, since the
+    // children were already merged) share one copy.
+    int value = -1;
+    for (int i = 0; i < row_count; i++) {
+        Row* other = rows[i];
+        if (other->is_rx == r->is_rx && memcmp(other->cells, r->cells, width * sizeof(int)) == 0) {
+            value = other->base;
+            free(r);
+            break;
+        }
+    }
+
+    if (value < 0) {
+        if (row_count >= MAX_ROWS) {
+            fprintf(stderr, "error: too many DFA rows!\n");
+            exit(1);
+        }
+
+        r->base = dfa_cursor;
+        dfa_cursor += width;
+        rows[row_count++] = r;
+        value = r->base;
+    }
+
+    n->placed = true;
+    n->base = value | (n->has_rx ? DFA_RX : 0);
+    return n->base;
+}
+
+////////////////////////////////
+// Semantics
+////////////////////////////////
+// matches X86_BranchClass in disx86.h
+static const char* branch_classes[] = {
+    "-", "jmp", "jcc", "call", "ret", "int", "trap"
+};
+
+static const char* branch_enum_names[] = {
+    "X86_BRANCH_NONE", "X86_BRANCH_JMP", "X86_BRANCH_JCC", "X86_BRANCH_CALL",
+    "X86_BRANCH_RET", "X86_BRANCH_INT", "X86_BRANCH_TRAP"
+};
+
+// matches X86_Flags in disx86.h, the bit is the index
+static const char flag_letters[] = "cpazsodi";
+
+enum { FLAG_C = 1, FLAG_P = 2, FLAG_Z = 8, FLAG_S = 16, FLAG_O = 32 };
+
+// what each X86_Cond reads
+static const unsigned cond_flags[16] = {
+    FLAG_O, FLAG_O, FLAG_C, FLAG_C, FLAG_Z, FLAG_Z, FLAG_C | FLAG_Z, FLAG_C | FLAG_Z,
+    FLAG_S, FLAG_S, FLAG_P, FLAG_P, FLAG_S | FLAG_O, FLAG_S | FLAG_O,
+    FLAG_Z | FLAG_S | FLAG_O, FLAG_Z | FLAG_S | FLAG_O
+};
+
+static const char* gpr_names[16] = {
+    "rax", "rcx", "rdx", "rbx", "rsp", "rbp", "rsi", "rdi",
+    "r8", "r9", "r10", "r11", "r12", "r13", "r14", "r15"
+};
+
+static bool parse_flags(const char* str, unsigned* out) {
+    *out = 0;
+    if (strcmp(str, "-") == 0) return true;
+
+    for (const char* p = str; *p; p++) {
+        const char* found = strchr(flag_letters, *p);
+        if (found == NULL) return false;
+
+        *out |= 1u << (found - flag_letters);
+    }
+    return true;
+}
+
+static bool parse_regs(char* str, unsigned* out) {
+    *out = 0;
+    if (strcmp(str, "-") == 0) return true;
+
+    char* cursor = str;
+    for (char* tok; (tok = next_token(&cursor, ",")) != NULL;) {
+        int i = 0;
+        while (i < 16 && strcmp(gpr_names[i], tok) != 0) i++;
+        if (i == 16) return false;
+
+        *out |= 1u << i;
+    }
+    return true;
+}
+
+// "w,r" -> 2 bits per slot, missing slots are read
+static bool parse_access(char* str, unsigned* out) {
+    *out = 0;
+    if (strcmp(str, "-") == 0) return true;
+
+    int slot = 0;
+    char* cursor = str;
+    for (char* tok; (tok = next_token(&cursor, ",")) != NULL; slot++) {
+        if (slot >= 4) return false;
+
+        unsigned bits;
+        if (strcmp(tok, "r") == 0) bits = 1;
+        else if (strcmp(tok, "w") == 0) bits = 2;
+        else if (strcmp(tok, "rw") == 0) bits = 3;
+        else if (strcmp(tok, "-") == 0) bits = 0;
+        else return false;
+
+        *out |= bits << (slot * 2);
+    }
+
+    for (; slot < 4; slot++) *out |= 1u << (slot * 2);
+    return true;
+}
+
+static void semantics_error(const char* path, int line, const char* msg) {
+    fprintf(stderr, "%s:%d: error: %s\n", path, line, msg);
+    exit(1);
+}
+
+static void load_semantics(const char* path) {
+    FILE* file = fopen(path, "rb");
+    if (file == NULL) {
+        fprintf(stderr, "error: could not open %s!\n", path);
+        exit(1);
+    }
+
+    char line[1024];
+    int line_num = 0;
+    while (fgets(line, sizeof(line), file)) {
+        line_num++;
+
+        char* cursor = line;
+        char* fields[7];
+        int field_count = 0;
+        for (char* tok; field_count < 7 && (tok = next_token(&cursor, " \t\r\n")) != NULL;) {
+            fields[field_count++] = tok;
+        }
+
+        if (field_count == 0 || fields[0][0] == ';') continue;
+        if (field_count < 6) semantics_error(path, line_num, "expected 6 or 7 fields");
+
+        int desc = 0;
+        for (int i = 1; i < desc_count; i++) {
+            if (strcmp(descs[i].key, fields[0]) == 0) {
+                desc = i;
+                break;
+            }
+        }
+        if (desc == 0) semantics_error(path, line_num, "unknown instruction");
+
+        int branch = 0;
+        while (branch < 7 && strcmp(branch_classes[branch], fields[1]) != 0) branch++;
+        if (branch == 7) semantics_error(path, line_num, "unknown branch class");
+
+        bool reads_cc = strcmp(fields[2], "cc") == 0;
+        if (reads_cc && !descs[desc].has_cc) semantics_error(path, line_num, "'cc' on an instruction without a condition code");
+
+        unsigned flags_read, flags_written, implicit_read, implicit_write;
+        if (!reads_cc && !parse_flags(fields[2], &flags_read)) semantics_error(path, line_num, "bad flags");
+        if (!parse_flags(fields[3], &flags_written)) semantics_error(path, line_num, "bad flags");
+        if (!parse_regs(fields[4], &implicit_read)) semantics_error(path, line_num, "bad register list");
+        if (!parse_regs(fields[5], &implicit_write)) semantics_error(path, line_num, "bad register list");
+
+        unsigned operand_access = DEFAULT_OPERAND_ACCESS;
+        if (field_count == 7 && !parse_access(fields[6], &operand_access)) semantics_error(path, line_num, "bad operand access");
+
+        for (int i = 0; i < (descs[desc].has_cc ? 16 : 1); i++) {
+            Desc* d = &descs[desc + i];
+            d->branch = branch;
+            d->flags_read = reads_cc ? cond_flags[i] : flags_read;
+            d->flags_written = flags_written;
+            d->implicit_read = implicit_read;
+            d->implicit_write = implicit_write;
+            d->operand_access = operand_access;
+        }
+    }
+
+    fclose(file);
+}
+
+////////////////////////////////
+// Output
+////////////////////////////////
+static FILE* open_output(const char* path) {
+    // binary mode so the line endings don't depend on the host
+    FILE* f = fopen(path, "wb");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open %s!\n", path);
+        exit(1);
+    }
+    return f;
+}
+
+static bool is_xmm_mode(int mode) {
+    return strstr(encoding_modes[mode], "xmm") != NULL;
+}
+
+////////////////////////////////
+// Reverse index
+////////////////////////////////
+// every path through the laid out DFA, walked the way x86_disasm walks it so
+// whatever x86_encode picks decodes back to the same thing.
+typedef struct {
+    int type, mode, prefixes, rx;
+    bool plus_r;
+    int opcode_count;
+    int opcode[4];
+
+    // ties go to the line the disassembler prefers (82 /0 is add too but
+    // not in long mode)
+    int prio;
+} Encoding;
+
+#define MAX_ENCODINGS 16384
+static Encoding encodings[MAX_ENCODINGS];
+static int encoding_count;
+
+static void add_encoding(int cell, const Term* term, int prefixes, const int* opcode, int opcode_count, int rx) {
+    int desc = cell & 0xFFFF;
+    int last = opcode[opcode_count - 1];
+
+    // +r fans out over the bottom 3 bits, the encoder puts the register back
+    bool plus_r = (cell & DFA_PLUS_R) != 0;
+    if (plus_r && (last & 7)) return;
+
+    Encoding e = { desc, (cell >> 16) & 0xFF, prefixes, rx, plus_r, opcode_count, .prio = term ? term->prio : 0 };
+    memcpy(e.opcode, opcode, opcode_count * sizeof(int));
+    if (descs[desc].has_cc) e.type += last & 0xF;
+
+    // only the shortest way to get the same thing
+    for (int i = 0; i < encoding_count; i++) {
+        Encoding* other = &encodings[i];
+        if (other->type == e.type && other->mode == e.mode && other->prefixes == e.prefixes) {
+            if (other->opcode_count > opcode_count || (other->opcode_count == opcode_count && other->prio < e.prio)) *other = e;
+            return;
+        }
+    }
+
+    if (encoding_count >= MAX_ENCODINGS) {
+        fprintf(stderr, "error: too many encodings!\n");
+        exit(1);
+    }
+    encodings[encoding_count++] = e;
+}
+
+// gate is the 66 row, x86_disasm drops the 66 when the first opcode byte
+// isn't in it.
+static void walk_encodings(const int* flat, const Term** flat_terms, int state, int gate, int prefixes, int* opcode, int depth) {
+    for (int b = 0; b < 256; b++) {
+        // the decoder eats these before it gets to the DFA
+        if (depth == 0 && is_prefix_byte(b)) continue;
+        if (depth == 0 && gate && flat[gate + b] == 0) continue;
+
+        int cell = flat[state + b];
+        if (cell == 0) continue;
+
+        opcode[depth] = b;
+        if (cell & DFA_END) {
+            add_encoding(cell, flat_terms[state + b], prefixes, opcode, depth + 1, -1);
+        } else if (cell & DFA_RX) {
+            int row = cell & ~DFA_RX;
+            for (int rx = 0; rx < 8; rx++) {
+                if (flat[row + rx] & DFA_END) add_encoding(flat[row + rx], flat_terms[row + rx], prefixes, opcode, depth + 1, rx);
+            }
+        } else if (depth < 3) {
+            walk_encodings(flat, flat_terms, cell, 0, prefixes, opcode, depth + 1);
+        }
+    }
+}
+
+static int cmp_encoding(const void* a, const void* b) {
+    const Encoding* x = a;
+    const Encoding* y = b;
+    if (x->type != y->type) return x->type - y->type;
+    if (x->prio != y->prio) return y->prio - x->prio;
+    if (x->mode != y->mode) return x->mode - y->mode;
+    return x->prefixes - y->prefixes;
+}
+
+static void write_encodings(FILE* f, int entrypoint) {
+    int* flat = calloc(dfa_cursor, sizeof(int));
+    const Term** flat_terms = calloc(dfa_cursor, sizeof(Term*));
+    for (int i = 0; i < row_count; i++) {
+        int width = rows[i]->is_rx ? 8 : 256;
+        memcpy(&flat[rows[i]->base], rows[i]->cells, width * sizeof(int));
+        memcpy(&flat_terms[rows[i]->base], rows[i]->terms, width * sizeof(Term*));
+    }
+
+    // same order x86_disasm applies them in
+    static const int prefix_bytes[4] = { 0x66, 0x48, 0xF3, 0xF2 };
+    for (int prefixes = 0; prefixes < 16; prefixes++) {
+        int state = entrypoint;
+        for (int i = 0; i < 4 && state; i++) {
+            if (prefixes & (1 << i)) {
+                state = flat[state + prefix_bytes[i]];
+                if (state & (DFA_END | DFA_RX)) state = 0;
+            }
+        }
+        if (state == 0) continue;
+
+        int opcode[4];
+        int gate = prefixes & 1 ? flat[entrypoint + 0x66] : 0;
+        walk_encodings(flat, flat_terms, state, gate, prefixes, opcode, 0);
+    }
+    free(flat_terms);
+    free(flat);
+
+    qsort(encodings, encoding_count, sizeof(Encoding), cmp_encoding);
+
+    fprintf(f, "// reverse of dfa[] for x86_encode, grouped by type\n");
+    fprintf(f, "const static X86__Encoding encodings[] = {\n");
+    for (int i = 0; i < encoding_count; i++) {
+        const Encoding* e = &encodings[i];
+        fprintf(f, "\t{ %d, %d, 0x%x, %d, %d, %d, {", e->type, e->mode, e->prefixes, e->rx, e->plus_r, e->opcode_count);
+        for (int j = 0; j < e->opcode_count; j++) fprintf(f, "%s0x%02x", j ? ", " : " ", e->opcode[j]);
+        fprintf(f, " } }, /* %s %s */\n", descs[e->type].name, encoding_modes[e->mode]);
+    }
+    fprintf(f, "};\n\n");
+
+    // encoding_start[type] .. encoding_start[type + 1]
+    fprintf(f, "const static uint16_t encoding_start[] = {");
+    int next = 0;
+    for (int type = 0; type <= used_desc_count; type++) {
+        while (next < encoding_count && encodings[next].type < type) next++;
+        fprintf(f, "%s%d,", type % 16 ? " " : "\n\t", next);
+    }
+    fprintf(f, "\n};\n\n");
+}
+
+static void write_table(const char* path, int entrypoint) {
+    FILE* f = open_output(path);
+    fprintf(f, "// generated by src/tablegen.c from tables/insns.dat, do not edit\n");
+    fprintf(f, "const static int dfa[] = {\n");
+
+    for (int i = 0; i < row_count; i++) {
+        Row* r = rows[i];
+        int width = r->is_rx ? 8 : 256;
+
+        fprintf(f, "\t/* %s 0x%x */", r->is_rx ? "RX" : "STATE", r->base);
+        for (int j = 0; j < width; j++) {
+            if (r->cells[j] == 0) continue;
+
+            fprintf(f, " [0x%x] = 0x%x", r->base + j, r->cells[j]);
+            if (r->terms[j]) {
+                fprintf(f, " /* %s %s */", r->terms[j]->ops, descs[r->terms[j]->desc].name);
+            }
+            fprintf(f, ",");
+        }
+        fprintf(f, "\n");
+    }
+
+    fprintf(f, "};\n");
+    fprintf(f, "#define DFA_ENTRYPOINT 0x%x\n\n", entrypoint);
+
+    // let the decoder drop the paths this subset can't reach
+    bool has_xmm = false;
+    for (int i = 0; i < row_count; i++) {
+        for (int j = 0; j < 256; j++) {
+            if (rows[i]->terms[j] && is_xmm_mode(rows[i]->terms[j]->mode)) has_xmm = true;
+        }
+    }
+
+    fprintf(f, "// ISA subset:");
+    for (int i = 0; i < ISA_COUNT; i++) {
+        if (isa_mask & (1u << i)) fprintf(f, " %s", isa_groups[i].name);
+    }
+    fprintf(f, "\n");
+    fprintf(f, "#define X86_TABLE_ISA 0x%x\n", isa_mask);
+    fprintf(f, "#define X86_TABLE_HAS_XMM %d\n\n", has_xmm);
+
+    fprintf(f, "const static InstructionDesc descs[] = {\n");
+    for (int i = 1; i < used_desc_count; i++) {
+        const Desc* d = &descs[i];
+        if (d->name[0] == 0) continue;
+
+        fprintf(f, "\t[%d] = { \"%s\"", i, d->name);
+        if (d->has_cc) fprintf(f, ", 1");
+        if (d->opcode_66) fprintf(f, ", .opcode_66 = 1");
+
+        // only the non-default semantics, keeps the table readable
+        if (d->branch) fprintf(f, ", .branch = %s", branch_enum_names[d->branch]);
+        if (d->flags_read) fprintf(f, ", .flags_read = 0x%02x", d->flags_read);
+        if (d->flags_written) fprintf(f, ", .flags_written = 0x%02x", d->flags_written);
+        if (d->implicit_read) fprintf(f, ", .implicit_read = 0x%04x", d->implicit_read);
+        if (d->implicit_write) fprintf(f, ", .implicit_write = 0x%04x", d->implicit_write);
+
+        // stored relative to the default so zero-initialized entries get it
+        if (d->operand_access != DEFAULT_OPERAND_ACCESS) fprintf(f, ", .operand_access = 0x%02x", d->operand_access ^ DEFAULT_OPERAND_ACCESS);
+        fprintf(f, " },\n");
+    }
+    fprintf(f, "};\n\n");
+
+    write_encodings(f, entrypoint);
+
+    fprintf(f, "typedef enum {\n");
+    for (int i = 0; i < ENCODING_MODE_COUNT; i++) {
+        char tmp[64];
+        snprintf(tmp, sizeof(tmp), "%s", encoding_modes[i]);
+        for (char* p = tmp; *p; p++) if (*p == ',' || *p == '|') *p = '_';
+
+        fprintf(f, "\tX86_ENCODE_%s = %d,\n", tmp, i);
+    }
+    fprintf(f, "} X86_EncodingMode;\n\n");
+
+    fprintf(f, "static const char* encoding_mode_names[] = {\n");
+    for (int i = 0; i < ENCODING_MODE_COUNT; i++) {
+        fprintf(f, "\t\"%s\",\n", encoding_modes[i]);
+    }
+    fprintf(f, "};\n");
+    fclose(f);
+}
+
+static void write_public(const char* path) {
+    FILE* f = open_output(path);
+    fprintf(f, "// generated by src/tablegen.c from tables/insns.dat, do not edit\n");
+    fprintf(f, "typedef enum {\n");
+    fprintf(f, "\tX86_INST_NONE,\n");
+
+    for (int i = 1; i < desc_count; i++) {
+        if (descs[i].name[0] == 0) continue;
+
+        char tmp[32];
+        snprintf(tmp, sizeof(tmp), "%s", descs[i].name);
+        for (char* p = tmp; *p; p++) *p = toupper(*p);
+
+        if (i == used_desc_count) fprintf(f, "\n\t// not in this ISA subset, never decoded\n");
+
+        // pinned names insns.dat has no line for
+        const char* note = i < used_desc_count && !descs[i].used ? " // reserved, never decoded" : "";
+        fprintf(f, "\tX86_INST_%s = %d,%s\n", tmp, i, note);
+    }
+
+    // not a valid type, just handy for sizing tables
+    fprintf(f, "\n\tX86_INST_COUNT = %d\n", desc_count);
+    fprintf(f, "} X86_InstType;\n\n");
+
+    // X86_EncodingMode itself is private to the decoder
+    fprintf(f, "#define X86_ENCODING_MODE_COUNT %d\n", ENCODING_MODE_COUNT);
+    fclose(f);
+}
+
+// FNV-1a over everything we generated (dfa, descs with their semantics, the
+// encodings and the X86_InstType numbering), x86_get_decoder_hash builds on
+// it so any table change invalidates stored decodes.
+static uint64_t hash_file(const char* path, uint64_t h) {
+    FILE* f = fopen(path, "rb");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open %s!\n", path);
+        exit(1);
+    }
+
+    for (int ch; (ch = fgetc(f)) != EOF;) {
+        h = (h ^ (uint8_t) ch) * 0x100000001B3ull;
+    }
+    fclose(f);
+    return h;
+}
+
+static void write_digest(const char* table_path, const char* public_path) {
+    uint64_t h = 0xCBF29CE484222325ull;
+    h = hash_file(table_path, h);
+    h = hash_file(public_path, h);
+
+    FILE* f = fopen(table_path, "ab");
+    if (f == NULL) {
+        fprintf(stderr, "error: could not open %s!\n", table_path);
+        exit(1);
+    }
+    fprintf(f, "\n// digest of the generated tables\n");
+    fprintf(f, "#define X86_TABLE_HASH 0x%016llxull\n", (unsigned long long) h);
+    fclose(f);
+}
+
+static bool parse_isa(char* list) {
+    isa_mask = 0;
+
+    char* cursor = list;
+    for (char* tok; (tok = next_token(&cursor, ",")) != NULL;) {
+        if (strcmp(tok, "all") == 0) {
+            isa_mask = ISA_ALL;
+            continue;
+        }
+
+        int i = 0;
+        while (i < ISA_COUNT && strcmp(isa_groups[i].name, tok) != 0) i++;
+
+        if (i == ISA_COUNT) {
+            fprintf(stderr, "error: unknown ISA '%s'!\n", tok);
+            return false;
+        }
+        isa_mask |= 1u << i;
+    }
+
+    return isa_mask != 0;
+}
+
+int main(int argc, char** argv) {
+    if (argc > 1 && strncmp(argv[1], "-isa=", 5) == 0) {
+        if (!parse_isa(argv[1] + 5)) return 1;
+        argc--, argv++;
+    }
+
+    if (argc != 6) {
+        fprintf(stderr, "usage: %s [-isa=gpr,legacy,x87,mmx,sse,sse4,system,ext,all] <insns.dat> <semantics.dat> <inst_ids.dat> <table.inc> <public.inc>\n", argv[0]);
+        return 1;
+    }
+
+    FILE* file = fopen(argv[1], "rb");
+    if (file == NULL) {
+        fprintf(stderr, "error: could not open %s!\n", argv[1]);
+        return 1;
+    }
+
+    load_pins(argv[3]);
+    Node* root = new_node();
+
+    // name  operands  [code]  flags
+    char line[1024];
+    while (fgets(line, sizeof(line), file)) {
+        if (line[0] == ';' || isspace(line[0]) || line[0] == '\0') continue;
+
+        char* cursor = line;
+        char* name = next_token(&cursor, " \t\r\n");
+        char* ops = next_token(&cursor, " \t\r\n");
+        if (name == NULL || ops == NULL) continue;
+
+        // the code can have whitespace in it, read up to the closing bracket
+        char* code = cursor + strspn(cursor, " \t");
+        char* close = code[0] == '[' ? strchr(code, ']') : NULL;
+        if (close == NULL || close[1] == '\0') continue;
+        close[1] = '\0';
+
+        cursor = close + 2;
+        char* flags = next_token(&cursor, " \t\r\n");
+        if (flags) insert_line(root, name, ops, code, flags);
+    }
+    fclose(file);
+
+    reserve_pins();
+    renumber_descs(root);
+    int entrypoint = layout(root) & ~DFA_RX;
+
+    load_semantics(argv[2]);
+
+    write_table(argv[4], entrypoint);
+    write_public(argv[5]);
+    write_digest(argv[4], argv[5]);
+
+    int named = 0, decoded = 0;
+    for (int i = 1; i < desc_count; i++) {
+        named += descs[i].name[0] != 0;
+        decoded += descs[i].used;
+    }
+
+    fprintf(stderr, "tablegen: %d lines, %d instructions (%d decoded), %d states, %d cells\n",
+        used_lines, named, decoded, row_count, dfa_cursor);
+    return 0;
+}
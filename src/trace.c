@@ -0,0 +1,156 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+#include <stdatomic.h>
+
+// Stage tracing, every thread appends to a buffer only it touches and the
+// buffers hang off a lock-free list so the writer can find them once the
+// threads are done. Spans are kept as begin/end pairs, the trace viewer
+// does the nesting.
+typedef struct {
+    const char* name;
+    const char* arg;
+    int64_t time; // ns since x86_trace_start
+    bool begin;
+} X86__TraceEvent;
+
+typedef struct X86__TraceBuffer X86__TraceBuffer;
+struct X86__TraceBuffer {
+    X86__TraceBuffer* next;
+    uint32_t tid;
+
+    size_t count, capacity;
+    X86__TraceEvent* events;
+};
+
+static const char* x86__trace_path;
+static bool x86__trace_enabled;
+static bool x86__trace_written;
+static int64_t x86__trace_epoch;
+
+static _Atomic(X86__TraceBuffer*) x86__trace_buffers;
+static atomic_uint x86__trace_next_tid;
+static _Thread_local X86__TraceBuffer* x86__trace_local;
+
+static int64_t x86__trace_nanos(void) {
+    struct timespec ts;
+    timespec_get(&ts, TIME_UTC);
+    return (int64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static X86__TraceBuffer* x86__trace_buffer(void) {
+    X86__TraceBuffer* buf = x86__trace_local;
+    if (buf != NULL) return buf;
+
+    buf = calloc(1, sizeof(X86__TraceBuffer));
+    if (buf == NULL) return NULL;
+    buf->tid = atomic_fetch_add(&x86__trace_next_tid, 1) + 1;
+
+    // pushed once per thread, it's never unlinked until the trace is written
+    buf->next = atomic_load(&x86__trace_buffers);
+    while (!atomic_compare_exchange_weak(&x86__trace_buffers, &buf->next, buf)) {}
+
+    x86__trace_local = buf;
+    return buf;
+}
+
+static void x86__trace_push(const char* name, const char* arg, bool begin) {
+    int64_t time = x86__trace_nanos() - x86__trace_epoch;
+
+    X86__TraceBuffer* buf = x86__trace_buffer();
+    if (buf == NULL) return;
+
+    if (buf->count == buf->capacity) {
+        size_t capacity = buf->capacity ? buf->capacity * 2 : 1024;
+        X86__TraceEvent* events = realloc(buf->events, capacity * sizeof(X86__TraceEvent));
+        if (events == NULL) return; // the span just goes missing
+
+        buf->events = events;
+        buf->capacity = capacity;
+    }
+
+    buf->events[buf->count++] = (X86__TraceEvent){ name, arg, time, begin };
+}
+
+void x86_trace_begin(const char* name, const char* arg) {
+    if (x86__trace_enabled) x86__trace_push(name, arg, true);
+}
+
+void x86_trace_end(void) {
+    if (x86__trace_enabled) x86__trace_push(NULL, NULL, false);
+}
+
+bool x86_trace_is_enabled(void) {
+    return x86__trace_enabled;
+}
+
+static void x86__trace_at_exit(void) {
+    if (!x86_trace_write()) fprintf(stderr, "error: could not write trace to %s\n", x86__trace_path);
+}
+
+bool x86_trace_start(const char* path) {
+    // one trace per run, the buffers are freed once it's written
+    if (x86__trace_enabled || x86__trace_written) return false;
+    if (atexit(x86__trace_at_exit) != 0) return false;
+
+    x86__trace_path = path;
+    x86__trace_epoch = x86__trace_nanos();
+    x86__trace_enabled = true;
+    return true;
+}
+
+static void x86__trace_string(FILE* out, const char* str) {
+    fputc('"', out);
+    for (; *str; str++) {
+        unsigned char ch = *str;
+        if (ch == '"' || ch == '\\') fprintf(out, "\\%c", ch);
+        else if (ch < 0x20) fprintf(out, "\\u%04x", ch);
+        else fputc(ch, out);
+    }
+    fputc('"', out);
+}
+
+bool x86_trace_write(void) {
+    if (!x86__trace_enabled || x86__trace_written) return true;
+    x86__trace_enabled = false;
+    x86__trace_written = true;
+
+    FILE* out = fopen(x86__trace_path, "wb");
+    if (out == NULL) return false;
+
+    // chrome trace-event format, timestamps are in microseconds
+    fprintf(out, "{\"traceEvents\":[\n");
+
+    bool first = true;
+    X86__TraceBuffer* buf = atomic_exchange(&x86__trace_buffers, NULL);
+    while (buf != NULL) {
+        fprintf(out, "%s{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":%u,\"args\":{\"name\":\"thread %u\"}}", first ? "" : ",\n", buf->tid, buf->tid);
+        first = false;
+
+        for (size_t i = 0; i < buf->count; i++) {
+            const X86__TraceEvent* e = &buf->events[i];
+            if (e->begin) {
+                fprintf(out, ",\n{\"name\":");
+                x86__trace_string(out, e->name);
+                fprintf(out, ",\"ph\":\"B\",\"pid\":1,\"tid\":%u,\"ts\":%.3f", buf->tid, e->time / 1000.0);
+                if (e->arg != NULL) {
+                    fprintf(out, ",\"args\":{\"detail\":");
+                    x86__trace_string(out, e->arg);
+                    fprintf(out, "}");
+                }
+                fprintf(out, "}");
+            } else {
+                fprintf(out, ",\n{\"ph\":\"E\",\"pid\":1,\"tid\":%u,\"ts\":%.3f}", buf->tid, e->time / 1000.0);
+            }
+        }
+
+        X86__TraceBuffer* next = buf->next;
+        free(buf->events);
+        free(buf);
+        buf = next;
+    }
+
+    fprintf(out, "\n],\"displayTimeUnit\":\"ms\"}\n");
+    return fclose(out) == 0;
+}
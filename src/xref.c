@@ -0,0 +1,207 @@
+#include "disx86.h"
+#include <string.h>
+#include <assert.h>
+
+// Cross references, every region gets swept on its own (in parallel) and the
+// lists get glued together. the sweep walks forward so each list is already
+// sorted by source and only the by-target order needs a real sort.
+typedef struct {
+    const X86_CodeRegion* region;
+
+    X86_Xref* xrefs;
+    size_t count, capacity;
+} X86__XrefScan;
+
+typedef struct {
+    uint64_t target;
+    uint32_t index;
+} X86__XrefKey;
+
+static void x86__push_xref(X86__XrefScan* scan, X86_Xref xref) {
+    if (scan->count == scan->capacity) {
+        scan->capacity = scan->capacity ? scan->capacity * 2 : 256;
+        scan->xrefs = realloc(scan->xrefs, scan->capacity * sizeof(X86_Xref));
+        if (scan->xrefs == NULL) {
+            fprintf(stderr, "error: xref index out of memory\n");
+            abort();
+        }
+    }
+
+    scan->xrefs[scan->count++] = xref;
+}
+
+// read/write of the memory operand, it's the slot without a register
+static uint8_t x86__memory_kind(const X86_Inst* inst) {
+    if (inst->type == X86_INST_LEA) return X86_XREF_ADDRESS;
+
+    uint32_t access = x86_get_operand_access(inst->type);
+    for (int i = 0; i < 4; i++) {
+        if (inst->regs[i] != X86_GPR_NONE) continue;
+
+        uint8_t kind = 0;
+        if (X86_OPERAND_ACCESS(access, i) & X86_ACCESS_READ) kind |= X86_XREF_READ;
+        if (X86_OPERAND_ACCESS(access, i) & X86_ACCESS_WRITE) kind |= X86_XREF_WRITE;
+        return kind;
+    }
+
+    return X86_XREF_READ;
+}
+
+static int x86__scan_xrefs(void* arg) {
+    X86__XrefScan* scan = arg;
+    X86_Buffer code = scan->region->code;
+    uint64_t address = scan->region->address;
+    x86_trace_begin("xref scan", NULL);
+
+    size_t offset = 0;
+    while (offset < code.length) {
+        X86_Inst inst;
+        if (x86_disasm(x86_advance(code, offset), &inst) != X86_RESULT_SUCCESS || inst.length == 0) {
+            offset += 1;
+            continue;
+        }
+
+        uint64_t source = address + offset;
+        uint64_t target;
+        if (x86_get_branch_target(&inst, source, &target)) {
+            X86_BranchClass branch = x86_get_branch_class(inst.type);
+            uint8_t kind = branch == X86_BRANCH_CALL ? X86_XREF_CALL : branch == X86_BRANCH_JCC ? X86_XREF_BRANCH : X86_XREF_JUMP;
+
+            x86__push_xref(scan, (X86_Xref){ source, target, kind });
+        } else if (inst.flags & X86_INSTR_USE_RIPMEM) {
+            // call [rip+disp] and jmp [rip+disp] read the pointer slot
+            uint8_t kind = x86__memory_kind(&inst);
+            X86_BranchClass branch = x86_get_branch_class(inst.type);
+            if (branch == X86_BRANCH_CALL) kind = X86_XREF_CALL | X86_XREF_READ;
+            else if (branch == X86_BRANCH_JMP) kind = X86_XREF_JUMP | X86_XREF_READ;
+
+            x86__push_xref(scan, (X86_Xref){ source, source + inst.length + (int64_t)inst.disp, kind });
+        }
+
+        if (inst.flags & X86_INSTR_ABSOLUTE) {
+            x86__push_xref(scan, (X86_Xref){ source, inst.abs, X86_XREF_ABSOLUTE });
+        }
+
+        offset += inst.length;
+    }
+
+    x86_trace_end();
+    return 0;
+}
+
+static int x86__cmp_xref(const void* a, const void* b) {
+    const X86_Xref* x = a;
+    const X86_Xref* y = b;
+    if (x->source != y->source) return (x->source > y->source) - (x->source < y->source);
+    return (x->target > y->target) - (x->target < y->target);
+}
+
+static int x86__cmp_xref_key(const void* a, const void* b) {
+    const X86__XrefKey* x = a;
+    const X86__XrefKey* y = b;
+    if (x->target != y->target) return (x->target > y->target) - (x->target < y->target);
+    return (x->index > y->index) - (x->index < y->index);
+}
+
+// fills in by_target from xrefs (which is sorted by source)
+static void x86__xref_index_targets(X86_Arena* arena, X86_XrefIndex* out) {
+    out->by_target = X86_ARENA_ARRAY(arena, uint32_t, out->count);
+
+    X86_ArenaSavepoint sp = x86_arena_save(arena);
+    X86__XrefKey* keys = X86_ARENA_ARRAY(arena, X86__XrefKey, out->count);
+    for (size_t i = 0; i < out->count; i++) keys[i] = (X86__XrefKey){ out->xrefs[i].target, i };
+    qsort(keys, out->count, sizeof(X86__XrefKey), x86__cmp_xref_key);
+
+    for (size_t i = 0; i < out->count; i++) out->by_target[i] = keys[i].index;
+    x86_arena_restore(arena, sp);
+}
+
+void x86_xref_build(X86_Arena* arena, const X86_CodeRegion* regions, size_t region_count, int thread_count, X86_XrefIndex* out) {
+    memset(out, 0, sizeof(*out));
+
+    // the per region lists grow on the worker threads so they're on the
+    // heap, everything else is arena scratch.
+    X86_ArenaSavepoint sp = x86_arena_save(arena);
+    X86__XrefScan* scans = X86_ARENA_ZARRAY(arena, X86__XrefScan, region_count);
+    for (size_t i = 0; i < region_count; i++) scans[i].region = &regions[i];
+
+    // sweep every region, thread_count of 0 means one thread per region
+    if (thread_count <= 0) thread_count = region_count;
+    x86_parallel_for(thread_count, scans, region_count, sizeof(X86__XrefScan), x86__scan_xrefs);
+
+    size_t count = 0;
+    for (size_t i = 0; i < region_count; i++) count += scans[i].count;
+    assert(count < UINT32_MAX);
+
+    X86_Xref* xrefs = X86_ARENA_ARRAY(arena, X86_Xref, count);
+
+    // regions usually come in address order, then the concatenation is
+    // already sorted by source.
+    bool sorted = true;
+    size_t next = 0;
+    for (size_t i = 0; i < region_count; i++) {
+        if (scans[i].count == 0) continue;
+        if (next > 0 && xrefs[next - 1].source > scans[i].xrefs[0].source) sorted = false;
+
+        memcpy(&xrefs[next], scans[i].xrefs, scans[i].count * sizeof(X86_Xref));
+        next += scans[i].count;
+        free(scans[i].xrefs);
+    }
+
+    out->count = count;
+    out->xrefs = x86_arena_restore_keep(arena, sp, xrefs, count * sizeof(X86_Xref), _Alignof(X86_Xref));
+
+    if (!sorted) qsort(out->xrefs, count, sizeof(X86_Xref), x86__cmp_xref);
+    x86__xref_index_targets(arena, out);
+}
+
+void x86_xref_merge(X86_Arena* arena, const X86_XrefIndex* a, const X86_XrefIndex* b, X86_XrefIndex* out) {
+    size_t count = a->count + b->count;
+    assert(count < UINT32_MAX);
+
+    X86_Xref* xrefs = X86_ARENA_ARRAY(arena, X86_Xref, count);
+    size_t i = 0, j = 0, k = 0;
+    while (i < a->count && j < b->count) {
+        xrefs[k++] = x86__cmp_xref(&a->xrefs[i], &b->xrefs[j]) <= 0 ? a->xrefs[i++] : b->xrefs[j++];
+    }
+    while (i < a->count) xrefs[k++] = a->xrefs[i++];
+    while (j < b->count) xrefs[k++] = b->xrefs[j++];
+
+    *out = (X86_XrefIndex){ .count = count, .xrefs = xrefs };
+    x86__xref_index_targets(arena, out);
+}
+
+const X86_Xref* x86_xref_from(const X86_XrefIndex* index, uint64_t source, size_t* out_count) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->xrefs[mid].source < source) lo = mid + 1;
+        else hi = mid;
+    }
+
+    size_t end = lo;
+    while (end < index->count && index->xrefs[end].source == source) end++;
+
+    *out_count = end - lo;
+    return &index->xrefs[lo];
+}
+
+const uint32_t* x86_xref_to(const X86_XrefIndex* index, uint64_t target, size_t* out_count) {
+    size_t lo = 0, hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->xrefs[index->by_target[mid]].target < target) lo = mid + 1;
+        else hi = mid;
+    }
+
+    size_t first = lo;
+    hi = index->count;
+    while (lo < hi) {
+        size_t mid = lo + (hi - lo) / 2;
+        if (index->xrefs[index->by_target[mid]].target <= target) lo = mid + 1;
+        else hi = mid;
+    }
+
+    *out_count = lo - first;
+    return &index->by_target[first];
+}